@@ -76,48 +76,48 @@ isc_result_t read_client_conf ()
 
 	/* 1 */
 	code = DHO_SUBNET_MASK;
-	option_code_hash_lookup(&default_requested_options[0],
-				dhcp_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[0],
+			   &dhcp_universe, code, MDL);
 
 	/* 2 */
 	code = DHO_BROADCAST_ADDRESS;
-	option_code_hash_lookup(&default_requested_options[1],
-				dhcp_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[1],
+			   &dhcp_universe, code, MDL);
 
 	/* 3 */
 	code = DHO_TIME_OFFSET;
-	option_code_hash_lookup(&default_requested_options[2],
-				dhcp_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[2],
+			   &dhcp_universe, code, MDL);
 
 	/* 4 */
 	code = DHO_ROUTERS;
-	option_code_hash_lookup(&default_requested_options[3],
-				dhcp_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[3],
+			   &dhcp_universe, code, MDL);
 
 	/* 5 */
 	code = DHO_DOMAIN_NAME;
-	option_code_hash_lookup(&default_requested_options[4],
-				dhcp_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[4],
+			   &dhcp_universe, code, MDL);
 
 	/* 6 */
 	code = DHO_DOMAIN_NAME_SERVERS;
-	option_code_hash_lookup(&default_requested_options[5],
-				dhcp_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[5],
+			   &dhcp_universe, code, MDL);
 
 	/* 7 */
 	code = DHO_HOST_NAME;
-	option_code_hash_lookup(&default_requested_options[6],
-				dhcp_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[6],
+			   &dhcp_universe, code, MDL);
 
 	/* 8 */
 	code = D6O_NAME_SERVERS;
-	option_code_hash_lookup(&default_requested_options[7],
-				dhcpv6_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[7],
+			   &dhcpv6_universe, code, MDL);
 
 	/* 9 */
 	code = D6O_DOMAIN_SEARCH;
-	option_code_hash_lookup(&default_requested_options[8],
-				dhcpv6_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&default_requested_options[8],
+			   &dhcpv6_universe, code, MDL);
 
 	for (code = 0 ; code < NUM_DEFAULT_REQUESTED_OPTS ; code++) {
 		if (default_requested_options[code] == NULL)
@@ -131,9 +131,9 @@ isc_result_t read_client_conf ()
 	if (dhcpv4_over_dhcpv6 == 1) {
 		/* The DHCP4o6 server option should be requested */
 		code = D6O_DHCP4_O_DHCP6_SERVER;
-		option_code_hash_lookup(&default_requested_options[9],
-					dhcpv6_universe.code_hash,
-					&code, 0, MDL);
+		option_code_lookup(&default_requested_options[9],
+				   &dhcpv6_universe,
+				   code, MDL);
 		if (default_requested_options[9] == NULL) {
 			log_fatal("Unable to find option definition for "
 				  "index %u during default parameter request "
@@ -143,18 +143,18 @@ isc_result_t read_client_conf ()
 		/* Called from run_stateless so the IRT should
 		   be requested too */
 		code = D6O_INFORMATION_REFRESH_TIME;
-		option_code_hash_lookup(&default_requested_options[9],
-					dhcpv6_universe.code_hash,
-					&code, 0, MDL);
+		option_code_lookup(&default_requested_options[9],
+				   &dhcpv6_universe,
+				   code, MDL);
 		if (default_requested_options[9] == NULL) {
 			log_fatal("Unable to find option definition for "
 				  "index %u during default parameter request "
 				  "assembly.", code);
 		}
 		code = D6O_DHCP4_O_DHCP6_SERVER;
-		option_code_hash_lookup(&default_requested_options[10],
-					dhcpv6_universe.code_hash,
-					&code, 0, MDL);
+		option_code_lookup(&default_requested_options[10],
+				   &dhcpv6_universe,
+				   code, MDL);
 		if (default_requested_options[10] == NULL) {
 			log_fatal("Unable to find option definition for "
 				  "index %u during default parameter request "
@@ -623,8 +623,7 @@ void parse_client_statement (cfile, ip, config)
 		if (known) {
 			option_name_hash_delete(option->universe->name_hash,
 						option->name, 0, MDL);
-			option_code_hash_delete(option->universe->code_hash,
-						&option->code, 0, MDL);
+			option_code_delete(option->universe, option);
 		}
 
 		parse_option_code_definition(cfile, option);
@@ -195,49 +195,49 @@ dhcpv6_client_assignments(void)
 	}
 
 	code = D6O_CLIENTID;
-	if (!option_code_hash_lookup(&clientid_option,
-				     dhcpv6_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&clientid_option,
+				&dhcpv6_universe, code, MDL))
 		log_fatal("Unable to find the CLIENTID option definition.");
 
 	code = D6O_ELAPSED_TIME;
-	if (!option_code_hash_lookup(&elapsed_option,
-				     dhcpv6_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&elapsed_option,
+				&dhcpv6_universe, code, MDL))
 		log_fatal("Unable to find the ELAPSED_TIME option definition.");
 
 	code = D6O_IA_NA;
-	if (!option_code_hash_lookup(&ia_na_option, dhcpv6_universe.code_hash,
-				     &code, 0, MDL))
+	if (!option_code_lookup(&ia_na_option, &dhcpv6_universe,
+				code, MDL))
 		log_fatal("Unable to find the IA_NA option definition.");
 
 	code = D6O_IA_TA;
-	if (!option_code_hash_lookup(&ia_ta_option, dhcpv6_universe.code_hash,
-				     &code, 0, MDL))
+	if (!option_code_lookup(&ia_ta_option, &dhcpv6_universe,
+				code, MDL))
 		log_fatal("Unable to find the IA_TA option definition.");
 
 	code = D6O_IA_PD;
-	if (!option_code_hash_lookup(&ia_pd_option, dhcpv6_universe.code_hash,
-				     &code, 0, MDL))
+	if (!option_code_lookup(&ia_pd_option, &dhcpv6_universe,
+				code, MDL))
 		log_fatal("Unable to find the IA_PD option definition.");
 
 	code = D6O_IAADDR;
-	if (!option_code_hash_lookup(&iaaddr_option, dhcpv6_universe.code_hash,
-				     &code, 0, MDL))
+	if (!option_code_lookup(&iaaddr_option, &dhcpv6_universe,
+				code, MDL))
 		log_fatal("Unable to find the IAADDR option definition.");
 
 	code = D6O_IAPREFIX;
-	if (!option_code_hash_lookup(&iaprefix_option,
-				     dhcpv6_universe.code_hash,
-				     &code, 0, MDL))
+	if (!option_code_lookup(&iaprefix_option,
+				&dhcpv6_universe,
+				code, MDL))
 		log_fatal("Unable to find the IAPREFIX option definition.");
 
 	code = D6O_ORO;
-	if (!option_code_hash_lookup(&oro_option, dhcpv6_universe.code_hash,
-				     &code, 0, MDL))
+	if (!option_code_lookup(&oro_option, &dhcpv6_universe,
+				code, MDL))
 		log_fatal("Unable to find the ORO option definition.");
 
 	code = D6O_INFORMATION_REFRESH_TIME;
-	if (!option_code_hash_lookup(&irt_option, dhcpv6_universe.code_hash,
-				     &code, 0, MDL))
+	if (!option_code_lookup(&irt_option, &dhcpv6_universe,
+				code, MDL))
 		log_fatal("Unable to find the IRT option definition.");
 
 #ifndef __CYGWIN32__ /* XXX */
@@ -2055,9 +2055,9 @@ void dhcpoffer (packet)
 				struct option *option = NULL;
 				unsigned code = req[i]->code;
 
-				option_code_hash_lookup(&option,
-							dhcp_universe.code_hash,
-							&code, 0, MDL);
+				option_code_lookup(&option,
+						   &dhcp_universe,
+						   code, MDL);
 
 				if (option)
 					log_info("%s: no %s option.", obuf,
@@ -2185,9 +2185,9 @@ struct client_lease *packet_to_lease (packet, client)
 					   packet -> options, lease -> options,
 					   &global_scope, oc, MDL)) {
 			if (data.len) {
-				if (!option_code_hash_lookup(&option,
-						dhcp_universe.code_hash,
-						&i, 0, MDL))
+				if (!option_code_lookup(&option,
+							&dhcp_universe,
+							i, MDL))
 					log_fatal("Unable to find VENDOR "
 						  "option (%s:%d).", MDL);
 				parse_encapsulated_suboptions
@@ -3167,8 +3167,8 @@ make_client_options(struct client_state *client, struct client_lease *lease,
 	if (rip) {
 		client->requested_address = *rip;
 		i = DHO_DHCP_REQUESTED_ADDRESS;
-		if (!(option_code_hash_lookup(&option, dhcp_universe.code_hash,
-					      &i, 0, MDL) &&
+		if (!(option_code_lookup(&option, &dhcp_universe,
+					 i, MDL) &&
 		      make_const_option_cache(&oc, NULL, rip->iabuf, rip->len,
 					      option, MDL)))
 			log_error ("can't make requested address cache.");
@@ -3182,8 +3182,7 @@ make_client_options(struct client_state *client, struct client_lease *lease,
 	}
 
 	i = DHO_DHCP_MESSAGE_TYPE;
-	if (!(option_code_hash_lookup(&option, dhcp_universe.code_hash, &i, 0,
-				      MDL) &&
+	if (!(option_code_lookup(&option, &dhcp_universe, i, MDL) &&
 	      make_const_option_cache(&oc, NULL, type, 1, option, MDL)))
 		log_error("can't make message type.");
 	else {
@@ -3211,9 +3210,9 @@ make_client_options(struct client_state *client, struct client_lease *lease,
 				if (prl[i]->universe == &dhcp_universe)
 					bp->data[len++] = prl[i]->code;
 
-			if (!(option_code_hash_lookup(&option,
-						      dhcp_universe.code_hash,
-						      &code, 0, MDL) &&
+			if (!(option_code_lookup(&option,
+						 &dhcp_universe,
+						 code, MDL) &&
 			      make_const_option_cache(&oc, &bp, NULL, len,
 						      option, MDL))) {
 				if (bp != NULL)
@@ -3267,8 +3266,8 @@ make_client_options(struct client_state *client, struct client_lease *lease,
 		       default_duid.data, default_duid.len);
 
 		/* And save the option */
-		if (!(option_code_hash_lookup(&option, dhcp_universe.code_hash,
-					      &i, 0, MDL) &&
+		if (!(option_code_lookup(&option, &dhcp_universe,
+					 i, MDL) &&
 		      make_const_option_cache(&oc, NULL,
 					      (u_int8_t *)client_identifier.data,
 					      client_identifier.len,
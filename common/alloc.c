@@ -421,6 +421,67 @@ void relinquish_free_pairs ()
 }
 #endif
 
+/* Nearly every option_state built for a packet gets an option_index,
+   and they are large enough that it's worth keeping them for reuse.  The
+   slots are cleared on the way onto the free list, which only has to
+   touch the ones that were used; indexes of a size other than the one at
+   the head of the list are simply freed. */
+struct option_index *free_option_indexes;
+
+struct option_index *new_option_index (size, file, line)
+	unsigned size;
+	const char *file;
+	int line;
+{
+	struct option_index *foo;
+
+	if (free_option_indexes && free_option_indexes -> size == size) {
+		foo = free_option_indexes;
+		free_option_indexes = (struct option_index *)foo -> slot [0];
+		foo -> slot [0] = (struct option_cache *)0;
+		dmalloc_reuse (foo, file, line, 0);
+		return foo;
+	}
+
+	foo = dmalloc (sizeof *foo + (size - 1) * sizeof foo -> slot [0],
+		       file, line);
+	if (foo)
+		foo -> size = size;
+	return foo;
+}
+
+void free_option_index (foo, file, line)
+	struct option_index *foo;
+	const char *file;
+	int line;
+{
+	if (foo -> size == 0 ||
+	    (free_option_indexes && free_option_indexes -> size != foo -> size)) {
+		dfree (foo, file, line);
+		return;
+	}
+	memset (foo -> slot, 0, foo -> hi * sizeof foo -> slot [0]);
+	foo -> hi = 0;
+	foo -> overflow = (pair)0;
+	foo -> slot [0] = (struct option_cache *)free_option_indexes;
+	free_option_indexes = foo;
+	dmalloc_reuse (free_option_indexes, __FILE__, __LINE__, 0);
+}
+
+#if defined (DEBUG_MEMORY_LEAKAGE) || \
+		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+void relinquish_free_option_indexes ()
+{
+	struct option_index *pf, *pc;
+
+	for (pf = free_option_indexes; pf; pf = pc) {
+		pc = (struct option_index *)pf -> slot [0];
+		dfree (pf, MDL);
+	}
+	free_option_indexes = (struct option_index *)0;
+}
+#endif
+
 struct expression *free_expressions;
 
 int expression_allocate (cptr, file, line)
@@ -676,6 +737,127 @@ int option_cache_reference (ptr, src, file, line)
 	return 1;
 }
 
+/* Packet arenas.
+
+   Every packet we process gets its options decoded into a fresh option
+   state and buffer, and a reply option state built for it, all of which
+   are thrown away again when we're done with the packet.  So while a
+   packet is being processed (current_packet_arena is set), option states
+   and option buffers are carved out of chunks hung off the packet rather
+   than malloc'd one at a time.  They're still reference counted: each
+   chunk counts the objects carved out of it that haven't been freed.
+   When the packet is released its chunks are marked as released, and a
+   chunk goes back on the free list once it's both released and empty.
+   Anything that's still referenced from longer-lived state (say a lease's
+   stashed agent options) just keeps its chunk around until it's freed,
+   the same way it would have kept its own buffer around. */
+
+#define ARENA_CHUNK_SIZE	1024
+#define ARENA_MAX_OBJECT	(ARENA_CHUNK_SIZE / 2)
+#define ARENA_ALIGN		8
+
+struct arena_chunk {
+	struct arena_chunk *next;	/* In the arena or on the free list. */
+	int live;			/* Objects not yet freed. */
+	int released;			/* The packet is done with it. */
+	unsigned used;
+	union {
+		double align;
+		unsigned char data [ARENA_CHUNK_SIZE];
+	} u;
+};
+
+struct packet_arena *current_packet_arena;
+static struct arena_chunk *free_arena_chunks;
+
+#if defined (DEBUG_MEMORY_LEAKAGE) || \
+		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+void relinquish_free_arena_chunks ()
+{
+	struct arena_chunk *c, *n;
+
+	for (c = free_arena_chunks; c; c = n) {
+		n = c -> next;
+		dfree (c, MDL);
+	}
+	free_arena_chunks = (struct arena_chunk *)0;
+}
+#endif
+
+/* Carve size bytes out of the current packet arena, if there is one.
+   The leak detector wants to see each object allocated, so it gets
+   them from dmalloc. */
+static void *arena_allocate (size, chunkp)
+	unsigned size;
+	struct arena_chunk **chunkp;
+{
+#if defined (DEBUG_MEMORY_LEAKAGE) || defined (DEBUG_MALLOC_POOL)
+	return (void *)0;
+#else
+	struct packet_arena *arena = current_packet_arena;
+	struct arena_chunk *chunk;
+	void *rval;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (!arena || size > ARENA_MAX_OBJECT)
+		return (void *)0;
+
+	chunk = arena -> chunks;
+	if (!chunk || chunk -> used + size > ARENA_CHUNK_SIZE) {
+		if (free_arena_chunks) {
+			chunk = free_arena_chunks;
+			free_arena_chunks = chunk -> next;
+		} else {
+			chunk = dmalloc (sizeof *chunk, MDL);
+			if (!chunk)
+				return (void *)0;
+		}
+		chunk -> live = 0;
+		chunk -> released = 0;
+		chunk -> used = 0;
+		chunk -> next = arena -> chunks;
+		arena -> chunks = chunk;
+	}
+
+	rval = &chunk -> u.data [chunk -> used];
+	chunk -> used += size;
+	chunk -> live++;
+	*chunkp = chunk;
+	return rval;
+#endif
+}
+
+static void arena_free (chunk)
+	struct arena_chunk *chunk;
+{
+	if (--chunk -> live == 0 && chunk -> released) {
+		chunk -> next = free_arena_chunks;
+		free_arena_chunks = chunk;
+	}
+}
+
+/* Called when a packet is released: the chunks nothing was left in go
+   straight back on the free list, the rest once they're emptied. */
+void packet_arena_release (arena)
+	struct packet_arena *arena;
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = arena -> chunks; chunk; chunk = next) {
+		next = chunk -> next;
+		chunk -> released = 1;
+		if (chunk -> live) {
+			chunk -> next = (struct arena_chunk *)0;
+		} else {
+			chunk -> next = free_arena_chunks;
+			free_arena_chunks = chunk;
+		}
+	}
+	arena -> chunks = (struct arena_chunk *)0;
+	if (current_packet_arena == arena)
+		current_packet_arena = (struct packet_arena *)0;
+}
+
 int buffer_allocate (ptr, len, file, line)
 	struct buffer **ptr;
 	unsigned len;
@@ -695,6 +877,26 @@ int buffer_allocate (ptr, len, file, line)
 	return buffer_reference (ptr, bp, file, line);
 }
 
+/* Allocate a buffer that's only expected to live as long as the packet
+   being processed, such as the copy of its options we decode; it comes
+   out of the packet arena when there is one. */
+int arena_buffer_allocate (ptr, len, file, line)
+	struct buffer **ptr;
+	unsigned len;
+	const char *file;
+	int line;
+{
+	struct arena_chunk *chunk = (struct arena_chunk *)0;
+	struct buffer *bp;
+
+	bp = arena_allocate (len + sizeof *bp, &chunk);
+	if (!bp)
+		return buffer_allocate (ptr, len, file, line);
+	memset (bp, 0, sizeof *bp);
+	bp -> chunk = chunk;
+	return buffer_reference (ptr, bp, file, line);
+}
+
 int buffer_reference (ptr, bp, file, line)
 	struct buffer **ptr;
 	struct buffer *bp;
@@ -749,7 +951,10 @@ int buffer_dereference (ptr, file, line)
 	(*ptr) -> refcnt--;
 	rc_register (file, line, ptr, *ptr, (*ptr) -> refcnt, 1, RC_MISC);
 	if (!(*ptr) -> refcnt) {
-		dfree ((*ptr), file, line);
+		if ((*ptr) -> chunk)
+			arena_free ((*ptr) -> chunk);
+		else
+			dfree ((*ptr), file, line);
 	} else if ((*ptr) -> refcnt < 0) {
 		log_error ("%s(%d): negative refcnt!", file, line);
 #if defined (DEBUG_RC_HISTORY)
@@ -848,6 +1053,7 @@ int option_state_allocate (ptr, file, line)
 	const char *file;
 	int line;
 {
+	struct arena_chunk *chunk = (struct arena_chunk *)0;
 	unsigned size;
 
 	if (!ptr) {
@@ -868,9 +1074,12 @@ int option_state_allocate (ptr, file, line)
 	}
 
 	size = sizeof **ptr + (universe_count - 1) * sizeof (void *);
-	*ptr = dmalloc (size, file, line);
+	*ptr = arena_allocate (size, &chunk);
+	if (!*ptr)
+		*ptr = dmalloc (size, file, line);
 	if (*ptr) {
 		memset (*ptr, 0, size);
+		(*ptr) -> chunk = chunk;
 		(*ptr) -> universe_count = universe_count;
 		(*ptr) -> refcnt = 1;
 		rc_register (file, line,
@@ -951,7 +1160,10 @@ int option_state_dereference (ptr, file, line)
 			((*(universes [i] -> option_state_dereference))
 			 (universes [i], options, file, line));
 
-	dfree (options, file, line);
+	if (options -> chunk)
+		arena_free (options -> chunk);
+	else
+		dfree (options, file, line);
 	return 1;
 }
 
@@ -1125,6 +1337,7 @@ int packet_dereference (ptr, file, line)
 			omapi_object_dereference ((omapi_object_t **)
 						  &packet -> classes [i], MDL);
 	}
+	packet_arena_release (&packet -> arena);
 	packet -> raw = (struct dhcp_packet *)free_packets;
 	free_packets = packet;
 	dmalloc_reuse (free_packets, __FILE__, __LINE__, 0);
@@ -1405,3 +1618,59 @@ int data_string_terminate(str, file, line)
 
 	return (ret_val);
 }
+
+/* \brief Moves a data_string out of the packet arena
+ *
+ * If the data are in a buffer carved out of a packet arena, replace it
+ * with a heap buffer holding just the data.  This is for data that's
+ * kept after the packet is released, such as a lease's stashed relay
+ * agent options, so that a few bytes don't keep a whole arena chunk
+ * around for as long as they're kept.
+ *
+ * \param [in/out] str the data_string to move
+ * \param file the file this routine was called from
+ * \param line the line this routine was called from
+ *
+ * \return 1 if the data are now on the heap, 0 if memory for the copy
+ * could not be allocated, in which case the string is left as it was.
+ */
+int data_string_to_heap(str, file, line)
+	struct data_string *str;
+	const char *file;
+	int line;
+{
+	struct buffer *bp = NULL;
+
+	if ((str->buffer == NULL) || (str->buffer->chunk == NULL))
+		return (1);
+
+	if (!buffer_allocate(&bp, str->len + str->terminated, file, line))
+		return (0);
+	memcpy(bp->data, str->data, str->len + str->terminated);
+
+	buffer_dereference(&str->buffer, file, line);
+	buffer_reference(&str->buffer, bp, file, line);
+	buffer_dereference(&bp, file, line);
+	str->data = str->buffer->data;
+	return (1);
+}
+
+/* \brief Moves the data of every option in a chain out of the arena
+ *
+ * The option caches are changed in place, so anything else holding
+ * them sees the same data as before.
+ */
+void option_chain_head_to_heap(head, file, line)
+	struct option_chain_head *head;
+	const char *file;
+	int line;
+{
+	struct option_cache *oc;
+	pair p;
+
+	for (p = head->first; p != NULL; p = p->cdr) {
+		for (oc = (struct option_cache *)p->car; oc != NULL;
+		     oc = oc->next)
+			(void) data_string_to_heap(&oc->data, file, line);
+	}
+}
@@ -0,0 +1,1123 @@
+/* bytecode.c
+
+   Compile expression trees into programs for a small register machine,
+   and run them... */
+
+/*
+ * Copyright (c) 2019 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   950 Charter Street
+ *   Redwood City, CA 94063
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+#include "dhcpd.h"
+#include <ctype.h>
+
+/*
+ * The first time an expression is evaluated it is lowered to a flat
+ * program.  Each node of the tree puts its value in a register, and its
+ * operands are in the registers just above it, so a node at depth N
+ * never uses more than the registers from N up.  Subtrees that use only
+ * constants are evaluated once, here, and become a single load.  Nodes
+ * the machine doesn't handle itself - function calls, variables, DNS
+ * and so on - are left to the tree evaluator, which is called on just
+ * that subtree.
+ *
+ * Intermediate data is built in a scratch area on the stack rather than
+ * in freshly allocated buffers; only a result that outlives the run is
+ * copied into a buffer.  Results must be the same as evaluating the tree
+ * directly, including the odd corners (a false left side of "and"
+ * yields no value, for example).  Define DEBUG_EXPRESSION_CODE to check
+ * every run against the tree evaluator.
+ */
+
+#define EXPR_CODE_MAX_INSNS	64
+#define EXPR_CODE_MAX_CONSTS	16
+#define EXPR_CODE_MAX_REGS	16
+#define EXPR_CODE_SCRATCH	512
+
+#if defined (DEBUG_EXPRESSIONS)
+/* The tree evaluator logs each step; the compiled code doesn't. */
+int expression_code_disabled = 1;
+#else
+int expression_code_disabled;
+#endif
+int expression_code_mismatches;
+
+enum expr_code_op {
+	xc_const,		/* reg = constant arg */
+	xc_call,		/* reg = tree evaluation of expr, arg is kind */
+	xc_option,
+	xc_config_option,
+	xc_hardware,
+	xc_packet,		/* reg = packet (reg, reg + 1) */
+	xc_substring,		/* reg = substring (reg, reg + 1, reg + 2) */
+	xc_suffix,
+	xc_lcase,
+	xc_ucase,
+	xc_concat,
+	xc_encode_int8,
+	xc_encode_int16,
+	xc_encode_int32,
+	xc_first_value,		/* if reg has a value, go to arg */
+	xc_extract_int8,
+	xc_extract_int16,
+	xc_extract_int32,
+	xc_add,
+	xc_subtract,
+	xc_multiply,
+	xc_divide,
+	xc_remainder,
+	xc_binary_and,
+	xc_binary_or,
+	xc_binary_xor,
+	xc_equal_data,		/* arg is nonzero for not-equal */
+	xc_equal_value,
+	xc_and_left,		/* unless reg is true, fail and go to arg */
+	xc_and,
+	xc_or_left,		/* if reg is true, go to arg */
+	xc_or,
+	xc_not,
+	xc_exists,
+	xc_known,
+	xc_static
+};
+
+struct expr_value {
+	int status;
+	unsigned long num;
+	struct data_string data;
+};
+
+struct expr_insn {
+	u_int8_t op;
+	u_int8_t reg;
+	u_int16_t arg;
+	struct expression *expr;
+};
+
+struct expr_code {
+	int kind;
+	int insn_count;
+	int const_count;
+	int reg_count;
+	struct expr_insn *insns;
+	struct expr_value *consts;
+};
+
+struct expr_compiler {
+	int insn_count;
+	int const_count;
+	int reg_count;
+	struct expr_insn insns [EXPR_CODE_MAX_INSNS];
+	struct expr_value consts [EXPR_CODE_MAX_CONSTS];
+};
+
+struct expr_run {
+	struct expr_value reg [EXPR_CODE_MAX_REGS + 2];
+	unsigned char *next;
+	unsigned char scratch [EXPR_CODE_SCRATCH];
+};
+
+static int compile_node (struct expr_compiler *, struct expression *,
+			 int, int, int);
+
+/* The kind of value the tree evaluator produces for an expression, or
+   zero if it can't be known without evaluating it. */
+static int expr_kind (struct expression *expr)
+{
+	if (is_boolean_expression (expr))
+		return EXPR_CODE_BOOLEAN;
+	if (is_numeric_expression (expr))
+		return EXPR_CODE_NUMERIC;
+	if (is_data_expression (expr))
+		return EXPR_CODE_DATA;
+	return 0;
+}
+
+/* Nonzero if the expression's value depends on nothing but constants. */
+static int constant_expression (struct expression *expr)
+{
+	switch (expr -> op) {
+	      case expr_const_data:
+	      case expr_const_int:
+		return 1;
+
+	      case expr_substring:
+		return (constant_expression (expr -> data.substring.expr) &&
+			constant_expression (expr -> data.substring.offset) &&
+			constant_expression (expr -> data.substring.len));
+
+	      case expr_suffix:
+		return (constant_expression (expr -> data.suffix.expr) &&
+			constant_expression (expr -> data.suffix.len));
+
+	      case expr_lcase:
+	      case expr_ucase:
+	      case expr_not:
+		return constant_expression (expr -> data.not);
+
+	      case expr_encode_int8:
+	      case expr_encode_int16:
+	      case expr_encode_int32:
+		return constant_expression (expr -> data.encode_int);
+
+	      case expr_extract_int8:
+	      case expr_extract_int16:
+	      case expr_extract_int32:
+		return constant_expression (expr -> data.extract_int);
+
+	      case expr_pick_first_value:
+		return (constant_expression
+			(expr -> data.pick_first_value.car) &&
+			(!expr -> data.pick_first_value.cdr ||
+			 constant_expression
+			 (expr -> data.pick_first_value.cdr)));
+
+	      case expr_equal:
+	      case expr_not_equal:
+	      case expr_concat:
+	      case expr_and:
+	      case expr_or:
+	      case expr_add:
+	      case expr_subtract:
+	      case expr_multiply:
+	      case expr_divide:
+	      case expr_remainder:
+	      case expr_binary_and:
+	      case expr_binary_or:
+	      case expr_binary_xor:
+		return (constant_expression (expr -> data.and [0]) &&
+			constant_expression (expr -> data.and [1]));
+
+	      default:
+		return 0;
+	}
+}
+
+static void value_forget (struct expr_value *v)
+{
+	if (v -> data.buffer)
+		data_string_forget (&v -> data, MDL);
+	memset (v, 0, sizeof *v);
+}
+
+static int emit (struct expr_compiler *c, int op, int reg, int arg,
+		 struct expression *expr)
+{
+	struct expr_insn *insn;
+
+	if (c -> insn_count == EXPR_CODE_MAX_INSNS)
+		return -1;
+	insn = &c -> insns [c -> insn_count];
+	insn -> op = op;
+	insn -> reg = reg;
+	insn -> arg = arg;
+	insn -> expr = expr;
+	if (reg >= c -> reg_count)
+		c -> reg_count = reg + 1;
+	return c -> insn_count++;
+}
+
+/* Evaluate a constant subtree now and load its value at run time. */
+static int fold_constant (struct expr_compiler *c, struct expression *expr,
+			  int kind, int reg)
+{
+	struct expr_value *v;
+	int value = 0;
+
+	if (c -> const_count == EXPR_CODE_MAX_CONSTS)
+		return 0;
+	v = &c -> consts [c -> const_count];
+	memset (v, 0, sizeof *v);
+
+	expression_code_disabled++;
+	switch (kind) {
+	      case EXPR_CODE_BOOLEAN:
+		v -> status = evaluate_boolean_expression
+			(&value, NULL, NULL, NULL, NULL, NULL, NULL, expr);
+		v -> num = value;
+		break;
+	      case EXPR_CODE_NUMERIC:
+		v -> status = evaluate_numeric_expression
+			(&v -> num, NULL, NULL, NULL, NULL, NULL, NULL, expr);
+		break;
+	      default:
+		v -> status = evaluate_data_expression
+			(&v -> data, NULL, NULL, NULL, NULL, NULL, NULL,
+			 expr, MDL);
+		break;
+	}
+	expression_code_disabled--;
+
+	if (!v -> status)
+		value_forget (v);
+	if (emit (c, xc_const, reg, c -> const_count, NULL) < 0) {
+		value_forget (v);
+		return 0;
+	}
+	c -> const_count++;
+	return 1;
+}
+
+static int compile_binary (struct expr_compiler *c, struct expression *expr,
+			   int kind, int reg, int op)
+{
+	return (compile_node (c, expr -> data.and [0], kind, reg, 0) &&
+		compile_node (c, expr -> data.and [1], kind, reg + 1, 0) &&
+		emit (c, op, reg, 0, expr) >= 0);
+}
+
+/* Emit code for an expression the machine handles itself.  Returns zero
+   if it doesn't, or if the program has grown too big. */
+static int compile_op (struct expr_compiler *c, struct expression *expr,
+		       int kind, int reg)
+{
+	int kind0, jump;
+
+	if (expr_kind (expr) != kind || reg + 3 > EXPR_CODE_MAX_REGS)
+		return 0;
+	if (constant_expression (expr))
+		return fold_constant (c, expr, kind, reg);
+
+	switch (expr -> op) {
+	      case expr_option:
+		return emit (c, xc_option, reg, 0, expr) >= 0;
+
+	      case expr_config_option:
+		return emit (c, xc_config_option, reg, 0, expr) >= 0;
+
+	      case expr_hardware:
+		return emit (c, xc_hardware, reg, 0, expr) >= 0;
+
+	      case expr_packet:
+		/* The tree evaluator checks for a packet before evaluating
+		   the offset and length, so only constants can be moved in
+		   front of the check. */
+		if (!constant_expression (expr -> data.packet.offset) ||
+		    !constant_expression (expr -> data.packet.len))
+			return 0;
+		return (compile_node (c, expr -> data.packet.offset,
+				      EXPR_CODE_NUMERIC, reg, 0) &&
+			compile_node (c, expr -> data.packet.len,
+				      EXPR_CODE_NUMERIC, reg + 1, 0) &&
+			emit (c, xc_packet, reg, 0, expr) >= 0);
+
+	      case expr_substring:
+		return (compile_node (c, expr -> data.substring.expr,
+				      EXPR_CODE_DATA, reg, 0) &&
+			compile_node (c, expr -> data.substring.offset,
+				      EXPR_CODE_NUMERIC, reg + 1, 0) &&
+			compile_node (c, expr -> data.substring.len,
+				      EXPR_CODE_NUMERIC, reg + 2, 0) &&
+			emit (c, xc_substring, reg, 0, expr) >= 0);
+
+	      case expr_suffix:
+		return (compile_node (c, expr -> data.suffix.expr,
+				      EXPR_CODE_DATA, reg, 0) &&
+			compile_node (c, expr -> data.suffix.len,
+				      EXPR_CODE_NUMERIC, reg + 1, 0) &&
+			emit (c, xc_suffix, reg, 0, expr) >= 0);
+
+	      case expr_lcase:
+	      case expr_ucase:
+		return (compile_node (c, expr -> data.lcase,
+				      EXPR_CODE_DATA, reg, 0) &&
+			emit (c, expr -> op == expr_lcase
+			      ? xc_lcase : xc_ucase, reg, 0, expr) >= 0);
+
+	      case expr_concat:
+		return compile_binary (c, expr, EXPR_CODE_DATA, reg,
+				       xc_concat);
+
+	      case expr_encode_int8:
+	      case expr_encode_int16:
+	      case expr_encode_int32:
+		return (compile_node (c, expr -> data.encode_int,
+				      EXPR_CODE_NUMERIC, reg, 0) &&
+			emit (c, (expr -> op == expr_encode_int8
+				  ? xc_encode_int8
+				  : expr -> op == expr_encode_int16
+				  ? xc_encode_int16 : xc_encode_int32),
+			      reg, 0, expr) >= 0);
+
+	      case expr_pick_first_value:
+		if (!compile_node (c, expr -> data.pick_first_value.car,
+				   EXPR_CODE_DATA, reg, 0))
+			return 0;
+		if (!expr -> data.pick_first_value.cdr)
+			return 1;
+		jump = emit (c, xc_first_value, reg, 0, expr);
+		if (jump < 0 ||
+		    !compile_node (c, expr -> data.pick_first_value.cdr,
+				   EXPR_CODE_DATA, reg, 0))
+			return 0;
+		c -> insns [jump].arg = c -> insn_count;
+		return 1;
+
+	      case expr_extract_int8:
+	      case expr_extract_int16:
+	      case expr_extract_int32:
+		return (compile_node (c, expr -> data.extract_int,
+				      EXPR_CODE_DATA, reg, 0) &&
+			emit (c, (expr -> op == expr_extract_int8
+				  ? xc_extract_int8
+				  : expr -> op == expr_extract_int16
+				  ? xc_extract_int16 : xc_extract_int32),
+			      reg, 0, expr) >= 0);
+
+	      case expr_add:
+		return compile_binary (c, expr, kind, reg, xc_add);
+	      case expr_subtract:
+		return compile_binary (c, expr, kind, reg, xc_subtract);
+	      case expr_multiply:
+		return compile_binary (c, expr, kind, reg, xc_multiply);
+	      case expr_divide:
+		return compile_binary (c, expr, kind, reg, xc_divide);
+	      case expr_remainder:
+		return compile_binary (c, expr, kind, reg, xc_remainder);
+	      case expr_binary_and:
+		return compile_binary (c, expr, kind, reg, xc_binary_and);
+	      case expr_binary_or:
+		return compile_binary (c, expr, kind, reg, xc_binary_or);
+	      case expr_binary_xor:
+		return compile_binary (c, expr, kind, reg, xc_binary_xor);
+
+	      case expr_equal:
+	      case expr_not_equal:
+		/* Both sides have to be of a kind known in advance;
+		   comparing, say, a variable is left to the tree. */
+		kind0 = expr_kind (expr -> data.equal [0]);
+		if (!kind0 || kind0 != expr_kind (expr -> data.equal [1]))
+			return 0;
+		if (!compile_node (c, expr -> data.equal [0], kind0, reg, 0) ||
+		    !compile_node (c, expr -> data.equal [1],
+				   kind0, reg + 1, 0))
+			return 0;
+		return emit (c, (kind0 == EXPR_CODE_DATA
+				 ? xc_equal_data : xc_equal_value), reg,
+			     expr -> op == expr_not_equal, expr) >= 0;
+
+	      case expr_and:
+	      case expr_or:
+		if (!compile_node (c, expr -> data.and [0], kind, reg, 0))
+			return 0;
+		jump = emit (c, expr -> op == expr_and
+			     ? xc_and_left : xc_or_left, reg, 0, expr);
+		if (jump < 0 ||
+		    !compile_node (c, expr -> data.and [1], kind, reg + 1, 0) ||
+		    emit (c, expr -> op == expr_and ? xc_and : xc_or,
+			  reg, 0, expr) < 0)
+			return 0;
+		c -> insns [jump].arg = c -> insn_count;
+		return 1;
+
+	      case expr_not:
+		return (compile_node (c, expr -> data.not, kind, reg, 0) &&
+			emit (c, xc_not, reg, 0, expr) >= 0);
+
+	      case expr_exists:
+		return emit (c, xc_exists, reg, 0, expr) >= 0;
+
+	      case expr_known:
+		return emit (c, xc_known, reg, 0, expr) >= 0;
+
+	      case expr_static:
+		return emit (c, xc_static, reg, 0, expr) >= 0;
+
+	      default:
+		return 0;
+	}
+}
+
+/* Emit code for a subtree, handing it to the tree evaluator if the
+   machine can't do it.  The root of the program has to be handled by
+   the machine, or running it would just evaluate the tree again. */
+static int compile_node (struct expr_compiler *c, struct expression *expr,
+			 int kind, int reg, int top)
+{
+	int insn_count = c -> insn_count;
+	int const_count = c -> const_count;
+
+	if (compile_op (c, expr, kind, reg))
+		return 1;
+
+	/* Throw away whatever was emitted for the subtree. */
+	c -> insn_count = insn_count;
+	while (c -> const_count > const_count)
+		value_forget (&c -> consts [--c -> const_count]);
+	if (top)
+		return 0;
+	return emit (c, xc_call, reg, kind, expr) >= 0;
+}
+
+static void compile_expression (struct expression *expr, int kind)
+{
+	struct expr_compiler c;
+	struct expr_code *code;
+	unsigned size;
+
+	expr -> code_tried = 1;
+
+	/* A lone leaf is as quick to evaluate as it would be to run. */
+	switch (expr -> op) {
+	      case expr_const_data:
+	      case expr_const_int:
+	      case expr_option:
+	      case expr_config_option:
+	      case expr_hardware:
+	      case expr_exists:
+	      case expr_known:
+	      case expr_static:
+		return;
+	      default:
+		break;
+	}
+
+	memset (&c, 0, sizeof c);
+	if (!compile_node (&c, expr, kind, 0, 1))
+		return;
+
+	size = (sizeof *code + c.insn_count * sizeof c.insns [0] +
+		c.const_count * sizeof c.consts [0]);
+	code = dmalloc (size, MDL);
+	if (!code) {
+		while (c.const_count > 0)
+			value_forget (&c.consts [--c.const_count]);
+		return;
+	}
+	code -> kind = kind;
+	code -> insn_count = c.insn_count;
+	code -> const_count = c.const_count;
+	code -> reg_count = c.reg_count;
+	code -> consts = (struct expr_value *)(code + 1);
+	code -> insns = (struct expr_insn *)(code -> consts + c.const_count);
+	memcpy (code -> consts, c.consts, c.const_count * sizeof c.consts [0]);
+	memcpy (code -> insns, c.insns, c.insn_count * sizeof c.insns [0]);
+	expr -> code = code;
+}
+
+/* Compile the expression if that hasn't been tried yet, and return
+   nonzero if there is code to run for this kind of evaluation. */
+int expression_code_ready (struct expression *expr, int kind)
+{
+	if (expression_code_disabled)
+		return 0;
+	if (!expr -> code_tried)
+		compile_expression (expr, kind);
+	return expr -> code && expr -> code -> kind == kind;
+}
+
+void free_expression_code (struct expr_code *code)
+{
+	int i;
+
+	for (i = 0; i < code -> const_count; i++)
+		value_forget (&code -> consts [i]);
+	dfree (code, MDL);
+}
+
+/* Space for LEN bytes of intermediate data, from the scratch area if
+   there's room or else in a new buffer. */
+static unsigned char *scratch_space (struct expr_run *run,
+				     struct buffer **bp, unsigned len)
+{
+	unsigned char *p;
+
+	if (len <= (unsigned)(&run -> scratch [EXPR_CODE_SCRATCH] -
+			      run -> next)) {
+		p = run -> next;
+		run -> next += len;
+		return p;
+	}
+	if (!buffer_allocate (bp, len, MDL))
+		return NULL;
+	return &(*bp) -> data [0];
+}
+
+/* Set a register to data just built with scratch_space(). */
+static void set_data (struct expr_value *v, struct buffer **bp,
+		      unsigned char *p, unsigned len, int terminated)
+{
+	value_forget (v);
+	v -> status = 1;
+	v -> data.buffer = *bp;
+	v -> data.data = p;
+	v -> data.len = len;
+	v -> data.terminated = terminated;
+	*bp = NULL;
+}
+
+static int run_code (struct expr_run *run, struct expr_code *code,
+		     struct packet *packet, struct lease *lease,
+		     struct client_state *client_state,
+		     struct option_state *in_options,
+		     struct option_state *cfg_options,
+		     struct binding_scope **scope)
+{
+	struct expr_insn *insn;
+	struct expr_value *v, *a, *b;
+	struct buffer *buffer;
+	struct data_string data;
+	unsigned char *p;
+	unsigned long offset, len, i;
+	int pc, status, value;
+
+	memset (run -> reg, 0, code -> reg_count * sizeof run -> reg [0]);
+	run -> next = run -> scratch;
+
+	pc = 0;
+	while (pc < code -> insn_count) {
+		insn = &code -> insns [pc++];
+		v = &run -> reg [insn -> reg];
+		a = v + 1;
+		b = v + 2;
+		buffer = NULL;
+
+		switch (insn -> op) {
+		      case xc_const:
+			value_forget (v);
+			v -> status = code -> consts [insn -> arg].status;
+			v -> num = code -> consts [insn -> arg].num;
+			data_string_copy (&v -> data,
+					  &code -> consts [insn -> arg].data,
+					  MDL);
+			break;
+
+		      case xc_call:
+			value_forget (v);
+			if (insn -> arg == EXPR_CODE_BOOLEAN) {
+				value = 0;
+				v -> status = evaluate_boolean_expression
+					(&value, packet, lease, client_state,
+					 in_options, cfg_options, scope,
+					 insn -> expr);
+				v -> num = value;
+			} else if (insn -> arg == EXPR_CODE_NUMERIC) {
+				v -> status = evaluate_numeric_expression
+					(&v -> num, packet, lease,
+					 client_state, in_options,
+					 cfg_options, scope, insn -> expr);
+			} else {
+				v -> status = evaluate_data_expression
+					(&v -> data, packet, lease,
+					 client_state, in_options,
+					 cfg_options, scope, insn -> expr,
+					 MDL);
+				if (!v -> status)
+					value_forget (v);
+			}
+			break;
+
+		      case xc_option:
+		      case xc_config_option:
+			value_forget (v);
+			if (insn -> op == xc_option
+			    ? in_options != NULL : cfg_options != NULL)
+				v -> status = get_option
+					(&v -> data,
+					 insn -> expr -> data.option -> universe,
+					 packet, lease, client_state,
+					 in_options, cfg_options,
+					 (insn -> op == xc_option
+					  ? in_options : cfg_options),
+					 scope,
+					 insn -> expr -> data.option -> code,
+					 MDL);
+			break;
+
+		      case xc_hardware:
+			value_forget (v);
+			if (client_state) {
+				v -> status = 1;
+				v -> data.data = client_state -> interface ->
+					hw_address.hbuf;
+				v -> data.len = client_state -> interface ->
+					hw_address.hlen;
+			} else if (packet != NULL && packet -> raw != NULL) {
+				if (packet -> raw -> hlen >
+				    sizeof (packet -> raw -> chaddr)) {
+					log_error ("data: hardware: invalid "
+						   "hlen (%d)\n",
+						   packet -> raw -> hlen);
+					break;
+				}
+				len = packet -> raw -> hlen + 1;
+				p = scratch_space (run, &buffer, len);
+				if (!p) {
+					log_error ("data: hardware: "
+						   "no memory for buffer.");
+					break;
+				}
+				p [0] = packet -> raw -> htype;
+				memcpy (&p [1], packet -> raw -> chaddr,
+					packet -> raw -> hlen);
+				set_data (v, &buffer, p, len, 0);
+			} else if (lease != NULL) {
+				len = lease -> hardware_addr.hlen;
+				p = scratch_space (run, &buffer, len);
+				if (!p) {
+					log_error ("data: hardware: "
+						   "no memory for buffer.");
+					break;
+				}
+				memcpy (p, lease -> hardware_addr.hbuf, len);
+				set_data (v, &buffer, p, len, 0);
+			} else
+				log_error ("data: hardware: no raw packet "
+					   "or lease is available");
+			break;
+
+		      case xc_packet:
+			status = v -> status && a -> status;
+			offset = v -> num;
+			len = a -> num;
+			value_forget (v);
+			value_forget (a);
+			if (!packet || !packet -> raw) {
+				log_error ("data: packet: raw packet "
+					   "not available");
+				break;
+			}
+			if (!status || offset >= packet -> packet_length)
+				break;
+			if (offset + len > packet -> packet_length)
+				len = packet -> packet_length - offset;
+			p = scratch_space (run, &buffer, len);
+			if (!p) {
+				log_error ("data: packet: no buffer memory.");
+				break;
+			}
+			memcpy (p, ((unsigned char *)packet -> raw) + offset,
+				len);
+			set_data (v, &buffer, p, len, 0);
+			break;
+
+		      case xc_substring:
+			if (v -> status && a -> status && b -> status) {
+				offset = a -> num;
+				len = b -> num;
+				if (v -> data.len > offset) {
+					v -> data.len -= offset;
+					if (v -> data.len > len) {
+						v -> data.len = len;
+						v -> data.terminated = 0;
+					}
+					v -> data.data += offset;
+				} else {
+					value_forget (v);
+					v -> status = 1;
+				}
+			} else
+				value_forget (v);
+			value_forget (a);
+			value_forget (b);
+			break;
+
+		      case xc_suffix:
+			if (v -> status && a -> status) {
+				len = a -> num;
+				if (v -> data.len > len) {
+					v -> data.data += v -> data.len - len;
+					v -> data.len = len;
+				}
+			} else
+				value_forget (v);
+			value_forget (a);
+			break;
+
+		      case xc_lcase:
+		      case xc_ucase:
+			if (!v -> status) {
+				value_forget (v);
+				break;
+			}
+			len = v -> data.len;
+			p = scratch_space (run, &buffer,
+					   len + v -> data.terminated);
+			if (!p) {
+				log_error ("data: lcase: no buffer memory.");
+				value_forget (v);
+				break;
+			}
+			memcpy (p, v -> data.data, len + v -> data.terminated);
+			for (i = 0; i < len; i++)
+				p [i] = (insn -> op == xc_lcase
+					 ? tolower (p [i]) : toupper (p [i]));
+			set_data (v, &buffer, p, len, v -> data.terminated);
+			break;
+
+		      case xc_concat:
+			if (!v -> status || !a -> status) {
+				value_forget (v);
+				value_forget (a);
+				break;
+			}
+			len = v -> data.len + a -> data.len;
+			p = scratch_space (run, &buffer,
+					   len + a -> data.terminated);
+			if (!p) {
+				log_error ("data: concat: no memory");
+				value_forget (v);
+				value_forget (a);
+				break;
+			}
+			memcpy (p, v -> data.data, v -> data.len);
+			memcpy (&p [v -> data.len], a -> data.data,
+				a -> data.len + a -> data.terminated);
+			value_forget (a);
+			set_data (v, &buffer, p, len, 0);
+			break;
+
+		      case xc_encode_int8:
+		      case xc_encode_int16:
+		      case xc_encode_int32:
+			status = v -> status;
+			offset = v -> num;
+			value_forget (v);
+			if (!status)
+				break;
+			len = (insn -> op == xc_encode_int8 ? 1
+			       : insn -> op == xc_encode_int16 ? 2 : 4);
+			p = scratch_space (run, &buffer, len);
+			if (!p) {
+				log_error ("data: encode_int%d: no memory",
+					   (int)len * 8);
+				break;
+			}
+			if (len == 1)
+				p [0] = offset;
+			else if (len == 2)
+				putUShort (p, offset);
+			else
+				putULong (p, offset);
+			set_data (v, &buffer, p, len, 0);
+			break;
+
+		      case xc_first_value:
+			if (v -> status)
+				pc = insn -> arg;
+			break;
+
+		      case xc_extract_int8:
+		      case xc_extract_int16:
+		      case xc_extract_int32:
+			data = v -> data;
+			status = v -> status;
+			if (insn -> op == xc_extract_int8) {
+				/* The tree evaluator reads the first byte
+				   even of an empty string. */
+				offset = data.len > 0 ? data.data [0] : 0;
+			} else if (insn -> op == xc_extract_int16) {
+				status = status && data.len >= 2;
+				offset = status ? getUShort (data.data) : 0;
+			} else {
+				status = status && data.len >= 4;
+				offset = status ? getULong (data.data) : 0;
+			}
+			value_forget (v);
+			v -> status = status;
+			v -> num = status ? offset : 0;
+			break;
+
+		      case xc_add:
+		      case xc_subtract:
+		      case xc_multiply:
+		      case xc_divide:
+		      case xc_remainder:
+		      case xc_binary_and:
+		      case xc_binary_or:
+		      case xc_binary_xor:
+			status = v -> status && a -> status;
+			offset = v -> num;
+			len = a -> num;
+			switch (insn -> op) {
+			      case xc_add:
+				offset += len;
+				break;
+			      case xc_subtract:
+				offset -= len;
+				break;
+			      case xc_multiply:
+				offset *= len;
+				break;
+			      case xc_divide:
+				status = status && len;
+				offset = status ? offset / len : 0;
+				break;
+			      case xc_remainder:
+				status = status && len;
+				offset = status ? offset % len : 0;
+				break;
+			      case xc_binary_and:
+				offset &= len;
+				break;
+			      case xc_binary_or:
+				offset |= len;
+				break;
+			      default:
+				offset ^= len;
+				break;
+			}
+			v -> status = status;
+			v -> num = status ? offset : 0;
+			a -> status = 0;
+			break;
+
+		      case xc_equal_data:
+		      case xc_equal_value:
+			if (v -> status && a -> status) {
+				if (insn -> op == xc_equal_data)
+					value = (v -> data.len == a -> data.len &&
+						 (!a -> data.len ||
+						  !memcmp (v -> data.data,
+							   a -> data.data,
+							   a -> data.len)));
+				else
+					value = v -> num == a -> num;
+			} else
+				value = !v -> status && !a -> status;
+			value_forget (v);
+			value_forget (a);
+			v -> status = 1;
+			v -> num = insn -> arg ? !value : value;
+			break;
+
+		      case xc_and_left:
+			/* A false left side makes "and" fail. */
+			if (!v -> status || !v -> num) {
+				v -> status = 0;
+				v -> num = 0;
+				pc = insn -> arg;
+			}
+			break;
+
+		      case xc_and:
+			v -> status = a -> status;
+			v -> num = a -> status && a -> num;
+			a -> status = 0;
+			break;
+
+		      case xc_or_left:
+			if (v -> status && v -> num) {
+				v -> num = 1;
+				pc = insn -> arg;
+			}
+			break;
+
+		      case xc_or:
+			v -> status = v -> status || a -> status;
+			v -> num = v -> status && (v -> num || a -> num);
+			a -> status = 0;
+			a -> num = 0;
+			break;
+
+		      case xc_not:
+			v -> num = v -> status && !v -> num;
+			break;
+
+		      case xc_exists:
+			value_forget (v);
+			v -> status = 1;
+			memset (&data, 0, sizeof data);
+			if (in_options &&
+			    get_option (&data,
+					insn -> expr -> data.exists -> universe,
+					packet, lease, client_state,
+					in_options, cfg_options, in_options,
+					scope,
+					insn -> expr -> data.exists -> code,
+					MDL)) {
+				v -> num = 1;
+				data_string_forget (&data, MDL);
+			}
+			break;
+
+		      case xc_known:
+			value_forget (v);
+			if (packet) {
+				v -> status = 1;
+				v -> num = packet -> known;
+			}
+			break;
+
+		      case xc_static:
+			value_forget (v);
+			v -> status = 1;
+			v -> num = (lease && (lease -> flags & STATIC_LEASE)
+				    ? 1 : 0);
+			break;
+		}
+	}
+
+	return run -> reg [0].status;
+}
+
+static void finish_run (struct expr_run *run, struct expr_code *code)
+{
+	int i;
+
+	for (i = 0; i < code -> reg_count; i++)
+		if (run -> reg [i].data.buffer)
+			data_string_forget (&run -> reg [i].data, MDL);
+}
+
+#if defined (DEBUG_EXPRESSION_CODE)
+static void code_mismatch (struct expression *expr, const char *what)
+{
+	expression_code_mismatches++;
+	log_error ("compiled %s expression (op %d) differs from tree",
+		   what, expr -> op);
+}
+#endif
+
+int execute_boolean_code (result, packet, lease, client_state,
+			  in_options, cfg_options, scope, expr)
+	int *result;
+	struct packet *packet;
+	struct lease *lease;
+	struct client_state *client_state;
+	struct option_state *in_options;
+	struct option_state *cfg_options;
+	struct binding_scope **scope;
+	struct expression *expr;
+{
+	struct expr_run run;
+	int status;
+#if defined (DEBUG_EXPRESSION_CODE)
+	int check, value = 0;
+#endif
+
+	status = run_code (&run, expr -> code, packet, lease, client_state,
+			   in_options, cfg_options, scope);
+	if (status)
+		*result = run.reg [0].num;
+	finish_run (&run, expr -> code);
+
+#if defined (DEBUG_EXPRESSION_CODE)
+	expression_code_disabled++;
+	check = evaluate_boolean_expression (&value, packet, lease,
+					     client_state, in_options,
+					     cfg_options, scope, expr);
+	expression_code_disabled--;
+	if (check != status || (status && value != *result))
+		code_mismatch (expr, "boolean");
+#endif
+	return status;
+}
+
+int execute_numeric_code (result, packet, lease, client_state,
+			  in_options, cfg_options, scope, expr)
+	unsigned long *result;
+	struct packet *packet;
+	struct lease *lease;
+	struct client_state *client_state;
+	struct option_state *in_options;
+	struct option_state *cfg_options;
+	struct binding_scope **scope;
+	struct expression *expr;
+{
+	struct expr_run run;
+	int status;
+#if defined (DEBUG_EXPRESSION_CODE)
+	unsigned long value = 0;
+	int check;
+#endif
+
+	status = run_code (&run, expr -> code, packet, lease, client_state,
+			   in_options, cfg_options, scope);
+	if (status)
+		*result = run.reg [0].num;
+	finish_run (&run, expr -> code);
+
+#if defined (DEBUG_EXPRESSION_CODE)
+	expression_code_disabled++;
+	check = evaluate_numeric_expression (&value, packet, lease,
+					     client_state, in_options,
+					     cfg_options, scope, expr);
+	expression_code_disabled--;
+	if (check != status || (status && value != *result))
+		code_mismatch (expr, "numeric");
+#endif
+	return status;
+}
+
+int execute_data_code (result, packet, lease, client_state,
+		       in_options, cfg_options, scope, expr, file, line)
+	struct data_string *result;
+	struct packet *packet;
+	struct lease *lease;
+	struct client_state *client_state;
+	struct option_state *in_options;
+	struct option_state *cfg_options;
+	struct binding_scope **scope;
+	struct expression *expr;
+	const char *file;
+	int line;
+{
+	struct expr_run run;
+	struct data_string *data;
+	int status;
+#if defined (DEBUG_EXPRESSION_CODE)
+	struct data_string value;
+	int check;
+#endif
+
+	status = run_code (&run, expr -> code, packet, lease, client_state,
+			   in_options, cfg_options, scope);
+	data = &run.reg [0].data;
+	if (status && !data -> buffer &&
+	    data -> data >= run.scratch &&
+	    data -> data < &run.scratch [EXPR_CODE_SCRATCH]) {
+		/* The result is in the scratch area, which is about
+		   to go away. */
+		if (buffer_allocate (&result -> buffer,
+				     data -> len + data -> terminated,
+				     file, line)) {
+			result -> data = &result -> buffer -> data [0];
+			memcpy (result -> buffer -> data, data -> data,
+				data -> len + data -> terminated);
+			result -> len = data -> len;
+			result -> terminated = data -> terminated;
+		} else {
+			log_error ("data: no memory for result.");
+			status = 0;
+		}
+	} else if (status)
+		data_string_copy (result, data, file, line);
+	finish_run (&run, expr -> code);
+
+#if defined (DEBUG_EXPRESSION_CODE)
+	memset (&value, 0, sizeof value);
+	expression_code_disabled++;
+	check = evaluate_data_expression (&value, packet, lease,
+					  client_state, in_options,
+					  cfg_options, scope, expr, MDL);
+	expression_code_disabled--;
+	if (check != status ||
+	    (status && (value.len != result -> len ||
+			value.terminated != result -> terminated ||
+			(value.len &&
+			 memcmp (value.data, result -> data, value.len)))))
+		code_mismatch (expr, "data");
+	if (check)
+		data_string_forget (&value, MDL);
+#endif
+	return status;
+}
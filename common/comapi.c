@@ -480,6 +480,24 @@ isc_result_t dhcp_control_get_value (omapi_object_t *h, omapi_object_t *id,
 	if (!omapi_ds_strcmp (name, "state"))
 		return omapi_make_int_value (value,
 					     name, (int)control -> state, MDL);
+#if defined (ENABLE_EXECUTE)
+	if (!omapi_ds_strcmp (name, "execute-running"))
+		return omapi_make_int_value (value, name,
+					     execute_running, MDL);
+	if (!omapi_ds_strcmp (name, "execute-queued"))
+		return omapi_make_int_value (value, name,
+					     execute_queued, MDL);
+	if (!omapi_ds_strcmp (name, "execute-dropped"))
+		return omapi_make_uint_value (value, name,
+					      execute_dropped, MDL);
+#endif
+#if defined (NSUPDATE)
+	if (!omapi_ds_strcmp (name, "ddns-queued"))
+		return omapi_make_int_value (value, name, ddns_queued, MDL);
+	if (!omapi_ds_strcmp (name, "ddns-dropped"))
+		return omapi_make_uint_value (value, name,
+					      ddns_dropped, MDL);
+#endif
 
 	/* Try to find some inner object that can take the value. */
 	if (h -> inner && h -> inner -> type -> get_value) {
@@ -543,6 +561,32 @@ isc_result_t dhcp_control_stuff_values (omapi_object_t *c,
 	if (status != ISC_R_SUCCESS)
 		return status;
 
+#if defined (ENABLE_EXECUTE)
+	status = omapi_connection_put_named_uint32 (c, "execute-running",
+						    execute_running);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "execute-queued",
+						    execute_queued);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "execute-dropped",
+						    execute_dropped);
+	if (status != ISC_R_SUCCESS)
+		return status;
+#endif
+
+#if defined (NSUPDATE)
+	status = omapi_connection_put_named_uint32 (c, "ddns-queued",
+						    ddns_queued);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "ddns-dropped",
+						    ddns_dropped);
+	if (status != ISC_R_SUCCESS)
+		return status;
+#endif
+
 	/* Write out the inner object, if any. */
 	if (h -> inner && h -> inner -> type -> stuff_values) {
 		status = ((*(h -> inner -> type -> stuff_values))
@@ -1085,6 +1085,56 @@ void reinitialize_interfaces ()
 	interfaces_invalidated = 1;
 }
 
+#if defined (USE_LPF_RX_RING)
+/* Drain the interface's receive ring, handing each packet to the
+   protocol handler where it lies.   A payload that isn't aligned well
+   enough to be used as a struct dhcp_packet is copied out first. */
+static isc_result_t got_batch (struct interface_info *ip)
+{
+	struct sockaddr_in from;
+	struct hardware hfrom;
+	struct iaddr ifrom;
+	unsigned char *payload;
+	unsigned len;
+	u_int32_t frames = 0;
+	union {
+		unsigned char packbuf [1536];
+		struct dhcp_packet packet;
+	} u;
+
+	while (receive_packet_batch (ip, &payload, &len, &from, &hfrom)) {
+		frames++;
+
+		/* See got_one() for why short packets are dropped. */
+		if (len < DHCP_FIXED_NON_UDP)
+			continue;
+
+		if (((uintptr_t)payload % sizeof (u_int32_t)) != 0) {
+			if (len > sizeof u)
+				continue;
+			memcpy (u.packbuf, payload, len);
+			payload = u.packbuf;
+		}
+
+		if (bootp_packet_handler) {
+			ifrom.len = 4;
+			memcpy (ifrom.iabuf, &from.sin_addr, ifrom.len);
+
+			(*bootp_packet_handler) (ip,
+						 (struct dhcp_packet *)payload,
+						 len, from.sin_port,
+						 ifrom, &hfrom);
+		}
+	}
+
+	ip -> rx_wakeups++;
+	ip -> rx_frames += frames;
+	if (frames > ip -> rx_batch_max)
+		ip -> rx_batch_max = frames;
+	return ISC_R_SUCCESS;
+}
+#endif /* USE_LPF_RX_RING */
+
 isc_result_t got_one (h)
 	omapi_object_t *h;
 {
@@ -1104,6 +1154,11 @@ isc_result_t got_one (h)
 		return DHCP_R_INVALIDARG;
 	ip = (struct interface_info *)h;
 
+#if defined (USE_LPF_RX_RING)
+	if (ip -> rx_ring != NULL)
+		return got_batch (ip);
+#endif
+
       again:
 	if ((result =
 	     receive_packet (ip, u.packbuf, sizeof u, &from, &hfrom)) < 0) {
@@ -1160,28 +1215,13 @@ isc_result_t got_one (h)
 }
 
 #ifdef DHCPv6
-isc_result_t
-got_one_v6(omapi_object_t *h) {
-	struct sockaddr_in6 from;
-	struct in6_addr to;
+/* Pass one received DHCPv6 packet on to the protocol handler. */
+static isc_result_t
+handle_one_v6(struct interface_info *ip, char *buf, int len,
+	      struct sockaddr_in6 *from, struct in6_addr *to,
+	      unsigned int if_idx) {
 	struct iaddr ifrom;
-	int result;
-	char buf[65536];	/* maximum size for a UDP packet is 65536 */
-	struct interface_info *ip;
 	int is_unicast;
-	unsigned int if_idx = 0;
-
-	if (h->type != dhcp_type_interface) {
-		return DHCP_R_INVALIDARG;
-	}
-	ip = (struct interface_info *)h;
-
-	result = receive_packet6(ip, (unsigned char *)buf, sizeof(buf),
-				 &from, &to, &if_idx);
-	if (result < 0) {
-		log_error("receive_packet6() failed on %s: %m", ip->name);
-		return ISC_R_UNEXPECTED;
-	}
 
 	/* 0 is 'any' interface. */
 	if (if_idx == 0)
@@ -1191,14 +1231,14 @@ got_one_v6(omapi_object_t *h) {
 		/*
 		 * If a packet is not multicast, we assume it is unicast.
 		 */
-		if (IN6_IS_ADDR_MULTICAST(&to)) { 
+		if (IN6_IS_ADDR_MULTICAST(to)) { 
 			is_unicast = ISC_FALSE;
 		} else {
 			is_unicast = ISC_TRUE;
 		}
 
 		ifrom.len = 16;
-		memcpy(ifrom.iabuf, &from.sin6_addr, ifrom.len);
+		memcpy(ifrom.iabuf, &from->sin6_addr, ifrom.len);
 
 		/* Seek forward to find the matching source interface. */
 		ip = interfaces;
@@ -1209,12 +1249,81 @@ got_one_v6(omapi_object_t *h) {
 			return ISC_R_NOTFOUND;
 
 		(*dhcpv6_packet_handler)(ip, buf, 
-					 result, from.sin6_port, 
+					 len, from->sin6_port, 
 					 &ifrom, is_unicast);
 	}
 
 	return ISC_R_SUCCESS;
 }
+
+isc_result_t
+got_one_v6(omapi_object_t *h) {
+	struct sockaddr_in6 from;
+	struct in6_addr to;
+	int result;
+	char buf[65536];	/* maximum size for a UDP packet is 65536 */
+	struct interface_info *ip;
+	unsigned int if_idx = 0;
+
+	if (h->type != dhcp_type_interface) {
+		return DHCP_R_INVALIDARG;
+	}
+	ip = (struct interface_info *)h;
+
+#if defined (USE_RECVMMSG)
+	{
+	/*
+	 * Read everything that's queued on the socket in one go and
+	 * hand each datagram on from the buffer it was received into.
+	 */
+	struct sockaddr_in6 bfrom[RX_BATCH_MAX];
+	struct in6_addr bto[RX_BATCH_MAX];
+	unsigned int bif_idx[RX_BATCH_MAX];
+	unsigned char *bufs[RX_BATCH_MAX];
+	int lens[RX_BATCH_MAX];
+	u_int32_t frames = 0;
+	int count, i;
+
+	do {
+		count = receive_packet6_batch(ip, bufs, lens, bfrom, bto,
+					      bif_idx, RX_BATCH_MAX);
+		if (count < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			log_error("receive_packet6_batch() failed on %s: %m",
+				  ip->name);
+			return ISC_R_UNEXPECTED;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (lens[i] < 0) {
+				log_error("receive_packet6_batch() on %s: "
+					  "no packet information", ip->name);
+				continue;
+			}
+			handle_one_v6(ip, (char *)bufs[i], lens[i],
+				      &bfrom[i], &bto[i], bif_idx[i]);
+		}
+		frames += count;
+	} while (count == RX_BATCH_MAX);
+
+	ip->rx_wakeups++;
+	ip->rx_frames += frames;
+	if (frames > ip->rx_batch_max)
+		ip->rx_batch_max = frames;
+	return ISC_R_SUCCESS;
+	}
+#endif /* USE_RECVMMSG */
+
+	result = receive_packet6(ip, (unsigned char *)buf, sizeof(buf),
+				 &from, &to, &if_idx);
+	if (result < 0) {
+		log_error("receive_packet6() failed on %s: %m", ip->name);
+		return ISC_R_UNEXPECTED;
+	}
+
+	return handle_one_v6(ip, buf, result, &from, &to, if_idx);
+}
 #endif /* DHCPv6 */
 
 isc_result_t dhcp_interface_set_value  (omapi_object_t *h,
@@ -1281,6 +1390,13 @@ isc_result_t dhcp_interface_destroy (omapi_object_t *h,
 		dfree (interface -> rbuf, file, line);
 		interface -> rbuf = (unsigned char *)0;
 	}
+#if defined (USE_SENDMMSG)
+	if (interface -> tx_queue) {
+		dfree (interface -> tx_queue, file, line);
+		interface -> tx_queue = (struct tx_frame *)0;
+		interface -> tx_count = 0;
+	}
+#endif
 	if (interface -> client)
 		interface -> client = (struct client_state *)0;
 
@@ -1350,6 +1466,22 @@ isc_result_t dhcp_interface_stuff_values (omapi_object_t *c,
 	if (status != ISC_R_SUCCESS)
 		return status;
 
+#if defined (USE_BATCH_RECEIVE)
+	/* Receive batching: how many packets each wakeup picked up. */
+	status = omapi_connection_put_named_uint32 (c, "rx-wakeups",
+						    interface -> rx_wakeups);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "rx-frames",
+						    interface -> rx_frames);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "rx-batch-max",
+						    interface -> rx_batch_max);
+	if (status != ISC_R_SUCCESS)
+		return status;
+#endif
+
 	/* Write out the inner object, if any. */
 	if (h -> inner && h -> inner -> type -> stuff_values) {
 		status = ((*(h -> inner -> type -> stuff_values))
@@ -30,9 +30,166 @@
 
 #include <sys/time.h>
 
-struct timeout *timeouts;
+/*
+ * Pending timeouts are indexed two ways: a min-heap ordered on the
+ * expiration time, so the next timeout to fire is always at the top,
+ * and a chained hash table on the data pointer so that add_timeout()
+ * and cancel_timeout() can find an existing (func, what) pair without
+ * walking every pending timeout.  The hash is keyed on "what" alone so
+ * that the where == NULL wildcard accepted by add_timeout() still works;
+ * the function is compared while walking the (short) chain.  The "next"
+ * pointer of a timeout links it either on its hash chain or, once it has
+ * fired or been cancelled, on the free list.
+ */
+static isc_heap_t *timeout_heap;
+static struct timeout **timeout_hash;
+static unsigned timeout_hash_size;
+static unsigned timeout_count;
 static struct timeout *free_timeouts;
 
+/* Initial number of hash buckets, must be a power of two. */
+#define TIMEOUT_HASH_INITIAL	1024
+
+/* Grow the heap in large steps, it may hold hundreds of thousands. */
+#define TIMEOUT_HEAP_INCREMENT	16384
+
+/*
+ * A single ISC timer is armed for the earliest pending timeout, and
+ * timer_armed_at records when it will go off so that we only need to
+ * reset it when a new timeout is added ahead of it.
+ */
+static isc_timer_t *dhcp_timer;
+static struct timeval timer_armed_at;
+static int timer_armed;
+
+static void timer_rearm(void);
+
+static isc_boolean_t
+timeout_earlier(void *a, void *b) {
+	struct timeout *ta = (struct timeout *)a;
+	struct timeout *tb = (struct timeout *)b;
+
+	if (ta->when.tv_sec != tb->when.tv_sec)
+		return (ta->when.tv_sec < tb->when.tv_sec);
+	return (ta->when.tv_usec < tb->when.tv_usec);
+}
+
+static void
+timeout_index_changed(void *timeout, unsigned int new_heap_index) {
+	((struct timeout *)timeout)->heap_index = new_heap_index;
+}
+
+static unsigned
+timeout_hash_bucket(void *what, unsigned size) {
+	u_int64_t key = (u_int64_t)(uintptr_t)what;
+
+	/* Fibonacci hashing; the low bits of a pointer carry no entropy. */
+	key = (key >> 3) * 0x9E3779B97F4A7C15ULL;
+	return ((unsigned)(key >> 32) & (size - 1));
+}
+
+static void
+timeout_hash_grow(void) {
+	struct timeout **nhash, *t, *n;
+	unsigned nsize, i, b;
+
+	nsize = timeout_hash_size ? timeout_hash_size * 2
+				  : TIMEOUT_HASH_INITIAL;
+	nhash = dmalloc(nsize * sizeof(*nhash), MDL);
+	if (nhash == NULL) {
+		/* Longer chains are slower but still correct. */
+		if (timeout_hash_size != 0)
+			return;
+		log_fatal("add_timeout: no memory for timeout hash!");
+	}
+
+	for (i = 0; i < timeout_hash_size; i++) {
+		for (t = timeout_hash[i]; t != NULL; t = n) {
+			n = t->next;
+			b = timeout_hash_bucket(t->what, nsize);
+			t->next = nhash[b];
+			nhash[b] = t;
+		}
+	}
+
+	if (timeout_hash != NULL)
+		dfree(timeout_hash, MDL);
+	timeout_hash = nhash;
+	timeout_hash_size = nsize;
+}
+
+/* Find the timeout for where and what; a NULL where matches any function. */
+static struct timeout *
+timeout_lookup(void (*where)(void *), void *what) {
+	struct timeout *t;
+
+	if (timeout_hash == NULL)
+		return (NULL);
+
+	t = timeout_hash[timeout_hash_bucket(what, timeout_hash_size)];
+	for (; t != NULL; t = t->next) {
+		if ((where == NULL || t->func == where) && t->what == what)
+			return (t);
+	}
+	return (NULL);
+}
+
+/* Take a pending timeout off both the hash table and the heap. */
+static void
+timeout_unlink(struct timeout *t) {
+	struct timeout **tp;
+
+	tp = &timeout_hash[timeout_hash_bucket(t->what, timeout_hash_size)];
+	while (*tp != t)
+		tp = &(*tp)->next;
+	*tp = t->next;
+	t->next = NULL;
+	timeout_count--;
+
+	if (t->heap_index != 0)
+		isc_heap_delete(timeout_heap, t->heap_index);
+}
+
+static void
+timeout_hash_insert(struct timeout *t) {
+	unsigned b;
+
+	if (timeout_count >= timeout_hash_size)
+		timeout_hash_grow();
+
+	b = timeout_hash_bucket(t->what, timeout_hash_size);
+	t->next = timeout_hash[b];
+	timeout_hash[b] = t;
+	timeout_count++;
+}
+
+static void
+timeout_free(struct timeout *t) {
+	if (t->unref)
+		(*t->unref) (&t->what, MDL);
+	t->next = free_timeouts;
+	free_timeouts = t;
+}
+
+/* Remove the earliest timeout if it has expired as of cur_tv. */
+static struct timeout *
+timeout_pop_expired(void) {
+	struct timeout *t;
+
+	if (timeout_heap == NULL)
+		return (NULL);
+
+	t = (struct timeout *)isc_heap_element(timeout_heap, 1);
+	if (t == NULL ||
+	    (t->when.tv_sec > cur_tv.tv_sec) ||
+	    ((t->when.tv_sec == cur_tv.tv_sec) &&
+	     (t->when.tv_usec > cur_tv.tv_usec)))
+		return (NULL);
+
+	timeout_unlink(t);
+	return (t);
+}
+
 void set_time(TIME t)
 {
 	/* Do any outstanding timeouts. */
@@ -45,31 +202,25 @@ void set_time(TIME t)
 
 struct timeval *process_outstanding_timeouts (struct timeval *tvp)
 {
+	struct timeout *t;
+
 	/* Call any expired timeouts, and then if there's
 	   still a timeout registered, time out the select
 	   call then. */
-      another:
-	if (timeouts) {
-		struct timeout *t;
-		if ((timeouts -> when . tv_sec < cur_tv . tv_sec) ||
-		    ((timeouts -> when . tv_sec == cur_tv . tv_sec) &&
-		     (timeouts -> when . tv_usec <= cur_tv . tv_usec))) {
-			t = timeouts;
-			timeouts = timeouts -> next;
-			(*(t -> func)) (t -> what);
-			if (t -> unref)
-				(*t -> unref) (&t -> what, MDL);
-			t -> next = free_timeouts;
-			free_timeouts = t;
-			goto another;
-		}
-		if (tvp) {
-			tvp -> tv_sec = timeouts -> when . tv_sec;
-			tvp -> tv_usec = timeouts -> when . tv_usec;
-		}
-		return tvp;
-	} else
+	while ((t = timeout_pop_expired ()) != NULL) {
+		(*(t -> func)) (t -> what);
+		timeout_free (t);
+	}
+
+	if (timeout_heap == NULL ||
+	    (t = isc_heap_element (timeout_heap, 1)) == NULL)
 		return (struct timeval *)0;
+
+	if (tvp) {
+		tvp -> tv_sec = t -> when . tv_sec;
+		tvp -> tv_usec = t -> when . tv_usec;
+	}
+	return tvp;
 }
 
 /* Wait for packets to come in using select().   When one does, call
@@ -78,7 +229,7 @@ struct timeval *process_outstanding_timeouts (struct timeval *tvp)
    bootp_packet_handler hook to try to do something with it. */
 
 /*
- * Use the DHCP timeout list as a place to store DHCP specific
+ * Use the DHCP timeout index as a place to store DHCP specific
  * information, but use the ISC timer system to actually dispatch
  * the events.
  *
@@ -90,19 +241,13 @@ struct timeval *process_outstanding_timeouts (struct timeval *tvp)
  * ISC code uses a pointer to the timer.
  * 3) The DHCP code includes provision for incrementing and decrementing
  * a reference counter associated with the data.
- * The first one is fairly easy to fix but will take some time to go throuh
- * the callers and update them.  The second is also not all that difficult
- * in concept - add a pointer to the appropriate structures to hold a pointer
- * to the timer and use that.  The complications arise in trying to ensure
- * that all of the corner cases are covered.  The last one is potentially
- * more painful and requires more investigation.
- * 
- * The plan is continue with the older DHCP calls and timer list.  The
- * calls will continue to manipulate the list but will also pass a
- * timer to the ISC timer code for the actual dispatch.  Later, if desired,
- * we can go back and modify the underlying calls to use the ISC
- * timer functions directly without requiring all of the code to change
- * at the same time.
+ *
+ * Rather than creating an ISC timer for every DHCP timeout, which made
+ * the ISC timer manager carry one entry per pending ping check, lease
+ * expiry, failover or DDNS timer, we keep our own heap of timeouts and
+ * arm a single ISC timer for whichever one is due first.  When it goes
+ * off isclib_timer_callback() runs every timeout that has expired and
+ * re-arms the timer for the next one.
  */
 
 void
@@ -139,53 +284,23 @@ void
 isclib_timer_callback(isc_task_t  *taskp,
 		      isc_event_t *eventp)
 {
-	struct timeout *t = (struct timeout *)eventp->ev_arg;
-	struct timeout *q, *r;
+	struct timeout *t;
 
 	/* Get the current time... */
 	gettimeofday (&cur_tv, (struct timezone *)0);
 
 	/*
-	 * Find the timeout on the dhcp list and remove it.
-	 * As the list isn't ordered we search the entire list
-	 */
-
-	r = NULL;
-	for (q = timeouts; q; q = q->next) {
-		if (q == t) {
-			if (r)
-				r->next = q->next;
-			else
-				timeouts = q->next;
-			break;
-		}
-		r = q;
-	}
-
-	/*
-	 * The timer should always be on the list.  If it is we do
-	 * the work and detach the timer block, if not we log an error.
-	 * In both cases we attempt free the ISC event and continue
-	 * processing.
+	 * The timer is armed for the earliest timeout but that one may
+	 * since have been cancelled or superseded, in which case there
+	 * may be nothing to do except arm the timer for the new earliest.
 	 */
-
-	if (q != NULL) {
+	timer_armed = 0;
+	while ((t = timeout_pop_expired()) != NULL) {
 		/* call the callback function */
-		(*(q->func)) (q->what);
-		if (q->unref) {
-			(*q->unref) (&q->what, MDL);
-		}
-		q->next = free_timeouts;
-		isc_timer_detach(&q->isc_timeout);
-		free_timeouts = q;
-	} else {
-		/*
-		 * Hmm, we should clean up the timer structure but aren't
-		 * sure about the pointer to the timer block we got so
-		 * don't try to - may change this to a log_fatal
-		 */
-		log_error("Error finding timer structure");
+		(*(t->func)) (t->what);
+		timeout_free(t);
 	}
+	timer_rearm();
 
 	isc_event_free(&eventp);
 	return;
@@ -194,6 +309,71 @@ isclib_timer_callback(isc_task_t  *taskp,
 /* maximum value for usec */
 #define USEC_MAX 1000000
 
+/*
+ * Arm the ISC timer for the timeout at the top of the heap.  The timer
+ * is never disarmed: if the heap empties it simply goes off once more
+ * and finds nothing to do.
+ */
+static void
+timer_rearm(void)
+{
+	struct timeout *t;
+	struct timeval now;
+	isc_interval_t interval;
+	isc_time_t expires;
+	isc_result_t status;
+	int64_t sec;
+	long usec;
+
+	t = (struct timeout *)isc_heap_element(timeout_heap, 1);
+	if (t == NULL)
+		return;
+
+	gettimeofday(&now, (struct timezone *)0);
+	sec  = t->when.tv_sec - now.tv_sec;
+	usec = t->when.tv_usec - now.tv_usec;
+	if (usec < 0) {
+		sec--;
+		usec += USEC_MAX;
+	}
+	if (sec < 0) {
+		sec  = 0;
+		usec = 0;
+	}
+
+	isc_interval_set(&interval, sec, usec * 1000);
+	status = isc_time_nowplusinterval(&expires, &interval);
+	if (status != ISC_R_SUCCESS) {
+		/*
+		 * The system time function isn't happy. Range errors
+		 * should not be possible with the check logic in
+		 * add_timeout().
+		 */
+		log_fatal("Unable to set up timer: %s",
+			  isc_result_totext(status));
+	}
+
+	if (dhcp_timer == NULL) {
+		status = isc_timer_create(dhcp_gbl_ctx.timermgr,
+					  isc_timertype_once, &expires,
+					  NULL, dhcp_gbl_ctx.task,
+					  isclib_timer_callback,
+					  NULL, &dhcp_timer);
+	} else {
+		status = isc_timer_reset(dhcp_timer,
+					 isc_timertype_once, &expires,
+					 NULL, ISC_TRUE);
+	}
+
+	/* If it fails log an error and die */
+	if (status != ISC_R_SUCCESS) {
+		log_fatal("Unable to add timeout to isclib\n");
+	}
+
+	timer_armed_at = t->when;
+	timer_armed = 1;
+}
+
 void add_timeout (when, where, what, ref, unref)
 	struct timeval *when;
 	void (*where) (void *);
@@ -201,32 +381,29 @@ void add_timeout (when, where, what, ref, unref)
 	tvref_t ref;
 	tvunref_t unref;
 {
-	struct timeout *t, *q;
-	int usereset = 0;
+	struct timeout *q;
+	struct timeval old_when;
 	isc_result_t status;
 	int64_t sec;
 	int usec;
-	isc_interval_t interval;
-	isc_time_t expires;
 
-	/* See if this timeout supersedes an existing timeout. */
-	t = (struct timeout *)0;
-	for (q = timeouts; q; q = q->next) {
-		if ((where == NULL || q->func == where) &&
-		    q->what == what) {
-			if (t)
-				t->next = q->next;
-			else
-				timeouts = q->next;
-			usereset = 1;
-			break;
-		}
-		t = q;
+	if (timeout_heap == NULL) {
+		status = isc_heap_create(dhcp_gbl_ctx.mctx, timeout_earlier,
+					 timeout_index_changed,
+					 TIMEOUT_HEAP_INCREMENT,
+					 &timeout_heap);
+		if (status != ISC_R_SUCCESS)
+			log_fatal("add_timeout: no memory for timeout heap!");
 	}
 
+	/* See if this timeout supersedes an existing timeout. */
+	q = timeout_lookup(where, what);
+
 	/* If we didn't supersede a timeout, allocate a timeout
 	   structure now. */
-	if (!q) {
+	if (q) {
+		old_when = q->when;
+	} else {
 		if (free_timeouts) {
 			q = free_timeouts;
 			free_timeouts = q->next;
@@ -287,89 +464,51 @@ void add_timeout (when, where, what, ref, unref)
 		usec = USEC_MAX - 1;
 	}
 
-	/* 
-	 * This is necessary for the tracing code but we put it
-	 * here in case we want to compare timing information
-	 * for some reason, like debugging.
+	/*
+	 * Store the absolute expiration time; the heap is ordered on it
+	 * and the trace playback code compares it against cur_tv.
 	 */
 	q->when.tv_sec  = cur_tv.tv_sec + sec;
-	q->when.tv_usec = usec;
-
-#if defined (TRACING)
-	if (trace_playback()) {
-		/*
-		 * If we are doing playback we need to handle the timers
-		 * within this code rather than having the isclib handle
-		 * them for us.  We need to keep the timer list in order
-		 * to allow us to find the ones to timeout.
-		 *
-		 * By using a different timer setup in the playback we may
-		 * have variations between the orginal and the playback but
-		 * it's the best we can do for now.
-		 */
-
-		/* Beginning of list? */
-		if (!timeouts || (timeouts->when.tv_sec > q-> when.tv_sec) ||
-		    ((timeouts->when.tv_sec == q->when.tv_sec) &&
-		     (timeouts->when.tv_usec > q->when.tv_usec))) {
-			q->next = timeouts;
-			timeouts = q;
-			return;
-		}
+	q->when.tv_usec = cur_tv.tv_usec + usec;
+	if (q->when.tv_usec >= USEC_MAX) {
+		q->when.tv_sec++;
+		q->when.tv_usec -= USEC_MAX;
+	}
 
-		/* Middle of list? */
-		for (t = timeouts; t->next; t = t->next) {
-			if ((t->next->when.tv_sec > q->when.tv_sec) ||
-			    ((t->next->when.tv_sec == q->when.tv_sec) &&
-			     (t->next->when.tv_usec > q->when.tv_usec))) {
-				q->next = t->next;
-				t->next = q;
-				return;
-			}
-		}
+	if (q->heap_index == 0) {
+		timeout_hash_insert(q);
+		status = isc_heap_insert(timeout_heap, q);
+		if (status != ISC_R_SUCCESS)
+			log_fatal("add_timeout: no memory for timeout heap!");
+	} else if (timercmp(&q->when, &old_when, <)) {
+		/* Superseded by an earlier time, move towards the top. */
+		isc_heap_increased(timeout_heap, q->heap_index);
+	} else {
+		isc_heap_decreased(timeout_heap, q->heap_index);
+	}
 
-		/* End of list. */
-		t->next = q;
-		q->next = (struct timeout *)0;
+#if defined (TRACING)
+	/*
+	 * If we are doing playback we need to handle the timers
+	 * within this code rather than having the isclib handle
+	 * them for us; process_outstanding_timeouts() runs them
+	 * off the heap as set_time() advances the clock.
+	 *
+	 * By using a different timer setup in the playback we may
+	 * have variations between the orginal and the playback but
+	 * it's the best we can do for now.
+	 */
+	if (trace_playback())
 		return;
-	}
 #endif
+
 	/*
-	 * Don't bother sorting the DHCP list, just add it to the front.
-	 * Eventually the list should be removed as we migrate the callers
-	 * to the native ISC timer functions, if it becomes a performance
-	 * problem before then we may need to order the list.
+	 * Only touch the ISC timer if this timeout is now the first one
+	 * due and is due before the timer would otherwise go off.
 	 */
-	q->next  = timeouts;
-	timeouts = q;
-
-	isc_interval_set(&interval, sec, usec * 1000);
-	status = isc_time_nowplusinterval(&expires, &interval);
-	if (status != ISC_R_SUCCESS) {
-		/*
-		 * The system time function isn't happy. Range errors
-		 * should not be possible with the check logic above.
-		 */
-		log_fatal("Unable to set up timer: %s",
-			  isc_result_totext(status));
-	}
-
-	if (usereset == 0) {
-		status = isc_timer_create(dhcp_gbl_ctx.timermgr,
-					  isc_timertype_once, &expires,
-					  NULL, dhcp_gbl_ctx.task,
-					  isclib_timer_callback,
-					  (void *)q, &q->isc_timeout);
-	} else {
-		status = isc_timer_reset(q->isc_timeout,
-					 isc_timertype_once, &expires,
-					 NULL, 0);
-	}
-
-	/* If it fails log an error and die */
-	if (status != ISC_R_SUCCESS) {
-		log_fatal("Unable to add timeout to isclib\n");
-	}
+	if (q->heap_index == 1 &&
+	    (!timer_armed || timercmp(&q->when, &timer_armed_at, <)))
+		timer_rearm();
 
 	return;
 }
@@ -378,39 +517,18 @@ void cancel_timeout (where, what)
 	void (*where) (void *);
 	void *what;
 {
-	struct timeout *t, *q;
-
-	/* Look for this timeout on the list, and unlink it if we find it. */
-	t = (struct timeout *)0;
-	for (q = timeouts; q; q = q -> next) {
-		if (q->func == where && q->what == what) {
-			if (t)
-				t->next = q->next;
-			else
-				timeouts = q->next;
-			break;
-		}
-		t = q;
-	}
+	struct timeout *q;
 
 	/*
-	 * If we found the timeout, cancel it and put it on the free list.
-	 * The TRACING stuff is ugly but we don't add a timer when doing
-	 * playback so we don't want to remove them then either.
+	 * Look for this timeout and, if we find it, unlink it and put
+	 * it on the free list.  The ISC timer is left alone; if this
+	 * was the earliest timeout it will go off, find nothing due
+	 * and re-arm itself for the next one.
 	 */
-	if (q) {
-#if defined (TRACING)
-		if (!trace_playback()) {
-#endif
-			isc_timer_detach(&q->isc_timeout);
-#if defined (TRACING)
-		}
-#endif
-
-		if (q->unref)
-			(*q->unref) (&q->what, MDL);
-		q->next = free_timeouts;
-		free_timeouts = q;
+	q = timeout_lookup(where, what);
+	if (q && q->func == where) {
+		timeout_unlink(q);
+		timeout_free(q);
 	}
 }
 
@@ -418,14 +536,25 @@ void cancel_timeout (where, what)
 void cancel_all_timeouts ()
 {
 	struct timeout *t, *n;
-	for (t = timeouts; t; t = n) {
-		n = t->next;
-		isc_timer_detach(&t->isc_timeout);
-		if (t->unref && t->what)
-			(*t->unref) (&t->what, MDL);
-		t->next = free_timeouts;
-		free_timeouts = t;
+	unsigned i;
+
+	for (i = 0; i < timeout_hash_size; i++) {
+		for (t = timeout_hash[i]; t; t = n) {
+			n = t->next;
+			if (t->heap_index != 0)
+				isc_heap_delete(timeout_heap, t->heap_index);
+			if (t->unref && t->what)
+				(*t->unref) (&t->what, MDL);
+			t->next = free_timeouts;
+			free_timeouts = t;
+		}
+		timeout_hash[i] = NULL;
 	}
+	timeout_count = 0;
+
+	if (dhcp_timer != NULL)
+		isc_timer_detach(&dhcp_timer);
+	timer_armed = 0;
 }
 
 void relinquish_timeouts ()
@@ -435,5 +564,14 @@ void relinquish_timeouts ()
 		n = t->next;
 		dfree(t, MDL);
 	}
+	free_timeouts = NULL;
+
+	if (timeout_hash != NULL) {
+		dfree(timeout_hash, MDL);
+		timeout_hash = NULL;
+		timeout_hash_size = 0;
+	}
+	if (timeout_heap != NULL)
+		isc_heap_destroy(&timeout_heap);
 }
 #endif
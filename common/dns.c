@@ -546,13 +546,220 @@ trace_ddns_init()
 	ddns_map = NULL;
 }
 
-#define ddns_update trace_ddns_output_write
-#else
-#define ddns_update dns_client_startupdate
 #endif /* TRACING */
 
+/*
+ * Updates are sent through ddns_update, which the unit tests point at a
+ * stand-in for the name server.
+ */
+ddns_update_t ddns_update =
+#if defined (TRACING)
+	trace_ddns_output_write;
+#else
+	dns_client_startupdate;
+#endif
+
 #define zone_resolve dns_client_startresolve
 
+/*
+ * Updates to a zone whose servers we know are limited to
+ * ddns_server_max_inflight transactions at a time to any one server,
+ * counting the first server an update goes to, and to
+ * ddns_zone_max_inflight at a time to any one zone.  Any more wait on
+ * ddns_pending and are sent, oldest first, as earlier ones complete.
+ * Zero means no limit.
+ *
+ * This only limits the rate updates go out at; waiting updates are not
+ * merged or packed into fewer messages.  An update that is cancelled
+ * while it waits, because a later one for the same lease has replaced
+ * it, is dropped without being sent.  A waiting update is not replaced
+ * by a later one for the same name from another lease: each carries its
+ * own lease's DHCID and conflict detection prerequisites, and removing
+ * one lease's records and adding another's must both happen, so dropping
+ * either would leave the wrong records in the zone.
+ */
+int ddns_zone_max_inflight = DEFAULT_DDNS_ZONE_CONCURRENCY;
+int ddns_server_max_inflight = DEFAULT_DDNS_SERVER_CONCURRENCY;
+int ddns_queued = 0;
+u_int32_t ddns_dropped = 0;
+
+/* A name server we send updates to, and how many it has in flight.
+   There are only ever a few of these, so they are kept for good. */
+struct ddns_server {
+	struct ddns_server *next;
+	isc_sockaddr_t addr;
+	int inflight;
+};
+
+static struct ddns_server *ddns_servers = NULL;
+static dhcp_ddns_cb_t *ddns_pending = NULL;
+static dhcp_ddns_cb_t *ddns_pending_tail = NULL;
+
+/* The server ddns_cb's update goes to first, if we know it. */
+static struct ddns_server *
+ddns_server_find(dhcp_ddns_cb_t *ddns_cb)
+{
+	isc_sockaddr_t *addr;
+	struct ddns_server *server;
+
+	addr = ISC_LIST_HEAD(ddns_cb->zone_server_list);
+	if (addr == NULL)
+		return (NULL);
+
+	for (server = ddns_servers; server != NULL; server = server->next) {
+		if (isc_sockaddr_equal(&server->addr, addr))
+			return (server);
+	}
+
+	server = dmalloc(sizeof(*server), MDL);
+	if (server == NULL)
+		return (NULL);
+	server->addr = *addr;
+	ISC_LINK_INIT(&server->addr, link);
+	server->next = ddns_servers;
+	ddns_servers = server;
+	return (server);
+}
+
+/* Whether ddns_cb can be sent now without going over either limit. */
+static int
+ddns_has_room(dhcp_ddns_cb_t *ddns_cb)
+{
+	struct ddns_server *server;
+
+	if ((ddns_cb->zone != NULL) && (ddns_zone_max_inflight != 0) &&
+	    (ddns_cb->zone->inflight >= ddns_zone_max_inflight))
+		return (0);
+
+	server = ddns_server_find(ddns_cb);
+	if ((server != NULL) && (ddns_server_max_inflight != 0) &&
+	    (server->inflight >= ddns_server_max_inflight))
+		return (0);
+
+	return (1);
+}
+
+/* Take ddns_cb off the queue of waiting updates. */
+static void
+ddns_unqueue(dhcp_ddns_cb_t *ddns_cb)
+{
+	dhcp_ddns_cb_t **cbp, *prev = NULL;
+
+	for (cbp = &ddns_pending; *cbp != NULL; cbp = &(*cbp)->pending_next) {
+		if (*cbp == ddns_cb) {
+			*cbp = ddns_cb->pending_next;
+			if (ddns_pending_tail == ddns_cb)
+				ddns_pending_tail = prev;
+			break;
+		}
+		prev = *cbp;
+	}
+	ddns_cb->pending_next = NULL;
+	ddns_cb->flags &= ~DDNS_QUEUED;
+	ddns_queued--;
+}
+
+/*
+ * If ddns_cb's zone or server already has as many updates in flight as
+ * it may, queue ddns_cb to be sent when there is room and return 1.
+ */
+static int
+ddns_wait(dhcp_ddns_cb_t *ddns_cb)
+{
+	if (ddns_has_room(ddns_cb))
+		return (0);
+
+	ddns_cb->pending_next = NULL;
+	if (ddns_pending_tail != NULL)
+		ddns_pending_tail->pending_next = ddns_cb;
+	else
+		ddns_pending = ddns_cb;
+	ddns_pending_tail = ddns_cb;
+	ddns_cb->flags |= DDNS_QUEUED;
+	ddns_queued++;
+
+#if defined (DEBUG_DNS_UPDATES)
+	log_info("DDNS: queueing cb=%p for zone %s", ddns_cb,
+		 ddns_cb->zone_name);
+#endif
+	return (1);
+}
+
+/* Count ddns_cb's transaction against its zone and server. */
+static void
+ddns_sent(dhcp_ddns_cb_t *ddns_cb)
+{
+	if (ddns_cb->zone == NULL)
+		return;
+
+	dns_zone_reference(&ddns_cb->inflight_zone, ddns_cb->zone, MDL);
+	ddns_cb->inflight_zone->inflight++;
+
+	ddns_cb->inflight_server = ddns_server_find(ddns_cb);
+	if (ddns_cb->inflight_server != NULL)
+		ddns_cb->inflight_server->inflight++;
+}
+
+/* ddns_cb's transaction is over, so give up its place. */
+static void
+ddns_release(dhcp_ddns_cb_t *ddns_cb)
+{
+	if (ddns_cb->inflight_zone != NULL) {
+		ddns_cb->inflight_zone->inflight--;
+		forget_zone(&ddns_cb->inflight_zone);
+	}
+	if (ddns_cb->inflight_server != NULL) {
+		ddns_cb->inflight_server->inflight--;
+		ddns_cb->inflight_server = NULL;
+	}
+}
+
+/*
+ * Send the waiting updates there is now room for, oldest first.  Sending
+ * one may fail, and its cur_func may then start or cancel others, so
+ * the queue is looked at afresh each time.
+ */
+static void
+ddns_pump(void)
+{
+	dhcp_ddns_cb_t *ddns_cb;
+	isc_result_t result;
+
+	for (;;) {
+		for (ddns_cb = ddns_pending; ddns_cb != NULL;
+		     ddns_cb = ddns_cb->pending_next) {
+			if (((ddns_cb->flags & DDNS_ABORT) != 0) ||
+			    ddns_has_room(ddns_cb))
+				break;
+		}
+		if (ddns_cb == NULL)
+			return;
+		ddns_unqueue(ddns_cb);
+
+		/* Cancelled while it waited, so nothing wants it now. */
+		if ((ddns_cb->flags & DDNS_ABORT) != 0) {
+			ddns_dropped++;
+			if (ddns_cb->next_op != NULL)
+				ddns_cb_free(ddns_cb->next_op, MDL);
+			ddns_cb_free(ddns_cb, MDL);
+			continue;
+		}
+
+		if ((ddns_cb->state == DDNS_STATE_ADD_PTR) ||
+		    (ddns_cb->state == DDNS_STATE_REM_PTR)) {
+			result = ddns_modify_ptr(ddns_cb, MDL);
+		} else {
+			result = ddns_modify_fwd(ddns_cb, MDL);
+		}
+
+		if (result != ISC_R_SUCCESS) {
+			log_info("DDNS: Failed to send queued update: %s",
+				 isc_result_totext(result));
+			ddns_cb->cur_func(ddns_cb, result);
+		}
+	}
+}
+
 /*
  * Code to allocate and free a dddns control block.  This block is used
  * to pass and track the information associated with a DDNS update request.
@@ -589,10 +796,19 @@ ddns_cb_free(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 	data_string_forget(&ddns_cb->rev_name, file, line);
 	data_string_forget(&ddns_cb->dhcid, file, line);
 
+	/* Should have been sent or dropped by now, check just in case. */
+	if ((ddns_cb->flags & DDNS_QUEUED) != 0) {
+		log_error("Impossible condition at %s:%d (attempt to free "
+			  "DDNS Control Block while queued).", MDL);
+		ddns_unqueue(ddns_cb);
+	}
+
 	if (ddns_cb->zone != NULL) {
 		forget_zone((struct dns_zone **)&ddns_cb->zone);
 	}
 
+	ddns_release(ddns_cb);
+
 	/* Should be freed by now, check just in case. */
 	if (ddns_cb->transaction != NULL) {
 		log_error("Impossible memory leak at %s:%d (attempt to free "
@@ -2414,7 +2630,6 @@ void ddns_interlude(isc_task_t  *taskp,
 	dhcp_ddns_cb_t *ddns_cb = (dhcp_ddns_cb_t *)eventp->ev_arg;
 	dns_clientupdateevent_t *ddns_event = (dns_clientupdateevent_t *)eventp;
 	isc_result_t eresult = ddns_event->result;
-	isc_result_t result;
 
 	/* We've extracted the information we want from it, get rid of
 	 * the event block.*/
@@ -2431,7 +2646,28 @@ void ddns_interlude(isc_task_t  *taskp,
 #endif
 
 	/* This transaction is complete, clear the value */
-	dns_client_destroyupdatetrans(&ddns_cb->transaction);
+	if (ddns_cb->transaction != NULL) {
+		dns_client_destroyupdatetrans(&ddns_cb->transaction);
+	}
+
+	ddns_complete(ddns_cb, eresult);
+}
+
+/*
+ * Handle the result of an update once its transaction is gone.  This
+ * is split from ddns_interlude() so the result can be delivered without
+ * an isc event, as the replay code and the unit tests do.
+ */
+void
+ddns_complete(dhcp_ddns_cb_t *ddns_cb, isc_result_t eresult)
+{
+	isc_result_t result;
+
+	/* Make room for another update to its zone and server, and
+	 * send whatever has been waiting longest for that room before
+	 * this block's next step can claim it. */
+	ddns_release(ddns_cb);
+	ddns_pump();
 
 	/* If we cancelled or tried to cancel the operation we just
 	 * need to clean up. */
@@ -2491,13 +2727,10 @@ void ddns_interlude(isc_task_t  *taskp,
 			log_info("DDNS: Failed to retry after zone failure");
 			ddns_cb->cur_func(ddns_cb, result);
 		}
-		return;
 	} else {
 		/* pass it along to be processed */
 		ddns_cb->cur_func(ddns_cb, eresult);
 	}
-
-	return;
 }
 
 /*
@@ -2576,6 +2809,10 @@ ddns_modify_fwd(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 			goto cleanup;
 	}
 
+	/* Wait for a slot if the zone's servers are busy. */
+	if (ddns_wait(ddns_cb))
+		return (ISC_R_SUCCESS);
+
 	/*
 	 * If we have a zone try to get any information we need
 	 * from it - name, addresses and the key.  The address
@@ -2733,7 +2970,9 @@ ddns_modify_fwd(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 			     ddns_interlude,
 			     (void *)ddns_cb,
 			     &ddns_cb->transaction);
-	if (result == ISC_R_FAMILYNOSUPPORT) {
+	if (result == ISC_R_SUCCESS) {
+		ddns_sent(ddns_cb);
+	} else if (result == ISC_R_FAMILYNOSUPPORT) {
 		log_info("Unable to perform DDNS update, "
 			 "address family not supported");
 	}
@@ -2787,31 +3026,39 @@ ddns_modify_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 	 * case it's okay if we don't have one, the DNS code will try to
 	 * find something also if we succeed we will need to dereference
 	 * the zone later.  Unlike with the forward case we assume we won't
-	 * have a pre-existing zone.
+	 * have a pre-existing zone, unless the update has been waiting
+	 * for a slot in it.
 	 */
-	result = find_cached_zone(ddns_cb, FIND_REVERSE);
+	if (ddns_cb->zone == NULL) {
+		result = find_cached_zone(ddns_cb, FIND_REVERSE);
 
 #if defined (DNS_ZONE_LOOKUP)
-	if (result == ISC_R_NOTFOUND) {
-		/*
-		 * We didn't find a cached zone, see if we can
-		 * can find a nameserver and create a zone.
-		 */
-		if (find_zone_start(ddns_cb, FIND_REVERSE) == ISC_R_SUCCESS) {
+		if (result == ISC_R_NOTFOUND) {
 			/*
-			 * We have started the process to find a zone
-			 * queue the ddns_cb for processing after we
-			 * create the zone
-			 */
-			/* sar - not yet implemented, currently we just
-			 * arrange for things to get cleaned up
+			 * We didn't find a cached zone, see if we can
+			 * can find a nameserver and create a zone.
 			 */
-			goto cleanup;
+			if (find_zone_start(ddns_cb, FIND_REVERSE) ==
+			    ISC_R_SUCCESS) {
+				/*
+				 * We have started the process to find a zone
+				 * queue the ddns_cb for processing after we
+				 * create the zone
+				 */
+				/* sar - not yet implemented, currently we
+				 * just arrange for things to get cleaned up
+				 */
+				goto cleanup;
+			}
 		}
-	}
 #endif
-	if (result != ISC_R_SUCCESS)
-		goto cleanup;
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+	}
+
+	/* Wait for a slot if the zone's servers are busy. */
+	if (ddns_wait(ddns_cb))
+		return (ISC_R_SUCCESS);
 
 
 	if ((result == ISC_R_SUCCESS) &&
@@ -2927,7 +3174,9 @@ ddns_modify_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 			     dhcp_gbl_ctx.task,
 			     ddns_interlude, (void *)ddns_cb,
 			     &ddns_cb->transaction);
-	if (result == ISC_R_FAMILYNOSUPPORT) {
+	if (result == ISC_R_SUCCESS) {
+		ddns_sent(ddns_cb);
+	} else if (result == ISC_R_FAMILYNOSUPPORT) {
 		log_info("Unable to perform DDNS update, "
 			 "address family not supported");
 	}
@@ -31,6 +31,10 @@
 #include <omapip/omapip_p.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#if defined (ENABLE_EXECUTE)
+#include <signal.h>
+#include <spawn.h>
+#endif
 
 int execute_statements (result, packet, lease, client_state,
 			in_options, out_options, scope, statements,
@@ -248,6 +252,11 @@ int execute_statements (result, packet, lease, client_state,
                         }
                         argv[i] = NULL;
 
+                        /* Hand it off if we aren't to wait for it. */
+                        if ((execute_max_running > 0) &&
+                            execute_async(argv, argc))
+                                break;
+
 	                if ((p = fork()) > 0) {
 		        	int status;
 		        	waitpid(p, &status, 0);
@@ -392,6 +401,15 @@ int execute_statements (result, packet, lease, client_state,
 						   in_options, out_options,
 						   scope, r->data.set.expr,
 						   MDL));
+					/* The scope is usually a lease's, which
+					   outlives the packet's arena. */
+					if (status &&
+					    (binding->value != NULL) &&
+					    (binding->value->type ==
+					     binding_data))
+						data_string_to_heap
+						    (&binding->value->value.data,
+						     MDL);
 				} else {
 				    if (!(binding_value_allocate
 					  (&binding->value, MDL))) {
@@ -1195,3 +1213,260 @@ int executable_statement_foreach (struct executable_statement *stmt,
 	}
 	return ok;
 }
+
+#if defined (ENABLE_EXECUTE)
+/*
+ * Asynchronous execute().
+ *
+ * When execute_max_running is non-zero, execute() statements don't wait
+ * for the command: it is started with posix_spawnp() and the dispatcher
+ * carries on.  At most execute_max_running commands run at once; the
+ * rest wait in a queue of up to execute_max_queued entries, and commands
+ * beyond that are dropped.  A command that runs for longer than
+ * execute_timeout seconds is killed.  SIGCHLD writes a byte to a pipe
+ * the dispatcher watches, and its exit status is logged when it is
+ * reaped there.
+ */
+
+int execute_max_running = 0;
+int execute_max_queued = DEFAULT_EXECUTE_QUEUE;
+int execute_timeout = 0;
+int execute_running = 0;
+int execute_queued = 0;
+u_int32_t execute_dropped = 0;
+
+struct execute_job {
+	struct execute_job *next;
+	char **argv;
+	int argc;
+	pid_t pid;
+};
+
+struct execute_state {
+	OMAPI_OBJECT_PREAMBLE;
+};
+
+static omapi_object_type_t *dhcp_type_execute;
+static struct execute_state *execute_state;
+OMAPI_OBJECT_ALLOC (execute_state, struct execute_state, dhcp_type_execute)
+
+static struct execute_job *execute_jobs;
+static struct execute_job *execute_queue_head, *execute_queue_tail;
+static int execute_pipe [2] = { -1, -1 };
+
+static void
+execute_job_free(struct execute_job *job)
+{
+	int i;
+
+	for (i = 0; i <= job->argc; i++) {
+		if (job->argv[i])
+			dfree(job->argv[i], MDL);
+	}
+	dfree(job->argv, MDL);
+	dfree(job, MDL);
+}
+
+static void
+execute_sigchld(int sig)
+{
+	int save_errno = errno;
+
+	IGNORE_RET(write(execute_pipe[1], "", 1));
+	errno = save_errno;
+}
+
+static void
+execute_timed_out(void *vjob)
+{
+	struct execute_job *job = vjob;
+
+	log_error("execute: %s ran for more than %d seconds, killing it",
+		  job->argv[0], execute_timeout);
+	kill(job->pid, SIGKILL);
+}
+
+static void
+execute_start(struct execute_job *job)
+{
+	extern char **environ;
+	posix_spawnattr_t attr;
+	sigset_t none, all;
+	struct timeval tv;
+	int rv;
+
+	/* Give the command the default signal setup. */
+	sigemptyset(&none);
+	sigfillset(&all);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setsigdefault(&attr, &all);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+					POSIX_SPAWN_SETSIGDEF);
+	rv = posix_spawnp(&job->pid, job->argv[0], NULL, &attr,
+			  job->argv, environ);
+	posix_spawnattr_destroy(&attr);
+
+	if (rv != 0) {
+		log_error("Unable to execute %s: %s", job->argv[0],
+			  strerror(rv));
+		execute_job_free(job);
+		return;
+	}
+
+	job->next = execute_jobs;
+	execute_jobs = job;
+	execute_running++;
+
+	if (execute_timeout > 0) {
+		tv.tv_sec = cur_tv.tv_sec + execute_timeout;
+		tv.tv_usec = cur_tv.tv_usec;
+		add_timeout(&tv, execute_timed_out, job, NULL, NULL);
+	}
+}
+
+/* The dispatcher's handle on the SIGCHLD pipe; the unit tests use these
+   two to wait for and reap commands without running the dispatcher. */
+int
+execute_readsocket(omapi_object_t *h)
+{
+	return execute_pipe[0];
+}
+
+/* Reap whichever commands have finished and start queued ones. */
+isc_result_t
+execute_reap(omapi_object_t *h)
+{
+	struct execute_job **jp, *job;
+	char buf [64];
+	int status;
+
+	while (read(execute_pipe[0], buf, sizeof buf) > 0)
+		;
+
+	for (jp = &execute_jobs; (job = *jp) != NULL; ) {
+		if (waitpid(job->pid, &status, WNOHANG) <= 0) {
+			jp = &job->next;
+			continue;
+		}
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+			log_error("execute: %s exit status %d",
+				  job->argv[0], WEXITSTATUS(status));
+		else if (WIFSIGNALED(status))
+			log_error("execute: %s killed by signal %d",
+				  job->argv[0], WTERMSIG(status));
+
+		*jp = job->next;
+		execute_running--;
+		cancel_timeout(execute_timed_out, job);
+		execute_job_free(job);
+	}
+
+	while (execute_queue_head != NULL &&
+	       execute_running < execute_max_running) {
+		job = execute_queue_head;
+		execute_queue_head = job->next;
+		if (execute_queue_head == NULL)
+			execute_queue_tail = NULL;
+		execute_queued--;
+		execute_start(job);
+	}
+	return ISC_R_SUCCESS;
+}
+
+static int
+execute_setup(void)
+{
+	struct sigaction sa;
+	isc_result_t result;
+
+	if (pipe(execute_pipe) < 0) {
+		log_error("execute: can't create pipe: %m");
+		return 0;
+	}
+#if defined (HAVE_SETFD)
+	if (fcntl(execute_pipe[0], F_SETFD, 1) < 0 ||
+	    fcntl(execute_pipe[1], F_SETFD, 1) < 0)
+		log_error("Can't set close-on-exec on execute pipe: %m");
+#endif
+	(void) fcntl(execute_pipe[0], F_SETFL, O_NONBLOCK);
+	(void) fcntl(execute_pipe[1], F_SETFL, O_NONBLOCK);
+
+	result = omapi_object_type_register(&dhcp_type_execute, "execute",
+					    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+					    sizeof(struct execute_state),
+					    0, RC_MISC);
+	if (result != ISC_R_SUCCESS)
+		log_fatal("Can't register execute object type: %s",
+			  isc_result_totext(result));
+	execute_state_allocate(&execute_state, MDL);
+	result = omapi_register_io_object((omapi_object_t *)execute_state,
+					  execute_readsocket, 0,
+					  execute_reap, 0, 0);
+	if (result != ISC_R_SUCCESS)
+		log_fatal("Can't register execute handle: %s",
+			  isc_result_totext(result));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = execute_sigchld;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	if (sigaction(SIGCHLD, &sa, NULL) < 0) {
+		log_error("execute: can't catch SIGCHLD: %m");
+		return 0;
+	}
+	return 1;
+}
+
+/* Run argv[0] without waiting for it.  Unless we return 0, having been
+   unable to set up, the argument vector (argc + 1 strings and a NULL)
+   is ours from here on. */
+int
+execute_async(char **argv, int argc)
+{
+	struct execute_job *job;
+	int i;
+
+	if (execute_pipe[0] < 0 && !execute_setup()) {
+		log_error("execute: falling back to waiting for commands");
+		execute_max_running = 0;
+		return 0;
+	}
+
+	job = dmalloc(sizeof(*job), MDL);
+	if (job == NULL) {
+		log_error("execute: no memory to run %s", argv[0]);
+		for (i = 0; i <= argc; i++) {
+			if (argv[i])
+				dfree(argv[i], MDL);
+		}
+		dfree(argv, MDL);
+		return 1;
+	}
+	job->next = NULL;
+	job->argv = argv;
+	job->argc = argc;
+
+	if (execute_running < execute_max_running) {
+		execute_start(job);
+		return 1;
+	}
+
+	if (execute_queued >= execute_max_queued) {
+		log_error("execute: %d commands queued, not running %s",
+			  execute_queued, argv[0]);
+		execute_dropped++;
+		execute_job_free(job);
+		return 1;
+	}
+
+	if (execute_queue_tail != NULL)
+		execute_queue_tail->next = job;
+	else
+		execute_queue_head = job;
+	execute_queue_tail = job;
+	execute_queued++;
+	return 1;
+}
+#endif /* ENABLE_EXECUTE */
@@ -190,6 +190,10 @@ static void lpf_tr_filter_setup (struct interface_info *);
 
 static void lpf_gen_filter_setup (struct interface_info *);
 
+#if defined (USE_LPF_RX_RING)
+static void lpf_rx_ring_setup (struct interface_info *);
+#endif
+
 void if_register_receive (info)
 	struct interface_info *info;
 {
@@ -217,6 +221,10 @@ void if_register_receive (info)
 #endif
 		lpf_gen_filter_setup (info);
 
+#if defined (USE_LPF_RX_RING)
+	lpf_rx_ring_setup (info);
+#endif
+
 	if (!quiet_interface_discovery)
 		log_info ("Listening on LPF/%s/%s%s%s",
 			  info -> name,
@@ -231,6 +239,15 @@ void if_register_receive (info)
 void if_deregister_receive (info)
 	struct interface_info *info;
 {
+#if defined (USE_LPF_RX_RING)
+	if (info -> rx_ring) {
+		munmap (info -> rx_ring, info -> rx_ring_len);
+		info -> rx_ring = NULL;
+		info -> rx_ring_len = 0;
+		info -> rx_frames_left = 0;
+		info -> rx_frame = NULL;
+	}
+#endif
 	/* for LPF this is simple, packet filters are removed when sockets
 	   are closed */
 	close (info -> rfdesc);
@@ -291,6 +308,65 @@ static void lpf_gen_filter_setup (info)
 	}
 }
 
+#if defined (USE_LPF_RX_RING)
+/* Switch the socket over to a TPACKET_V3 receive ring so that a single
+   wakeup can hand us every frame the kernel has queued since the last
+   one.   If the kernel won't give us a ring we stay with recvmsg(). */
+static void lpf_rx_ring_setup (info)
+	struct interface_info *info;
+{
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+	void *ring;
+
+	if (setsockopt (info -> rfdesc, SOL_PACKET, PACKET_VERSION,
+			&version, sizeof version) < 0) {
+		log_info ("No TPACKET_V3 receive ring on %s: %m",
+			  info -> name);
+		return;
+	}
+
+	memset (&req, 0, sizeof req);
+	req.tp_block_size = RX_RING_BLOCK_SIZE;
+	req.tp_block_nr = RX_RING_BLOCK_COUNT;
+	req.tp_frame_size = TPACKET_ALIGN (TPACKET3_HDRLEN + 1536);
+	req.tp_frame_nr = ((RX_RING_BLOCK_SIZE / req.tp_frame_size) *
+			   RX_RING_BLOCK_COUNT);
+	req.tp_retire_blk_tov = RX_RING_BLOCK_TIMEOUT;
+
+	if (setsockopt (info -> rfdesc, SOL_PACKET, PACKET_RX_RING,
+			&req, sizeof req) < 0) {
+		log_info ("No TPACKET_V3 receive ring on %s: %m",
+			  info -> name);
+		version = TPACKET_V1;
+		setsockopt (info -> rfdesc, SOL_PACKET, PACKET_VERSION,
+			    &version, sizeof version);
+		return;
+	}
+
+	ring = mmap (NULL, (size_t)RX_RING_BLOCK_SIZE * RX_RING_BLOCK_COUNT,
+		     PROT_READ | PROT_WRITE, MAP_SHARED, info -> rfdesc, 0);
+	if (ring == MAP_FAILED) {
+		/* Once the ring exists the kernel stops queueing frames
+		   for recvmsg(), so take it down again. */
+		log_error ("Can't map receive ring on %s: %m", info -> name);
+		memset (&req, 0, sizeof req);
+		setsockopt (info -> rfdesc, SOL_PACKET, PACKET_RX_RING,
+			    &req, sizeof req);
+		version = TPACKET_V1;
+		setsockopt (info -> rfdesc, SOL_PACKET, PACKET_VERSION,
+			    &version, sizeof version);
+		return;
+	}
+
+	info -> rx_ring = ring;
+	info -> rx_ring_len = (size_t)RX_RING_BLOCK_SIZE * RX_RING_BLOCK_COUNT;
+	info -> rx_block = 0;
+	info -> rx_frames_left = 0;
+	info -> rx_frame = NULL;
+}
+#endif /* USE_LPF_RX_RING */
+
 #if defined (HAVE_TR_SUPPORT)
 static void lpf_tr_filter_setup (info)
 	struct interface_info *info;
@@ -346,6 +422,8 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 	int result;
 	int fudge;
 
+	/* send_fallback() joins an open batch itself, on the fallback
+	   interface's queue. */
 	if (!strcmp (interface -> name, "fallback"))
 		return send_fallback (interface, packet, raw,
 				      len, from, to, hto);
@@ -362,6 +440,11 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 				to -> sin_addr.s_addr, to -> sin_port,
 				(unsigned char *)raw, len);
 	memcpy (buf + ibufp, raw, len);
+#if defined (USE_SENDMMSG)
+	if (send_batching)
+		return send_batch_queue (interface, buf + fudge,
+					 ibufp + len - fudge, NULL, 0);
+#endif
 	result = write(interface->wfdesc, buf + fudge, ibufp + len - fudge);
 	if (result < 0)
 		log_error ("send_packet: %m");
@@ -370,6 +453,54 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 #endif /* USE_LPF_SEND */
 
 #ifdef USE_LPF_RECEIVE
+/* Strip the link, IP and UDP headers off a received frame.   Returns
+   the length of the DHCP payload and points *payload at it, or returns
+   zero if the frame should be dropped. */
+static unsigned lpf_decode_frame (interface, frame, length, csum_ready,
+				  from, hfrom, payload)
+	struct interface_info *interface;
+	unsigned char *frame;
+	int length;
+	int csum_ready;
+	struct sockaddr_in *from;
+	struct hardware *hfrom;
+	unsigned char **payload;
+{
+	int offset = 0;
+	unsigned bufix = 0;
+	unsigned paylen;
+
+	/* Decode the physical header... */
+	offset = decode_hw_header (interface, frame, bufix, hfrom);
+
+	/* If a physical layer checksum failed (dunno of any
+	   physical layer that supports this, but WTH), skip this
+	   packet. */
+	if (offset < 0) {
+		return 0;
+	}
+
+	bufix += offset;
+	length -= offset;
+
+	/* Decode the IP and UDP headers... */
+	offset = decode_udp_ip_header (interface, frame, bufix, from,
+				       (unsigned)length, &paylen, csum_ready);
+
+	/* If the IP or UDP checksum was bad, skip the packet... */
+	if (offset < 0)
+		return 0;
+
+	bufix += offset;
+	length -= offset;
+
+	if (length < paylen)
+		log_fatal("Internal inconsistency at %s:%d.", MDL);
+
+	*payload = &frame[bufix];
+	return paylen;
+}
+
 ssize_t receive_packet (interface, buf, len, from, hfrom)
 	struct interface_info *interface;
 	unsigned char *buf;
@@ -378,10 +509,9 @@ ssize_t receive_packet (interface, buf, len, from, hfrom)
 	struct hardware *hfrom;
 {
 	int length = 0;
-	int offset = 0;
 	int csum_ready = 1;
 	unsigned char ibuf [1536];
-	unsigned bufix = 0;
+	unsigned char *payload;
 	unsigned paylen;
 	struct iovec iov = {
 		.iov_base = ibuf,
@@ -452,38 +582,81 @@ ssize_t receive_packet (interface, buf, len, from, hfrom)
 	}
 #endif /* PACKET_AUXDATA */
 
-	bufix = 0;
-	/* Decode the physical header... */
-	offset = decode_hw_header (interface, ibuf, bufix, hfrom);
-
-	/* If a physical layer checksum failed (dunno of any
-	   physical layer that supports this, but WTH), skip this
-	   packet. */
-	if (offset < 0) {
+	paylen = lpf_decode_frame (interface, ibuf, length, csum_ready,
+				   from, hfrom, &payload);
+	if (paylen == 0)
 		return 0;
-	}
 
-	bufix += offset;
-	length -= offset;
+	/* Copy out the data in the packet... */
+	memcpy(buf, payload, paylen);
+	return paylen;
+}
 
-	/* Decode the IP and UDP headers... */
-	offset = decode_udp_ip_header (interface, ibuf, bufix, from,
-				       (unsigned)length, &paylen, csum_ready);
+#if defined (USE_LPF_RX_RING)
+/* Hand back the next frame waiting in the receive ring.   The payload is
+   not copied out of the ring: it stays valid until the following call,
+   which is when a block that has been read through is given back to the
+   kernel.   Returns 1 if a frame was consumed, with *lenp set to zero if
+   it had to be dropped, or 0 once there is nothing left to read. */
+int receive_packet_batch (interface, bufp, lenp, from, hfrom)
+	struct interface_info *interface;
+	unsigned char **bufp;
+	unsigned *lenp;
+	struct sockaddr_in *from;
+	struct hardware *hfrom;
+{
+	struct tpacket_block_desc *block;
+	struct tpacket3_hdr *frame;
+	int csum_ready;
 
-	/* If the IP or UDP checksum was bad, skip the packet... */
-	if (offset < 0)
-		return 0;
+	for (;;) {
+		block = (struct tpacket_block_desc *)
+			(interface -> rx_ring +
+			 (size_t)interface -> rx_block * RX_RING_BLOCK_SIZE);
 
-	bufix += offset;
-	length -= offset;
+		if (interface -> rx_frames_left != 0)
+			break;
 
-	if (length < paylen)
-		log_fatal("Internal inconsistency at %s:%d.", MDL);
+		/* Everything in the current block has been handled, so
+		   give it back and move on to the next one. */
+		if (interface -> rx_frame != NULL) {
+			__sync_synchronize ();
+			block -> hdr.bh1.block_status = TP_STATUS_KERNEL;
+			interface -> rx_frame = NULL;
+			interface -> rx_block = ((interface -> rx_block + 1) %
+						 RX_RING_BLOCK_COUNT);
+			continue;
+		}
 
-	/* Copy out the data in the packet... */
-	memcpy(buf, &ibuf[bufix], paylen);
-	return paylen;
+		if ((block -> hdr.bh1.block_status & TP_STATUS_USER) == 0)
+			return 0;
+		__sync_synchronize ();
+
+		interface -> rx_frames_left = block -> hdr.bh1.num_pkts;
+		interface -> rx_frame = ((unsigned char *)block +
+					 block -> hdr.bh1.offset_to_first_pkt);
+	}
+
+	frame = (struct tpacket3_hdr *)interface -> rx_frame;
+	interface -> rx_frame += frame -> tp_next_offset;
+	interface -> rx_frames_left--;
+	*lenp = 0;
+
+#ifdef VLAN_TCI_PRESENT
+	/* Discard packets with stripped vlan id, as receive_packet()
+	   does with the auxiliary data. */
+	if (frame -> hv1.tp_vlan_tci & 0x0fff)
+		return 1;
+#endif
+
+	csum_ready = ((frame -> tp_status & TP_STATUS_CSUMNOTREADY) ? 0 : 1);
+	*lenp = lpf_decode_frame (interface,
+				  (unsigned char *)frame + frame -> tp_mac,
+				  (int)frame -> tp_snaplen, csum_ready,
+				  from, hfrom, bufp);
+	return 1;
 }
+#endif /* USE_LPF_RX_RING */
 
 int can_unicast_without_arp (ip)
 	struct interface_info *ip;
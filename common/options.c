@@ -129,7 +129,7 @@ int parse_option_buffer (options, buffer, length, universe)
 	struct option *option = NULL;
 	char *reason = "general failure";
 
-	if (!buffer_allocate (&bp, length, MDL)) {
+	if (!arena_buffer_allocate (&bp, length, MDL)) {
 		log_error ("no memory for option buffer.");
 		return 0;
 	}
@@ -174,8 +174,7 @@ int parse_option_buffer (options, buffer, length, universe)
 
 		offset += universe->length_size;
 
-		option_code_hash_lookup(&option, universe->code_hash, &code,
-					0, MDL);
+		option_code_lookup(&option, universe, code, MDL);
 
 		/* If the length is outrageous, the options are bad. */
 		if (offset + len > length) {
@@ -233,8 +232,8 @@ int parse_option_buffer (options, buffer, length, universe)
 			   what is there ...*/
 			struct data_string new;
 			memset(&new, 0, sizeof new);
-			if (!buffer_allocate(&new.buffer, op->data.len + len,
-					     MDL)) {
+			if (!arena_buffer_allocate(&new.buffer,
+						   op->data.len + len, MDL)) {
 				log_error("parse_option_buffer: No memory.");
 				buffer_dereference(&bp, MDL);
 				option_dereference(&option, MDL);
@@ -527,6 +526,325 @@ int fqdn_universe_decode (struct option_state *options,
 	return 1;
 }
 
+/*
+ * Add the codes of the options in a space that fall in [min_code, max_code)
+ * to cons_options()'s priority list.
+ */
+struct priority_collection {
+	unsigned *list;
+	int *len;
+	int max_len;
+	unsigned min_code, max_code;
+};
+
+static void
+collect_priority(struct option_cache *oc, struct packet *packet,
+		 struct lease *lease, struct client_state *client_state,
+		 struct option_state *in_options,
+		 struct option_state *cfg_options,
+		 struct binding_scope **scope,
+		 struct universe *u, void *stuff)
+{
+	struct priority_collection *pc = stuff;
+	unsigned code = oc->option->code;
+
+	if (code >= pc->min_code && code < pc->max_code &&
+	    *pc->len < pc->max_len && code != DHO_DHCP_AGENT_OPTIONS)
+		pc->list[(*pc->len)++] = code;
+}
+
+/*
+ * The encoded option cache.
+ *
+ * Most replies sent to clients on the same network with the same parameter
+ * request list carry the same options.  Only the few that are made up for
+ * each lease, such as the lease times, are different, and those are
+ * usually the same length.  So the options cons_options() encodes are
+ * remembered, keyed by the space available and, for each option on the
+ * priority list, either the configured option cache it comes from, if that
+ * has a constant value, or else the length of its value.  When the same
+ * key comes up again the encoded options are copied out of the cache and
+ * the values that aren't constant patched in, without evaluating the
+ * constant options or encoding anything.
+ *
+ * Configured option caches are known by their addresses, so freeing one
+ * (which happens when an OMAPI client changes a host, say) makes every
+ * entry stale.
+ */
+
+#define ENCODED_OPTION_SLOTS	256	/* A power of two. */
+#define ENCODED_OPTION_KEY_MAX	64	/* Longer priority lists aren't kept. */
+
+/* Where store_option_list() put the value of an option. */
+struct option_spot {
+	int offset;		/* In the options buffer, or -1 if it isn't
+				   there, or -2 if it isn't in one piece. */
+	unsigned len;		/* Of the value. */
+};
+
+/* What an option on the priority list adds to the key. */
+struct encoded_key {
+	unsigned code;
+	struct option_cache *oc;	/* If its value is constant, */
+	unsigned len;			/* otherwise the value's length */
+	int terminated;			/* and whether a NUL is added. */
+};
+
+/* What find_store_value() found for an option on the priority list. */
+struct store_value {
+	int found;		/* Its result, or -1 if it wasn't called. */
+	struct option *option;
+	struct data_string value;
+};
+
+struct encoded_patch {
+	int index;		/* Into the key. */
+	int offset;		/* In the encoded options. */
+};
+
+struct encoded_options {
+	unsigned long generation;
+	u_int32_t hash;
+	unsigned index, buflen, first_cutoff;
+	int second_cutoff, terminate, site_universe, site_code_min;
+	int key_len;
+	struct encoded_key *key;
+	int patch_count;
+	struct encoded_patch *patches;
+	unsigned length;
+	unsigned char *data;
+};
+
+int encoded_options_disabled;
+unsigned long encoded_options_hits;
+static unsigned long encoded_options_generation;
+static struct encoded_options *encoded_options [ENCODED_OPTION_SLOTS];
+
+#if defined (DEBUG_MEMORY_LEAKAGE) || \
+		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+void relinquish_encoded_options()
+{
+	int i;
+
+	for (i = 0; i < ENCODED_OPTION_SLOTS; i++) {
+		if (encoded_options[i] != NULL) {
+			dfree(encoded_options[i], MDL);
+			encoded_options[i] = NULL;
+		}
+	}
+}
+#endif
+
+static int prune_priority_list(unsigned *, int);
+static int find_store_value(struct data_string *, struct option **,
+			    unsigned, struct packet *, struct lease *,
+			    struct client_state *, struct option_state *,
+			    struct option_state *, struct binding_scope **,
+			    const char *);
+static int store_option_list(int *, unsigned char *, unsigned, unsigned,
+			     struct packet *, struct lease *,
+			     struct client_state *, struct option_state *,
+			     struct option_state *, struct binding_scope **,
+			     unsigned *, int, unsigned, int, int,
+			     const char *, struct store_value *,
+			     struct option_spot *);
+
+/* Work out the key for the options on a pruned priority list, finding
+   the values of those that aren't constant as we go. */
+static u_int32_t
+encoded_options_key(struct encoded_key *key, struct store_value *values,
+		    unsigned *priority_list, int priority_len,
+		    struct packet *packet, struct lease *lease,
+		    struct client_state *client_state,
+		    struct option_state *in_options,
+		    struct option_state *cfg_options,
+		    struct binding_scope **scope, int terminate,
+		    const char *vuname)
+{
+	struct store_value *v;
+	struct option_cache *oc;
+	struct universe *u;
+	u_int32_t hash = 0;
+	unsigned code;
+	int i;
+
+	for (i = 0; i < priority_len; i++) {
+		code = priority_list[i];
+		memset(&key[i], 0, sizeof key[i]);
+		memset(&values[i], 0, sizeof values[i]);
+		key[i].code = code;
+
+		if (code >= cfg_options->site_code_min)
+			u = universes[cfg_options->site_universe];
+		else
+			u = &dhcp_universe;
+		oc = lookup_option(u, cfg_options, code);
+
+		if (oc != NULL && (oc->flags & OPTION_CONSTANT) &&
+		    oc->option != NULL && oc->option->format[0] != 'e') {
+			key[i].oc = oc;
+			values[i].found = -1;
+		} else {
+			v = &values[i];
+			v->found = find_store_value(&v->value, &v->option,
+						    code, packet, lease,
+						    client_state, in_options,
+						    cfg_options, scope, vuname);
+			if (v->found) {
+				key[i].len = v->value.len;
+				key[i].terminated =
+					terminate && v->option != NULL &&
+					format_has_text(v->option->format);
+			}
+		}
+
+		hash = hash * 33 + code;
+		hash = hash * 33 + (u_int32_t)(unsigned long)key[i].oc;
+		hash = hash * 33 + key[i].len * 2 + key[i].terminated;
+	}
+	return hash;
+}
+
+/* Remember the options store_option_list() just encoded, unless some of
+   them can't be patched. */
+static void
+remember_encoded_options(struct encoded_options *like,
+			 struct encoded_key *key, struct option_spot *spots,
+			 unsigned char *data, unsigned length)
+{
+	struct encoded_options *eo, **slot;
+	int i, patch_count = 0;
+
+	for (i = 0; i < like->key_len; i++) {
+		if (key[i].oc != NULL)
+			continue;
+		if (spots[i].len != key[i].len || spots[i].offset == -2)
+			return;
+		if (spots[i].offset >= 0 && key[i].len > 0)
+			patch_count++;
+	}
+
+	eo = dmalloc(sizeof *eo + like->key_len * sizeof *key +
+		     patch_count * sizeof *eo->patches + length, MDL);
+	if (eo == NULL)
+		return;
+	*eo = *like;
+	eo->key = (struct encoded_key *)(eo + 1);
+	memcpy(eo->key, key, like->key_len * sizeof *key);
+	eo->patches = (struct encoded_patch *)(eo->key + like->key_len);
+	eo->patch_count = 0;
+	for (i = 0; i < like->key_len; i++) {
+		if (key[i].oc == NULL && spots[i].offset >= 0 &&
+		    key[i].len > 0) {
+			eo->patches[eo->patch_count].index = i;
+			eo->patches[eo->patch_count].offset = spots[i].offset;
+			eo->patch_count++;
+		}
+	}
+	eo->data = (unsigned char *)(eo->patches + patch_count);
+	eo->length = length;
+	memcpy(eo->data, data, length);
+
+	slot = &encoded_options[like->hash & (ENCODED_OPTION_SLOTS - 1)];
+	if (*slot != NULL)
+		dfree(*slot, MDL);
+	*slot = eo;
+}
+
+/*
+ * store_options(), going through the encoded option cache.
+ */
+static int
+encode_options(int *ocount,
+	       unsigned char *buffer, unsigned index, unsigned buflen,
+	       struct packet *packet, struct lease *lease,
+	       struct client_state *client_state,
+	       struct option_state *in_options,
+	       struct option_state *cfg_options,
+	       struct binding_scope **scope,
+	       unsigned *priority_list, int priority_len,
+	       unsigned first_cutoff, int second_cutoff, int terminate,
+	       const char *vuname)
+{
+	struct encoded_key key[ENCODED_OPTION_KEY_MAX];
+	struct store_value values[ENCODED_OPTION_KEY_MAX];
+	struct option_spot spots[ENCODED_OPTION_KEY_MAX];
+	struct encoded_options like, *eo;
+	int i, j, length;
+
+	if (encoded_options_disabled || priority_len > ENCODED_OPTION_KEY_MAX)
+		return store_options(ocount, buffer, index, buflen, packet,
+				     lease, client_state, in_options,
+				     cfg_options, scope, priority_list,
+				     priority_len, first_cutoff, second_cutoff,
+				     terminate, vuname);
+
+	priority_len = prune_priority_list(priority_list, priority_len);
+
+	memset(&like, 0, sizeof like);
+	like.generation = encoded_options_generation;
+	like.index = index;
+	like.buflen = buflen;
+	like.first_cutoff = first_cutoff;
+	like.second_cutoff = second_cutoff;
+	like.terminate = terminate;
+	like.site_universe = cfg_options->site_universe;
+	like.site_code_min = cfg_options->site_code_min;
+	like.key_len = priority_len;
+	like.hash = encoded_options_key(key, values, priority_list,
+					priority_len, packet, lease,
+					client_state, in_options, cfg_options,
+					scope, terminate, vuname);
+	like.hash = like.hash * 33 + buflen + first_cutoff + second_cutoff;
+
+	eo = encoded_options[like.hash & (ENCODED_OPTION_SLOTS - 1)];
+	if (eo != NULL &&
+	    (eo->generation != like.generation || eo->hash != like.hash ||
+	     eo->index != like.index || eo->buflen != like.buflen ||
+	     eo->first_cutoff != like.first_cutoff ||
+	     eo->second_cutoff != like.second_cutoff ||
+	     eo->terminate != like.terminate ||
+	     eo->site_universe != like.site_universe ||
+	     eo->site_code_min != like.site_code_min ||
+	     eo->key_len != like.key_len))
+		eo = NULL;
+	for (i = 0; eo != NULL && i < priority_len; i++) {
+		if (eo->key[i].code != key[i].code ||
+		    eo->key[i].oc != key[i].oc ||
+		    eo->key[i].len != key[i].len ||
+		    eo->key[i].terminated != key[i].terminated)
+			eo = NULL;
+	}
+
+	if (eo != NULL) {
+		memcpy(&buffer[index], eo->data, eo->length);
+		for (i = 0; i < eo->patch_count; i++) {
+			j = eo->patches[i].index;
+			memcpy(&buffer[index + eo->patches[i].offset],
+			       values[j].value.data, values[j].value.len);
+		}
+		length = eo->length;
+		encoded_options_hits++;
+	} else {
+		length = store_option_list(ocount, buffer, index, buflen,
+					   packet, lease, client_state,
+					   in_options, cfg_options, scope,
+					   priority_list, priority_len,
+					   first_cutoff, second_cutoff,
+					   terminate, vuname, values, spots);
+		if (length > 0 && (ocount == NULL || *ocount == 0))
+			remember_encoded_options(&like, key, spots,
+						 &buffer[index], length);
+	}
+
+	for (i = 0; i < priority_len; i++) {
+		data_string_forget(&values[i].value, MDL);
+		if (values[i].option != NULL)
+			option_dereference(&values[i].option, MDL);
+	}
+	return length;
+}
+
 /*
  * Load all options into a buffer, and then split them out into the three
  * separate fields in the dhcp packet (options, file, and sname) where
@@ -554,7 +872,7 @@ cons_options(struct packet *inpacket, struct dhcp_packet *outpacket,
 	int i;
 	struct option_cache *op;
 	struct data_string ds;
-	pair pp, *hash;
+	struct priority_collection pc;
 	int overload_used = 0;
 	int of1 = 0, of2 = 0;
 
@@ -748,21 +1066,16 @@ cons_options(struct packet *inpacket, struct dhcp_packet *outpacket,
 		 * it's slightly more general to do it this way,
 		 * taking the 1Q99 DHCP futures work into account.
 		 */
+		memset(&pc, 0, sizeof(pc));
+		pc.list = priority_list;
+		pc.len = &priority_len;
+		pc.max_len = PRIORITY_COUNT;
 		if (cfg_options->site_code_min) {
-		    for (i = 0; i < OPTION_HASH_SIZE; i++) {
-			hash = cfg_options->universes[dhcp_universe.index];
-			if (hash) {
-			    for (pp = hash[i]; pp; pp = pp->cdr) {
-				op = (struct option_cache *)(pp->car);
-				if (op->option->code <
-				     cfg_options->site_code_min &&
-				    priority_len < PRIORITY_COUNT &&
-				    op->option->code != DHO_DHCP_AGENT_OPTIONS)
-					priority_list[priority_len++] =
-						op->option->code;
-			    }
-			}
-		    }
+			pc.max_code = cfg_options->site_code_min;
+			option_space_foreach(inpacket, lease, client_state,
+					     in_options, cfg_options, scope,
+					     &dhcp_universe, &pc,
+					     collect_priority);
 		}
 
 		/*
@@ -770,19 +1083,12 @@ cons_options(struct packet *inpacket, struct dhcp_packet *outpacket,
 		 * is no site option space, we'll be cycling through the
 		 * dhcp option space.
 		 */
-		for (i = 0; i < OPTION_HASH_SIZE; i++) {
-		    hash = cfg_options->universes[cfg_options->site_universe];
-		    if (hash != NULL)
-			for (pp = hash[i]; pp; pp = pp->cdr) {
-				op = (struct option_cache *)(pp->car);
-				if (op->option->code >=
-				     cfg_options->site_code_min &&
-				    priority_len < PRIORITY_COUNT &&
-				    op->option->code != DHO_DHCP_AGENT_OPTIONS)
-					priority_list[priority_len++] =
-						op->option->code;
-			}
-		}
+		pc.min_code = cfg_options->site_code_min;
+		pc.max_code = UINT_MAX;
+		option_space_foreach(inpacket, lease, client_state,
+				     in_options, cfg_options, scope,
+				     universes[cfg_options->site_universe],
+				     &pc, collect_priority);
 
 		/*
 		 * Put any spaces that are encapsulated on the list,
@@ -813,11 +1119,11 @@ cons_options(struct packet *inpacket, struct dhcp_packet *outpacket,
 	index += 4;
 
 	/* Copy the options into the big buffer... */
-	option_size = store_options(&overload_used, buffer, index, mb_max,
-				    inpacket, lease, client_state,
-				    in_options, cfg_options, scope,
-				    priority_list, priority_len,
-				    of1, of2, terminate, vuname);
+	option_size = encode_options(&overload_used, buffer, index, mb_max,
+				     inpacket, lease, client_state,
+				     in_options, cfg_options, scope,
+				     priority_list, priority_len,
+				     of1, of2, terminate, vuname);
 
 	/* If store_options() failed */
 	if (option_size == 0)
@@ -1170,9 +1476,9 @@ store_options6(char *buf, int buflen,
 			struct option *encap_opt = NULL;
 			unsigned int code_int = code;
 
-			option_code_hash_lookup(&encap_opt,
-						dhcpv6_universe.code_hash,
-						&code_int, 0, MDL);
+			option_code_lookup(&encap_opt,
+					   &dhcpv6_universe,
+					   code_int, MDL);
 			if (encap_opt != NULL) {
 				store_encap6(buf, buflen, &bufpos, opt_state,
 					     packet, encap_opt, code);
@@ -1225,67 +1531,14 @@ store_options6(char *buf, int buflen,
 }
 
 /*
- * Store all the requested options into the requested buffer.
- * XXX: ought to be static
+ * Eliminate duplicate options from a priority list and enforce RFC-mandated
+ * ordering of options that are present.  Returns the new length.
  */
-int
-store_options(int *ocount,
-	      unsigned char *buffer, unsigned index, unsigned buflen,
-	      struct packet *packet, struct lease *lease,
-	      struct client_state *client_state,
-	      struct option_state *in_options,
-	      struct option_state *cfg_options,
-	      struct binding_scope **scope,
-	      unsigned *priority_list, int priority_len,
-	      unsigned first_cutoff, int second_cutoff, int terminate,
-	      const char *vuname)
+static int
+prune_priority_list(unsigned *priority_list, int priority_len)
 {
-	int bufix = 0, six = 0, tix = 0;
-	int i;
-	int ix;
-	int tto;
-	int bufend, sbufend;
-	struct data_string od;
-	struct option_cache *oc;
-	struct option *option = NULL;
-	unsigned code;
-
-	/*
-	 * These arguments are relative to the start of the buffer, so
-	 * reduce them by the current buffer index, and advance the
-	 * buffer pointer to where we're going to start writing.
-	 */
-	buffer = &buffer[index];
-	buflen -= index;
-	if (first_cutoff)
-		first_cutoff -= index;
-	if (second_cutoff)
-		second_cutoff -= index;
-
-	/* Calculate the start and end of each section of the buffer */
-	bufend = sbufend = buflen;
-	if (first_cutoff) {
-	    if (first_cutoff >= buflen)
-		log_fatal("%s:%d:store_options: Invalid first cutoff.", MDL);
-	    bufend = first_cutoff;
-
-	    if (second_cutoff) {
-	        if (second_cutoff >= buflen)
-		    log_fatal("%s:%d:store_options: Invalid second cutoff.",
-			      MDL);
-	        sbufend = second_cutoff;
-	    }
-	} else if (second_cutoff) {
-	    if (second_cutoff >= buflen)
-		log_fatal("%s:%d:store_options: Invalid second cutoff.", MDL);
-	    bufend = second_cutoff;
-	}
+	int i, ix, tto;
 
-	memset (&od, 0, sizeof od);
-
-	/* Eliminate duplicate options from the parameter request list.
-	 * Enforce RFC-mandated ordering of options that are present.
-	 */
 	for (i = 0; i < priority_len; i++) {
 		/* Eliminate duplicates. */
 		tto = 0;
@@ -1321,58 +1574,61 @@ store_options(int *ocount,
 			}
 		}
 	}
+	return priority_len;
+}
 
-	/* Copy out the options in the order that they appear in the
-	   priority list... */
-	for (i = 0; i < priority_len; i++) {
-	    /* Number of bytes left to store (some may already
-	       have been stored by a previous pass). */
-	    unsigned length;
-	    int optstart, soptstart, toptstart;
-	    struct universe *u;
-	    int have_encapsulation = 0;
-	    struct data_string encapsulation;
-	    int splitup;
+/*
+ * Find the value store_options() stores for an option code: that of the
+ * option cache for it in cfg_options, that of the option space it
+ * encapsulates, or the two together.  Returns 0 if there's nothing to
+ * store.  *option is left referencing the option if it's known.
+ */
+static int
+find_store_value(struct data_string *od, struct option **option,
+		 unsigned code, struct packet *packet, struct lease *lease,
+		 struct client_state *client_state,
+		 struct option_state *in_options,
+		 struct option_state *cfg_options,
+		 struct binding_scope **scope, const char *vuname)
+{
+	unsigned length;
+	struct option_cache *oc;
+	struct universe *u;
+	int have_encapsulation = 0;
+	struct data_string encapsulation;
 
-	    memset (&encapsulation, 0, sizeof encapsulation);
-	    have_encapsulation = 0;
+	memset (&encapsulation, 0, sizeof encapsulation);
 
-	    if (option != NULL)
-		option_dereference(&option, MDL);
+	/* Look up the option in the site option space if the code
+	   is above the cutoff, otherwise in the DHCP option space. */
+	if (code >= cfg_options -> site_code_min)
+		u = universes [cfg_options -> site_universe];
+	else
+		u = &dhcp_universe;
 
-	    /* Code for next option to try to store. */
-	    code = priority_list [i];
+	oc = lookup_option (u, cfg_options, code);
 
-	    /* Look up the option in the site option space if the code
-	       is above the cutoff, otherwise in the DHCP option space. */
-	    if (code >= cfg_options -> site_code_min)
-		    u = universes [cfg_options -> site_universe];
-	    else
-		    u = &dhcp_universe;
-
-	    oc = lookup_option (u, cfg_options, code);
+	if (oc && oc->option)
+		option_reference(option, oc->option, MDL);
+	else
+		option_code_lookup(option, u, code, MDL);
 
-	    if (oc && oc->option)
-		option_reference(&option, oc->option, MDL);
-	    else
-		option_code_hash_lookup(&option, u->code_hash, &code, 0, MDL);
-
-	    /* If it's a straight encapsulation, and the user supplied a
-	     * value for the entire option, use that.  Otherwise, search
-	     * the encapsulated space.
-	     *
-	     * If it's a limited encapsulation with preceding data, and the
-	     * user supplied values for the preceding bytes, search the
-	     * encapsulated space.
-	     */
-	    if ((option != NULL) &&
-		(((oc == NULL) && (option->format[0] == 'E')) ||
-		 ((oc != NULL) && (option->format[0] == 'e')))) {
+	/* If it's a straight encapsulation, and the user supplied a
+	 * value for the entire option, use that.  Otherwise, search
+	 * the encapsulated space.
+	 *
+	 * If it's a limited encapsulation with preceding data, and the
+	 * user supplied values for the preceding bytes, search the
+	 * encapsulated space.
+	 */
+	if ((*option != NULL) &&
+	    (((oc == NULL) && ((*option)->format[0] == 'E')) ||
+	     ((oc != NULL) && ((*option)->format[0] == 'e')))) {
 		static char *s, *t;
 		struct option_cache *tmp;
 		struct data_string name;
 
-		s = strchr (option->format, 'E');
+		s = strchr ((*option)->format, 'E');
 		if (s)
 		    t = strchr (++s, '.');
 		if (s && t) {
@@ -1412,77 +1668,179 @@ store_options(int *ocount,
 
 		    data_string_forget (&name, MDL);
 		}
-	    }
+	}
 
-	    /* In order to avoid memory leaks, we have to get to here
-	       with any option cache that we allocated in tmp not being
-	       referenced by tmp, and whatever option cache is referenced
-	       by oc being an actual reference.   lookup_option doesn't
-	       generate a reference (this needs to be fixed), so the
-	       preceding goop ensures that if we *didn't* generate a new
-	       option cache, oc still winds up holding an actual reference. */
+	/* In order to avoid memory leaks, we have to get to here
+	   with any option cache that we allocated in tmp not being
+	   referenced by tmp, and whatever option cache is referenced
+	   by oc being an actual reference.   lookup_option doesn't
+	   generate a reference (this needs to be fixed), so the
+	   preceding goop ensures that if we *didn't* generate a new
+	   option cache, oc still winds up holding an actual reference. */
 
-	    /* If no data is available for this option, skip it. */
-	    if (!oc && !have_encapsulation) {
-		    continue;
+	/* If no data is available for this option, skip it. */
+	if (!oc && !have_encapsulation) {
+		return 0;
+	}
+
+	/* Find the value of the option... */
+	od->len = 0;
+	if (oc) {
+	    /* No need to check the return as we check od.len below */
+	    (void) evaluate_option_cache (od, packet,
+					  lease, client_state, in_options,
+					  cfg_options, scope, oc, MDL);
+
+	    /* If we have encapsulation for this option, and an oc
+	     * lookup succeeded, but the evaluation failed, it is
+	     * either because this is a complex atom (atoms before
+	     * E on format list) and the top half of the option is
+	     * not configured, or this is a simple encapsulated
+	     * space and the evaluator is giving us a NULL.  Prefer
+	     * the evaluator's opinion over the subspace.
+	     */
+	    if (!od->len) {
+		data_string_forget (&encapsulation, MDL);
+		data_string_forget (od, MDL);
+		return 0;
 	    }
+	}
+
+	/* We should now have a constant length for the option. */
+	length = od->len;
+	if (have_encapsulation) {
+		length += encapsulation.len;
 
-	    /* Find the value of the option... */
-	    od.len = 0;
-	    if (oc) {
-		/* No need to check the return as we check od.len below */
-		(void) evaluate_option_cache (&od, packet,
-					      lease, client_state, in_options,
-					      cfg_options, scope, oc, MDL);
-
-		/* If we have encapsulation for this option, and an oc
-		 * lookup succeeded, but the evaluation failed, it is
-		 * either because this is a complex atom (atoms before
-		 * E on format list) and the top half of the option is
-		 * not configured, or this is a simple encapsulated
-		 * space and the evaluator is giving us a NULL.  Prefer
-		 * the evaluator's opinion over the subspace.
+		/* od.len can be nonzero if we got here without an
+		 * oc (cache lookup failed), but did have an encapsulated
+		 * simple encapsulation space.
 		 */
-		if (!od.len) {
-		    data_string_forget (&encapsulation, MDL);
-		    data_string_forget (&od, MDL);
-		    continue;
+		if (!od->len) {
+			data_string_copy (od, &encapsulation, MDL);
+			data_string_forget (&encapsulation, MDL);
+		} else {
+			struct buffer *bp = (struct buffer *)0;
+			if (!arena_buffer_allocate (&bp, length, MDL)) {
+				option_cache_dereference (&oc, MDL);
+				data_string_forget (od, MDL);
+				data_string_forget (&encapsulation, MDL);
+				return 0;
+			}
+			memcpy (&bp -> data [0], od->data, od->len);
+			memcpy (&bp -> data [od->len], encapsulation.data,
+				encapsulation.len);
+			data_string_forget (od, MDL);
+			data_string_forget (&encapsulation, MDL);
+			od->data = &bp -> data [0];
+			buffer_reference (&od->buffer, bp, MDL);
+			buffer_dereference (&bp, MDL);
+			od->len = length;
+			od->terminated = 0;
 		}
+	}
+	return 1;
+}
+
+/*
+ * Store all the requested options into the requested buffer.  If values
+ * isn't NULL, it holds what find_store_value() already found for options
+ * on the (pruned) priority list, so they aren't evaluated a second time.
+ * If spots isn't NULL, it's told where the value of each option on that
+ * list was stored, for the encoded option cache.
+ */
+static int
+store_option_list(int *ocount,
+		  unsigned char *buffer, unsigned index, unsigned buflen,
+		  struct packet *packet, struct lease *lease,
+		  struct client_state *client_state,
+		  struct option_state *in_options,
+		  struct option_state *cfg_options,
+		  struct binding_scope **scope,
+		  unsigned *priority_list, int priority_len,
+		  unsigned first_cutoff, int second_cutoff, int terminate,
+		  const char *vuname, struct store_value *values,
+		  struct option_spot *spots)
+{
+	int bufix = 0, six = 0, tix = 0;
+	int i;
+	int ix;
+	int tto;
+	int bufend, sbufend;
+	struct data_string od;
+	struct option *option = NULL;
+	unsigned code;
+
+	/*
+	 * These arguments are relative to the start of the buffer, so
+	 * reduce them by the current buffer index, and advance the
+	 * buffer pointer to where we're going to start writing.
+	 */
+	buffer = &buffer[index];
+	buflen -= index;
+	if (first_cutoff)
+		first_cutoff -= index;
+	if (second_cutoff)
+		second_cutoff -= index;
+
+	/* Calculate the start and end of each section of the buffer */
+	bufend = sbufend = buflen;
+	if (first_cutoff) {
+	    if (first_cutoff >= buflen)
+		log_fatal("%s:%d:store_options: Invalid first cutoff.", MDL);
+	    bufend = first_cutoff;
+
+	    if (second_cutoff) {
+	        if (second_cutoff >= buflen)
+		    log_fatal("%s:%d:store_options: Invalid second cutoff.",
+			      MDL);
+	        sbufend = second_cutoff;
 	    }
+	} else if (second_cutoff) {
+	    if (second_cutoff >= buflen)
+		log_fatal("%s:%d:store_options: Invalid second cutoff.", MDL);
+	    bufend = second_cutoff;
+	}
 
-	    /* We should now have a constant length for the option. */
-	    length = od.len;
-	    if (have_encapsulation) {
-		    length += encapsulation.len;
+	memset (&od, 0, sizeof od);
 
-		    /* od.len can be nonzero if we got here without an
-		     * oc (cache lookup failed), but did have an encapsulated
-		     * simple encapsulation space.
-		     */
-		    if (!od.len) {
-			    data_string_copy (&od, &encapsulation, MDL);
-			    data_string_forget (&encapsulation, MDL);
-		    } else {
-			    struct buffer *bp = (struct buffer *)0;
-			    if (!buffer_allocate (&bp, length, MDL)) {
-				    option_cache_dereference (&oc, MDL);
-				    data_string_forget (&od, MDL);
-				    data_string_forget (&encapsulation, MDL);
-				    continue;
-			    }
-			    memcpy (&bp -> data [0], od.data, od.len);
-			    memcpy (&bp -> data [od.len], encapsulation.data,
-				    encapsulation.len);
-			    data_string_forget (&od, MDL);
-			    data_string_forget (&encapsulation, MDL);
-			    od.data = &bp -> data [0];
-			    buffer_reference (&od.buffer, bp, MDL);
-			    buffer_dereference (&bp, MDL);
-			    od.len = length;
-			    od.terminated = 0;
-		    }
+	priority_len = prune_priority_list(priority_list, priority_len);
+
+	/* Copy out the options in the order that they appear in the
+	   priority list... */
+	for (i = 0; i < priority_len; i++) {
+	    /* Number of bytes left to store (some may already
+	       have been stored by a previous pass). */
+	    unsigned length;
+	    int optstart, soptstart, toptstart;
+	    int splitup;
+
+	    if (option != NULL)
+		option_dereference(&option, MDL);
+
+	    if (spots != NULL) {
+		spots[i].offset = -1;
+		spots[i].len = 0;
 	    }
 
+	    /* Code for next option to try to store. */
+	    code = priority_list [i];
+
+	    if (values != NULL && values[i].found >= 0) {
+		if (!values[i].found)
+		    continue;
+		if (values[i].option != NULL)
+		    option_reference(&option, values[i].option, MDL);
+		data_string_copy(&od, &values[i].value, MDL);
+	    } else if (!find_store_value(&od, &option, code, packet, lease,
+					 client_state, in_options, cfg_options,
+					 scope, vuname))
+		continue;
+
+	    /* We should now have a constant length for the option. */
+	    length = od.len;
+	    if (spots != NULL)
+		spots[i].len = od.len;
+
 	    /* Do we add a NUL? */
 	    if (terminate && option && format_has_text(option->format)) {
 		    length++;
@@ -1555,6 +1913,8 @@ store_options(int *ocount,
 			    bufix = optstart;
 			    six = soptstart;
 			    tix = toptstart;
+			    if (spots != NULL)
+				spots[i].offset = -1;
 			    break;
 			}
 		    }
@@ -1564,6 +1924,12 @@ store_options(int *ocount,
 		    if (incr > 255)
 			incr = 255;
 
+		    /* Note where the value went if it went into the
+		       options buffer in one piece. */
+		    if (spots != NULL)
+			spots[i].offset = (!splitup && base == buffer)
+					  ? *pix + 2 : -2;
+
 		    /* Everything looks good - copy it in! */
 		    base [*pix] = code;
 		    base [*pix + 1] = (unsigned char)incr;
@@ -1617,6 +1983,29 @@ store_options(int *ocount,
 	return bufix;
 }
 
+/*
+ * Store all the requested options into the requested buffer.
+ * XXX: ought to be static
+ */
+int
+store_options(int *ocount,
+	      unsigned char *buffer, unsigned index, unsigned buflen,
+	      struct packet *packet, struct lease *lease,
+	      struct client_state *client_state,
+	      struct option_state *in_options,
+	      struct option_state *cfg_options,
+	      struct binding_scope **scope,
+	      unsigned *priority_list, int priority_len,
+	      unsigned first_cutoff, int second_cutoff, int terminate,
+	      const char *vuname)
+{
+	return store_option_list(ocount, buffer, index, buflen, packet,
+				 lease, client_state, in_options, cfg_options,
+				 scope, priority_list, priority_len,
+				 first_cutoff, second_cutoff, terminate,
+				 vuname, NULL, NULL);
+}
+
 /* Return true if the format string has a variable length text option
  * ("t"), return false otherwise.
  */
@@ -2493,6 +2882,29 @@ struct option_cache *lookup_hashed_option (universe, options, code)
 	return (struct option_cache *)0;
 }
 
+struct option_cache *lookup_indexed_option (universe, options, code)
+	struct universe *universe;
+	struct option_state *options;
+	unsigned code;
+{
+	struct option_index *idx;
+	pair bptr;
+
+	if (universe -> index >= options -> universe_count ||
+	    !(idx = options -> universes [universe -> index]))
+		return (struct option_cache *)0;
+
+	if (code < idx -> size)
+		return idx -> slot [code];
+
+	for (bptr = idx -> overflow; bptr; bptr = bptr -> cdr) {
+		if (((struct option_cache *)(bptr -> car)) -> option -> code ==
+		    code)
+			return (struct option_cache *)(bptr -> car);
+	}
+	return (struct option_cache *)0;
+}
+
 /* Save a specified buffer into an option cache. */
 int
 save_option_buffer(struct universe *universe, struct option_state *options,
@@ -2571,7 +2983,7 @@ prepare_option_buffer(struct universe *universe, struct buffer *bp,
 		log_fatal("Inconsistent universe tag size at %s:%d.", MDL);
 	}
 
-	option_code_hash_lookup(&option, universe->code_hash, &code, 0, MDL);
+	option_code_lookup(&option, universe, code, MDL);
 
 	/* If we created an option structure for each option a client
 	 * supplied, it's possible we may create > 2^32 option structures.
@@ -2613,7 +3025,7 @@ prepare_option_buffer(struct universe *universe, struct buffer *bp,
 	/* If we weren't passed a buffer in which the data are saved and
 	   refcounted, allocate one now. */
 	if (!bp) {
-		if (!buffer_allocate (&lbp, length + terminatep, MDL)) {
+		if (!arena_buffer_allocate (&lbp, length + terminatep, MDL)) {
 			log_error ("no memory for option buffer.");
 
 			status = 0;
@@ -2856,6 +3268,119 @@ save_hashed_option(struct universe *universe, struct option_state *options,
 	hash [hashix] = bptr;
 }
 
+/* Make an option_index with a slot for every code in the universe's
+   option table, moving over the contents of any older, smaller one. */
+static struct option_index *
+grow_option_index(struct universe *universe, struct option_state *options)
+{
+	struct option_index *idx = options -> universes [universe -> index];
+	struct option_index *nidx;
+	struct option_cache *oc;
+	unsigned size = universe -> code_table_size;
+	pair *bp, bptr;
+
+	nidx = new_option_index (size, MDL);
+	if (!nidx)
+		return NULL;
+	if (idx) {
+		memcpy (nidx -> slot, idx -> slot,
+			idx -> size * sizeof (idx -> slot [0]));
+		nidx -> hi = idx -> hi;
+		nidx -> overflow = idx -> overflow;
+		free_option_index (idx, MDL);
+
+		/* Move anything that now has a slot off the overflow list. */
+		for (bp = &nidx -> overflow; (bptr = *bp) != NULL; ) {
+			oc = (struct option_cache *)bptr -> car;
+			if (oc -> option -> code < size) {
+				nidx -> slot [oc -> option -> code] = oc;
+				if (oc -> option -> code >= nidx -> hi)
+					nidx -> hi = oc -> option -> code + 1;
+				*bp = bptr -> cdr;
+				free_pair (bptr, MDL);
+			} else
+				bp = &bptr -> cdr;
+		}
+	}
+	options -> universes [universe -> index] = nidx;
+	return nidx;
+}
+
+/* Store an option cache in a space whose options are kept in an array
+   indexed by code.  This is used for the DHCPv4 and DHCPv6 spaces, where
+   every packet decoded and every reply built looks up options by code. */
+void
+save_indexed_option(struct universe *universe, struct option_state *options,
+		    struct option_cache *oc, isc_boolean_t appendp)
+{
+	struct option_index *idx = options -> universes [universe -> index];
+	struct option_cache **ocloc;
+	unsigned code = oc -> option -> code;
+	pair bptr;
+
+	if (oc -> refcnt == 0)
+		abort ();
+
+	if (code < universe -> code_table_size &&
+	    (!idx || code >= idx -> size)) {
+		idx = grow_option_index (universe, options);
+		if (!idx) {
+			log_error ("no memory to store %s.%s",
+				   universe -> name, oc -> option -> name);
+			return;
+		}
+	} else if (!idx) {
+		/* Codes the option table doesn't reach only need the
+		   overflow list. */
+		idx = dmalloc (sizeof (*idx), MDL);
+		if (!idx) {
+			log_error ("no memory to store %s.%s",
+				   universe -> name, oc -> option -> name);
+			return;
+		}
+		options -> universes [universe -> index] = idx;
+	}
+
+	if (code < idx -> size) {
+		ocloc = &idx -> slot [code];
+		if (code >= idx -> hi)
+			idx -> hi = code + 1;
+	} else {
+		for (bptr = idx -> overflow; bptr; bptr = bptr -> cdr) {
+			if (((struct option_cache *)
+			     (bptr -> car)) -> option -> code == code)
+				break;
+		}
+		if (!bptr) {
+			bptr = new_pair (MDL);
+			if (!bptr) {
+				log_error ("No memory for option_cache "
+					   "reference.");
+				return;
+			}
+			bptr -> car = 0;
+			bptr -> cdr = idx -> overflow;
+			idx -> overflow = bptr;
+		}
+		ocloc = (struct option_cache **)&bptr -> car;
+	}
+
+	/*
+	 * As with the hashed spaces, appendp puts the new cache on the
+	 * tail of the ->next list, otherwise it replaces what is there.
+	 */
+	if (*ocloc) {
+		if (appendp) {
+			do {
+				ocloc = &(*ocloc)->next;
+			} while (*ocloc != NULL);
+		} else {
+			option_cache_dereference(ocloc, MDL);
+		}
+	}
+	option_cache_reference(ocloc, oc, MDL);
+}
+
 void delete_option (universe, options, code)
 	struct universe *universe;
 	struct option_state *options;
@@ -2901,6 +3426,41 @@ void delete_hashed_option (universe, options, code)
 	}
 }
 
+void delete_indexed_option (universe, options, code)
+	struct universe *universe;
+	struct option_state *options;
+	int code;
+{
+	struct option_index *idx = options -> universes [universe -> index];
+	pair bptr, prev = (pair)0;
+
+	/* There may not be any options in this space. */
+	if (!idx)
+		return;
+
+	if ((unsigned)code < idx -> size) {
+		if (idx -> slot [code])
+			option_cache_dereference (&idx -> slot [code], MDL);
+		return;
+	}
+
+	for (bptr = idx -> overflow; bptr; bptr = bptr -> cdr) {
+		if (((struct option_cache *)(bptr -> car)) -> option -> code
+		    == code)
+			break;
+		prev = bptr;
+	}
+	if (bptr) {
+		if (prev)
+			prev -> cdr = bptr -> cdr;
+		else
+			idx -> overflow = bptr -> cdr;
+		option_cache_dereference
+			((struct option_cache **)(&bptr -> car), MDL);
+		free_pair (bptr, MDL);
+	}
+}
+
 extern struct option_cache *free_option_caches; /* XXX */
 
 int option_cache_dereference (ptr, file, line)
@@ -2921,6 +3481,9 @@ int option_cache_dereference (ptr, file, line)
 	(*ptr) -> refcnt--;
 	rc_register (file, line, ptr, *ptr, (*ptr) -> refcnt, 1, RC_MISC);
 	if (!(*ptr) -> refcnt) {
+		/* Encoded options may know it by its address. */
+		if ((*ptr) -> flags & OPTION_CONSTANT)
+			encoded_options_generation++;
 		if ((*ptr) -> data.buffer)
 			data_string_forget (&(*ptr) -> data, file, line);
 		if ((*ptr)->option)
@@ -2985,6 +3548,37 @@ int hashed_option_state_dereference (universe, state, file, line)
 	return 1;
 }
 
+int indexed_option_state_dereference (universe, state, file, line)
+	struct universe *universe;
+	struct option_state *state;
+	const char *file;
+	int line;
+{
+	struct option_index *idx;
+	pair cp, next;
+	unsigned i;
+
+	idx = (struct option_index *)(state -> universes [universe -> index]);
+	if (!idx)
+		return 0;
+
+	for (i = 0; i < idx -> hi; i++) {
+		if (idx -> slot [i])
+			option_cache_dereference (&idx -> slot [i],
+						  file, line);
+	}
+	for (cp = idx -> overflow; cp; cp = next) {
+		next = cp -> cdr;
+		option_cache_dereference ((struct option_cache **)&cp -> car,
+					  file, line);
+		free_pair (cp, file, line);
+	}
+
+	free_option_index (idx, file, line);
+	state -> universes [universe -> index] = (void *)0;
+	return 1;
+}
+
 /* The 'data_string' primitive doesn't have an appension mechanism.
  * This function must then append a new option onto an existing buffer
  * by first duplicating the original buffer and appending the desired
@@ -3242,6 +3836,57 @@ int hashed_option_space_encapsulate (result, packet, lease, client_state,
 	return status;
 }
 
+int indexed_option_space_encapsulate (result, packet, lease, client_state,
+				      in_options, cfg_options, scope, universe)
+	struct data_string *result;
+	struct packet *packet;
+	struct lease *lease;
+	struct client_state *client_state;
+	struct option_state *in_options;
+	struct option_state *cfg_options;
+	struct binding_scope **scope;
+	struct universe *universe;
+{
+	struct option_index *idx;
+	pair p;
+	int status;
+	unsigned i;
+
+	if (universe -> index >= cfg_options -> universe_count)
+		return 0;
+
+	idx = cfg_options -> universes [universe -> index];
+	if (!idx)
+		return 0;
+
+	/* Append each configured option onto the buffer in code order,
+	 * then any that are on the overflow list.
+	 */
+	status = 0;
+	for (i = 0; idx != NULL && i < idx -> hi; i++) {
+		if (idx -> slot [i] &&
+		    store_option(result, universe, packet, lease,
+				 client_state, in_options, cfg_options,
+				 scope, idx -> slot [i]))
+			status = 1;
+		/* Storing an option evaluates it, which may have added
+		 * options to this space and so grown the index. */
+		idx = cfg_options -> universes [universe -> index];
+	}
+	for (p = idx ? idx -> overflow : NULL; p; p = p -> cdr) {
+		if (store_option(result, universe, packet, lease,
+				 client_state, in_options, cfg_options,
+				 scope, (struct option_cache *)p->car))
+			status = 1;
+	}
+
+	if (search_subencapsulation(result, packet, lease, client_state,
+				    in_options, cfg_options, scope, universe))
+		status = 1;
+
+	return status;
+}
+
 int nwip_option_space_encapsulate (result, packet, lease, client_state,
 				   in_options, cfg_options, scope, universe)
 	struct data_string *result;
@@ -3287,9 +3932,9 @@ int nwip_option_space_encapsulate (result, packet, lease, client_state,
 			ds.len = 2;
 			if (option_cache_allocate (&no_nwip, MDL))
 				data_string_copy (&no_nwip -> data, &ds, MDL);
-			if (!option_code_hash_lookup(&no_nwip->option,
-						     nwip_universe.code_hash,
-						     &one, 0, MDL))
+			if (!option_code_lookup(&no_nwip->option,
+						&nwip_universe,
+						one, MDL))
 				log_fatal("Nwip option hash does not contain "
 					  "1 (%s:%d).", MDL);
 		}
@@ -3818,6 +4463,50 @@ void hashed_option_space_foreach (struct packet *packet, struct lease *lease,
 	}
 }
 
+void indexed_option_space_foreach (struct packet *packet, struct lease *lease,
+				   struct client_state *client_state,
+				   struct option_state *in_options,
+				   struct option_state *cfg_options,
+				   struct binding_scope **scope,
+				   struct universe *u, void *stuff,
+				   void (*func) (struct option_cache *,
+						 struct packet *,
+						 struct lease *,
+						 struct client_state *,
+						 struct option_state *,
+						 struct option_state *,
+						 struct binding_scope **,
+						 struct universe *, void *))
+{
+	struct option_index *idx;
+	struct option_cache *oc;
+	unsigned i;
+	pair p;
+
+	if (cfg_options -> universe_count <= u -> index)
+		return;
+
+	idx = cfg_options -> universes [u -> index];
+	if (!idx)
+		return;
+	for (i = 0; idx != NULL && i < idx -> hi; i++) {
+		if ((oc = idx -> slot [i]) != NULL) {
+			(*func) (oc, packet, lease, client_state,
+				 in_options, cfg_options, scope, u, stuff);
+			/* The function may have added options and so
+			 * grown the index. */
+			idx = cfg_options -> universes [u -> index];
+		}
+	}
+	if (!idx)
+		return;
+	for (p = idx -> overflow; p; p = p -> cdr) {
+		oc = (struct option_cache *)p -> car;
+		(*func) (oc, packet, lease, client_state,
+			 in_options, cfg_options, scope, u, stuff);
+	}
+}
+
 void
 save_linked_option(struct universe *universe, struct option_state *options,
 		   struct option_cache *oc, isc_boolean_t appendp)
@@ -4025,6 +4714,10 @@ void do_packet (interface, packet, len, from_port, from, hfrom)
 	interface_reference(&decoded_packet->interface, interface, MDL);
 	decoded_packet->haddr = hfrom;
 
+	/* Decode into and build the reply out of the packet's arena.
+	   Releasing the packet takes us back off it. */
+	current_packet_arena = &decoded_packet->arena;
+
 	if (packet->hlen > sizeof packet->chaddr) {
 		packet_dereference(&decoded_packet, MDL);
 		log_info("Discarding packet with bogus hlen.");
@@ -4070,6 +4763,7 @@ void do_packet (interface, packet, len, from_port, from, hfrom)
 	}
 
 	/* If the caller kept the packet, they'll have upped the refcnt. */
+	current_packet_arena = NULL;
 	packet_dereference(&decoded_packet, MDL);
 
 #if defined (DEBUG_MEMORY_LEAKAGE)
@@ -4133,6 +4827,7 @@ do_packet6(struct interface_info *interface, const char *packet,
 		log_error("do_packet6: no memory for incoming packet.");
 		return;
 	}
+	current_packet_arena = &decoded_packet->arena;
 
 	if (!option_state_allocate(&decoded_packet->options, MDL)) {
 		log_error("do_packet6: no memory for options.");
@@ -4221,6 +4916,7 @@ do_packet6(struct interface_info *interface, const char *packet,
 
 	dhcpv6(decoded_packet);
 
+	current_packet_arena = NULL;
 	packet_dereference(&decoded_packet, MDL);
 
 #if defined (DEBUG_MEMORY_LEAKAGE)
@@ -4442,8 +5138,8 @@ add_option(struct option_state *options,
 	/* INSIST(data != NULL); */
 
 	option = NULL;
-	if (!option_code_hash_lookup(&option, dhcp_universe.code_hash,
-				     &option_num, 0, MDL)) {
+	if (!option_code_lookup(&option, &dhcp_universe,
+				option_num, MDL)) {
 		log_error("Attempting to add unknown option %d.", option_num);
 		return 0;
 	}
@@ -4596,8 +5292,8 @@ void parse_vendor_option(packet, lease, client_state, in_options,
 	}
 
 	/* Get the proper option to pass to the parse routine */
-	option_code_hash_lookup(&option, dhcp_universe.code_hash,
-				&code, 0, MDL);
+	option_code_lookup(&option, &dhcp_universe,
+			   code, MDL);
 
 	/* Now that we have the data from the vendor option and a vendor
 	 * option space try to parse things.  On success the parsed options
@@ -935,6 +935,57 @@ void convert_num (cfile, buf, str, base, size)
  * optional.
  */
 
+/*
+ * Turn the fields of a date as written in a lease file into a TIME.
+ * year is as written (either since 1900 or in full) and mon counts
+ * from zero.  The lease file reader uses this as well as the parser.
+ */
+TIME
+date_to_time(int year, int mon, int mday, int hour, int min, int sec,
+	     int tzoff)
+{
+	int guess;
+	static int months[11] = { 31, 59, 90, 120, 151, 181,
+				  212, 243, 273, 304, 334 };
+
+	/* Note: the following is not a Y2K bug - it's a Y1.9K bug.   Until
+	   somebody invents a time machine, I think we can safely disregard
+	   it.   This actually works around a stupid Y2K bug that was present
+	   in a very early beta release of dhcpd. */
+	if (year > 1900)
+		year -= 1900;
+
+	/* If the year is 2038 or greater return the max time to avoid
+	 * overflow issues.  We could try and be more precise but there
+	 * doesn't seem to be a good reason to worry about it and waste
+	 * the cpu looking at the rest of the date. */
+	if (year >= 138)
+		return(MAX_TIME);
+
+	/* Guess the time value... */
+	guess = ((((((365 * (year - 70) +	/* Days in years since '70 */
+		      (year - 69) / 4 +		/* Leap days since '70 */
+		      (mon			/* Days in months this year */
+		       ? months [mon - 1]
+		       : 0) +
+		      (mon > 1 &&		/* Leap day this year */
+		       !((year - 72) & 3)) +
+		      mday - 1) * 24) +		/* Day of month */
+		    hour) * 60) +
+		  min) * 60) + sec + tzoff;
+
+	/* This guess could be wrong because of leap seconds or other
+	   weirdness we don't know about that the system does.   For
+	   now, we're just going to accept the guess, but at some point
+	   it might be nice to do a successive approximation here to
+	   get an exact value.   Even if the error is small, if the
+	   server is restarted frequently (and thus the lease database
+	   is reread), the error could accumulate into something
+	   significant. */
+
+	return((TIME)guess);
+}
+
 /*
  * just parse the date
  * any trailing semi must be consumed by the caller of this routine
@@ -947,8 +998,6 @@ parse_date_core(cfile)
 	int tzoff, year, mon, mday, hour, min, sec;
 	const char *val;
 	enum dhcp_token token;
-	static int months[11] = { 31, 59, 90, 120, 151, 181,
-				  212, 243, 273, 304, 334 };
 
 	/* "never", "epoch" or day of week */
 	token = peek_token(&val, NULL, cfile);
@@ -994,13 +1043,7 @@ parse_date_core(cfile)
 	}
 	skip_token(&val, NULL, cfile); /* consume year */
 
-	/* Note: the following is not a Y2K bug - it's a Y1.9K bug.   Until
-	   somebody invents a time machine, I think we can safely disregard
-	   it.   This actually works around a stupid Y2K bug that was present
-	   in a very early beta release of dhcpd. */
 	year = atoi(val);
-	if (year > 1900)
-		year -= 1900;
 
 	/* Slash separating year from month... */
 	token = peek_token(&val, NULL, cfile);
@@ -1113,35 +1156,7 @@ parse_date_core(cfile)
 		return((TIME)0);
 	}
 
-	/* If the year is 2038 or greater return the max time to avoid
-	 * overflow issues.  We could try and be more precise but there
-	 * doesn't seem to be a good reason to worry about it and waste
-	 * the cpu looking at the rest of the date. */
-	if (year >= 138)
-		return(MAX_TIME);
-
-	/* Guess the time value... */
-	guess = ((((((365 * (year - 70) +	/* Days in years since '70 */
-		      (year - 69) / 4 +		/* Leap days since '70 */
-		      (mon			/* Days in months this year */
-		       ? months [mon - 1]
-		       : 0) +
-		      (mon > 1 &&		/* Leap day this year */
-		       !((year - 72) & 3)) +
-		      mday - 1) * 24) +		/* Day of month */
-		    hour) * 60) +
-		  min) * 60) + sec + tzoff;
-
-	/* This guess could be wrong because of leap seconds or other
-	   weirdness we don't know about that the system does.   For
-	   now, we're just going to accept the guess, but at some point
-	   it might be nice to do a successive approximation here to
-	   get an exact value.   Even if the error is small, if the
-	   server is restarted frequently (and thus the lease database
-	   is reread), the error could accumulate into something
-	   significant. */
-
-	return((TIME)guess);
+	return(date_to_time(year, mon, mday, hour, min, sec, tzoff));
 }
 
 /*
@@ -1264,8 +1279,8 @@ parse_option_name (cfile, allocate, known, opt)
 		if (known)
 			*known = 1;
 
-		option_code_hash_lookup(opt, universe->code_hash,
-					&code, 0, MDL);
+		option_code_lookup(opt, universe,
+				   code, MDL);
 		option = *opt;
 
 		/* If we did not find an option of that code,
@@ -1818,8 +1833,8 @@ int parse_option_code_definition (cfile, option)
 	option -> format = s;
 
 	oldopt = NULL;
-	option_code_hash_lookup(&oldopt, option->universe->code_hash,
-				&option->code, 0, MDL);
+	option_code_lookup(&oldopt, option->universe,
+			   option->code, MDL);
 	if (oldopt != NULL) {
 		/*
 		 * XXX: This illegalizes a configuration syntax that was
@@ -1832,21 +1847,19 @@ int parse_option_code_definition (cfile, option)
 		option_name_hash_delete(option->universe->name_hash,
 					oldopt->name, 0, MDL);
 		 */
-		option_code_hash_delete(option->universe->code_hash,
-					&oldopt->code, 0, MDL);
+		option_code_delete(option->universe, oldopt);
 
 		option_dereference(&oldopt, MDL);
 	}
-	option_code_hash_add(option->universe->code_hash, &option->code, 0,
-			     option, MDL);
+	option_code_add(option->universe, option);
 	option_name_hash_add(option->universe->name_hash, option->name, 0,
 			     option, MDL);
 	if (has_encapsulation) {
 		/* INSIST(tokbuf[0] == 'E'); */
 		/* INSIST(encapsulated != NULL); */
-		if (!option_code_hash_lookup(&encapsulated->enc_opt,
-					     option->universe->code_hash, 
-					     &option->code, 0, MDL)) {
+		if (!option_code_lookup(&encapsulated->enc_opt,
+					option->universe,
+					option->code, MDL)) {
 			log_fatal("error finding encapsulated option (%s:%d)",
 				  MDL);
 		}
@@ -4930,6 +4943,8 @@ int parse_option_statement (result, cfile, lookups, option, op)
 	if (expr && !option_cache (&(*result)->data.option,
 				   NULL, expr, option, MDL))
 		log_fatal ("no memory for option cache");
+	if (expr && is_constant_data_expression (expr))
+		(*result)->data.option->flags |= OPTION_CONSTANT;
 
 	if (expr)
 		expression_dereference (&expr, MDL);
@@ -5597,6 +5612,9 @@ int parse_warn (struct parse *cfile, const char *fmt, ...)
 	/* Replace %m in fmt with errno error text */
 	do_percentm (mbuf, sizeof(mbuf), fmt);
 
+	/* Find the line and column of the token being complained about. */
+	lex_position (cfile);
+
 	/* %Audit% This is log output. %2004.06.17,Safe%
 	 * If we truncate we hope the user can get a hint from the log.
 	 */
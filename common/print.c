@@ -361,6 +361,19 @@ void hash_dump (table)
 				log_info ("%s", (const char *)bp -> name);
 		}
 	}
+
+	/* Entries not yet moved over by a resize in progress. */
+	for (i = 0; table -> old_buckets && i < table -> old_count; i++) {
+		if (!table -> old_buckets [i])
+			continue;
+		log_info ("old hash bucket %d:", i);
+		for (bp = table -> old_buckets [i]; bp; bp = bp -> next) {
+			if (bp -> len)
+				dump_raw (bp -> name, bp -> len);
+			else
+				log_info ("%s", (const char *)bp -> name);
+		}
+	}
 }
 
 /*
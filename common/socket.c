@@ -394,6 +394,164 @@ void if_deregister_send (info)
 #endif /* USE_SOCKET_SEND */
 #endif /* USE_SOCKET_SEND || USE_SOCKET_FALLBACK */
 
+#if defined (USE_SENDMMSG)
+/*
+ * Batched transmission.  Between send_batch_begin() and send_batch_end()
+ * the send_packet() implementations hand their finished frames to
+ * send_batch_queue() rather than writing them, and each interface's
+ * frames then go out with as few sendmmsg() calls as the kernel allows.
+ * This is used when a delayed-ack flush releases a large number of
+ * replies at once.  Replies that go out through the fallback socket are
+ * queued on the fallback interface the same way.  Where IP_PKTINFO
+ * picks the outgoing interface, each frame carries its own rather than
+ * setting it on the shared socket.  Only builds with IGNORE_HOSTUNREACH,
+ * which retries broadcasts the network refuses, send one at a time.
+ */
+int send_batching = 0;
+
+static void send_batch_flush (struct interface_info *);
+
+#if defined (USE_SOCKET_SEND) || defined (USE_SOCKET_FALLBACK)
+/* The interface a frame sent on the shared socket must leave by, or
+   zero if the socket's own routing is to be used. */
+static int send_ifindex (interface)
+	struct interface_info *interface;
+{
+#if defined(IP_PKTINFO) && defined(IP_RECVPKTINFO) && defined(USE_V4_PKTINFO)
+	if (interface -> ifp != NULL)
+		return interface -> ifp -> ifr_index;
+#endif
+	return 0;
+}
+#endif
+
+void send_batch_begin ()
+{
+	send_batching = 1;
+}
+
+void send_batch_end ()
+{
+	struct interface_info *ip;
+
+	send_batching = 0;
+	for (ip = interfaces; ip; ip = ip -> next) {
+		if (ip -> tx_count)
+			send_batch_flush (ip);
+	}
+	if (fallback_interface && fallback_interface -> tx_count)
+		send_batch_flush (fallback_interface);
+}
+
+/* Hold a copy of an assembled frame for the next flush of its
+   interface.   If to is non-null the frame is sent to that address,
+   otherwise it is written to the interface as is. */
+ssize_t send_batch_queue (interface, buf, len, to, ifindex)
+	struct interface_info *interface;
+	const unsigned char *buf;
+	size_t len;
+	struct sockaddr_in *to;
+	int ifindex;
+{
+	struct tx_frame *frame;
+
+	if (len > sizeof frame -> buf) {
+		log_error ("send_batch_queue: %lu byte frame is too long.",
+			   (unsigned long)len);
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (interface -> tx_queue == NULL) {
+		interface -> tx_queue = dmalloc (TX_BATCH_MAX * sizeof *frame,
+						 MDL);
+		if (interface -> tx_queue == NULL) {
+			log_error ("send_batch_queue: no memory for %s.",
+				   interface -> name);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	if (interface -> tx_count == TX_BATCH_MAX)
+		send_batch_flush (interface);
+
+	frame = &interface -> tx_queue [interface -> tx_count++];
+	memcpy (frame -> buf, buf, len);
+	frame -> len = len;
+	if (to) {
+		memcpy (&frame -> to, to, sizeof frame -> to);
+		frame -> has_to = 1;
+	} else
+		frame -> has_to = 0;
+	frame -> ifindex = ifindex;
+
+	return len;
+}
+
+static void send_batch_flush (interface)
+	struct interface_info *interface;
+{
+	struct mmsghdr msgs [TX_BATCH_MAX];
+	struct iovec iov [TX_BATCH_MAX];
+	struct tx_frame *frame;
+	int count = interface -> tx_count;
+	int done = 0;
+	int i, result;
+#if defined(IP_PKTINFO) && defined(IP_RECVPKTINFO) && defined(USE_V4_PKTINFO)
+	union {
+		struct cmsghdr hdr;
+		unsigned char buf [CMSG_SPACE (sizeof (struct in_pktinfo))];
+	} control [TX_BATCH_MAX];
+	struct cmsghdr *cmsg;
+	struct in_pktinfo *pktinfo;
+#endif
+
+	memset (msgs, 0, sizeof msgs);
+	for (i = 0; i < count; i++) {
+		frame = &interface -> tx_queue [i];
+		iov [i].iov_base = frame -> buf;
+		iov [i].iov_len = frame -> len;
+		msgs [i].msg_hdr.msg_iov = &iov [i];
+		msgs [i].msg_hdr.msg_iovlen = 1;
+		if (frame -> has_to) {
+			msgs [i].msg_hdr.msg_name = &frame -> to;
+			msgs [i].msg_hdr.msg_namelen = sizeof frame -> to;
+		}
+#if defined(IP_PKTINFO) && defined(IP_RECVPKTINFO) && defined(USE_V4_PKTINFO)
+		if (frame -> ifindex) {
+			memset (&control [i], 0, sizeof control [i]);
+			msgs [i].msg_hdr.msg_control = control [i].buf;
+			msgs [i].msg_hdr.msg_controllen = sizeof control [i].buf;
+			cmsg = CMSG_FIRSTHDR (&msgs [i].msg_hdr);
+			cmsg -> cmsg_level = IPPROTO_IP;
+			cmsg -> cmsg_type = IP_PKTINFO;
+			cmsg -> cmsg_len = CMSG_LEN (sizeof *pktinfo);
+			pktinfo = (struct in_pktinfo *)CMSG_DATA (cmsg);
+			pktinfo -> ipi_ifindex = frame -> ifindex;
+		}
+#endif
+	}
+
+	/* sendmmsg() stops at the first frame it can't send; report that
+	   one and carry on with the rest. */
+	while (done < count) {
+		result = sendmmsg (interface -> wfdesc, &msgs [done],
+				   count - done, 0);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			log_error ("send_packet: %s: %m", interface -> name);
+			done++;
+			continue;
+		}
+		done += result;
+	}
+
+	interface -> tx_count = 0;
+}
+#endif /* USE_SENDMMSG */
+
 #ifdef USE_SOCKET_RECEIVE
 void if_register_receive (info)
 	struct interface_info *info;
@@ -728,7 +886,14 @@ ssize_t send_packet (interface, packet, raw, len, from, to, hto)
 #endif
 #if defined(IP_PKTINFO) && defined(IP_RECVPKTINFO) && defined(USE_V4_PKTINFO)
 		struct in_pktinfo pktinfo;
-
+#endif
+#if defined (USE_SENDMMSG) && !defined (IGNORE_HOSTUNREACH)
+		if (send_batching)
+			return send_batch_queue (interface,
+						 (unsigned char *)raw, len, to,
+						 send_ifindex (interface));
+#endif
+#if defined(IP_PKTINFO) && defined(IP_RECVPKTINFO) && defined(USE_V4_PKTINFO)
 		if (interface->ifp != NULL) {
 			memset(&pktinfo, 0, sizeof (pktinfo));
 			pktinfo.ipi_ifindex = interface->ifp->ifr_index;
@@ -1151,6 +1316,94 @@ receive_packet6(struct interface_info *interface,
 
 	return (result);
 }
+
+#if defined (USE_RECVMMSG)
+/*
+ * Read up to max queued datagrams with a single recvmmsg() call.  The
+ * datagrams are left in buffers owned by this module and bufs[] is
+ * pointed at them; they stay valid until the next call.  A datagram that
+ * arrived without IPV6_PKTINFO gets a length of -1.  Returns the number
+ * of datagrams read, or -1 on error.
+ */
+int
+receive_packet6_batch(struct interface_info *interface,
+		      unsigned char **bufs, int *lens,
+		      struct sockaddr_in6 *from, struct in6_addr *to_addr,
+		      unsigned int *if_idx, int max)
+{
+	static unsigned char *batch_buf = NULL;
+	static unsigned char *batch_cbuf = NULL;
+	struct mmsghdr msgs[RX_BATCH_MAX];
+	struct iovec v[RX_BATCH_MAX];
+	size_t cbuf_len = CMSG_SPACE(sizeof(struct in6_pktinfo));
+	struct cmsghdr *cmsg;
+	struct in6_pktinfo *pktinfo;
+	int count, i;
+
+	if (max > RX_BATCH_MAX)
+		max = RX_BATCH_MAX;
+
+	/*
+	 * The data and control buffers are allocated once and reused, as
+	 * with control_buf above.
+	 */
+	if (batch_buf == NULL) {
+		batch_buf = dmalloc(RX_BATCH_MAX * 65536, MDL);
+		batch_cbuf = dmalloc(RX_BATCH_MAX * cbuf_len, MDL);
+		if ((batch_buf == NULL) || (batch_cbuf == NULL)) {
+			log_error("receive_packet6_batch: unable to allocate "
+				  "receive buffers");
+			if (batch_buf != NULL)
+				dfree(batch_buf, MDL);
+			if (batch_cbuf != NULL)
+				dfree(batch_cbuf, MDL);
+			batch_buf = batch_cbuf = NULL;
+			errno = ENOMEM;
+			return (-1);
+		}
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+	memset(batch_cbuf, 0, RX_BATCH_MAX * cbuf_len);
+	for (i = 0; i < max; i++) {
+		v[i].iov_base = batch_buf + i * 65536;
+		v[i].iov_len = 65536;
+		msgs[i].msg_hdr.msg_name = &from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+		msgs[i].msg_hdr.msg_iov = &v[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = batch_cbuf + i * cbuf_len;
+		msgs[i].msg_hdr.msg_controllen = cbuf_len;
+	}
+
+	/*
+	 * We were woken because the socket is readable, so the first
+	 * datagram is there; don't wait for any more than are queued.
+	 */
+	count = recvmmsg(interface->rfdesc, msgs, max, MSG_DONTWAIT, NULL);
+	if (count <= 0)
+		return (count);
+
+	for (i = 0; i < count; i++) {
+		bufs[i] = v[i].iov_base;
+		lens[i] = -1;
+		cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+		while (cmsg != NULL) {
+			if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+			    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+				pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+				to_addr[i] = pktinfo->ipi6_addr;
+				if_idx[i] = pktinfo->ipi6_ifindex;
+				lens[i] = msgs[i].msg_len;
+				break;
+			}
+			cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg);
+		}
+	}
+
+	return (count);
+}
+#endif /* USE_RECVMMSG */
 #endif /* DHCPv6 */
 
 #if defined (USE_SOCKET_FALLBACK)
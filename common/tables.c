@@ -1092,13 +1092,13 @@ void initialize_common_option_spaces()
 	/* Set up the DHCP option universe... */
 	dhcp_universe.name = "dhcp";
 	dhcp_universe.concat_duplicates = 1;
-	dhcp_universe.lookup_func = lookup_hashed_option;
+	dhcp_universe.lookup_func = lookup_indexed_option;
 	dhcp_universe.option_state_dereference =
-		hashed_option_state_dereference;
-	dhcp_universe.save_func = save_hashed_option;
-	dhcp_universe.delete_func = delete_hashed_option;
-	dhcp_universe.encapsulate = hashed_option_space_encapsulate;
-	dhcp_universe.foreach = hashed_option_space_foreach;
+		indexed_option_state_dereference;
+	dhcp_universe.save_func = save_indexed_option;
+	dhcp_universe.delete_func = delete_indexed_option;
+	dhcp_universe.encapsulate = indexed_option_space_encapsulate;
+	dhcp_universe.foreach = indexed_option_space_foreach;
 	dhcp_universe.decode = parse_option_buffer;
 	dhcp_universe.length_size = 1;
 	dhcp_universe.tag_size = 1;
@@ -1115,10 +1115,9 @@ void initialize_common_option_spaces()
 	    !option_code_new_hash(&dhcp_universe.code_hash,
 				  BYTE_CODE_HASH_SIZE, MDL))
 		log_fatal ("Can't allocate dhcp option hash table.");
+	option_code_table_init(&dhcp_universe, 256);
 	for (i = 0 ; dhcp_options[i].name ; i++) {
-		option_code_hash_add(dhcp_universe.code_hash,
-				     &dhcp_options[i].code, 0,
-				     &dhcp_options[i], MDL);
+		option_code_add(&dhcp_universe, &dhcp_options[i]);
 		option_name_hash_add(dhcp_universe.name_hash,
 				     dhcp_options [i].name, 0,
 				     &dhcp_options [i], MDL);
@@ -1151,8 +1150,8 @@ void initialize_common_option_spaces()
 	nwip_universe.end = 0;
 	code = DHO_NWIP_SUBOPTIONS;
 	nwip_universe.enc_opt = NULL;
-	if (!option_code_hash_lookup(&nwip_universe.enc_opt,
-				     dhcp_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&nwip_universe.enc_opt,
+				&dhcp_universe, code, MDL))
 		log_fatal("Unable to find NWIP parent option (%s:%d).", MDL);
 	nwip_universe.index = universe_count++;
 	universes [nwip_universe.index] = &nwip_universe;
@@ -1198,8 +1197,8 @@ void initialize_common_option_spaces()
 	fqdn_universe.index = universe_count++;
 	code = DHO_FQDN;
 	fqdn_universe.enc_opt = NULL;
-	if (!option_code_hash_lookup(&fqdn_universe.enc_opt,
-				     dhcp_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&fqdn_universe.enc_opt,
+				&dhcp_universe, code, MDL))
 		log_fatal("Unable to find FQDN parent option (%s:%d).", MDL);
 	universes [fqdn_universe.index] = &fqdn_universe;
 	if (!option_name_new_hash(&fqdn_universe.name_hash,
@@ -1245,8 +1244,8 @@ void initialize_common_option_spaces()
 	vendor_class_universe.end = 0;
 	code = DHO_VIVCO_SUBOPTIONS;
 	vendor_class_universe.enc_opt = NULL;
-	if (!option_code_hash_lookup(&vendor_class_universe.enc_opt,
-				     dhcp_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&vendor_class_universe.enc_opt,
+				&dhcp_universe, code, MDL))
 		log_fatal("Unable to find VIVCO parent option (%s:%d).", MDL);
         vendor_class_universe.index = universe_count++;
         universes[vendor_class_universe.index] = &vendor_class_universe;
@@ -1292,8 +1291,8 @@ void initialize_common_option_spaces()
 	vendor_universe.end = 0;
 	code = DHO_VIVSO_SUBOPTIONS;
 	vendor_universe.enc_opt = NULL;
-	if (!option_code_hash_lookup(&vendor_universe.enc_opt,
-				     dhcp_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&vendor_universe.enc_opt,
+				&dhcp_universe, code, MDL))
 		log_fatal("Unable to find VIVSO parent option (%s:%d).", MDL);
         vendor_universe.index = universe_count++;
         universes[vendor_universe.index] = &vendor_universe;
@@ -1339,8 +1338,8 @@ void initialize_common_option_spaces()
 	isc_universe.end = 0;
 	code = VENDOR_ISC_SUBOPTIONS;
 	isc_universe.enc_opt = NULL;
-	if (!option_code_hash_lookup(&isc_universe.enc_opt,
-				     vendor_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&isc_universe.enc_opt,
+				&vendor_universe, code, MDL))
 		log_fatal("Unable to find ISC parent option (%s:%d).", MDL);
         isc_universe.index = universe_count++;
         universes[isc_universe.index] = &isc_universe;
@@ -1367,13 +1366,13 @@ void initialize_common_option_spaces()
 	/* Set up the DHCPv6 root universe. */
 	dhcpv6_universe.name = "dhcp6";
 	dhcpv6_universe.concat_duplicates = 0;
-	dhcpv6_universe.lookup_func = lookup_hashed_option;
+	dhcpv6_universe.lookup_func = lookup_indexed_option;
 	dhcpv6_universe.option_state_dereference =
-		hashed_option_state_dereference;
-	dhcpv6_universe.save_func = save_hashed_option;
-	dhcpv6_universe.delete_func = delete_hashed_option;
-	dhcpv6_universe.encapsulate = hashed_option_space_encapsulate;
-	dhcpv6_universe.foreach = hashed_option_space_foreach;
+		indexed_option_state_dereference;
+	dhcpv6_universe.save_func = save_indexed_option;
+	dhcpv6_universe.delete_func = delete_indexed_option;
+	dhcpv6_universe.encapsulate = indexed_option_space_encapsulate;
+	dhcpv6_universe.foreach = indexed_option_space_foreach;
 	dhcpv6_universe.decode = parse_option_buffer;
 	dhcpv6_universe.length_size = 2;
 	dhcpv6_universe.tag_size = 2;
@@ -1391,10 +1390,9 @@ void initialize_common_option_spaces()
 	    !option_code_new_hash(&dhcpv6_universe.code_hash,
 				  WORD_CODE_HASH_SIZE, MDL))
 		log_fatal("Can't allocate dhcpv6 option hash tables.");
+	option_code_table_init(&dhcpv6_universe, 256);
 	for (i = 0 ; dhcpv6_options[i].name ; i++) {
-		option_code_hash_add(dhcpv6_universe.code_hash,
-				     &dhcpv6_options[i].code, 0,
-				     &dhcpv6_options[i], MDL);
+		option_code_add(&dhcpv6_universe, &dhcpv6_options[i]);
 		option_name_hash_add(dhcpv6_universe.name_hash,
 				     dhcpv6_options[i].name, 0,
 				     &dhcpv6_options[i], MDL);
@@ -1426,8 +1424,8 @@ void initialize_common_option_spaces()
 	/* No END option. */
 	vsio_universe.end = 0x00;
 	code = D6O_VENDOR_OPTS;
-	if (!option_code_hash_lookup(&vsio_universe.enc_opt,
-				     dhcpv6_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&vsio_universe.enc_opt,
+				&dhcpv6_universe, code, MDL))
 		log_fatal("Unable to find VSIO parent option (%s:%d).", MDL);
 	vsio_universe.index = universe_count++;
 	universes[vsio_universe.index] = &vsio_universe;
@@ -1467,8 +1465,8 @@ void initialize_common_option_spaces()
 	/* No END option. */
 	isc6_universe.end = 0x00;
 	code = 2495;
-	if (!option_code_hash_lookup(&isc6_universe.enc_opt,
-				     vsio_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&isc6_universe.enc_opt,
+				&vsio_universe, code, MDL))
 		log_fatal("Unable to find ISC parent option (%s:%d).", MDL);
 	isc6_universe.index = universe_count++;
 	universes[isc6_universe.index] = &isc6_universe;
@@ -1512,8 +1510,8 @@ void initialize_common_option_spaces()
 	fqdn6_universe.index = universe_count++;
 	code = D6O_CLIENT_FQDN;
 	fqdn6_universe.enc_opt = NULL;
-	if (!option_code_hash_lookup(&fqdn6_universe.enc_opt,
-				     dhcpv6_universe.code_hash, &code, 0, MDL))
+	if (!option_code_lookup(&fqdn6_universe.enc_opt,
+				&dhcpv6_universe, code, MDL))
 		log_fatal("Unable to find FQDN v6 parent option. (%s:%d).",
 			  MDL);
 	universes[fqdn6_universe.index] = &fqdn6_universe;
@@ -1553,3 +1551,120 @@ void initialize_common_option_spaces()
 			  &fqdn6_universe, MDL);
 
 }
+
+/* The DHCPv4 and DHCPv6 option spaces also keep their options in an array
+   indexed by code, so that finding the definition of an option while
+   decoding or building a packet is a single load rather than a hash
+   lookup.  The array holds its own reference to each option and is grown
+   as options are defined, up to OPTION_CODE_TABLE_MAX codes.  The code
+   hash is kept as well, for the spaces that have no array, for codes
+   beyond it and for the code that walks it. */
+
+static void
+option_code_table_grow(struct universe *universe, unsigned code)
+{
+	struct option **table;
+	unsigned size;
+
+	size = universe->code_table_size ? universe->code_table_size : 32;
+	while (size <= code && size < OPTION_CODE_TABLE_MAX)
+		size *= 2;
+	if (size > OPTION_CODE_TABLE_MAX)
+		size = OPTION_CODE_TABLE_MAX;
+	if (size <= universe->code_table_size)
+		return;
+
+	table = dmalloc(size * sizeof(*table), MDL);
+	if (table == NULL)
+		log_fatal("No memory for the %s option table.",
+			  universe->name);
+	if (universe->code_table != NULL) {
+		memcpy(table, universe->code_table,
+		       universe->code_table_size * sizeof(*table));
+		dfree(universe->code_table, MDL);
+	}
+	universe->code_table = table;
+	universe->code_table_size = size;
+}
+
+/* Give a universe an option array covering at least the given number of
+   codes.  Only universes with 8 or 16 bit codes may have one. */
+
+void
+option_code_table_init(struct universe *universe, unsigned size)
+{
+	if (universe->tag_size > 2)
+		log_fatal("The %s option space is too large to index.",
+			  universe->name);
+	universe->code_table = NULL;
+	universe->code_table_size = 0;
+	option_code_table_grow(universe, size - 1);
+}
+
+void
+option_code_table_free(struct universe *universe)
+{
+	unsigned i;
+
+	if (universe->code_table == NULL)
+		return;
+	for (i = 0; i < universe->code_table_size; i++) {
+		if (universe->code_table[i] != NULL)
+			option_dereference(&universe->code_table[i], MDL);
+	}
+	dfree(universe->code_table, MDL);
+	universe->code_table = NULL;
+	universe->code_table_size = 0;
+}
+
+int
+option_code_lookup(struct option **option, struct universe *universe,
+		   unsigned code, const char *file, int line)
+{
+	if (universe->code_table == NULL ||
+	    code >= universe->code_table_size)
+		return option_code_hash_lookup(option, universe->code_hash,
+					       &code, 0, file, line);
+
+	if (universe->code_table[code] == NULL)
+		return 0;
+	return (option_reference(option, universe->code_table[code],
+				 file, line) == ISC_R_SUCCESS);
+}
+
+void
+option_code_add(struct universe *universe, struct option *option)
+{
+	struct option **slot;
+
+	option_code_hash_add(universe->code_hash, &option->code, 0,
+			     option, MDL);
+	if (universe->code_table == NULL ||
+	    option->code >= OPTION_CODE_TABLE_MAX)
+		return;
+
+	if (option->code >= universe->code_table_size)
+		option_code_table_grow(universe, option->code);
+	slot = &universe->code_table[option->code];
+	if (*slot != NULL)
+		option_dereference(slot, MDL);
+	option_reference(slot, option, MDL);
+}
+
+void
+option_code_delete(struct universe *universe, struct option *option)
+{
+	struct option **slot;
+	unsigned code = option->code;
+
+	option_code_hash_delete(universe->code_hash, &code, 0, MDL);
+	if (universe->code_table == NULL ||
+	    code >= universe->code_table_size)
+		return;
+
+	/* An earlier definition may still be in the hash. */
+	slot = &universe->code_table[code];
+	if (*slot != NULL)
+		option_dereference(slot, MDL);
+	option_code_hash_lookup(slot, universe->code_hash, &code, 0, MDL);
+}
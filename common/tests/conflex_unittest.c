@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+#include "t_bench.h"
+
+/*
+ * Test the config file scanner: keyword lookup, the tokens taken from
+ * the buffer in one go, and the line and column worked out for
+ * parse_warn() after the fact.
+ */
+
+#define BENCH_HOSTS 400000
+
+struct test_token {
+	enum dhcp_token token;
+	const char *text;
+};
+
+static struct parse *
+start_parse(const char *text) {
+	struct parse *cfile = NULL;
+
+	if (new_parse(&cfile, -1, (char *)text, strlen(text), "test",
+		      0) != ISC_R_SUCCESS)
+		atf_tc_fail("new_parse failed");
+	return cfile;
+}
+
+static void
+check_tokens(const char *text, struct test_token *expect) {
+	struct parse *cfile = start_parse(text);
+	enum dhcp_token token;
+	const char *val;
+	unsigned len;
+	int i;
+
+	for (i = 0; ; i++) {
+		token = next_token(&val, &len, cfile);
+		if (token != expect[i].token)
+			atf_tc_fail("token %d of \"%s\": %d, expected %d",
+				    i, text, token, expect[i].token);
+		if (token == END_OF_FILE)
+			break;
+		if (len != strlen(expect[i].text) ||
+		    memcmp(val, expect[i].text, len) != 0)
+			atf_tc_fail("token %d of \"%s\": \"%s\", "
+				    "expected \"%s\"", i, text, val,
+				    expect[i].text);
+	}
+	end_parse(&cfile);
+}
+
+ATF_TC(conflex_keywords);
+ATF_TC_HEAD(conflex_keywords, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify keyword lookup");
+}
+
+ATF_TC_BODY(conflex_keywords, tc)
+{
+	static struct test_token expect[] = {
+		{ SUBNET, "subnet" },
+		{ SUBNET, "Subnet" },
+		{ SUBNET, "SUBNET" },
+		{ NAME, "subnets" },
+		{ NAME, "subne" },
+		{ CLIENT_UPDATES, "client-updates" },
+		{ TOKEN_NEW, "new" },
+		{ USE_LEASE_ADDR_FOR_DEFAULT_ROUTE,
+		  "use-lease-addr-for-default-route" },
+		{ NAME, "use-lease-addr-for-default-router" },
+		{ DO_FORWARD_UPDATE, "do-forward-update" },
+		{ DO_FORWARD_UPDATE, "do-forward-updates" },
+		{ PICK, "pick" },
+		{ PICK, "pick-first-value" },
+		{ NAME, "host-name" },
+		{ NUMBER_OR_NAME, "deadbeef" },
+		{ NUMBER_OR_NAME, "abc" },
+		{ NAME, "zz" },
+		{ NUMBER, "42" },
+		{ END_OF_FILE, "" }
+	};
+
+	check_tokens("subnet Subnet SUBNET subnets subne client-updates new "
+		     "use-lease-addr-for-default-route "
+		     "use-lease-addr-for-default-router "
+		     "do-forward-update do-forward-updates "
+		     "pick pick-first-value host-name deadbeef abc zz 42",
+		     expect);
+}
+
+ATF_TC(conflex_tokens);
+ATF_TC_HEAD(conflex_tokens, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify strings, comments and "
+			  "punctuation");
+}
+
+ATF_TC_BODY(conflex_tokens, tc)
+{
+	static struct test_token expect[] = {
+		{ OPTION, "option" },
+		{ NAME, "host-name" },
+		{ STRING, "plain" },
+		{ SEMI, ";" },
+		{ STRING, "tab\there" },
+		{ STRING, "AB\"C" },
+		{ STRING, "" },
+		{ LBRACE, "{" },
+		{ NUMBER_OR_NAME, "0x1f" },
+		{ NUMBER, "10" },
+		{ DOT, "." },
+		{ NUMBER, "0" },
+		{ RBRACE, "}" },
+		{ NAME, "last" },
+		{ END_OF_FILE, "" }
+	};
+
+	check_tokens("option host-name \"plain\";  # comment \"not a string\n"
+		     "\t\"tab\\there\" \"\\101\\x42\\\"C\" \"\"#\n"
+		     "{0x1f 10.0}\r\n"
+		     "# trailing comment\n"
+		     "last # no newline", expect);
+}
+
+ATF_TC(conflex_position);
+ATF_TC_HEAD(conflex_position, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the line and column of the "
+			  "current token");
+}
+
+ATF_TC_BODY(conflex_position, tc)
+{
+	struct parse *cfile;
+	const char *val;
+
+	cfile = start_parse("# header\n"
+			    "subnet 10.0.0.0 netmask 255.0.0.0 {\n"
+			    "\trange 10.0.0.1\n"
+			    "\t      10.0.0.9;\n"
+			    "}\n");
+	cfile->line = 10;
+
+	skip_token(&val, NULL, cfile);		/* subnet */
+	lex_position(cfile);
+	ATF_CHECK_EQ(cfile->lexline, 11);
+	ATF_CHECK_EQ(cfile->lexchar, 1);
+	ATF_CHECK_STREQ(cfile->token_line,
+			"subnet 10.0.0.0 netmask 255.0.0.0 {");
+
+	while (next_token(&val, NULL, cfile) != LBRACE)
+		;
+	lex_position(cfile);
+	ATF_CHECK_EQ(cfile->lexline, 11);
+	ATF_CHECK_EQ(cfile->lexchar, 35);
+
+	/* Looking ahead doesn't move the current token. */
+	ATF_CHECK_EQ(peek_token(&val, NULL, cfile), RANGE);
+	lex_position(cfile);
+	ATF_CHECK_EQ(cfile->lexline, 11);
+	ATF_CHECK_EQ(cfile->lexchar, 35);
+
+	skip_token(&val, NULL, cfile);		/* range */
+	lex_position(cfile);
+	ATF_CHECK_EQ(cfile->lexline, 12);
+	ATF_CHECK_EQ(cfile->lexchar, 2);
+	ATF_CHECK_STREQ(cfile->token_line, "\trange 10.0.0.1");
+
+	while (next_token(&val, NULL, cfile) != SEMI)
+		;
+	lex_position(cfile);
+	ATF_CHECK_EQ(cfile->lexline, 13);
+	ATF_CHECK_EQ(cfile->lexchar, 16);
+
+	/* Going back to an earlier token counts from the start again. */
+	cfile->lexpos = 0;
+	lex_position(cfile);
+	ATF_CHECK_EQ(cfile->lexline, 10);
+	ATF_CHECK_STREQ(cfile->token_line, "# header");
+
+	end_parse(&cfile);
+}
+
+ATF_TC(conflex_bench);
+ATF_TC_HEAD(conflex_bench, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Time scanning a file of host "
+			  "declarations");
+}
+
+ATF_TC_BODY(conflex_bench, tc)
+{
+	struct parse *cfile;
+	struct timeval start;
+	const char *val;
+	char *text, *p;
+	int i, tokens = 0;
+
+	BENCH_REQUIRE();
+	text = malloc(BENCH_HOSTS * 160);
+	if (text == NULL)
+		atf_tc_fail("no memory");
+	p = text;
+	for (i = 0; i < BENCH_HOSTS; i++)
+		p += sprintf(p, "host h%d {\n"
+			     "  hardware ethernet 02:00:00:%02x:%02x:%02x;\n"
+			     "  fixed-address 10.%d.%d.%d;\n"
+			     "  option host-name \"h%d.example.com\";\n"
+			     "}\n", i, (i >> 16) & 0xff, (i >> 8) & 0xff,
+			     i & 0xff, (i >> 16) & 0xff, (i >> 8) & 0xff,
+			     i & 0xff, i);
+
+	cfile = start_parse(text);
+	bench_start(&start);
+	while (next_token(&val, NULL, cfile) != END_OF_FILE)
+		tokens++;
+	bench_report(&start, "%d tokens in %d host declarations", tokens,
+		     BENCH_HOSTS);
+	ATF_CHECK_EQ(tokens, BENCH_HOSTS * 31);
+
+	end_parse(&cfile);
+	free(text);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, conflex_keywords);
+	ATF_TP_ADD_TC(tp, conflex_tokens);
+	ATF_TP_ADD_TC(tp, conflex_position);
+	ATF_TP_ADD_TC(tp, conflex_bench);
+
+	return (atf_no_error());
+}
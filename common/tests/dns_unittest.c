@@ -20,9 +20,8 @@
 
 /*
  * This file provides unit tests for the dns and ddns code.
- * Currently this is limited to verifying the dhcid code is
- * working properly.  In time we may be able to expand the
- * tests to cover other areas.
+ * Currently this covers the dhcid code and the queue that limits
+ * the updates in flight to each zone and server.
  *
  * The tests for the interim txt records comapre to previous
  * internally generated values.
@@ -165,6 +164,353 @@ ATF_TC_BODY(interim_dhcid, tc)
 
 }
 
+/*
+ * The update queue tests stand in for the name server: ddns_update is
+ * pointed at queue_update(), which records each update instead of sending
+ * it, and the test answers an update by handing its result to
+ * ddns_complete() as ddns_interlude() would.
+ */
+#define QUEUE_MAX 8
+
+static dhcp_ddns_cb_t *queue_sent[QUEUE_MAX];	/* sent, not answered */
+static unsigned long queue_order[QUEUE_MAX];	/* ids in the order sent */
+static int queue_nsent;
+static unsigned long queue_done[QUEUE_MAX];	/* ids in the order done */
+static isc_result_t queue_result[QUEUE_MAX];
+static int queue_ndone;
+static isc_result_t queue_fail;		/* returned by the next send */
+static struct dns_zone *queue_zones[QUEUE_MAX];
+static int queue_nzones;
+static ddns_update_t queue_saved_update;
+
+static isc_result_t
+queue_update(dns_client_t *client, dns_rdataclass_t rdclass,
+	     dns_name_t *zonename, dns_namelist_t *prerequisites,
+	     dns_namelist_t *updates, isc_sockaddrlist_t *servers,
+	     dns_tsec_t *tsec, unsigned int options, isc_task_t *task,
+	     isc_taskaction_t action, void *arg,
+	     dns_clientupdatetrans_t **transp)
+{
+    dhcp_ddns_cb_t *ddns_cb = arg;
+    isc_result_t result;
+
+    *transp = NULL;
+    if (queue_fail != ISC_R_SUCCESS) {
+	result = queue_fail;
+	queue_fail = ISC_R_SUCCESS;
+	return (result);
+    }
+
+    if (queue_nsent >= QUEUE_MAX)
+	atf_tc_fail("too many updates sent");
+    queue_sent[queue_nsent] = ddns_cb;
+    queue_order[queue_nsent++] = ddns_cb->ttl;
+    return (ISC_R_SUCCESS);
+}
+
+/* Stands in for the next step of the update, which here is the last. */
+static void
+queue_finish(dhcp_ddns_cb_t *ddns_cb, isc_result_t result)
+{
+    if (queue_ndone >= QUEUE_MAX)
+	atf_tc_fail("too many updates finished");
+    queue_result[queue_ndone] = result;
+    queue_done[queue_ndone++] = ddns_cb->ttl;
+    ddns_cb_free(ddns_cb, MDL);
+}
+
+static void
+queue_setup(int zone_max, int server_max)
+{
+    static int initialized = 0;
+
+    if (!initialized) {
+	if (dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL) !=
+	    ISC_R_SUCCESS)
+	    atf_tc_fail("can't create the isc context");
+	initialized = 1;
+    }
+
+    /* Any non-NULL client will do, as the stand-in never uses it. */
+    dhcp_gbl_ctx.dnsclient = (dns_client_t *)&queue_sent;
+    queue_saved_update = ddns_update;
+    ddns_update = queue_update;
+    ddns_zone_max_inflight = zone_max;
+    ddns_server_max_inflight = server_max;
+
+    memset(queue_sent, 0, sizeof(queue_sent));
+    queue_nsent = 0;
+    queue_ndone = 0;
+    queue_nzones = 0;
+    queue_fail = ISC_R_SUCCESS;
+}
+
+/* Configure a zone whose only server is 10.0.0.server. */
+static void
+queue_zone(const char *name, int server)
+{
+    struct dns_zone *zone = NULL;
+    struct option_cache *oc = NULL;
+
+    if (!dns_zone_allocate(&zone, MDL) ||
+	!option_cache_allocate(&oc, MDL) ||
+	!buffer_allocate(&oc->data.buffer, 4, MDL))
+	atf_tc_fail("can't allocate zone %s", name);
+    oc->data.data = oc->data.buffer->data;
+    oc->data.len = 4;
+    oc->data.buffer->data[0] = 10;
+    oc->data.buffer->data[3] = server;
+    zone->primary = oc;
+
+    zone->name = dmalloc(strlen(name) + 1, MDL);
+    if (zone->name == NULL)
+	atf_tc_fail("can't allocate zone name %s", name);
+    strcpy(zone->name, name);
+
+    if (enter_dns_zone(zone) != ISC_R_SUCCESS)
+	atf_tc_fail("can't enter zone %s", name);
+    queue_zones[queue_nzones++] = zone;
+}
+
+/* Start adding the A record for fqdn, as the update numbered id. */
+static dhcp_ddns_cb_t *
+queue_start(const char *fqdn, unsigned long id)
+{
+    dhcp_ddns_cb_t *ddns_cb;
+    static unsigned char dhcid[] = { 0x00, 0x01, 0x01 };
+
+    ddns_cb = ddns_cb_alloc(MDL);
+    if ((ddns_cb == NULL) ||
+	!buffer_allocate(&ddns_cb->fwd_name.buffer, strlen(fqdn) + 1, MDL) ||
+	!buffer_allocate(&ddns_cb->dhcid.buffer, sizeof(dhcid), MDL))
+	atf_tc_fail("can't allocate update %lu", id);
+    ddns_cb->fwd_name.data = ddns_cb->fwd_name.buffer->data;
+    ddns_cb->fwd_name.len = strlen(fqdn);
+    strcpy((char *)ddns_cb->fwd_name.buffer->data, fqdn);
+    ddns_cb->dhcid.data = ddns_cb->dhcid.buffer->data;
+    ddns_cb->dhcid.len = sizeof(dhcid);
+    memcpy(ddns_cb->dhcid.buffer->data, dhcid, sizeof(dhcid));
+    ddns_cb->dhcid_class = dns_rdatatype_dhcid;
+
+    ddns_cb->address.len = 4;
+    ddns_cb->address.iabuf[0] = 192;
+    ddns_cb->address.iabuf[1] = 0;
+    ddns_cb->address.iabuf[2] = 2;
+    ddns_cb->address.iabuf[3] = id;
+    ddns_cb->ttl = id;
+    ddns_cb->state = DDNS_STATE_ADD_FW_NXDOMAIN;
+    ddns_cb->cur_func = queue_finish;
+
+    if (ddns_modify_fwd(ddns_cb, MDL) != ISC_R_SUCCESS)
+	atf_tc_fail("can't start update %lu", id);
+    return (ddns_cb);
+}
+
+/* Answer the update numbered id, which must have been sent. */
+static void
+queue_answer(unsigned long id)
+{
+    int i;
+
+    for (i = 0; i < queue_nsent; i++) {
+	if ((queue_sent[i] != NULL) && (queue_order[i] == id)) {
+	    dhcp_ddns_cb_t *ddns_cb = queue_sent[i];
+
+	    queue_sent[i] = NULL;
+	    ddns_complete(ddns_cb, ISC_R_SUCCESS);
+	    return;
+	}
+    }
+    atf_tc_fail("update %lu was not sent", id);
+}
+
+static void
+queue_check(const char *what, unsigned long *list, int count,
+	    const unsigned long *expect, int expect_count)
+{
+    int i;
+
+    if (count != expect_count)
+	atf_tc_fail("%d updates %s, expected %d", count, what,
+		    expect_count);
+    for (i = 0; i < count; i++) {
+	if (list[i] != expect[i])
+	    atf_tc_fail("update %lu %s in place %d, expected %lu",
+			list[i], what, i, expect[i]);
+    }
+}
+
+static void
+queue_cleanup(void)
+{
+    int i;
+
+    if (ddns_queued != 0)
+	atf_tc_fail("%d updates still queued", ddns_queued);
+    for (i = 0; i < queue_nzones; i++) {
+	if (queue_zones[i]->inflight != 0)
+	    atf_tc_fail("zone %s still has %d in flight",
+			queue_zones[i]->name, queue_zones[i]->inflight);
+	remove_dns_zone(queue_zones[i]);
+	dns_zone_dereference(&queue_zones[i], MDL);
+    }
+
+    ddns_update = queue_saved_update;
+    ddns_zone_max_inflight = DEFAULT_DDNS_ZONE_CONCURRENCY;
+    ddns_server_max_inflight = DEFAULT_DDNS_SERVER_CONCURRENCY;
+    dhcp_gbl_ctx.dnsclient = NULL;
+}
+
+ATF_TC(queue_server_limit);
+
+ATF_TC_HEAD(queue_server_limit, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify updates to zones sharing a "
+		      "server wait for that server, and no other.");
+}
+
+ATF_TC_BODY(queue_server_limit, tc)
+{
+    static const unsigned long sent_1[] = { 1, 2, 4 };
+    static const unsigned long sent_2[] = { 1, 2, 4, 3 };
+    static const unsigned long done[] = { 1, 2, 4, 3 };
+
+    queue_setup(0, 2);
+    queue_zone("a.example.", 1);
+    queue_zone("b.example.", 1);
+    queue_zone("c.example.", 2);
+
+    /* Two zones on 10.0.0.1 share its two places, so the third update
+       to it waits while the update to 10.0.0.2 goes straight out. */
+    queue_start("h1.a.example", 1);
+    queue_start("h2.b.example", 2);
+    queue_start("h3.a.example", 3);
+    queue_start("h4.c.example", 4);
+    queue_check("sent", queue_order, queue_nsent, sent_1, 3);
+    if (ddns_queued != 1)
+	atf_tc_fail("%d updates queued, expected 1", ddns_queued);
+
+    queue_answer(1);
+    queue_check("sent", queue_order, queue_nsent, sent_2, 4);
+
+    queue_answer(2);
+    queue_answer(4);
+    queue_answer(3);
+    queue_check("done", queue_done, queue_ndone, done, 4);
+
+    queue_cleanup();
+}
+
+ATF_TC(queue_zone_limit);
+
+ATF_TC_HEAD(queue_zone_limit, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify updates over the zone limit "
+		      "are sent in the order they were started.");
+}
+
+ATF_TC_BODY(queue_zone_limit, tc)
+{
+    static const unsigned long sent_1[] = { 1, 3 };
+    static const unsigned long sent_2[] = { 1, 3, 2, 4 };
+    static const unsigned long sent_3[] = { 1, 3, 2, 4, 5 };
+
+    queue_setup(1, 0);
+    queue_zone("d.example.", 3);
+    queue_zone("e.example.", 3);
+
+    queue_start("h1.d.example", 1);
+    queue_start("h2.d.example", 2);
+    queue_start("h3.e.example", 3);
+    queue_start("h4.e.example", 4);
+    queue_start("h5.d.example", 5);
+    queue_check("sent", queue_order, queue_nsent, sent_1, 2);
+
+    /* Each answer makes room for the oldest update waiting on that
+       zone, which is sent before the answered update is finished. */
+    queue_answer(1);
+    queue_answer(3);
+    queue_check("sent", queue_order, queue_nsent, sent_2, 4);
+    queue_answer(2);
+    queue_check("sent", queue_order, queue_nsent, sent_3, 5);
+
+    queue_answer(4);
+    queue_answer(5);
+    if (queue_ndone != 5)
+	atf_tc_fail("%d updates done, expected 5", queue_ndone);
+
+    queue_cleanup();
+}
+
+ATF_TC(queue_cancel);
+
+ATF_TC_HEAD(queue_cancel, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify a waiting update that is "
+		      "cancelled is dropped without being sent.");
+}
+
+ATF_TC_BODY(queue_cancel, tc)
+{
+    static const unsigned long sent[] = { 1, 3 };
+    static const unsigned long done[] = { 1, 3 };
+    dhcp_ddns_cb_t *ddns_cb;
+    u_int32_t dropped = ddns_dropped;
+
+    queue_setup(1, 0);
+    queue_zone("f.example.", 4);
+
+    queue_start("h1.f.example", 1);
+    ddns_cb = queue_start("h2.f.example", 2);
+    queue_start("h3.f.example", 3);
+    ddns_cancel(ddns_cb, MDL);
+
+    queue_answer(1);
+    queue_check("sent", queue_order, queue_nsent, sent, 2);
+    if (ddns_dropped != dropped + 1)
+	atf_tc_fail("%u updates dropped, expected 1",
+		    ddns_dropped - dropped);
+
+    queue_answer(3);
+    queue_check("done", queue_done, queue_ndone, done, 2);
+
+    queue_cleanup();
+}
+
+ATF_TC(queue_send_failure);
+
+ATF_TC_HEAD(queue_send_failure, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify a waiting update that can't "
+		      "be sent is finished with the error.");
+}
+
+ATF_TC_BODY(queue_send_failure, tc)
+{
+    static const unsigned long sent[] = { 1, 3 };
+    static const unsigned long done[] = { 2, 1, 3 };
+
+    queue_setup(0, 1);
+    queue_zone("g.example.", 5);
+
+    queue_start("h1.g.example", 1);
+    queue_start("h2.g.example", 2);
+    queue_start("h3.g.example", 3);
+
+    /* Sending the second fails, which must leave its place free for
+       the third. */
+    queue_fail = ISC_R_CONNREFUSED;
+    queue_answer(1);
+    queue_check("sent", queue_order, queue_nsent, sent, 2);
+    if ((queue_ndone < 1) || (queue_result[0] != ISC_R_CONNREFUSED))
+	atf_tc_fail("failed update wasn't finished with its error");
+
+    queue_answer(3);
+    queue_check("done", queue_done, queue_ndone, done, 3);
+
+    queue_cleanup();
+}
+
 /* This macro defines main() method that will call specified
    test cases. tp and simple_test_case names can be whatever you want
    as long as it is a valid variable identifier. */
@@ -172,6 +518,10 @@ ATF_TP_ADD_TCS(tp)
 {
     ATF_TP_ADD_TC(tp, interim_dhcid);
     ATF_TP_ADD_TC(tp, standard_dhcid);
+    ATF_TP_ADD_TC(tp, queue_server_limit);
+    ATF_TP_ADD_TC(tp, queue_zone_limit);
+    ATF_TP_ADD_TC(tp, queue_cancel);
+    ATF_TP_ADD_TC(tp, queue_send_failure);
 
     return (atf_no_error());
 }
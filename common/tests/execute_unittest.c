@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include <errno.h>
+#include <poll.h>
+#include "dhcpd.h"
+
+/*
+ * The dispatcher never runs in these tests.  Instead we wait on the
+ * SIGCHLD pipe ourselves and call execute_reap() when it is readable,
+ * which is what the dispatcher would do.  Timeouts are run by moving
+ * cur_tv forward and calling process_outstanding_timeouts().
+ */
+
+#if defined (ENABLE_EXECUTE)
+/* Build an argument vector the way execute_statements() does. */
+static char **
+make_argv(const char *command, const char *arg) {
+    char **argv;
+
+    argv = dmalloc(3 * sizeof(*argv), MDL);
+    ATF_REQUIRE(argv != NULL);
+    memset(argv, 0, 3 * sizeof(*argv));
+    argv[0] = dmalloc(strlen(command) + 1, MDL);
+    ATF_REQUIRE(argv[0] != NULL);
+    strcpy(argv[0], command);
+    if (arg != NULL) {
+        argv[1] = dmalloc(strlen(arg) + 1, MDL);
+        ATF_REQUIRE(argv[1] != NULL);
+        strcpy(argv[1], arg);
+    }
+    return (argv);
+}
+
+static void
+run(const char *command, const char *arg) {
+    ATF_REQUIRE(execute_async(make_argv(command, arg),
+                              arg != NULL ? 1 : 0));
+}
+
+/* Wait up to five seconds for SIGCHLD to write to the pipe. */
+static int
+wait_sigchld(void) {
+    struct pollfd pfd;
+    int rv;
+
+    pfd.fd = execute_readsocket(NULL);
+    pfd.events = POLLIN;
+    do {
+        pfd.revents = 0;
+        rv = poll(&pfd, 1, 5000);
+    } while (rv < 0 && errno == EINTR);
+    return (rv == 1);
+}
+
+/* Wait for SIGCHLD and reap until the counts are as given. */
+static void
+reap_until(int running, int queued) {
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        if (execute_running == running && execute_queued == queued)
+            return;
+
+        if (!wait_sigchld()) {
+            atf_tc_fail("ERROR: no SIGCHLD with %d running %s:%d",
+                        execute_running, MDL);
+        }
+        execute_reap(NULL);
+    }
+    atf_tc_fail("ERROR: %d running and %d queued, not %d and %d %s:%d",
+                execute_running, execute_queued, running, queued, MDL);
+}
+#endif
+
+ATF_TC(execute_queue_full);
+
+ATF_TC_HEAD(execute_queue_full, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "This test case checks that commands "
+                      "beyond the running limit are queued, and that they "
+                      "are dropped once the queue is full.");
+}
+
+ATF_TC_BODY(execute_queue_full, tc)
+{
+#if defined (ENABLE_EXECUTE)
+    u_int32_t dropped;
+
+    execute_max_running = 1;
+    execute_max_queued = 1;
+    dropped = execute_dropped;
+
+    run("true", NULL);
+    ATF_CHECK_EQ(execute_running, 1);
+    ATF_CHECK_EQ(execute_queued, 0);
+
+    run("true", NULL);
+    ATF_CHECK_EQ(execute_running, 1);
+    ATF_CHECK_EQ(execute_queued, 1);
+
+    /* No room left, this one and the next are dropped. */
+    run("true", NULL);
+    run("true", "x");
+    ATF_CHECK_EQ(execute_running, 1);
+    ATF_CHECK_EQ(execute_queued, 1);
+    ATF_CHECK_EQ(execute_dropped, dropped + 2);
+
+    reap_until(0, 0);
+    ATF_CHECK_EQ(execute_dropped, dropped + 2);
+#else
+    atf_tc_skip("execute() is disabled");
+#endif
+}
+
+ATF_TC(execute_sigchld);
+
+ATF_TC_HEAD(execute_sigchld, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "This test case checks that SIGCHLD "
+                      "wakes the dispatcher and that reaping one command "
+                      "starts the next with a concurrency of one.");
+}
+
+ATF_TC_BODY(execute_sigchld, tc)
+{
+#if defined (ENABLE_EXECUTE)
+    execute_max_running = 1;
+    execute_max_queued = 4;
+
+    run("true", NULL);
+    run("sleep", "0");
+    run("true", NULL);
+    ATF_CHECK_EQ(execute_running, 1);
+    ATF_CHECK_EQ(execute_queued, 2);
+
+    /* Nothing is reaped until the pipe says a command has finished. */
+    ATF_REQUIRE(wait_sigchld());
+    ATF_CHECK_EQ(execute_running, 1);
+    ATF_CHECK_EQ(execute_queued, 2);
+
+    /* Each reap replaces the finished command with the next one. */
+    execute_reap(NULL);
+    ATF_CHECK_EQ(execute_running, 1);
+    ATF_CHECK_EQ(execute_queued, 1);
+
+    reap_until(1, 0);
+    reap_until(0, 0);
+
+    /* With nothing left, reaping again changes nothing. */
+    execute_reap(NULL);
+    ATF_CHECK_EQ(execute_running, 0);
+    ATF_CHECK_EQ(execute_queued, 0);
+#else
+    atf_tc_skip("execute() is disabled");
+#endif
+}
+
+ATF_TC(execute_timeout_kill);
+
+ATF_TC_HEAD(execute_timeout_kill, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "This test case checks that a command "
+                      "running past execute-timeout is killed and that the "
+                      "command queued behind it then runs.");
+}
+
+ATF_TC_BODY(execute_timeout_kill, tc)
+{
+#if defined (ENABLE_EXECUTE)
+    struct timeval start, now, next;
+
+    dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+    cur_tv.tv_sec = 1000;
+    cur_tv.tv_usec = 0;
+
+    execute_max_running = 1;
+    execute_max_queued = 4;
+    execute_timeout = 2;
+
+    gettimeofday(&start, NULL);
+    run("sleep", "60");
+    run("true", NULL);
+    ATF_CHECK_EQ(execute_running, 1);
+    ATF_CHECK_EQ(execute_queued, 1);
+
+    /* Not due yet, the command is left alone. */
+    cur_tv.tv_sec = 1001;
+    process_outstanding_timeouts(NULL);
+    ATF_CHECK_EQ(execute_running, 1);
+    ATF_CHECK_EQ(execute_queued, 1);
+
+    /* Now it is killed, reaped, and the queued command started. */
+    cur_tv.tv_sec = 1002;
+    process_outstanding_timeouts(NULL);
+    reap_until(1, 0);
+    reap_until(0, 0);
+
+    gettimeofday(&now, NULL);
+    if (now.tv_sec - start.tv_sec >= 30) {
+        atf_tc_fail("ERROR: sleep ran for %ld seconds %s:%d",
+                    (long)(now.tv_sec - start.tv_sec), MDL);
+    }
+
+    /* The finished command's timeout was cancelled along with it. */
+    ATF_CHECK(process_outstanding_timeouts(&next) == NULL);
+#else
+    atf_tc_skip("execute() is disabled");
+#endif
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+    ATF_TP_ADD_TC(tp, execute_queue_full);
+    ATF_TP_ADD_TC(tp, execute_sigchld);
+    ATF_TP_ADD_TC(tp, execute_timeout_kill);
+
+    return (atf_no_error());
+}
@@ -17,6 +17,7 @@
 #include <config.h>
 #include <atf-c.h>
 #include "dhcpd.h"
+#include "t_bench.h"
 
 ATF_TC(option_refcnt);
 
@@ -130,6 +131,609 @@ ATF_TC_BODY(pretty_print_option, tc)
 }
 
 
+ATF_TC(option_code_table);
+
+ATF_TC_HEAD(option_code_table, tc)
+{
+    atf_tc_set_md_var(tc, "descr",
+		      "Verify the option tables agree with the code hashes.");
+}
+
+ATF_TC_BODY(option_code_table, tc)
+{
+    struct universe *spaces[] = { &dhcp_universe, &dhcpv6_universe };
+    struct option *option, *hashed;
+    unsigned code, i;
+
+    initialize_common_option_spaces();
+
+    for (i = 0; i < 2; i++) {
+	ATF_REQUIRE(spaces[i]->code_table != NULL);
+	for (code = 0; code < 0x10000; code++) {
+	    option = hashed = NULL;
+	    option_code_lookup(&option, spaces[i], code, MDL);
+	    option_code_hash_lookup(&hashed, spaces[i]->code_hash,
+				    &code, 0, MDL);
+	    if (option != hashed) {
+		atf_tc_fail("%s option %u differs", spaces[i]->name, code);
+	    }
+	    if (option != NULL) {
+		option_dereference(&option, MDL);
+		option_dereference(&hashed, MDL);
+	    }
+	}
+    }
+
+    /* Spaces with 32 bit codes stay hashed. */
+    ATF_CHECK(vsio_universe.code_table == NULL);
+}
+
+static void
+count_option(struct option_cache *oc, struct packet *packet,
+	     struct lease *lease, struct client_state *client_state,
+	     struct option_state *in_options, struct option_state *cfg_options,
+	     struct binding_scope **scope, struct universe *u, void *stuff)
+{
+    (*(int *)stuff)++;
+}
+
+ATF_TC(option_indexed_state);
+
+ATF_TC_HEAD(option_indexed_state, tc)
+{
+    atf_tc_set_md_var(tc, "descr",
+		      "Verify saving, finding and deleting options by code.");
+}
+
+ATF_TC_BODY(option_indexed_state, tc)
+{
+    struct option_state *options;
+    struct option_cache *oc;
+    unsigned char data[4] = { 1, 2, 3, 4 };
+    unsigned codes[] = { 3, 23, 1000, 65535, 6 };
+    int i, count;
+
+    initialize_common_option_spaces();
+
+    options = NULL;
+    if (!option_state_allocate(&options, MDL)) {
+	atf_tc_fail("can't allocate option state");
+    }
+
+    /* Include codes past the end of the option table. */
+    for (i = 0; i < 5; i++) {
+	data[0] = i;
+	ATF_REQUIRE(save_option_buffer(&dhcpv6_universe, options, NULL,
+				       data, sizeof(data), codes[i], 0));
+    }
+    for (i = 0; i < 5; i++) {
+	oc = lookup_option(&dhcpv6_universe, options, codes[i]);
+	if (oc == NULL || oc->data.data[0] != i) {
+	    atf_tc_fail("option %u not found", codes[i]);
+	}
+    }
+    ATF_CHECK(lookup_option(&dhcpv6_universe, options, 4) == NULL);
+    ATF_CHECK(lookup_option(&dhcpv6_universe, options, 999) == NULL);
+    ATF_CHECK(lookup_option(&dhcp_universe, options, 3) == NULL);
+
+    /* Appending keeps the first, saving again replaces it. */
+    data[0] = 10;
+    ATF_REQUIRE(append_option_buffer(&dhcpv6_universe, options, NULL,
+				     data, sizeof(data), 1000, 0));
+    oc = lookup_option(&dhcpv6_universe, options, 1000);
+    ATF_CHECK(oc->data.data[0] == 2 && oc->next != NULL &&
+	      oc->next->data.data[0] == 10);
+    data[0] = 11;
+    ATF_REQUIRE(save_option_buffer(&dhcpv6_universe, options, NULL,
+				   data, sizeof(data), 23, 0));
+    oc = lookup_option(&dhcpv6_universe, options, 23);
+    ATF_CHECK(oc->data.data[0] == 11 && oc->next == NULL);
+
+    count = 0;
+    option_space_foreach(NULL, NULL, NULL, NULL, options, NULL,
+			 &dhcpv6_universe, &count, count_option);
+    ATF_CHECK_EQ(count, 5);
+
+    delete_option(&dhcpv6_universe, options, 3);
+    delete_option(&dhcpv6_universe, options, 65535);
+    delete_option(&dhcpv6_universe, options, 4);
+    ATF_CHECK(lookup_option(&dhcpv6_universe, options, 3) == NULL);
+    ATF_CHECK(lookup_option(&dhcpv6_universe, options, 65535) == NULL);
+    ATF_CHECK(lookup_option(&dhcpv6_universe, options, 1000) != NULL);
+
+    count = 0;
+    option_space_foreach(NULL, NULL, NULL, NULL, options, NULL,
+			 &dhcpv6_universe, &count, count_option);
+    ATF_CHECK_EQ(count, 3);
+
+    option_state_dereference(&options, MDL);
+}
+
+ATF_TC(option_high_code);
+
+ATF_TC_HEAD(option_high_code, tc)
+{
+    atf_tc_set_md_var(tc, "descr",
+		      "Verify an option defined past the option table is "
+		      "found by code and kept on the overflow list.");
+}
+
+ATF_TC_BODY(option_high_code, tc)
+{
+    struct option_state *options;
+    struct option_index *idx;
+    struct option_cache *oc;
+    struct option *option, *found;
+    unsigned char data[2] = { 0xab, 0xcd };
+    unsigned code = 60000;
+
+    initialize_common_option_spaces();
+
+    /* As if from "option dhcp6.high-code code 60000 = unsigned integer 16;" */
+    option = new_option("high-code", MDL);
+    ATF_REQUIRE(option != NULL);
+    option->format = "S";
+    option->code = code;
+    option->universe = &dhcpv6_universe;
+    option_code_add(&dhcpv6_universe, option);
+    option_name_hash_add(dhcpv6_universe.name_hash, option->name, 0,
+			 option, MDL);
+
+    /* The table doesn't grow to cover it, but it is found by code. */
+    ATF_CHECK(dhcpv6_universe.code_table_size <= OPTION_CODE_TABLE_MAX);
+    found = NULL;
+    ATF_REQUIRE(option_code_lookup(&found, &dhcpv6_universe, code, MDL));
+    ATF_CHECK(found == option);
+    option_dereference(&found, MDL);
+
+    /* Nor does the index of an option state holding it. */
+    options = NULL;
+    if (!option_state_allocate(&options, MDL)) {
+	atf_tc_fail("can't allocate option state");
+    }
+    ATF_REQUIRE(save_option_buffer(&dhcpv6_universe, options, NULL,
+				   data, sizeof(data), code, 0));
+    idx = options->universes[dhcpv6_universe.index];
+    ATF_REQUIRE(idx != NULL);
+    ATF_CHECK(idx->size <= OPTION_CODE_TABLE_MAX);
+    ATF_CHECK(idx->overflow != NULL);
+
+    oc = lookup_option(&dhcpv6_universe, options, code);
+    ATF_REQUIRE(oc != NULL);
+    ATF_CHECK(oc->option == option);
+    ATF_CHECK(oc->data.len == 2 && oc->data.data[0] == 0xab);
+
+    delete_option(&dhcpv6_universe, options, code);
+    ATF_CHECK(lookup_option(&dhcpv6_universe, options, code) == NULL);
+
+    option_state_dereference(&options, MDL);
+}
+
+#define BENCH_PACKETS 1000000
+
+ATF_TC(option_packet_arena);
+
+ATF_TC_HEAD(option_packet_arena, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify a packet's options are decoded "
+		      "into its arena, and that what's still referenced "
+		      "outlives the packet.");
+}
+
+ATF_TC_BODY(option_packet_arena, tc)
+{
+    unsigned char discover[] = {
+	53, 1, 1,
+	12, 4, 'h', 'o', 's', 't',
+	60, 4, 'M', 'S', 'F', 'T',
+	255
+    };
+    struct option_state *options = NULL, *previous = NULL;
+    struct option_cache *oc, *kept = NULL;
+    struct packet *packet;
+    int i;
+
+    initialize_common_option_spaces();
+
+    /* Not processing a packet, so nothing comes from an arena. */
+    ATF_REQUIRE(option_state_allocate(&options, MDL));
+    ATF_CHECK(options->chunk == NULL);
+    option_state_dereference(&options, MDL);
+
+    for (i = 0; i < 3; i++) {
+	/* A different host name each time. */
+	discover[8] = '0' + i;
+	packet = NULL;
+	ATF_REQUIRE(packet_allocate(&packet, MDL));
+	current_packet_arena = &packet->arena;
+	ATF_REQUIRE(option_state_allocate(&packet->options, MDL));
+	ATF_REQUIRE(parse_option_buffer(packet->options, discover,
+					sizeof(discover), &dhcp_universe));
+	current_packet_arena = NULL;
+
+	ATF_CHECK(packet->options->chunk != NULL);
+	oc = lookup_option(&dhcp_universe, packet->options, DHO_HOST_NAME);
+	ATF_REQUIRE(oc != NULL);
+	ATF_CHECK(oc->data.buffer->chunk != NULL);
+
+	/* The first packet's host name is held on to, so its chunk has to
+	   stay; the second packet's chunk is free for the third. */
+	if (i == 0)
+	    option_cache_reference(&kept, oc, MDL);
+	else if (i == 2)
+	    ATF_CHECK(packet->options == previous);
+	previous = packet->options;
+
+	packet_dereference(&packet, MDL);
+    }
+
+    ATF_REQUIRE(kept != NULL);
+    ATF_CHECK(kept->data.len == 4 &&
+	      memcmp(kept->data.data, "hos0", 4) == 0);
+    option_cache_dereference(&kept, MDL);
+}
+
+ATF_TC(option_arena_to_heap);
+
+ATF_TC_HEAD(option_arena_to_heap, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify options kept after their packet "
+		      "is released can be moved out of its arena, so that "
+		      "they don't keep its chunk.");
+}
+
+ATF_TC_BODY(option_arena_to_heap, tc)
+{
+    unsigned char discover[] = {
+	53, 1, 1,
+	12, 4, 'h', 'o', 's', 't',
+	60, 4, 'M', 'S', 'F', 'T',
+	255
+    };
+    struct option_chain_head *chain = NULL;
+    struct option_state *previous;
+    struct option_cache *oc;
+    struct data_string kept;
+    struct packet *packet;
+    pair p;
+    int i;
+
+    initialize_common_option_spaces();
+    memset(&kept, 0, sizeof(kept));
+
+    /* Keep the host name as a scope would, and the host name and vendor
+       class in a chain as a lease keeps its relay agent options. */
+    packet = NULL;
+    ATF_REQUIRE(packet_allocate(&packet, MDL));
+    current_packet_arena = &packet->arena;
+    ATF_REQUIRE(option_state_allocate(&packet->options, MDL));
+    ATF_REQUIRE(parse_option_buffer(packet->options, discover,
+				    sizeof(discover), &dhcp_universe));
+    current_packet_arena = NULL;
+    previous = packet->options;
+
+    oc = lookup_option(&dhcp_universe, packet->options, DHO_HOST_NAME);
+    ATF_REQUIRE(oc != NULL);
+    data_string_copy(&kept, &oc->data, MDL);
+    ATF_CHECK(kept.buffer->chunk != NULL);
+    ATF_CHECK(data_string_to_heap(&kept, MDL));
+    ATF_CHECK(kept.buffer->chunk == NULL);
+
+    ATF_REQUIRE(option_chain_head_allocate(&chain, MDL));
+    chain->first = cons(NULL, cons(NULL, NULL));
+    ATF_REQUIRE(chain->first != NULL && chain->first->cdr != NULL);
+    option_cache_reference((struct option_cache **)&chain->first->car,
+			   oc, MDL);
+    oc = lookup_option(&dhcp_universe, packet->options,
+		       DHO_VENDOR_CLASS_IDENTIFIER);
+    ATF_REQUIRE(oc != NULL);
+    option_cache_reference((struct option_cache **)&chain->first->cdr->car,
+			   oc, MDL);
+    option_chain_head_to_heap(chain, MDL);
+    for (p = chain->first; p != NULL; p = p->cdr) {
+	oc = (struct option_cache *)p->car;
+	ATF_CHECK(oc->data.buffer->chunk == NULL);
+	ATF_CHECK(oc->data.data == oc->data.buffer->data);
+    }
+
+    /* Heap data is left alone. */
+    oc = (struct option_cache *)chain->first->car;
+    ATF_CHECK(data_string_to_heap(&oc->data, MDL));
+    ATF_CHECK(oc->data.data == oc->data.buffer->data);
+
+    packet_dereference(&packet, MDL);
+
+    /* Nothing kept is in the chunk, so the next packet gets it. */
+    packet = NULL;
+    ATF_REQUIRE(packet_allocate(&packet, MDL));
+    current_packet_arena = &packet->arena;
+    ATF_REQUIRE(option_state_allocate(&packet->options, MDL));
+    current_packet_arena = NULL;
+    ATF_CHECK(packet->options == previous);
+    packet_dereference(&packet, MDL);
+
+    ATF_CHECK(kept.len == 4 && memcmp(kept.data, "host", 4) == 0);
+    for (i = 0, p = chain->first; p != NULL; p = p->cdr, i++) {
+	oc = (struct option_cache *)p->car;
+	ATF_CHECK(oc->data.len == 4 &&
+		  memcmp(oc->data.data, i ? "MSFT" : "host", 4) == 0);
+    }
+    option_chain_head_dereference(&chain, MDL);
+    data_string_forget(&kept, MDL);
+}
+
+ATF_TC(option_bench);
+
+ATF_TC_HEAD(option_bench, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Time decoding the options of a "
+		      "DISCOVER and building those of an OFFER.");
+}
+
+ATF_TC_BODY(option_bench, tc)
+{
+    /* The options a Windows client puts in a DISCOVER. */
+    unsigned char discover[] = {
+	53, 1, 1,
+	61, 7, 1, 0, 1, 2, 3, 4, 5,
+	50, 4, 10, 0, 0, 7,
+	12, 8, 'w', 'o', 'r', 'k', 's', 't', 'n', '1',
+	81, 12, 0, 0, 0, 'w', 'o', 'r', 'k', 's', 't', 'n', '1', '.',
+	60, 8, 'M', 'S', 'F', 'T', ' ', '5', '.', '0',
+	55, 14, 1, 3, 6, 15, 31, 33, 43, 44, 46, 47, 119, 121, 249, 252,
+	57, 2, 5, 220,
+	255
+    };
+    unsigned offer[] = { 1, 3, 6, 15, 28, 42, 44, 46, 51, 54, 58, 59, 119 };
+    struct option_state *options, *cfg_options;
+    struct data_string prl;
+    struct dhcp_packet raw;
+    struct timeval start;
+    unsigned char data[8];
+    int i, len = 0;
+
+    BENCH_REQUIRE();
+    initialize_common_option_spaces();
+
+    bench_start(&start);
+    for (i = 0; i < BENCH_PACKETS; i++) {
+	options = NULL;
+	if (!option_state_allocate(&options, MDL) ||
+	    !parse_option_buffer(options, discover, sizeof(discover),
+				 &dhcp_universe)) {
+	    atf_tc_fail("can't parse the DISCOVER");
+	}
+	option_state_dereference(&options, MDL);
+    }
+    bench_report(&start, "decode %d DISCOVERs", BENCH_PACKETS);
+
+    cfg_options = NULL;
+    ATF_REQUIRE(option_state_allocate(&cfg_options, MDL));
+    memset(data, 10, sizeof(data));
+    for (i = 0; i < sizeof(offer) / sizeof(offer[0]); i++) {
+	ATF_REQUIRE(save_option_buffer(&dhcp_universe, cfg_options, NULL,
+				       data, 4, offer[i], 0));
+    }
+    data[0] = DHCPOFFER;
+    ATF_REQUIRE(save_option_buffer(&dhcp_universe, cfg_options, NULL,
+				   data, 1, DHO_DHCP_MESSAGE_TYPE, 0));
+
+    memset(&prl, 0, sizeof(prl));
+    prl.data = discover + 54;
+    prl.len = 14;
+    ATF_REQUIRE(prl.data[-2] == DHO_DHCP_PARAMETER_REQUEST_LIST);
+
+    bench_start(&start);
+    for (i = 0; i < BENCH_PACKETS; i++) {
+	len = cons_options(NULL, &raw, NULL, NULL, 0, NULL, cfg_options,
+			   NULL, 0, 0, 0, &prl, NULL);
+    }
+    bench_report(&start, "build %d OFFERs", BENCH_PACKETS);
+    ATF_CHECK(len > DHCP_FIXED_NON_UDP);
+
+    option_state_dereference(&cfg_options, MDL);
+}
+
+ATF_TC(option_encoded_cache);
+
+ATF_TC_HEAD(option_encoded_cache, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify options encoded through the "
+		      "encoded option cache are the same as those encoded "
+		      "afresh, and time both if benchmarks are enabled.");
+}
+
+static struct executable_statement *
+config_statement(const char *text) {
+    struct executable_statement *stmt = NULL;
+    struct parse *cfile = NULL;
+    int lose = 0;
+
+    if (new_parse(&cfile, -1, (char *)text, strlen(text),
+		  "test statement", 0) != ISC_R_SUCCESS)
+	atf_tc_fail("can't set up parse");
+    if (!parse_executable_statement(&stmt, cfile, &lose, context_any))
+	atf_tc_fail("can't parse %s", text);
+    end_parse(&cfile);
+    return stmt;
+}
+
+/* Build the options ack_lease() would for the i'th lease: the configured
+   ones, and some made up for the lease. */
+static struct option_state *
+lease_options(struct executable_statement **config, int count, int i) {
+    struct option_state *options = NULL;
+    unsigned char data[4];
+    const char *message = i % 5 == 4 ? "a longer message" : "message";
+    int j;
+
+    ATF_REQUIRE(option_state_allocate(&options, MDL));
+    for (j = 0; j < count; j++)
+	save_option(&dhcp_universe, options, config[j]->data.option);
+
+    data[0] = DHCPOFFER;
+    ATF_REQUIRE(save_option_buffer(&dhcp_universe, options, NULL, data, 1,
+				   DHO_DHCP_MESSAGE_TYPE, 0));
+    putULong(data, 3600 + i);
+    ATF_REQUIRE(save_option_buffer(&dhcp_universe, options, NULL, data, 4,
+				   DHO_DHCP_LEASE_TIME, 0));
+    putULong(data, 1800 + i);
+    ATF_REQUIRE(save_option_buffer(&dhcp_universe, options, NULL, data, 4,
+				   DHO_DHCP_RENEWAL_TIME, 0));
+    ATF_REQUIRE(save_option_buffer(&dhcp_universe, options, NULL,
+				   (unsigned char *)message, strlen(message),
+				   DHO_DHCP_MESSAGE, 0));
+    return options;
+}
+
+ATF_TC_BODY(option_encoded_cache, tc)
+{
+    const char *config_text[] = {
+	"option subnet-mask 255.255.255.0;",
+	"option routers 10.0.0.1;",
+	"option domain-name-servers 10.0.0.2, 10.0.0.3;",
+	"option domain-name \"example.com\";",
+	"option host-name = concat(\"pc\", \"-1\");",
+	"option ntp-servers 10.0.0.4;",
+	"option dhcp-server-identifier 10.0.0.5;"
+    };
+    unsigned char prl_data[][12] = {
+	{ 1, 3, 6, 15, 12, 42, 56 },
+	{ 3, 1, 6, 12, 42, 56, 119, 252 }
+    };
+    struct executable_statement *config[7];
+    struct option_state *options;
+    struct dhcp_packet fresh, cached;
+    struct data_string prl;
+    struct timeval start;
+    int count = sizeof(config) / sizeof(config[0]);
+    int i, pass, flen, clen;
+    unsigned long hits;
+
+    initialize_common_option_spaces();
+
+    for (i = 0; i < count; i++) {
+	config[i] = config_statement(config_text[i]);
+	ATF_CHECK(config[i]->data.option->flags & OPTION_CONSTANT);
+    }
+
+    hits = encoded_options_hits;
+    for (i = 0; i < 40; i++) {
+	/* Replace a configured option halfway through. */
+	if (i == 20) {
+	    executable_statement_dereference(&config[1], MDL);
+	    config[1] = config_statement("option routers 10.0.0.9;");
+	}
+
+	options = lease_options(config, count, i);
+	memset(&prl, 0, sizeof(prl));
+	prl.data = prl_data[i % 2];
+	prl.len = strlen((char *)prl.data);
+
+	memset(&fresh, 0, sizeof(fresh));
+	memset(&cached, 0, sizeof(cached));
+	encoded_options_disabled = 1;
+	flen = cons_options(NULL, &fresh, NULL, NULL, 0, NULL, options,
+			    NULL, 0, i % 3 == 0, 0, &prl, NULL);
+	encoded_options_disabled = 0;
+	clen = cons_options(NULL, &cached, NULL, NULL, 0, NULL, options,
+			    NULL, 0, i % 3 == 0, 0, &prl, NULL);
+	ATF_CHECK_EQ(flen, clen);
+	ATF_CHECK_MSG(memcmp(fresh.options, cached.options,
+			     flen - DHCP_FIXED_NON_UDP) == 0,
+		      "lease %d: options differ", i);
+	option_state_dereference(&options, MDL);
+    }
+    ATF_CHECK(encoded_options_hits > hits);
+
+    options = lease_options(config, count, 0);
+    memset(&prl, 0, sizeof(prl));
+    prl.data = prl_data[1];
+    prl.len = strlen((char *)prl.data);
+    for (pass = 0; bench_enabled() && pass < 2; pass++) {
+	encoded_options_disabled = !pass;
+	bench_start(&start);
+	for (i = 0; i < BENCH_PACKETS / 10; i++) {
+	    clen = cons_options(NULL, &cached, NULL, NULL, 0, NULL, options,
+				NULL, 0, 0, 0, &prl, NULL);
+	}
+	bench_report(&start, "%s %d OFFERs", pass ? "cached" : "encode",
+		     BENCH_PACKETS / 10);
+    }
+    encoded_options_disabled = 0;
+    option_state_dereference(&options, MDL);
+
+    for (i = 0; i < count; i++)
+	executable_statement_dereference(&config[i], MDL);
+}
+
+ATF_TC(option_encoded_cache_evaluations);
+
+ATF_TC_HEAD(option_encoded_cache_evaluations, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify an option that isn't constant "
+		      "is evaluated once per reply whether the encoded "
+		      "option cache misses or hits.");
+}
+
+ATF_TC_BODY(option_encoded_cache_evaluations, tc)
+{
+    struct executable_statement *define, *set, *option;
+    struct binding_scope *scope = NULL;
+    struct binding *evals;
+    struct option_state *options = NULL;
+    struct dhcp_packet raw;
+    struct data_string prl;
+    unsigned char prl_data[] = { 1, 12, 0 };
+    unsigned long hits;
+    int i;
+
+    initialize_common_option_spaces();
+
+    /* Each call of count() adds a byte to evals.  Function calls yield
+       no data, so the option falls back to a constant. */
+    define = config_statement("define count(name) { "
+			      "set grown = concat(evals, name); "
+			      "set evals = grown; return name; }");
+    set = config_statement("set evals = \"-\";");
+    option = config_statement("option host-name = "
+			      "pick-first-value(count(\"x\"), \"pc\");");
+    ATF_CHECK(!(option->data.option->flags & OPTION_CONSTANT));
+
+    ATF_REQUIRE(binding_scope_allocate(&scope, MDL));
+    execute_statements(NULL, NULL, NULL, NULL, NULL, NULL, &scope,
+		       define, NULL);
+    execute_statements(NULL, NULL, NULL, NULL, NULL, NULL, &scope,
+		       set, NULL);
+    evals = find_binding(scope, "evals");
+    ATF_REQUIRE(evals != NULL);
+
+    ATF_REQUIRE(option_state_allocate(&options, MDL));
+    save_option(&dhcp_universe, options, option->data.option);
+    memset(&prl, 0, sizeof(prl));
+    prl.data = prl_data;
+    prl.len = strlen((char *)prl.data);
+
+    /* The first reply misses the cache, the second hits it. */
+    hits = encoded_options_hits;
+    for (i = 1; i <= 2; i++) {
+	memset(&raw, 0, sizeof(raw));
+	cons_options(NULL, &raw, NULL, NULL, 0, NULL, options, &scope,
+		     0, 0, 0, &prl, NULL);
+	ATF_REQUIRE(evals->value != NULL);
+	ATF_CHECK_MSG(evals->value->value.data.len == i + 1,
+		      "reply %d: %d evaluations", i,
+		      evals->value->value.data.len - 1);
+    }
+    ATF_CHECK_EQ(encoded_options_hits, hits + 1);
+
+    option_state_dereference(&options, MDL);
+    binding_scope_dereference(&scope, MDL);
+    executable_statement_dereference(&option, MDL);
+    executable_statement_dereference(&set, MDL);
+    executable_statement_dereference(&define, MDL);
+}
+
 /* This macro defines main() method that will call specified
    test cases. tp and simple_test_case names can be whatever you want
    as long as it is a valid variable identifier. */
@@ -137,6 +741,14 @@ ATF_TP_ADD_TCS(tp)
 {
     ATF_TP_ADD_TC(tp, option_refcnt);
     ATF_TP_ADD_TC(tp, pretty_print_option);
+    ATF_TP_ADD_TC(tp, option_code_table);
+    ATF_TP_ADD_TC(tp, option_indexed_state);
+    ATF_TP_ADD_TC(tp, option_high_code);
+    ATF_TP_ADD_TC(tp, option_packet_arena);
+    ATF_TP_ADD_TC(tp, option_arena_to_heap);
+    ATF_TP_ADD_TC(tp, option_bench);
+    ATF_TP_ADD_TC(tp, option_encoded_cache);
+    ATF_TP_ADD_TC(tp, option_encoded_cache_evaluations);
 
     return (atf_no_error());
 }
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include <stdlib.h>
+#include "dhcpd.h"
+#include "t_bench.h"
+
+#include <sys/time.h>
+
+/*
+ * The application context is never run in these tests, so the ISC timer
+ * armed by add_timeout() never goes off.  Instead we move cur_tv forward
+ * by hand and let process_outstanding_timeouts() run whatever is due.
+ */
+
+#define BENCH_TIMERS 1000000
+
+static int fired;
+static int order_ok;
+static struct timeval last_fired;
+static char *objects;
+
+static void
+count_timeout(void *what) {
+	fired++;
+}
+
+static void
+ordered_timeout(void *what) {
+	struct timeval *when = (struct timeval *)what;
+
+	if (timercmp(when, &last_fired, <))
+		order_ok = 0;
+	last_fired = *when;
+	fired++;
+}
+
+static void
+other_timeout(void *what) {
+	fired += 1000;
+}
+
+static void
+advance_to(time_t sec) {
+	cur_tv.tv_sec = sec;
+	cur_tv.tv_usec = 0;
+	process_outstanding_timeouts(NULL);
+}
+
+ATF_TC(timeout_order);
+
+ATF_TC_HEAD(timeout_order, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify timeouts run in time order.");
+}
+
+ATF_TC_BODY(timeout_order, tc)
+{
+    struct timeval whens[64], next;
+    int i;
+
+    dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+    cur_tv.tv_sec = 1000;
+    cur_tv.tv_usec = 0;
+
+    /* Add them out of order, including one that is already due. */
+    for (i = 0; i < 64; i++) {
+        whens[i].tv_sec = 1000 + ((i * 37) % 64);
+        whens[i].tv_usec = 0;
+        add_timeout(&whens[i], ordered_timeout, &whens[i], NULL, NULL);
+    }
+
+    fired = 0;
+    order_ok = 1;
+    timerclear(&last_fired);
+
+    advance_to(1031);
+    ATF_CHECK_EQ(fired, 32);
+
+    advance_to(1100);
+    ATF_CHECK_EQ(fired, 64);
+    ATF_CHECK(order_ok);
+
+    /* Nothing left to run. */
+    ATF_CHECK(process_outstanding_timeouts(&next) == NULL);
+}
+
+ATF_TC(timeout_supersede_cancel);
+
+ATF_TC_HEAD(timeout_supersede_cancel, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Verify superseding and cancelling "
+                      "timeouts by function and data.");
+}
+
+ATF_TC_BODY(timeout_supersede_cancel, tc)
+{
+    struct timeval when, next;
+    int a, b;
+
+    dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+    cur_tv.tv_sec = 2000;
+    cur_tv.tv_usec = 0;
+    fired = 0;
+
+    when.tv_sec = 2010;
+    when.tv_usec = 0;
+    add_timeout(&when, count_timeout, &a, NULL, NULL);
+    add_timeout(&when, other_timeout, &a, NULL, NULL);
+    add_timeout(&when, count_timeout, &b, NULL, NULL);
+
+    /* Move one later, it must not fire with the others. */
+    when.tv_sec = 2020;
+    add_timeout(&when, count_timeout, &b, NULL, NULL);
+
+    /* Cancelling needs both the function and the data to match. */
+    cancel_timeout(count_timeout, &b);
+    cancel_timeout(count_timeout, &b);
+    cancel_timeout(other_timeout, &b);
+
+    ATF_CHECK(process_outstanding_timeouts(&next) == &next);
+    ATF_CHECK_EQ(next.tv_sec, 2010);
+
+    advance_to(2030);
+    ATF_CHECK_EQ(fired, 1001);
+    ATF_CHECK(process_outstanding_timeouts(&next) == NULL);
+}
+
+ATF_TC(timeout_bench_1m);
+
+ATF_TC_HEAD(timeout_bench_1m, tc)
+{
+    atf_tc_set_md_var(tc, "descr", "Time adding, rescheduling, cancelling "
+                      "and running one million timeouts.");
+}
+
+ATF_TC_BODY(timeout_bench_1m, tc)
+{
+    struct timeval when, start, next;
+    int i;
+
+    BENCH_REQUIRE();
+    objects = malloc(BENCH_TIMERS);
+    ATF_REQUIRE(objects != NULL);
+
+    dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+    cur_tv.tv_sec = 3000;
+    cur_tv.tv_usec = 0;
+    fired = 0;
+    srandom(42);
+
+    bench_start(&start);
+    for (i = 0; i < BENCH_TIMERS; i++) {
+        when.tv_sec = 3001 + random() % 3600;
+        when.tv_usec = random() % 1000000;
+        add_timeout(&when, count_timeout, &objects[i], NULL, NULL);
+    }
+    bench_report(&start, "add %d timeouts", BENCH_TIMERS);
+
+    bench_start(&start);
+    for (i = 0; i < BENCH_TIMERS; i += 2) {
+        when.tv_sec = 3001 + random() % 3600;
+        when.tv_usec = 0;
+        add_timeout(&when, count_timeout, &objects[i], NULL, NULL);
+    }
+    bench_report(&start, "reschedule %d timeouts", BENCH_TIMERS / 2);
+
+    bench_start(&start);
+    for (i = 0; i < BENCH_TIMERS; i += 4) {
+        cancel_timeout(count_timeout, &objects[i]);
+    }
+    bench_report(&start, "cancel %d timeouts", BENCH_TIMERS / 4);
+
+    bench_start(&start);
+    advance_to(3000 + 3601);
+    bench_report(&start, "run %d timeouts", fired);
+
+    ATF_CHECK_EQ(fired, BENCH_TIMERS - BENCH_TIMERS / 4);
+    ATF_CHECK(process_outstanding_timeouts(&next) == NULL);
+
+    free(objects);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+    ATF_TP_ADD_TC(tp, timeout_order);
+    ATF_TP_ADD_TC(tp, timeout_supersede_cancel);
+    ATF_TP_ADD_TC(tp, timeout_bench_1m);
+
+    return (atf_no_error());
+}
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+#include "t_bench.h"
+
+/*
+ * Expressions are compiled the first time they are evaluated, unless
+ * expression_code_disabled is set.  Each expression here is evaluated
+ * against each packet both ways and the results have to be the same.
+ */
+
+#define BENCH_EVALS 1000000
+
+struct test_expr {
+	int kind;
+	int compiled;		/* Should the root be compiled? */
+	const char *text;
+};
+
+static struct test_expr exprs[] = {
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "substring(option vendor-class-identifier, 0, 9) = \"PXEClient\"" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "option vendor-class-identifier = \"MSFT 5.0\" or exists host-name" },
+	{ EXPR_CODE_BOOLEAN, 1, "exists host-name and known" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "option host-name = \"pc\" and exists vendor-class-identifier" },
+	{ EXPR_CODE_BOOLEAN, 1, "not exists user-class" },
+	{ EXPR_CODE_BOOLEAN, 0, "static" },
+	{ EXPR_CODE_BOOLEAN, 1, "option host-name != \"pc\"" },
+	{ EXPR_CODE_BOOLEAN, 1, "suffix(option host-name, 1) = \"1\"" },
+	{ EXPR_CODE_BOOLEAN, 1, "lcase(option host-name) = \"pc1\"" },
+	{ EXPR_CODE_BOOLEAN, 1, "ucase(option host-name) = \"PC\"" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "extract-int(substring(hardware, 0, 1), 8) = 1" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "binary-to-ascii(16, 8, \":\", substring(hardware, 1, 6)) = "
+	  "\"0:1:2:3:4:5\"" },
+	{ EXPR_CODE_BOOLEAN, 1, "packet(0, 1) = encode-int(1, 8)" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "pick-first-value(option user-class, option host-name, \"none\") = "
+	  "\"none\"" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "substring(option vendor-class-identifier, 20, 4) = \"\"" },
+	{ EXPR_CODE_BOOLEAN, 1, "1 = 1" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "extract-int(hardware, 8) ^ 3 | 16 & 255 = 16" },
+	{ EXPR_CODE_BOOLEAN, 1, "option dhcp-message-type = 1" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "extract-int(option dhcp-message-type, 8) = 3 or "
+	  "exists user-class" },
+	{ EXPR_CODE_BOOLEAN, 1, "config-option domain-name = \"example.com\"" },
+	{ EXPR_CODE_BOOLEAN, 1, "not known or not exists host-name" },
+	{ EXPR_CODE_BOOLEAN, 1,
+	  "exists user-class or option host-name = \"PC1\"" },
+	{ EXPR_CODE_DATA, 1,
+	  "concat(substring(hardware, 1, 3), \":\", option host-name)" },
+	{ EXPR_CODE_DATA, 1,
+	  "pick-first-value(option user-class, option host-name)" },
+	{ EXPR_CODE_DATA, 1,
+	  "lcase(concat(option vendor-class-identifier, option host-name, "
+	  "option vendor-class-identifier))" },
+	{ EXPR_CODE_DATA, 1,
+	  "encode-int(extract-int(option host-name, 16) + 1, 32)" },
+	{ EXPR_CODE_DATA, 1, "suffix(packet(0, 4), 2)" },
+	{ EXPR_CODE_DATA, 1, "packet(500, 100)" },
+	{ EXPR_CODE_DATA, 1, "concat(\"a\", \"b\")" },
+	{ EXPR_CODE_DATA, 0, "binary-to-ascii(10, 8, \".\", leased-address)" },
+	{ EXPR_CODE_NUMERIC, 1,
+	  "extract-int(substring(option vendor-class-identifier, 0, 2), 16) "
+	  "% 7" },
+	{ EXPR_CODE_NUMERIC, 1,
+	  "extract-int(hardware, 8) ^ 3 | 16 & 255" },
+	{ EXPR_CODE_NUMERIC, 1, "extract-int(option host-name, 32) - 1" },
+	{ EXPR_CODE_NUMERIC, 1, "extract-int(option host-name, 16) / 0" },
+	{ EXPR_CODE_NUMERIC, 1, "1 + 2 * 3" },
+	{ EXPR_CODE_NUMERIC, 0, "lease-time" },
+	{ 0, 0, NULL }
+};
+
+static struct dhcp_packet raw;
+static struct packet packet;
+static struct option_state *cfg_options;
+static char long_vendor[400];
+
+static void
+setup(void) {
+	initialize_common_option_spaces();
+	if (!option_state_allocate(&cfg_options, MDL))
+		atf_tc_fail("can't allocate config options");
+	if (!save_option_buffer(&dhcp_universe, cfg_options, NULL,
+				(unsigned char *)"example.com", 11,
+				DHO_DOMAIN_NAME, 0))
+		atf_tc_fail("can't save domain name");
+	memset(long_vendor, 'V', sizeof(long_vendor) - 1);
+}
+
+static struct expression *
+parse_test_expr(struct test_expr *t) {
+	struct expression *expr = NULL;
+	struct parse *cfile = NULL;
+	int lose = 0, status;
+
+	if (new_parse(&cfile, -1, (char *)t->text, strlen(t->text),
+		      "test expression", 0) != ISC_R_SUCCESS)
+		atf_tc_fail("can't set up parse");
+	if (t->kind == EXPR_CODE_BOOLEAN)
+		status = parse_boolean_expression(&expr, cfile, &lose);
+	else if (t->kind == EXPR_CODE_DATA)
+		status = parse_data_expression(&expr, cfile, &lose);
+	else
+		status = parse_numeric_expression(&expr, cfile, &lose);
+	end_parse(&cfile);
+	if (!status)
+		atf_tc_fail("can't parse %s", t->text);
+	return expr;
+}
+
+static void
+packet_option(int code, const char *value) {
+	if (value != NULL &&
+	    !save_option_buffer(&dhcp_universe, packet.options, NULL,
+				(unsigned char *)value, strlen(value), code, 0))
+		atf_tc_fail("can't save option %d", code);
+}
+
+static void
+new_packet(int which) {
+	unsigned char type = which % 2 ? DHCPDISCOVER : DHCPREQUEST;
+	int i;
+
+	if (packet.options != NULL)
+		option_state_dereference(&packet.options, MDL);
+	memset(&packet, 0, sizeof(packet));
+	memset(&raw, 0, sizeof(raw));
+	raw.op = BOOTREQUEST;
+	raw.htype = HTYPE_ETHER;
+	raw.hlen = 6;
+	for (i = 0; i < 6; i++)
+		raw.chaddr[i] = i + which;
+	packet.raw = &raw;
+	packet.packet_length = DHCP_FIXED_NON_UDP + 64;
+	packet.known = which % 3 == 0;
+	if (!option_state_allocate(&packet.options, MDL))
+		atf_tc_fail("can't allocate options");
+
+	switch (which) {
+	      case 0:
+		break;
+	      case 1:
+		packet_option(DHO_VENDOR_CLASS_IDENTIFIER, "MSFT 5.0");
+		packet_option(DHO_HOST_NAME, "pc");
+		break;
+	      case 2:
+		packet_option(DHO_VENDOR_CLASS_IDENTIFIER,
+			    "PXEClient:Arch:00000");
+		packet_option(DHO_HOST_NAME, "PC1");
+		break;
+	      case 3:
+		packet_option(DHO_HOST_NAME, "");
+		packet_option(DHO_USER_CLASS, "lab");
+		break;
+	      case 4:
+		packet_option(DHO_VENDOR_CLASS_IDENTIFIER, long_vendor);
+		packet_option(DHO_HOST_NAME, long_vendor);
+		break;
+	}
+	if (which != 0 &&
+	    !save_option_buffer(&dhcp_universe, packet.options, NULL,
+				&type, 1, DHO_DHCP_MESSAGE_TYPE, 0))
+		atf_tc_fail("can't save message type");
+}
+
+/* Evaluate an expression against the current packet. */
+static int
+evaluate(struct test_expr *t, struct expression *expr,
+	 unsigned long *num, struct data_string *data) {
+	int value = 0, status;
+
+	*num = 0;
+	memset(data, 0, sizeof(*data));
+	if (t->kind == EXPR_CODE_BOOLEAN) {
+		status = evaluate_boolean_expression(&value, &packet, NULL,
+						     NULL, packet.options,
+						     cfg_options, NULL, expr);
+		*num = value;
+	} else if (t->kind == EXPR_CODE_NUMERIC) {
+		status = evaluate_numeric_expression(num, &packet, NULL, NULL,
+						     packet.options,
+						     cfg_options, NULL, expr);
+	} else {
+		status = evaluate_data_expression(data, &packet, NULL, NULL,
+						  packet.options, cfg_options,
+						  NULL, expr, MDL);
+	}
+	return status;
+}
+
+ATF_TC(expression_code_matches_tree);
+
+ATF_TC_HEAD(expression_code_matches_tree, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify compiled expressions give "
+			  "the same results as the tree evaluator.");
+}
+
+ATF_TC_BODY(expression_code_matches_tree, tc)
+{
+	struct expression *expr;
+	struct data_string tdata, cdata;
+	unsigned long tnum, cnum;
+	int i, which, tstatus, cstatus;
+
+	setup();
+
+	for (i = 0; exprs[i].text != NULL; i++) {
+		expr = parse_test_expr(&exprs[i]);
+		for (which = 0; which < 5; which++) {
+			new_packet(which);
+
+			expression_code_disabled = 1;
+			tstatus = evaluate(&exprs[i], expr, &tnum, &tdata);
+			expression_code_disabled = 0;
+			cstatus = evaluate(&exprs[i], expr, &cnum, &cdata);
+
+			ATF_CHECK_MSG(tstatus == cstatus,
+				      "%s, packet %d: status %d, tree %d",
+				      exprs[i].text, which, cstatus, tstatus);
+			if (tstatus && cstatus) {
+				ATF_CHECK_MSG(tnum == cnum,
+					      "%s, packet %d: %lu, tree %lu",
+					      exprs[i].text, which,
+					      cnum, tnum);
+				ATF_CHECK_MSG(tdata.len == cdata.len &&
+					      tdata.terminated ==
+					      cdata.terminated &&
+					      (tdata.len == 0 ||
+					       memcmp(tdata.data, cdata.data,
+						      tdata.len) == 0),
+					      "%s, packet %d: data differs",
+					      exprs[i].text, which);
+			}
+			if (tdata.buffer != NULL)
+				data_string_forget(&tdata, MDL);
+			if (cdata.buffer != NULL)
+				data_string_forget(&cdata, MDL);
+		}
+		ATF_CHECK_MSG((expr->code != NULL) == exprs[i].compiled,
+			      "%s: %scompiled", exprs[i].text,
+			      expr->code != NULL ? "" : "not ");
+		expression_dereference(&expr, MDL);
+	}
+}
+
+ATF_TC(expression_code_bench);
+
+ATF_TC_HEAD(expression_code_bench, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Time a class match expression "
+			  "and a data expression both ways.");
+}
+
+ATF_TC_BODY(expression_code_bench, tc)
+{
+	static struct test_expr bench[] = {
+		{ EXPR_CODE_BOOLEAN, 1,
+		  "extract-int(substring(hardware, 0, 1), 8) = 1 and "
+		  "option host-name = \"pc\" or "
+		  "substring(option vendor-class-identifier, 0, 9) = "
+		  "\"PXEClient\"" },
+		{ EXPR_CODE_DATA, 1,
+		  "concat(lcase(option host-name), \"-\", "
+		  "suffix(hardware, 3))" }
+	};
+	struct expression *expr;
+	struct data_string data;
+	struct timeval start;
+	unsigned long num;
+	int i, j, pass, matched[2];
+
+	BENCH_REQUIRE();
+	setup();
+	new_packet(2);
+
+	for (i = 0; i < 2; i++) {
+		expr = parse_test_expr(&bench[i]);
+		for (pass = 0; pass < 2; pass++) {
+			expression_code_disabled = !pass;
+			matched[pass] = 0;
+			bench_start(&start);
+			for (j = 0; j < BENCH_EVALS; j++) {
+				if (evaluate(&bench[i], expr, &num, &data))
+					matched[pass] += num || data.len;
+				if (data.buffer != NULL)
+					data_string_forget(&data, MDL);
+			}
+			bench_report(&start, "%s %d evaluations of "
+				     "expression %d", pass ? "run" : "interpret",
+				     BENCH_EVALS, i);
+		}
+		ATF_CHECK(expr->code != NULL);
+		ATF_CHECK_EQ(matched[0], matched[1]);
+		ATF_CHECK_EQ(matched[1], BENCH_EVALS);
+		expression_dereference(&expr, MDL);
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, expression_code_matches_tree);
+	ATF_TP_ADD_TC(tp, expression_code_bench);
+
+	return (atf_no_error());
+}
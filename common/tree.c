@@ -230,8 +230,9 @@ int make_const_data (struct expression **expr, const unsigned char *data,
 
 	if (len) {
 		if (allocate) {
-			if (!buffer_allocate (&nt -> data.const_data.buffer,
-					      len + terminated, file, line)) {
+			if (!arena_buffer_allocate
+			    (&nt -> data.const_data.buffer,
+			     len + terminated, file, line)) {
 				log_error ("Can't allocate const_data buffer");
 				expression_dereference (expr, file, line);
 				return 0;
@@ -712,6 +713,11 @@ int evaluate_boolean_expression (result, packet, lease, client_state,
 	regex_t re;
 #endif
 
+	if (expression_code_ready (expr, EXPR_CODE_BOOLEAN))
+		return execute_boolean_code (result, packet, lease,
+					     client_state, in_options,
+					     cfg_options, scope, expr);
+
 	switch (expr -> op) {
 	      case expr_check:
 		*result = check_collection (packet, lease,
@@ -1146,6 +1152,11 @@ int evaluate_data_expression (result, packet, lease, client_state,
 	struct packet *relay_packet;
 	struct option_state *relay_options;
 
+	if (expression_code_ready (expr, EXPR_CODE_DATA))
+		return execute_data_code (result, packet, lease, client_state,
+					  in_options, cfg_options, scope,
+					  expr, file, line);
+
 	switch (expr -> op) {
 		/* Extract N bytes starting at byte M of a data string. */
 	      case expr_substring:
@@ -2245,6 +2256,11 @@ int evaluate_numeric_expression (result, packet, lease, client_state,
 	unsigned long ileft, iright;
 	int rc = 0;
 
+	if (expression_code_ready (expr, EXPR_CODE_NUMERIC))
+		return execute_numeric_code (result, packet, lease,
+					     client_state, in_options,
+					     cfg_options, scope, expr);
+
 	switch (expr -> op) {
 	      case expr_check:
 	      case expr_equal:
@@ -3025,6 +3041,8 @@ void expression_dereference (eptr, file, line)
 	      default:
 		break;
 	}
+	if (expr -> code)
+		free_expression_code (expr -> code);
 	free_expression (expr, MDL);
 }
 
@@ -3114,6 +3132,19 @@ int is_compound_expression (expr)
 		expr -> op == expr_v6relay);
 }
 
+/* Is expr a data expression whose value can't change: constant data, or
+   constant data concatenated together, as parse_option_data() builds? */
+int is_constant_data_expression (expr)
+	struct expression *expr;
+{
+	if (expr -> op == expr_const_data)
+		return 1;
+	return (expr -> op == expr_concat &&
+		expr -> data.concat [0] && expr -> data.concat [1] &&
+		is_constant_data_expression (expr -> data.concat [0]) &&
+		is_constant_data_expression (expr -> data.concat [1]));
+}
+
 static int op_val (enum expr_op);
 
 static int op_val (op)
@@ -4094,6 +4125,8 @@ int bind_ds_value (struct binding_scope **scope,
 		return 0;
 
 	data_string_copy (&binding -> value -> value.data, value, MDL);
+	/* Scopes outlive the packet, so don't keep its arena chunk. */
+	data_string_to_heap (&binding -> value -> value.data, MDL);
 	binding -> value -> type = binding_data;
 
 	return 1;
@@ -289,36 +289,30 @@ struct parse {
 	int lexline;
 	int lexchar;
 	char *token_line;
-	char *prev_line;
-	char *cur_line;
 	const char *tlname;
 	int eol_token;
 
 	/*
 	 * In order to give nice output when we have a parsing error
-	 * in our file, we keep track of where we are in the line so
-	 * that we can show the user.
+	 * in our file, we need the line and column of the token and
+	 * the text of its line.  The scanner only keeps the buffer
+	 * offset where each token starts: "lexpos" for the current
+	 * token and "tpos" for one we have looked ahead to with the
+	 * "peek" function.  lex_position() turns "lexpos" into
+	 * "lexline", "lexchar" and "token_line" (a copy of the line
+	 * in "line1") when parse_warn() needs them.
 	 *
-	 * We need to keep track of two lines, because we can look
-	 * ahead, via the "peek" function, to the next line sometimes.
-	 *
-	 * The "line1" and "line2" variables act as buffers for this
-	 * information. The "lpos" variable tells us where we are in the
-	 * line.
-	 *
-	 * When we "put back" a character from the parsing context, we
-	 * do not want to have the character appear twice in the error
-	 * output. So, we set a flag, the "ugflag", which the
-	 * get_char() function uses to check for this condition.
+	 * Lines are counted from "line", the line the buffer starts
+	 * on; "lineno" is the line at offset "lineix", where the last
+	 * count stopped.
 	 */
 	char line1 [81];
-	char line2 [81];
-	int lpos;
+	size_t lexpos;
+	size_t tpos;
 	int line;
-	int tlpos;
-	int tline;
+	size_t lineix;
+	int lineno;
 	enum dhcp_token token;
-	int ugflag;
 	char *tval;
 	int tlen;
 	char tokbuf [1500];
@@ -390,6 +384,8 @@ struct option_cache {
 	struct data_string data;
 
 	#define OPTION_HAD_NULLS	0x00000001
+	#define OPTION_CONSTANT		0x00000002 /* Configured, with a value
+						      that never changes. */
 	u_int32_t flags;
 };
 
@@ -398,9 +394,27 @@ struct option_state {
 	int universe_count;
 	int site_universe;
 	int site_code_min;
+	struct arena_chunk *chunk;	/* Packet arena chunk, or NULL. */
 	void *universes [1];
 };
 
+/* The option caches of one option space in an option_state, for spaces
+   that are stored by code rather than hashed (see save_indexed_option()).
+   There is a slot for each code in the space's option table; options with
+   codes beyond that go on the overflow list. */
+struct option_index {
+	unsigned size;		/* Number of slots. */
+	unsigned hi;		/* One past the highest slot ever used. */
+	pair overflow;
+	struct option_cache *slot [1];
+};
+
+/* The chunks that option states and option buffers made while a packet
+   is being processed are carved out of; see alloc.c. */
+struct packet_arena {
+	struct arena_chunk *chunks;	/* The one being carved up first. */
+};
+
 /* A dhcp packet and the pointers to its option values. */
 struct packet {
 	struct dhcp_packet *raw;
@@ -475,6 +489,10 @@ struct packet {
 
 	/* Relay port check */
 	isc_boolean_t relay_source_port;
+
+	/* Where option states and buffers come from while this packet is
+	   the one being processed. */
+	struct packet_arena arena;
 };
 
 /*
@@ -635,6 +653,8 @@ struct lease {
 	TIME atsfp;	/* Actual time sent from partner. */
 	TIME cltt;	/* Client last transaction time. */
 	u_int32_t last_xid; /* XID we sent in this lease's BNDUPD */
+	isc_uint64_t fo_seq; /* Failover sequence number of the last change
+				to the lease; see failover.c. */
 	struct lease *next_pending;
 
 	/*
@@ -817,6 +837,12 @@ struct lease_state {
 #define SV_BIND_LOCAL_ADDRESS6		98
 #define SV_PING_CLTT_SECS		99
 #define SV_PING_TIMEOUT_MS		100
+#define SV_LOG_HASH_STATISTICS		101
+#define SV_EXECUTE_CONCURRENCY		102
+#define SV_EXECUTE_QUEUE_DEPTH		103
+#define SV_EXECUTE_TIMEOUT		104
+#define SV_DDNS_ZONE_CONCURRENCY	105
+#define SV_DDNS_SERVER_CONCURRENCY	106
 
 #if !defined (DEFAULT_PING_TIMEOUT)
 # define DEFAULT_PING_TIMEOUT 1
@@ -830,6 +856,20 @@ struct lease_state {
 # define DEFAULT_PING_CLTT_SECS 60  /* in seconds */
 #endif
 
+#if !defined (DEFAULT_EXECUTE_QUEUE)
+# define DEFAULT_EXECUTE_QUEUE 1024 /* commands waiting for an execute slot */
+#endif
+
+#if !defined (DEFAULT_DDNS_ZONE_CONCURRENCY)
+# define DEFAULT_DDNS_ZONE_CONCURRENCY 0 /* updates in flight per zone,
+					    0 for no limit */
+#endif
+
+#if !defined (DEFAULT_DDNS_SERVER_CONCURRENCY)
+# define DEFAULT_DDNS_SERVER_CONCURRENCY 32 /* updates in flight per name
+					       server, 0 for no limit */
+#endif
+
 #if !defined (DEFAULT_DELAYED_ACK)
 # define DEFAULT_DELAYED_ACK 0  /* default 0 disables delayed acking */
 #endif
@@ -846,6 +886,27 @@ struct lease_state {
 # define DEFAULT_MIN_ACK_DELAY_USECS 10000 /* 1/100 second */
 #endif
 
+#if !defined (RX_RING_BLOCK_SIZE)
+# define RX_RING_BLOCK_SIZE 65536 /* bytes per PACKET_MMAP ring block */
+#endif
+
+#if !defined (RX_RING_BLOCK_COUNT)
+# define RX_RING_BLOCK_COUNT 64
+#endif
+
+#if !defined (RX_RING_BLOCK_TIMEOUT)
+# define RX_RING_BLOCK_TIMEOUT 1 /* ms before a partly filled block is
+				    handed to us */
+#endif
+
+#if !defined (RX_BATCH_MAX)
+# define RX_BATCH_MAX 16 /* datagrams read by one recvmmsg() */
+#endif
+
+#if !defined (TX_BATCH_MAX)
+# define TX_BATCH_MAX 64 /* frames queued per interface before a send */
+#endif
+
 #if !defined (DEFAULT_CACHE_THRESHOLD)
 # define DEFAULT_CACHE_THRESHOLD 25
 #endif
@@ -1007,17 +1068,29 @@ struct permit {
 };
 
 #if defined (BINARY_LEASES)
+struct lc_node;
 struct leasechain {
-	struct lease **list; /* lease list */
-	size_t total;	     /* max number of elements in this list,
-			      * including free pointers at the end if any */
-	size_t nelem;	     /* the number of elements, also the next index to use */
-	size_t growth;	     /* the growth factor to use when increase an array
-			      * this is set after parsing the pools and before
-			      * creatin an array.  */
+	struct lc_node *root; /* root of the B+tree, NULL when empty */
+	size_t nelem;	      /* the number of leases in the chain */
 };
 #endif
 
+/* Part of a range statement for which leases have not all been made.
+   Addresses that have never been used have a bit set in "unused" instead
+   of a lease; a lease is made for one when it is about to be offered or
+   when the address turns up in the lease file, from the failover peer or
+   through OMAPI. */
+struct lease_range {
+	struct lease_range *next;	/* next range in the same pool */
+	struct pool *pool;
+	struct subnet *subnet;
+	u_int32_t low;			/* first address, host byte order */
+	unsigned count;			/* number of addresses */
+	unsigned remaining;		/* bits still set in unused */
+	unsigned cursor;		/* first bit that might be set */
+	unsigned char *unused;
+};
+
 struct pool {
 	OMAPI_OBJECT_PREAMBLE;
 	struct pool *next;
@@ -1025,6 +1098,7 @@ struct pool {
 	struct shared_network *shared_network;
 	struct permit *permit_list;
 	struct permit *prohibit_list;
+	struct lease_range *ranges;
 	LEASE_STRUCT active;
 	LEASE_STRUCT expired;
 	LEASE_STRUCT free;
@@ -1077,11 +1151,14 @@ struct subnet {
 	struct group *group;
 };
 
+struct class_index;
+
 struct collection {
 	struct collection *next;
 
 	const char *name;
 	struct class *classes;
+	struct class_index *index;	/* See check_collection(). */
 };
 
 /* Used as an argument to parse_clasS_decl() */
@@ -1423,8 +1500,35 @@ struct interface_info {
 	struct hardware dlpi_broadcast_addr;
 # endif /* DLPI_SEND || DLPI_RECEIVE */
 	struct hardware anycast_mac_addr;
+#if defined (USE_LPF_RX_RING)
+	unsigned char *rx_ring;		/* Mapped PACKET_MMAP ring, if any. */
+	size_t rx_ring_len;		/* Length of the mapping. */
+	unsigned rx_block;		/* Ring block being drained. */
+	unsigned rx_frames_left;	/* Frames not yet read from it. */
+	unsigned char *rx_frame;	/* Next frame to read from it. */
+#endif
+#if defined (USE_SENDMMSG)
+	struct tx_frame *tx_queue;	/* Frames held for a batched send. */
+	int tx_count;			/* Number of frames held. */
+#endif
+#if defined (USE_BATCH_RECEIVE)
+	u_int32_t rx_wakeups;		/* Read events handled. */
+	u_int32_t rx_frames;		/* Packets read during those events. */
+	u_int32_t rx_batch_max;		/* Most packets read in one event. */
+#endif
 };
 
+#if defined (USE_SENDMMSG)
+/* An assembled frame waiting to go out in a batched send. */
+struct tx_frame {
+	struct sockaddr_in to;		/* Destination, if sent with sendto. */
+	int has_to;			/* Nonzero if to is to be used. */
+	int ifindex;			/* For IP_PKTINFO, if nonzero. */
+	unsigned len;
+	unsigned char buf [1536];
+};
+#endif
+
 struct hardware_link {
 	struct hardware_link *next;
 	char name [IFNAMSIZ];
@@ -1446,7 +1550,8 @@ struct timeout {
 	void *what;
 	tvref_t ref;
 	tvunref_t unref;
-	isc_timer_t *isc_timeout;
+	unsigned int heap_index;	/* position in the timeout heap,
+					   0 when not pending */
 };
 
 struct eventqueue {
@@ -1514,6 +1619,7 @@ struct dns_zone {
 	struct option_cache *secondary6;
 	struct auth_key *key;
 	u_int16_t flags;
+	int inflight;			/* Updates sent and not yet answered. */
 };
 
 struct icmp_state {
@@ -1773,6 +1879,7 @@ struct ipv6_pond {
 #define DDNS_DUAL_STACK_MIXED_MODE	0x0200
 #define DDNS_GUARD_ID_MUST_MATCH	0x0400
 #define DDNS_OTHER_GUARD_IS_DYNAMIC	0x0800
+#define DDNS_QUEUED			0x1000
 
 #define CONFLICT_BITS (DDNS_CONFLICT_DETECTION|\
                        DDNS_DUAL_STACK_MIXED_MODE|\
@@ -1799,10 +1906,25 @@ struct ipv6_pond {
 #define DDNS_PRINT_OUTBOUND 0
 
 struct dhcp_ddns_cb;
+struct ddns_server;
 
 typedef void (*ddns_action_t)(struct dhcp_ddns_cb *ddns_cb,
 			      isc_result_t result);
 
+/* Has the signature of dns_client_startupdate(). */
+typedef isc_result_t (*ddns_update_t)(dns_client_t *client,
+				      dns_rdataclass_t rdclass,
+				      dns_name_t *zonename,
+				      dns_namelist_t *prerequisites,
+				      dns_namelist_t *updates,
+				      isc_sockaddrlist_t *servers,
+				      dns_tsec_t *tsec,
+				      unsigned int options,
+				      isc_task_t *task,
+				      isc_taskaction_t action,
+				      void *arg,
+				      dns_clientupdatetrans_t **transp);
+
 typedef struct dhcp_ddns_cb {
 	struct data_string fwd_name;
 	struct data_string rev_name;
@@ -1817,6 +1939,11 @@ typedef struct dhcp_ddns_cb {
 	isc_sockaddr_t zone_addrs[DHCP_MAXNS];
 	int zone_addr_count;
 	struct dns_zone *zone;
+	struct dns_zone *inflight_zone;	/* Zone the transaction counts
+					   against, if any. */
+	struct ddns_server *inflight_server; /* Server it counts against,
+						if any. */
+	struct dhcp_ddns_cb *pending_next; /* Next waiting to be sent. */
 
 	u_int16_t flags;
 	TIME timeout;
@@ -1860,6 +1987,8 @@ HASH_FUNCTIONS_DECL (class, const char *, struct class, class_hash_t)
 /* options.c */
 
 extern struct option *vendor_cfg_option;
+extern int encoded_options_disabled;
+extern unsigned long encoded_options_hits;
 int parse_options (struct packet *);
 int parse_option_buffer (struct option_state *, const unsigned char *,
 			 unsigned, struct universe *);
@@ -1948,6 +2077,9 @@ struct option_cache *lookup_option (struct universe *,
 struct option_cache *lookup_hashed_option (struct universe *,
 					   struct option_state *,
 					   unsigned);
+struct option_cache *lookup_indexed_option (struct universe *,
+					    struct option_state *,
+					    unsigned);
 struct option_cache *next_hashed_option(struct universe *,
 					struct option_state *,
 					struct option_cache *);
@@ -1965,14 +2097,21 @@ void also_save_option(struct universe *, struct option_state *,
 		      struct option_cache *);
 void save_hashed_option(struct universe *, struct option_state *,
 			struct option_cache *, isc_boolean_t appendp);
+void save_indexed_option(struct universe *, struct option_state *,
+			 struct option_cache *, isc_boolean_t appendp);
 void delete_option (struct universe *, struct option_state *, int);
 void delete_hashed_option (struct universe *,
 			   struct option_state *, int);
+void delete_indexed_option (struct universe *,
+			    struct option_state *, int);
 int option_cache_dereference (struct option_cache **,
 			      const char *, int);
 int hashed_option_state_dereference (struct universe *,
 				     struct option_state *,
 				     const char *, int);
+int indexed_option_state_dereference (struct universe *,
+				      struct option_state *,
+				      const char *, int);
 int store_option (struct data_string *,
 		  struct universe *, struct packet *, struct lease *,
 		  struct client_state *,
@@ -1992,6 +2131,13 @@ int hashed_option_space_encapsulate (struct data_string *,
 				     struct option_state *,
 				     struct binding_scope **,
 				     struct universe *);
+int indexed_option_space_encapsulate (struct data_string *,
+				      struct packet *, struct lease *,
+				      struct client_state *,
+				      struct option_state *,
+				      struct option_state *,
+				      struct binding_scope **,
+				      struct universe *);
 int nwip_option_space_encapsulate (struct data_string *,
 				   struct packet *, struct lease *,
 				   struct client_state *,
@@ -2042,6 +2188,20 @@ void hashed_option_space_foreach (struct packet *, struct lease *,
 					    struct option_state *,
 					    struct binding_scope **,
 					    struct universe *, void *));
+void indexed_option_space_foreach (struct packet *, struct lease *,
+				   struct client_state *,
+				   struct option_state *,
+				   struct option_state *,
+				   struct binding_scope **,
+				   struct universe *, void *,
+				   void (*) (struct option_cache *,
+					     struct packet *,
+					     struct lease *,
+					     struct client_state *,
+					     struct option_state *,
+					     struct option_state *,
+					     struct binding_scope **,
+					     struct universe *, void *));
 int linked_option_get (struct data_string *, struct universe *,
 		       struct packet *, struct lease *,
 		       struct client_state *,
@@ -2118,6 +2278,7 @@ extern u_int16_t ddns_conflict_mask;
 #endif
 extern int dont_use_fsync;
 extern int server_id_check;
+extern int log_hash_statistics;
 
 #ifdef EUI_64
 extern int persist_eui64;
@@ -2158,6 +2319,9 @@ isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
 
 #if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
 void relinquish_ackqueue(void);
+#if defined (DHCPv6)
+void relinquish_reply6_queue(void);
+#endif
 #endif
 
 /* conflex.c */
@@ -2166,6 +2330,7 @@ isc_result_t new_parse (struct parse **, int,
 isc_result_t end_parse (struct parse **);
 isc_result_t save_parse_state(struct parse *cfile);
 isc_result_t restore_parse_state(struct parse *cfile);
+void lex_position(struct parse *cfile);
 enum dhcp_token next_token (const char **, unsigned *, struct parse *);
 enum dhcp_token peek_token (const char **, unsigned *, struct parse *);
 enum dhcp_token next_raw_token(const char **rval, unsigned *rlen,
@@ -2213,11 +2378,12 @@ void parse_group_declaration (struct parse *, struct group *);
 int parse_fixed_addr_param (struct option_cache **,
 			    struct parse *, enum dhcp_token);
 int parse_lease_declaration (struct lease **, struct parse *);
+void finish_lease_declaration (struct lease *, int);
 int parse_ip6_addr(struct parse *, struct iaddr *);
 int parse_ip6_addr_expr(struct expression **, struct parse *);
 int parse_ip6_prefix(struct parse *, struct iaddr *, u_int8_t *);
 void parse_address_range (struct parse *, struct group *, int,
-			  struct pool *, struct lease **);
+			  struct pool *);
 void parse_address_range6(struct parse *cfile, struct group *group,
 			  struct ipv6_pond *);
 void parse_prefix6(struct parse *cfile, struct group *group,
@@ -2263,6 +2429,7 @@ void convert_num (struct parse *, unsigned char *, const char *,
 		  int, unsigned);
 TIME parse_date (struct parse *);
 TIME parse_date_core(struct parse *);
+TIME date_to_time(int, int, int, int, int, int, int);
 isc_result_t parse_option_name (struct parse *, int, int *,
 				struct option **);
 void parse_option_space_decl (struct parse *);
@@ -2389,6 +2556,7 @@ int is_boolean_expression (struct expression *);
 int is_data_expression (struct expression *);
 int is_numeric_expression (struct expression *);
 int is_compound_expression (struct expression *);
+int is_constant_data_expression (struct expression *);
 int op_precedence (enum expr_op, enum expr_op);
 enum expression_context expression_context (struct expression *);
 enum expression_context op_context (enum expr_op);
@@ -2410,11 +2578,30 @@ int data_string_sprintfa(struct data_string *ds, const char *fmt, ...);
 int concat_dclists (struct data_string *, struct data_string *,
                     struct data_string *);
 
+/* bytecode.c */
+extern int expression_code_disabled;
+extern int expression_code_mismatches;
+int expression_code_ready (struct expression *, int);
+void free_expression_code (struct expr_code *);
+int execute_boolean_code (int *, struct packet *, struct lease *,
+			  struct client_state *, struct option_state *,
+			  struct option_state *, struct binding_scope **,
+			  struct expression *);
+int execute_numeric_code (unsigned long *, struct packet *, struct lease *,
+			  struct client_state *, struct option_state *,
+			  struct option_state *, struct binding_scope **,
+			  struct expression *);
+int execute_data_code (struct data_string *, struct packet *, struct lease *,
+		       struct client_state *, struct option_state *,
+		       struct option_state *, struct binding_scope **,
+		       struct expression *, const char *, int);
+
 /* dhcp.c */
 extern int outstanding_pings;
 extern int max_outstanding_acks;
 extern int max_ack_delay_secs;
 extern int max_ack_delay_usecs;
+extern int min_ack_delay_usecs;
 
 void dhcp (struct packet *);
 void dhcpdiscover (struct packet *, int);
@@ -2469,6 +2656,10 @@ void set_server_duid_type(int type);
 isc_result_t generate_new_server_duid(void);
 isc_result_t get_client_id(struct packet *, struct data_string *);
 void dhcpv6(struct packet *);
+#if defined (DELAYED_ACK)
+void delayed_reply6_enqueue(struct packet *, struct sockaddr_in6 *,
+			    struct data_string *);
+#endif
 
 /* bootp.c */
 void bootp(struct packet *);
@@ -2507,10 +2698,13 @@ OMAPI_OBJECT_ALLOC_DECL (dhcp_control,
 #if defined (DEBUG_MEMORY_LEAKAGE) || \
 		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
 void relinquish_free_pairs (void);
+void relinquish_free_option_indexes (void);
 void relinquish_free_expressions (void);
 void relinquish_free_binding_values (void);
 void relinquish_free_option_caches (void);
 void relinquish_free_packets (void);
+void relinquish_free_arena_chunks (void);
+void relinquish_encoded_options (void);
 #endif
 
 int option_chain_head_allocate (struct option_chain_head **,
@@ -2546,6 +2740,8 @@ struct permit *new_permit (const char *, int);
 void free_permit (struct permit *, const char *, int);
 pair new_pair (const char *, int);
 void free_pair (pair, const char *, int);
+struct option_index *new_option_index (unsigned, const char *, int);
+void free_option_index (struct option_index *, const char *, int);
 int expression_allocate (struct expression **, const char *, int);
 int expression_reference (struct expression **,
 			  struct expression *, const char *, int);
@@ -2562,7 +2758,10 @@ int fundef_reference (struct fundef **,
 int option_cache_allocate (struct option_cache **, const char *, int);
 int option_cache_reference (struct option_cache **,
 			    struct option_cache *, const char *, int);
+extern struct packet_arena *current_packet_arena;
+void packet_arena_release (struct packet_arena *);
 int buffer_allocate (struct buffer **, unsigned, const char *, int);
+int arena_buffer_allocate (struct buffer **, unsigned, const char *, int);
 int buffer_reference (struct buffer **, struct buffer *,
 		      const char *, int);
 int buffer_dereference (struct buffer **, const char *, int);
@@ -2585,6 +2784,9 @@ void data_string_copy(struct data_string *, const struct data_string *,
 void data_string_forget (struct data_string *, const char *, int);
 void data_string_truncate (struct data_string *, int);
 int data_string_terminate (struct data_string *, const char *, int);
+int data_string_to_heap (struct data_string *, const char *, int);
+void option_chain_head_to_heap (struct option_chain_head *,
+				const char *, int);
 int executable_statement_allocate (struct executable_statement **,
 				   const char *, int);
 int executable_statement_reference (struct executable_statement **,
@@ -2698,12 +2900,26 @@ int supports_multiple_interfaces (struct interface_info *);
 void maybe_setup_fallback (void);
 #endif
 
+#if defined (USE_SENDMMSG)
+extern int send_batching;
+void send_batch_begin (void);
+void send_batch_end (void);
+ssize_t send_batch_queue (struct interface_info *, const unsigned char *,
+			  size_t, struct sockaddr_in *, int);
+#endif
+
 void if_register6(struct interface_info *info, int do_multicast);
 void if_register_linklocal6(struct interface_info *info);
 ssize_t receive_packet6(struct interface_info *interface,
 			unsigned char *buf, size_t len,
 			struct sockaddr_in6 *from, struct in6_addr *to_addr,
 			unsigned int *if_index);
+#if defined (USE_RECVMMSG)
+int receive_packet6_batch(struct interface_info *interface,
+			  unsigned char **bufs, int *lens,
+			  struct sockaddr_in6 *from, struct in6_addr *to_addr,
+			  unsigned int *if_index, int max);
+#endif
 void if_deregister6(struct interface_info *info);
 
 
@@ -2756,6 +2972,10 @@ ssize_t receive_packet (struct interface_info *,
 			unsigned char *, size_t,
 			struct sockaddr_in *, struct hardware *);
 #endif
+#if defined (USE_LPF_RX_RING)
+int receive_packet_batch (struct interface_info *, unsigned char **,
+			  unsigned *, struct sockaddr_in *, struct hardware *);
+#endif
 #if defined (USE_LPF_SEND)
 int can_unicast_without_arp (struct interface_info *);
 int can_receive_unicast_unconfigured (struct interface_info *);
@@ -2864,7 +3084,6 @@ extern void (*bootp_packet_handler) (struct interface_info *,
 extern void (*dhcpv6_packet_handler)(struct interface_info *,
 				     const char *, int,
 				     int, const struct iaddr *, isc_boolean_t);
-extern struct timeout *timeouts;
 extern omapi_object_type_t *dhcp_type_interface;
 #if defined (TRACING)
 extern trace_type_t *interface_trace;
@@ -2921,6 +3140,12 @@ extern struct universe **universes;
 extern universe_hash_t *universe_hash;
 void initialize_common_option_spaces (void);
 extern struct universe *config_universe;
+void option_code_table_init (struct universe *, unsigned);
+void option_code_table_free (struct universe *);
+int option_code_lookup (struct option **, struct universe *, unsigned,
+			const char *, int);
+void option_code_add (struct universe *, struct option *);
+void option_code_delete (struct universe *, struct option *);
 
 /* stables.c */
 #if defined (FAILOVER_PROTOCOL)
@@ -3072,6 +3297,8 @@ void start_selecting6(struct client_state *client);
 void unconfigure6(struct client_state *client, const char *reason);
 
 /* db.c */
+extern u_int32_t ia_write_count;
+
 int write_lease (struct lease *);
 int write_host (struct host_decl *);
 int write_server_duid(void);
@@ -3085,9 +3312,16 @@ void write_billing_classes (void);
 int write_billing_class (struct class *);
 void commit_leases_timeout (void *);
 int commit_leases (void);
+#if defined (ASYNC_LEASE_WRITER)
+int commit_leases_async (void (*)(void *), void *);
+#endif
 int commit_leases_timed (void);
+#if defined (FAST_LEASE_READER)
+isc_result_t read_lease_file (const char *, int, size_t);
+#endif
 void db_startup (int);
 int new_lease_file (int test_mode);
+void log_hash_tables(void);
 int group_writer (struct group_object *);
 int write_ia(const struct ia_xx *);
 
@@ -3190,6 +3424,7 @@ isc_result_t icmp_echoreply (omapi_object_t *);
 
 /* dns.c */
 isc_result_t enter_dns_zone (struct dns_zone *);
+isc_result_t remove_dns_zone (struct dns_zone *);
 isc_result_t dns_zone_lookup (struct dns_zone **, const char *);
 int dns_zone_dereference (struct dns_zone **, const char *, int);
 #if defined (NSUPDATE)
@@ -3218,6 +3453,14 @@ isc_result_t
 ddns_modify_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line);
 void
 ddns_cancel(dhcp_ddns_cb_t *ddns_cb, const char *file, int line);
+#if defined (NSUPDATE)
+extern int ddns_zone_max_inflight;
+extern int ddns_server_max_inflight;
+extern int ddns_queued;
+extern u_int32_t ddns_dropped;
+extern ddns_update_t ddns_update;
+void ddns_complete(dhcp_ddns_cb_t *ddns_cb, isc_result_t eresult);
+#endif
 
 /* resolv.c */
 extern char path_resolv_conf [];
@@ -3243,6 +3486,7 @@ extern struct executable_statement *default_classification_rules;
 void classification_setup (void);
 void classify_client (struct packet *);
 int check_collection (struct packet *, struct lease *, struct collection *);
+void clear_class_index (struct collection *);
 void classify (struct packet *, struct class *);
 isc_result_t unlink_class (struct class **class);
 isc_result_t find_class (struct class **, const char *,
@@ -3277,6 +3521,17 @@ int find_matching_case (struct executable_statement **,
 int executable_statement_foreach (struct executable_statement *,
 				  int (*) (struct executable_statement *,
 					   void *, int), void *, int);
+#if defined (ENABLE_EXECUTE)
+extern int execute_max_running;
+extern int execute_max_queued;
+extern int execute_timeout;
+extern int execute_running;
+extern int execute_queued;
+extern u_int32_t execute_dropped;
+int execute_async (char **, int);
+int execute_readsocket (omapi_object_t *);
+isc_result_t execute_reap (omapi_object_t *);
+#endif
 
 /* comapi.c */
 extern omapi_object_type_t *dhcp_type_group;
@@ -3538,12 +3793,14 @@ int find_hosts_by_uid (struct host_decl **, const unsigned char *,
 		       unsigned, const char *, int);
 int find_hosts_by_option(struct host_decl **, struct packet *,
 			 struct option_state *, const char *, int);
+int host_id_options_configured (void);
 int find_host_for_network (struct subnet **, struct host_decl **,
 			   struct iaddr *, struct shared_network *);
 
 void new_address_range (struct parse *, struct iaddr, struct iaddr,
-			struct subnet *, struct pool *,
-			struct lease **);
+			struct subnet *, struct pool *);
+void pool_merge_ranges (struct pool *, struct pool *);
+void pool_make_free_lease (struct pool *);
 isc_result_t dhcp_lease_free (omapi_object_t *, const char *, int);
 isc_result_t dhcp_lease_get (omapi_object_t **, const char *, int);
 int find_grouped_subnet (struct subnet **, struct shared_network *,
@@ -3647,13 +3904,17 @@ isc_result_t dhcp_failover_set_state (dhcp_failover_state_t *,
 isc_result_t dhcp_failover_peer_state_changed (dhcp_failover_state_t *,
 					       failover_message_t *);
 void dhcp_failover_pool_rebalance (void *);
+void dhcp_failover_pool_balance_slice (void *);
 void dhcp_failover_pool_check (struct pool *);
 int dhcp_failover_state_pool_check (dhcp_failover_state_t *);
 void dhcp_failover_timeout (void *);
 void dhcp_failover_send_contact (void *);
 isc_result_t dhcp_failover_send_state (dhcp_failover_state_t *);
 isc_result_t dhcp_failover_send_updates (dhcp_failover_state_t *);
+u_int32_t dhcp_failover_update_window (dhcp_failover_state_t *);
+void dhcp_failover_update_rtt (dhcp_failover_state_t *);
 int dhcp_failover_queue_update (struct lease *, int);
+isc_uint64_t dhcp_failover_next_sequence (dhcp_failover_state_t *);
 int dhcp_failover_send_acks (dhcp_failover_state_t *);
 void dhcp_failover_toack_queue_timeout (void *);
 int dhcp_failover_queue_ack (dhcp_failover_state_t *, failover_message_t *msg);
@@ -3716,12 +3977,14 @@ isc_result_t dhcp_failover_send_poolresp (dhcp_failover_state_t *, int);
 isc_result_t dhcp_failover_send_update_request (dhcp_failover_state_t *);
 isc_result_t dhcp_failover_send_update_request_all (dhcp_failover_state_t *);
 isc_result_t dhcp_failover_send_update_done (dhcp_failover_state_t *);
+isc_result_t dhcp_failover_parse_message (failover_message_t *,
+					  u_int8_t *, unsigned);
 isc_result_t dhcp_failover_process_bind_update (dhcp_failover_state_t *,
 						failover_message_t *);
 isc_result_t dhcp_failover_process_bind_ack (dhcp_failover_state_t *,
 					     failover_message_t *);
 isc_result_t dhcp_failover_generate_update_queue (dhcp_failover_state_t *,
-						  int);
+						  int, isc_uint64_t);
 isc_result_t dhcp_failover_process_update_request (dhcp_failover_state_t *,
 						   failover_message_t *);
 isc_result_t dhcp_failover_process_update_request_all (dhcp_failover_state_t *,
@@ -3733,6 +3996,13 @@ void dhcp_failover_recover_done (void *);
 void failover_print (char *, unsigned *, unsigned, const char *);
 void update_partner (struct lease *);
 int load_balance_mine (struct packet *, dhcp_failover_state_t *);
+int load_balance_theirs_raw (struct interface_info *,
+			     const struct dhcp_packet *, unsigned,
+			     dhcp_failover_state_t **);
+void dhcp_failover_packet_handler (struct interface_info *,
+				   struct dhcp_packet *, unsigned,
+				   unsigned int, struct iaddr,
+				   struct hardware *);
 int peer_wants_lease (struct lease *);
 binding_state_t normal_binding_state_transition_check (struct lease *,
 						       dhcp_failover_state_t *,
@@ -376,7 +376,8 @@ enum dhcp_token {
 	LEASE_ID_FORMAT = 676,
 	TOKEN_HEX = 677,
 	TOKEN_OCTAL = 678,
-	KEY_ALGORITHM = 679
+	KEY_ALGORITHM = 679,
+	SEQUENCE = 680
 };
 
 #define is_identifier(x)	((x) >= FIRST_TOKEN &&	\
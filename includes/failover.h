@@ -147,6 +147,11 @@ typedef struct {
 
 #define FTO_MAX				FTO_VENDOR_OPTIONS
 
+/* Our sub-options of FTO_VENDOR_OPTIONS: each is the ISC enterprise
+   number, a one-byte code and a one-byte length, then the data. */
+#define FTV_ISC_ENTERPRISE		2495
+#define FTV_SEQUENCE			1	/* 64-bit sequence number. */
+
 /* Failover protocol message types from Section 6.1: */
 #define FTM_POOLREQ		1
 #define FTM_POOLRESP		2
@@ -273,7 +278,6 @@ typedef struct {
 	struct _dhcp_failover_state *state_object;
 	u_int16_t imsg_len;
 	unsigned imsg_count;
-	u_int8_t imsg_payoff; /* Pay*load* offset. :') */
 	u_int32_t xid;
 } dhcp_failover_link_t;
 
@@ -390,9 +394,59 @@ typedef struct _dhcp_failover_state {
 	int curUPD;			/* If an UPDREQ* message is in motion,
 					   this value indicates which one. */
 	u_int32_t updxid;		/* XID of UPDREQ* message in action. */
+
+	u_int32_t update_window;	/* How many updates we let the peer
+					   have unacked, within what it
+					   allows; zero until measured. */
+	u_int32_t rtt_xid;		/* XID of the update being timed. */
+	struct timeval rtt_sent;	/* When it was sent. */
+	u_int32_t rtt, rtt_min;		/* Smoothed and least round trip
+					   time of an update, in
+					   microseconds. */
+
+	u_int32_t updates_sent;		/* Update traffic on the link since */
+	u_int32_t updates_acked;	/* the server started, for the */
+	u_int32_t acks_sent;		/* failover-state object. */
+	TIME rate_time;			/* Second being counted, and the */
+	u_int32_t rate_count;		/* updates acked in it and in the */
+	u_int32_t rate_last;		/* one before. */
+
+	struct pool *balance_pool;	/* Pool being balanced, if any, */
+	struct lease *balance_next;	/* the next lease to look at in */
+	int balance_pass;		/* it, and which pass this is. */
+	int balance_flags;		/* DHCP_FAILOVER_BALANCE_*. */
+	isc_boolean_t balance_sendreq;	/* A POOLREQ is needed. */
+	int balance_queued;		/* Leases given away, */
+	u_int32_t balance_slices;	/* slices run, time spent in them */
+	u_int32_t balance_busy;		/* and the longest of them, in */
+	u_int32_t balance_slice_max;	/* microseconds, in this balance, */
+	int balance_moved;		/* and the same for the last one */
+	u_int32_t balance_time_slices;	/* done. */
+	u_int32_t balance_time;
+	u_int32_t balance_time_slice_max;
+
+	isc_uint64_t sequence;		/* Last sequence number we stamped
+					   on a lease. */
+	isc_uint64_t sequence_start;	/* Lowest we can vouch for: the
+					   lowest in the lease file, or the
+					   first we stamped. */
+	isc_uint64_t partner_sequence;	/* Highest of the partner's sequence
+					   numbers we have stored and
+					   acked; zero if unknown. */
+
+	u_int32_t lb_prefiltered;	/* DHCPDISCOVERs left to the peer
+					   before being parsed. */
 } dhcp_failover_state_t;
 
 extern int check_secs_byte_order; /* check byte order of secs field when true */
 
 #define DHCP_FAILOVER_VERSION		1
+
+/* Pool rebalancing looks at this many leases before letting the
+   dispatcher run. */
+#define DHCP_FAILOVER_BALANCE_SLICE	256
+
+/* What to do when a pool balance is done. */
+#define DHCP_FAILOVER_BALANCE_POOLREQ	1	/* Send a POOLREQ if needed. */
+#define DHCP_FAILOVER_BALANCE_POOLRESP	2	/* Answer the peer's POOLREQ. */
 #endif /* FAILOVER_PROTOCOL */
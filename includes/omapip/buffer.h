@@ -70,6 +70,8 @@ isc_result_t omapi_connection_copyout (unsigned char *,
 isc_result_t omapi_connection_copyin (omapi_object_t *,
 				      const unsigned char *, unsigned);
 isc_result_t omapi_connection_flush (omapi_object_t *);
+isc_result_t omapi_connection_cork (omapi_object_t *);
+isc_result_t omapi_connection_uncork (omapi_object_t *);
 isc_result_t omapi_connection_get_uint32 (omapi_object_t *, u_int32_t *);
 isc_result_t omapi_connection_put_uint32 (omapi_object_t *, u_int32_t);
 isc_result_t omapi_connection_get_uint16 (omapi_object_t *, u_int16_t *);
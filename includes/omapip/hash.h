@@ -56,15 +56,36 @@ struct hash_bucket {
 
 typedef int (*hash_comparator_t)(const void *, const void *, size_t);
 
+/*
+ * A hash table grows once it holds more than HASH_MAX_LOAD entries per
+ * bucket.  Rather than rehashing everything at once, the old bucket
+ * array is kept and HASH_REHASH_STEP of its buckets are moved into the
+ * new one on each add, delete or lookup until it is empty.
+ */
+#if !defined (HASH_MAX_LOAD)
+# define HASH_MAX_LOAD		2
+#endif
+
+#if !defined (HASH_REHASH_STEP)
+# define HASH_REHASH_STEP	8
+#endif
+
 struct hash_table {
-	unsigned hash_count;
+	unsigned hash_count;		/* Number of buckets. */
+	unsigned entries;		/* Entries in both bucket arrays. */
 	hash_reference referencer;
 	hash_dereference dereferencer;
 	hash_comparator_t cmp;
 	unsigned (*do_hash)(const void *, unsigned, unsigned);
+	struct hash_bucket **buckets;
+
+	/* Bucket array being drained into buckets while resizing. */
+	struct hash_bucket **old_buckets;
+	unsigned old_count;
+	unsigned rehash_index;
 
-	/* This must remain the last entry in this table. */
-	struct hash_bucket *buckets [1];
+	/* Non-zero while hash_foreach() is walking the table. */
+	int iterating;
 };
 
 struct named_hash {
@@ -189,6 +189,8 @@ typedef struct __omapi_connection_object {
 	omapi_buffer_t *inbufs;
 	u_int32_t out_bytes;	/* Bytes of output in buffers. */
 	omapi_buffer_t *outbufs;
+	int corked;		/* Output is being held back until this
+				   drops to zero. */
 	omapi_listener_object_t *listener;	/* Listener that accepted this
 						   connection, if any. */
 	dst_key_t *in_key;	/* Authenticator signing incoming
@@ -182,6 +182,22 @@
 #  define PACKET_DECODING
 #endif
 
+/* Batched receive is only implemented on top of a PACKET_MMAP ring for
+   LPF and of recvmmsg() for the DHCPv6 socket; everything else keeps
+   reading one packet per wakeup. */
+#if defined (USE_BATCH_RECEIVE) && defined (USE_LPF_RECEIVE)
+#  define USE_LPF_RX_RING
+#endif
+#if defined (USE_BATCH_RECEIVE) && defined (DHCPv6) && defined (MSG_WAITFORONE)
+#  define USE_RECVMMSG
+#endif
+
+/* Batched transmission needs sendmmsg(), which arrived alongside
+   recvmmsg() and its MSG_WAITFORONE flag. */
+#if defined (USE_BATCH_SEND) && defined (MSG_WAITFORONE)
+#  define USE_SENDMMSG
+#endif
+
 /* If we don't have a DLPI packet filter, we have to filter in userland.
    Probably not worth doing, actually. */
 #if defined (USE_DLPI_RECEIVE) && !defined (USE_DLPI_PFMOD)
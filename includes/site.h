@@ -30,6 +30,13 @@
 
 /* #define DEBUG_EXPRESSIONS */
 
+/* Define this to check every run of a compiled expression against the
+   tree evaluator, logging any difference.   Anything the expression
+   does besides computing a value, such as calling a function, happens
+   twice. */
+
+/* #define DEBUG_EXPRESSION_CODE */
+
 /* Define this if you want to see dumps of find_lease() in action. */
 
 /* #define DEBUG_FIND_LEASE */
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TESTS_T_BENCH_H
+#define TESTS_T_BENCH_H 1
+
+/*! \file includes/t_bench.h */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/*
+ * Some of the unit test programs carry benchmarks as well.  They are slow
+ * and print their timings, so they are skipped unless DHCP_BENCH is set
+ * to something other than 0 in the environment, for example:
+ *
+ *	DHCP_BENCH=1 atf-run option_unittest
+ *
+ * A benchmark test case starts with BENCH_REQUIRE() and times each step
+ * between bench_start() and bench_report().
+ */
+#define BENCH_ENV "DHCP_BENCH"
+
+static inline int
+bench_enabled(void) {
+	const char *value = getenv(BENCH_ENV);
+
+	return ((value != NULL) && (*value != '\0') &&
+		(strcmp(value, "0") != 0));
+}
+
+/* Skip the calling test case unless benchmarks were asked for. */
+#define BENCH_REQUIRE()							\
+	do {								\
+		if (!bench_enabled())					\
+			atf_tc_skip("benchmark, set " BENCH_ENV		\
+				    " to run it");			\
+	} while (0)
+
+static inline void
+bench_start(struct timeval *start) {
+	gettimeofday(start, NULL);
+}
+
+/* Print what was timed, as for printf(), and how long it took. */
+static inline void
+bench_report(const struct timeval *start, const char *fmt, ...) {
+	struct timeval now;
+	va_list args;
+
+	gettimeofday(&now, NULL);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf(": %.3fs\n", (now.tv_sec - start->tv_sec) +
+	       (now.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+#endif /* TESTS_T_BENCH_H */
@@ -56,9 +56,12 @@ struct enumeration {
 #define TREE_LIMIT		4
 #define TREE_DATA_EXPR		5
 
+struct arena_chunk; /* forward */
+
 /* A data buffer with a reference count. */
 struct buffer {
 	int refcnt;
+	struct arena_chunk *chunk;	/* Packet arena chunk, or NULL. */
 	unsigned char data [1];
 };
 
@@ -194,6 +197,8 @@ enum expr_op {
 	expr_concat_dclist
 };
 
+struct expr_code; /* forward */
+
 struct expression {
 	int refcnt;
 	enum expr_op op;
@@ -281,7 +286,14 @@ struct expression {
 	} data;
 	int flags;
 #	define EXPR_EPHEMERAL	1
-};		
+	struct expr_code *code;	/* Compiled form, see bytecode.c. */
+	int code_tried;
+};
+
+/* What an expression is being evaluated for, when it is compiled. */
+#define EXPR_CODE_BOOLEAN	1
+#define EXPR_CODE_NUMERIC	2
+#define EXPR_CODE_DATA		3		
 
 /* DNS host entry structure... */
 struct dns_host_entry {
@@ -340,8 +352,18 @@ struct universe {
 
 	/* Flags should probably become condensed. */
 	int concat_duplicates;
+
+	/* Options by code, for spaces small enough to index directly.
+	   See option_code_lookup(). */
+	struct option **code_table;
+	unsigned code_table_size;
 };
 
+/* The most codes a universe's option table covers.  Every option_state
+   sizes its index for the space to the table, so options with higher
+   codes are only hashed, and stored on the index's overflow list. */
+#define OPTION_CODE_TABLE_MAX	256
+
 struct option {
 	const char *name;
 	const char *format;
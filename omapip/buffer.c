@@ -31,6 +31,8 @@
 #include <omapip/omapip_p.h>
 #include <errno.h>
 
+static void omapi_connection_poke_writer (omapi_connection_object_t *);
+
 #if defined (TRACING)
 static void trace_connection_input_input (trace_type_t *, unsigned, char *);
 static void trace_connection_input_stop (trace_type_t *);
@@ -339,20 +341,65 @@ isc_result_t omapi_connection_copyin (omapi_object_t *h,
 	/*
 	 * If we have any bytes to send and we have a proper io object
 	 * inform the socket code that we would like to know when we
-	 * can send more bytes.
+	 * can send more bytes.  While the connection is corked that
+	 * waits until it is uncorked.
 	 */
-	if (c->out_bytes != 0) {
-		if ((c->outer != NULL) &&
-		    (c->outer->type == omapi_type_io_object)) {
-			omapi_io_object_t *io = (omapi_io_object_t *)c->outer;
-			isc_socket_fdwatchpoke(io->fd,
-					       ISC_SOCKFDWATCH_WRITE);
-		}
-	}
+	if (c->out_bytes != 0 && c->corked == 0)
+		omapi_connection_poke_writer(c);
 
 	return (status);
 }
 
+static void omapi_connection_poke_writer (omapi_connection_object_t *c)
+{
+	if ((c->outer != NULL) &&
+	    (c->outer->type == omapi_type_io_object)) {
+		omapi_io_object_t *io = (omapi_io_object_t *)c->outer;
+		isc_socket_fdwatchpoke(io->fd, ISC_SOCKFDWATCH_WRITE);
+	}
+}
+
+/* Hold back whatever is copied into the output buffer until the
+   matching call to omapi_connection_uncork(), so that a run of
+   messages goes out in as few writes as possible.  Calls nest, and
+   the last uncork writes what it can straight away. */
+
+isc_result_t omapi_connection_cork (omapi_object_t *h)
+{
+	omapi_connection_object_t *c;
+
+	if (!h || h -> type != omapi_type_connection)
+		return DHCP_R_INVALIDARG;
+	c = (omapi_connection_object_t *)h;
+
+	c -> corked++;
+	return ISC_R_SUCCESS;
+}
+
+isc_result_t omapi_connection_uncork (omapi_object_t *h)
+{
+	omapi_connection_object_t *c;
+
+	if (!h || h -> type != omapi_type_connection)
+		return DHCP_R_INVALIDARG;
+	c = (omapi_connection_object_t *)h;
+
+	if (c -> corked == 0)
+		return ISC_R_UNEXPECTED;
+	if (--c -> corked != 0 || c -> out_bytes == 0)
+		return ISC_R_SUCCESS;
+
+	/* Anything that doesn't fit in the socket buffer, and any error,
+	   is left to the socket code. */
+	if (c -> state == omapi_connection_connected &&
+	    omapi_connection_writer (h) == ISC_R_SUCCESS)
+		return ISC_R_SUCCESS;
+	if (c -> state != omapi_connection_disconnecting &&
+	    c -> state != omapi_connection_closed)
+		omapi_connection_poke_writer(c);
+	return ISC_R_SUCCESS;
+}
+
 /* Copy some bytes from the input buffer, and advance the input buffer
    pointer beyond the bytes copied out. */
 
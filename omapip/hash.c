@@ -52,6 +52,21 @@ find_length(const void *key,
 	return 0;
 }
 
+/* Key for the string and identifier hashes, see hash_bytes(). */
+static u_int64_t hash_seed;
+static int hash_seeded;
+
+static void
+hash_seed_init(void)
+{
+	isc_uint32_t r0, r1;
+
+	isc_random_get(&r0);
+	isc_random_get(&r1);
+	hash_seed = ((u_int64_t)r0 << 32) | r1;
+	hash_seeded = 1;
+}
+
 int new_hash_table (tp, count, file, line)
 	struct hash_table **tp;
 	unsigned count;
@@ -59,7 +74,6 @@ int new_hash_table (tp, count, file, line)
 	int line;
 {
 	struct hash_table *rval;
-	unsigned extra;
 
 	if (!tp) {
 		log_error ("%s(%d): new_hash_table called with null pointer.",
@@ -77,19 +91,24 @@ int new_hash_table (tp, count, file, line)
 #endif
 	}
 
-	/* There is one hash bucket in the structure.  Allocate extra
-	 * memory beyond the end of the structure to fulfill the requested
-	 * count ("count - 1").  Do not let there be less than one.
-	 */
-	if (count <= 1)
-		extra = 0;
-	else
-		extra = count - 1;
+	/* Do not let there be less than one bucket, and round up to a
+	   power of two so that the hash functions can mask. */
+	if (count < 1)
+		count = 1;
+	if (count > UINT_MAX / 2 / sizeof(struct hash_bucket *))
+		count = UINT_MAX / 2 / sizeof(struct hash_bucket *);
+	while (count & (count - 1))
+		count = (count | (count - 1)) + 1;
 
-	rval = dmalloc(sizeof(struct hash_table) +
-		       (extra * sizeof(struct hash_bucket *)), file, line);
+	rval = dmalloc(sizeof(struct hash_table), file, line);
 	if (!rval)
 		return 0;
+	rval -> buckets = dmalloc(count * sizeof(struct hash_bucket *),
+				  file, line);
+	if (!rval -> buckets) {
+		dfree(rval, file, line);
+		return 0;
+	}
 	rval -> hash_count = count;
 	*tp = rval;
 	return 1;
@@ -102,29 +121,109 @@ void free_hash_table (tp, file, line)
 {
 	struct hash_table *ptr = *tp;
 
+	if (ptr == NULL)
+		return;
+
 #if defined (DEBUG_MEMORY_LEAKAGE) || \
 		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
-	int i;
-	struct hash_bucket *hbc, *hbn = (struct hash_bucket *)0;
-
-	for (i = 0; ptr != NULL && i < ptr -> hash_count; i++) {
-	    for (hbc = ptr -> buckets [i]; hbc; hbc = hbn) {
-		hbn = hbc -> next;
-		if (ptr -> dereferencer && hbc -> value)
-		    (*ptr -> dereferencer) (&hbc -> value, MDL);
-	    }
-	    for (hbc = ptr -> buckets [i]; hbc; hbc = hbn) {
-		hbn = hbc -> next;
-		free_hash_bucket (hbc, MDL);
+	struct hash_bucket **array, *hbc, *hbn = (struct hash_bucket *)0;
+	unsigned count, i, pass;
+
+	for (pass = 0; pass < 2; pass++) {
+	    array = pass ? ptr -> old_buckets : ptr -> buckets;
+	    count = pass ? ptr -> old_count : ptr -> hash_count;
+	    for (i = 0; array != NULL && i < count; i++) {
+		for (hbc = array [i]; hbc; hbc = hbn) {
+		    hbn = hbc -> next;
+		    if (ptr -> dereferencer && hbc -> value)
+			(*ptr -> dereferencer) (&hbc -> value, MDL);
+		}
+		for (hbc = array [i]; hbc; hbc = hbn) {
+		    hbn = hbc -> next;
+		    free_hash_bucket (hbc, MDL);
+		}
+		array [i] = (struct hash_bucket *)0;
 	    }
-	    ptr -> buckets [i] = (struct hash_bucket *)0;
 	}
 #endif
 
+	if (ptr -> old_buckets)
+		dfree((void *)ptr -> old_buckets, MDL);
+	dfree((void *)ptr -> buckets, MDL);
 	dfree((void *)ptr, MDL);
 	*tp = (struct hash_table *)0;
 }
 
+/*
+ * Move up to HASH_REHASH_STEP buckets from the array being drained into
+ * the current one, and drop the old array once it is empty.  Nothing is
+ * moved while hash_foreach() is running so that it sees every entry
+ * exactly once.
+ */
+static void
+hash_rehash_step(struct hash_table *table)
+{
+	struct hash_bucket *bp, *next, **tail;
+	unsigned moved, hashno;
+
+	if (table->old_buckets == NULL || table->iterating)
+		return;
+
+	for (moved = 0; moved < HASH_REHASH_STEP &&
+			table->rehash_index < table->old_count; moved++) {
+		bp = table->old_buckets[table->rehash_index];
+		table->old_buckets[table->rehash_index++] = NULL;
+		/* Append, so that entries added since the resize began
+		   are still found ahead of older ones with the same key. */
+		for (; bp != NULL; bp = next) {
+			next = bp->next;
+			hashno = (*table->do_hash)(bp->name, bp->len,
+						   table->hash_count);
+			for (tail = &table->buckets[hashno]; *tail;
+			     tail = &(*tail)->next)
+				;
+			bp->next = NULL;
+			*tail = bp;
+		}
+	}
+
+	if (table->rehash_index >= table->old_count) {
+		dfree(table->old_buckets, MDL);
+		table->old_buckets = NULL;
+		table->old_count = 0;
+		table->rehash_index = 0;
+	}
+}
+
+/*
+ * Start growing the table if it has become too full.  The current
+ * array becomes the one being drained and a new one twice its size
+ * takes new entries.  If we can't get the memory we just carry on with
+ * longer chains.
+ */
+static void
+hash_maybe_grow(struct hash_table *table)
+{
+	struct hash_bucket **nb;
+	unsigned ncount;
+
+	if (table->old_buckets != NULL || table->iterating ||
+	    table->entries <= table->hash_count * HASH_MAX_LOAD ||
+	    table->hash_count > (UINT_MAX / 2) / sizeof(*nb))
+		return;
+
+	ncount = table->hash_count * 2;
+	nb = dmalloc(ncount * sizeof(*nb), MDL);
+	if (nb == NULL)
+		return;
+
+	table->old_buckets = table->buckets;
+	table->old_count = table->hash_count;
+	table->rehash_index = 0;
+	table->buckets = nb;
+	table->hash_count = ncount;
+}
+
 struct hash_bucket *free_hash_buckets;
 
 #if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
@@ -219,11 +318,12 @@ int new_hash(struct hash_table **rp,
 	if (hsize == 0)
 		hsize = DEFAULT_HASH_SIZE;
 
+	if (!hash_seeded)
+		hash_seed_init();
+
 	if (!new_hash_table (rp, hsize, file, line))
 		return 0;
 
-	memset ((*rp)->buckets, 0, hsize * sizeof(struct hash_bucket *));
-
 	(*rp)->referencer = referencer;
 	(*rp)->dereferencer = dereferencer;
 	(*rp)->do_hash = hasher;
@@ -236,96 +336,115 @@ int new_hash(struct hash_table **rp,
 	return 1;
 }
 
-unsigned
-do_case_hash(const void *name, unsigned len, unsigned size)
+/*
+ * The string and identifier hashes read their keys eight bytes at a
+ * time and mix them with the multiply-rotate rounds used by xxHash64.
+ * The result is keyed with a seed picked when the first table is made,
+ * so that clients can't choose identifiers that all land in one chain.
+ * Tables are always a power of two in size, so the bucket is just the
+ * low bits of the hash.
+ */
+#define HASH_PRIME1	0x9E3779B185EBCA87ULL
+#define HASH_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3	0x165667B19E3779F9ULL
+#define HASH_PRIME4	0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5	0x27D4EB2F165667C5ULL
+
+#define HASH_ROTL(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+/* Byte masks for lower casing eight ASCII characters at once. */
+#define HASH_ONES	0x0101010101010101ULL
+#define HASH_HIGH	0x8080808080808080ULL
+
+/* Convert any upper case ASCII letters in the word to lower case. */
+static inline u_int64_t
+hash_fold_case(u_int64_t word)
 {
-	register unsigned accum = 0;
-	register const unsigned char *s = name;
-	int i = len;
-	register unsigned c;
-
-	while (i--) {
-		/* Make the hash case-insensitive. */
-		c = *s++;
-		if (isascii(c))
-			c = tolower(c);
-
-		/* Add the character in... */
-		accum = (accum << 1) + c;
-
-		/* Add carry back in... */
-		while (accum > 65535) {
-			accum = (accum & 65535) + (accum >> 16);
-		}
+	u_int64_t low7 = word & ~HASH_HIGH;
+	u_int64_t above_z = low7 + HASH_ONES * (0x7f - 'Z');
+	u_int64_t from_a = low7 + HASH_ONES * (0x80 - 'A');
+	u_int64_t upper = (from_a ^ above_z) & ~word & HASH_HIGH;
+
+	return word | (upper >> 2);
+}
 
+static unsigned
+hash_bytes(const unsigned char *s, unsigned len, int fold, unsigned size)
+{
+	u_int64_t h = hash_seed + HASH_PRIME5 + len;
+	u_int64_t k;
+	u_int32_t k32;
+
+	for (; len >= 8; s += 8, len -= 8) {
+		memcpy(&k, s, 8);
+		if (fold)
+			k = hash_fold_case(k);
+		k *= HASH_PRIME2;
+		k = HASH_ROTL(k, 31) * HASH_PRIME1;
+		h ^= k;
+		h = HASH_ROTL(h, 27) * HASH_PRIME1 + HASH_PRIME4;
+	}
+	if (len >= 4) {
+		memcpy(&k32, s, 4);
+		k = k32;
+		if (fold)
+			k = hash_fold_case(k);
+		h ^= k * HASH_PRIME1;
+		h = HASH_ROTL(h, 23) * HASH_PRIME2 + HASH_PRIME3;
+		s += 4;
+		len -= 4;
 	}
-	return accum % size;
+	for (; len > 0; s++, len--) {
+		k = *s;
+		if (fold && isascii(*s))
+			k = tolower(*s);
+		h ^= k * HASH_PRIME5;
+		h = HASH_ROTL(h, 11) * HASH_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= HASH_PRIME2;
+	h ^= h >> 29;
+	h *= HASH_PRIME3;
+	h ^= h >> 32;
+
+	return (unsigned)h & (size - 1);
 }
 
 unsigned
-do_string_hash(const void *name, unsigned len, unsigned size)
+do_case_hash(const void *name, unsigned len, unsigned size)
 {
-	register unsigned accum = 0;
-	register const unsigned char *s = (const unsigned char *)name;
-	int i = len;
-
-	while (i--) {
-		/* Add the character in... */
-		accum = (accum << 1) + *s++;
+	return hash_bytes((const unsigned char *)name, len, 1, size);
+}
 
-		/* Add carry back in... */
-		while (accum > 65535) {
-			accum = (accum & 65535) + (accum >> 16);
-		}
-	}
-	return accum % size;
+unsigned
+do_string_hash(const void *name, unsigned len, unsigned size)
+{
+	return hash_bytes((const unsigned char *)name, len, 0, size);
 }
 
-/* Client identifiers are generally 32-bits of ordinary
- * non-randomness followed by 24-bits of unordinary randomness.
- * So, end-align in 24-bit chunks, and xor any preceding data
- * just to mix it up a little.
+/* Client identifiers and hardware addresses tend to share a long
+ * vendor prefix and differ only in the last few bytes, which is the
+ * case a full width mix handles well.
  */
 unsigned
 do_id_hash(const void *name, unsigned len, unsigned size)
 {
-	register unsigned accum = 0;
-	register const unsigned char *s = (const unsigned char *)name;
-	const unsigned char *end = s + len;
-
 	if (len == 0)
 		return 0;
 
-	/*
-	 * The switch handles our starting conditions, then we hash the
-	 * remaining bytes in groups of 3
-	 */
-	   
-	switch (len % 3) {
-	case 0:
-		break;
-	case 2:
-		accum ^= *s++ << 8;
-	case 1:
-		accum ^= *s++;
-		break;
-	}
-
-	while (s < end) {
-		accum ^= *s++ << 16;
-		accum ^= *s++ << 8;
-		accum ^= *s++;
-	}
-
-	return accum % size;
+	return hash_bytes((const unsigned char *)name, len, 0, size);
 }
 
+/* Numbers and addresses are usually consecutive, so their low bits
+ * already spread them evenly over the buckets.
+ */
 unsigned
 do_number_hash(const void *key, unsigned len, unsigned size)
 {
 	register unsigned number = *((const unsigned *)key);
 
-	return number % size;
+	return number & (size - 1);
 }
 
 unsigned
@@ -337,7 +456,7 @@ do_ip4_hash(const void *key, unsigned len, unsigned size)
 
 	number = ntohl(number);
 
-	return number % size;
+	return number & (size - 1);
 }
 
 unsigned char *
@@ -357,6 +476,10 @@ hash_report(struct hash_table *table)
 	if (table->hash_count == 0)
 		return (unsigned char *) "Invalid hash table.";
 
+	/* Report on the table as it will be once any resize finishes. */
+	while (table->old_buckets != NULL && !table->iterating)
+		hash_rehash_step(table);
+
 	for (i = 0 ; i < table->hash_count ; i++) {
 		curlen = 0;
 
@@ -411,6 +534,8 @@ void add_hash (table, key, len, pointer, file, line)
 	if (!len)
 		len = find_length(key, table->do_hash);
 
+	hash_rehash_step(table);
+
 	hashno = (*table->do_hash)(key, len, table->hash_count);
 	bp = new_hash_bucket (file, line);
 
@@ -427,30 +552,20 @@ void add_hash (table, key, len, pointer, file, line)
 	bp -> next = table -> buckets [hashno];
 	bp -> len = len;
 	table -> buckets [hashno] = bp;
+	table -> entries++;
+
+	hash_maybe_grow(table);
 }
 
-void delete_hash_entry (table, key, len, file, line)
-	struct hash_table *table;
-	unsigned len;
-	const void *key;
-	const char *file;
-	int line;
+/* Unlink and free the first entry in a chain that matches the key. */
+static int
+hash_chain_delete(struct hash_table *table, struct hash_bucket **chain,
+		  const void *key, unsigned len, const char *file, int line)
 {
-	int hashno;
 	struct hash_bucket *bp, *pbp = (struct hash_bucket *)0;
 	void *foo;
 
-	if (!table)
-		return;
-
-	if (!len)
-		len = find_length(key, table->do_hash);
-
-	hashno = (*table->do_hash)(key, len, table->hash_count);
-
-	/* Go through the list looking for an entry that matches;
-	   if we find it, delete it. */
-	for (bp = table -> buckets [hashno]; bp; bp = bp -> next) {
+	for (bp = *chain; bp; bp = bp -> next) {
 		if ((!bp -> len &&
 		     !strcmp ((const char *)bp->name, key)) ||
 		    (bp -> len == len &&
@@ -458,17 +573,62 @@ void delete_hash_entry (table, key, len, file, line)
 			if (pbp) {
 				pbp -> next = bp -> next;
 			} else {
-				table -> buckets [hashno] = bp -> next;
+				*chain = bp -> next;
 			}
 			if (bp -> value && table -> dereferencer) {
 				foo = &bp -> value;
 				(*(table -> dereferencer)) (foo, file, line);
 			}
 			free_hash_bucket (bp, file, line);
-			break;
+			table -> entries--;
+			return 1;
 		}
 		pbp = bp;	/* jwg, 9/6/96 - nice catch! */
 	}
+	return 0;
+}
+
+void delete_hash_entry (table, key, len, file, line)
+	struct hash_table *table;
+	unsigned len;
+	const void *key;
+	const char *file;
+	int line;
+{
+	int hashno;
+
+	if (!table)
+		return;
+
+	if (!len)
+		len = find_length(key, table->do_hash);
+
+	hash_rehash_step(table);
+
+	/* Go through the list looking for an entry that matches;
+	   if we find it, delete it.  Entries still waiting to be moved
+	   out of the old bucket array are older, so look there last. */
+	hashno = (*table->do_hash)(key, len, table->hash_count);
+	if (hash_chain_delete(table, &table -> buckets [hashno],
+			      key, len, file, line))
+		return;
+
+	if (table -> old_buckets) {
+		hashno = (*table->do_hash)(key, len, table->old_count);
+		(void) hash_chain_delete(table, &table -> old_buckets [hashno],
+					 key, len, file, line);
+	}
+}
+
+static struct hash_bucket *
+hash_chain_find(struct hash_table *table, struct hash_bucket *bp,
+		const void *key, unsigned len)
+{
+	for (; bp; bp = bp -> next) {
+		if (len == bp -> len && !(*table->cmp)(bp->name, key, len))
+			return bp;
+	}
+	return NULL;
 }
 
 int hash_lookup (vp, table, key, len, file, line)
@@ -492,43 +652,56 @@ int hash_lookup (vp, table, key, len, file, line)
 			  "initialized to zero (from %s:%d).", file, line);
 	}
 
-	hashno = (*table->do_hash)(key, len, table->hash_count);
+	hash_rehash_step(table);
 
-	for (bp = table -> buckets [hashno]; bp; bp = bp -> next) {
-		if (len == bp -> len
-		    && !(*table->cmp)(bp->name, key, len)) {
-			if (table -> referencer)
-				(*table -> referencer) (vp, bp -> value,
-							file, line);
-			else
-				*vp = bp -> value;
-			return 1;
-		}
+	/* Entries still in the old bucket array are older, so they are
+	   only found if there's no match in the current one. */
+	hashno = (*table->do_hash)(key, len, table->hash_count);
+	bp = hash_chain_find(table, table -> buckets [hashno], key, len);
+	if (!bp && table -> old_buckets) {
+		hashno = (*table->do_hash)(key, len, table->old_count);
+		bp = hash_chain_find(table, table -> old_buckets [hashno],
+				     key, len);
 	}
-	return 0;
+	if (!bp)
+		return 0;
+
+	if (table -> referencer)
+		(*table -> referencer) (vp, bp -> value, file, line);
+	else
+		*vp = bp -> value;
+	return 1;
 }
 
 int hash_foreach (struct hash_table *table, hash_foreach_func func)
 {
-	int i;
-	struct hash_bucket *bp, *next;
-	int count = 0;
+	unsigned i, count, pass;
+	struct hash_bucket **array, *bp, *next;
+	int done = 0;
 
 	if (!table)
 		return 0;
 
-	for (i = 0; i < table -> hash_count; i++) {
-		bp = table -> buckets [i];
-		while (bp) {
-			next = bp -> next;
-			if ((*func)(bp->name, bp->len, bp->value)
-							!= ISC_R_SUCCESS)
-				return count;
-			bp = next;
-			count++;
+	table -> iterating++;
+	for (pass = 0; pass < 2; pass++) {
+		array = pass ? table -> old_buckets : table -> buckets;
+		count = pass ? table -> old_count : table -> hash_count;
+		for (i = 0; array != NULL && i < count; i++) {
+			bp = array [i];
+			while (bp) {
+				next = bp -> next;
+				if ((*func)(bp->name, bp->len, bp->value)
+								!= ISC_R_SUCCESS) {
+					table -> iterating--;
+					return done;
+				}
+				bp = next;
+				done++;
+			}
 		}
 	}
-	return count;
+	table -> iterating--;
+	return done;
 }
 
 int casecmp (const void *v1, const void *v2, size_t len)
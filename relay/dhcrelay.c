@@ -739,15 +739,15 @@ main(int argc, char **argv) {
 
 		/* Check requested options. */
 		code = D6O_RELAY_MSG;
-		if (!option_code_hash_lookup(&requested_opts[0],
-					     dhcpv6_universe.code_hash,
-					     &code, 0, MDL))
+		if (!option_code_lookup(&requested_opts[0],
+					&dhcpv6_universe,
+					code, MDL))
 			log_fatal("Unable to find the RELAY_MSG "
 				  "option definition.");
 		code = D6O_INTERFACE_ID;
-		if (!option_code_hash_lookup(&requested_opts[1],
-					     dhcpv6_universe.code_hash,
-					     &code, 0, MDL))
+		if (!option_code_lookup(&requested_opts[1],
+					&dhcpv6_universe,
+					code, MDL))
 			log_fatal("Unable to find the INTERFACE_ID "
 				  "option definition.");
 	}
@@ -233,9 +233,9 @@ void bootp (packet)
 				     lease -> subnet -> netmask.iabuf,
 				     lease -> subnet -> netmask.len,
 				     0, 0, MDL)) {
-					option_code_hash_lookup(&oc->option,
-							dhcp_universe.code_hash,
-								&i, 0, MDL);
+					option_code_lookup(&oc->option,
+							   &dhcp_universe,
+							   i, MDL);
 					save_option (&dhcp_universe,
 						     options, oc);
 				}
@@ -59,136 +59,547 @@ void classify_client (packet)
 			    &global_scope, default_classification_rules, NULL);
 }
 
-int check_collection (packet, lease, collection)
+/* Check one class of a collection against a packet.  If known is set,
+   the class's match expression is already known to be true. */
+
+static int check_class (packet, lease, class, known)
 	struct packet *packet;
 	struct lease *lease;
-	struct collection *collection;
+	struct class *class;
+	int known;
 {
-	struct class *class, *nc;
+	struct class *nc;
 	struct data_string data;
-	int matched = 0;
 	int status;
 	int ignorep;
 	int classfound;
 
-	for (class = collection -> classes; class; class = class -> nic) {
 #if defined (DEBUG_CLASS_MATCHING)
-		log_info ("checking against class %s...", class -> name);
+	log_info ("checking against class %s...", class -> name);
 #endif
-		memset (&data, 0, sizeof data);
-
-		/* If there is a "match if" expression, check it.   If
-		   we get a match, and there's no subclass expression,
-		   it's a match.   If we get a match and there is a subclass
-		   expression, then we check the submatch.   If it's not a
-		   match, that's final - we don't check the submatch. */
-
-		if (class -> expr) {
-			status = (evaluate_boolean_expression_result
-				  (&ignorep, packet, lease,
-				   (struct client_state *)0,
-				   packet -> options, (struct option_state *)0,
-				   lease ? &lease -> scope : &global_scope,
-				   class -> expr));
-			if (status) {
-				if (!class -> submatch) {
-					matched = 1;
+	memset (&data, 0, sizeof data);
+
+	/* If there is a "match if" expression, check it.   If
+	   we get a match, and there's no subclass expression,
+	   it's a match.   If we get a match and there is a subclass
+	   expression, then we check the submatch.   If it's not a
+	   match, that's final - we don't check the submatch. */
+
+	if (class -> expr) {
+		status = known || (evaluate_boolean_expression_result
+				   (&ignorep, packet, lease,
+				    (struct client_state *)0,
+				    packet -> options, (struct option_state *)0,
+				    lease ? &lease -> scope : &global_scope,
+				    class -> expr));
+		if (status) {
+			if (!class -> submatch) {
 #if defined (DEBUG_CLASS_MATCHING)
-					log_info ("matches class.");
+				log_info ("matches class.");
 #endif
-					classify (packet, class);
-					continue;
-				}
-			} else
-				continue;
-		}
+				classify (packet, class);
+				return 1;
+			}
+		} else
+			return 0;
+	}
 
-		/* Check to see if the client matches an existing subclass.
-		   If it doesn't, and this is a spawning class, spawn a new
-		   subclass and put the client in it. */
-		if (class -> submatch) {
-			status = (evaluate_data_expression
-				  (&data, packet, lease,
-				   (struct client_state *)0,
-				   packet -> options, (struct option_state *)0,
-				   lease ? &lease -> scope : &global_scope,
-				   class -> submatch, MDL));
-			if (status && data.len) {
-				nc = (struct class *)0;
-				classfound = class_hash_lookup (&nc, class -> hash,
-					(const char *)data.data, data.len, MDL);
+	/* Check to see if the client matches an existing subclass.
+	   If it doesn't, and this is a spawning class, spawn a new
+	   subclass and put the client in it. */
+	if (class -> submatch) {
+		status = (evaluate_data_expression
+			  (&data, packet, lease,
+			   (struct client_state *)0,
+			   packet -> options, (struct option_state *)0,
+			   lease ? &lease -> scope : &global_scope,
+			   class -> submatch, MDL));
+		if (status && data.len) {
+			nc = (struct class *)0;
+			classfound = class_hash_lookup (&nc, class -> hash,
+				(const char *)data.data, data.len, MDL);
 
 #ifdef LDAP_CONFIGURATION
-				if (!classfound && find_subclass_in_ldap (class, &nc, &data))
-					classfound = 1;
+			if (!classfound && find_subclass_in_ldap (class, &nc, &data))
+				classfound = 1;
 #endif
 
-				if (classfound) {
+			if (classfound) {
 #if defined (DEBUG_CLASS_MATCHING)
-					log_info ("matches subclass %s.",
-					      print_hex_1 (data.len,
-							   data.data, 60));
+				log_info ("matches subclass %s.",
+				      print_hex_1 (data.len,
+						   data.data, 60));
 #endif
-					data_string_forget (&data, MDL);
-					classify (packet, nc);
-					matched = 1;
+				data_string_forget (&data, MDL);
+				classify (packet, nc);
+				class_dereference (&nc, MDL);
+				return 1;
+			}
+			if (!class -> spawning) {
+				data_string_forget (&data, MDL);
+				return 0;
+			}
+			/* XXX Write out the spawned class? */
+#if defined (DEBUG_CLASS_MATCHING)
+			log_info ("spawning subclass %s.",
+			      print_hex_1 (data.len, data.data, 60));
+#endif
+			status = class_allocate (&nc, MDL);
+			group_reference (&nc -> group,
+					 class -> group, MDL);
+			class_reference (&nc -> superclass,
+					 class, MDL);
+			nc -> lease_limit = class -> lease_limit;
+			nc -> dirty = 1;
+			if (nc -> lease_limit) {
+				nc -> billed_leases =
+					(dmalloc
+					 (nc -> lease_limit *
+					  sizeof (struct lease *),
+					  MDL));
+				if (!nc -> billed_leases) {
+					log_error ("no memory for%s",
+						   " billing");
+					data_string_forget
+						(&nc -> hash_string,
+						 MDL);
 					class_dereference (&nc, MDL);
-					continue;
+					data_string_forget (&data,
+							    MDL);
+					return 0;
 				}
-				if (!class -> spawning) {
-					data_string_forget (&data, MDL);
-					continue;
-				}
-				/* XXX Write out the spawned class? */
+				memset (nc -> billed_leases, 0,
+					(nc -> lease_limit *
+					 sizeof (struct lease *)));
+			}
+			data_string_copy (&nc -> hash_string, &data,
+					  MDL);
+			/* The key may point into the packet's arena, and the
+			   subclass outlives the packet. */
+			data_string_to_heap (&nc -> hash_string, MDL);
+			if (!class -> hash)
+			    class_new_hash(&class->hash,
+					   SCLASS_HASH_SIZE, MDL);
+			class_hash_add (class -> hash,
+					(const char *)
+					nc -> hash_string.data,
+					nc -> hash_string.len,
+					nc, MDL);
+			classify (packet, nc);
+			class_dereference (&nc, MDL);
+		}
+
+		data_string_forget (&data, MDL);
+	}
+	return 0;
+}
+
+/* Most classes in a large collection are of the form
+
+	match if <expression> = "constant";
+
+   often with several such comparisons or'ed together, and they differ
+   only in the constant.  Rather than evaluate each of them in turn for
+   every packet, the first time a collection is checked its classes are
+   grouped by the expression they compare, and the constants of each
+   group are entered in a hash.  A packet then only evaluates each
+   distinct expression once and looks up the result.  A comparison that
+   is the first half of an "and" is indexed too, but a class found that
+   way still has its whole match expression evaluated.  Classes that fit
+   none of these shapes are evaluated as before, and every class is
+   still checked in its place in the collection.
+
+   Only expressions that have no side effects and whose value depends
+   only on the packet are indexed, since classes that aren't found in
+   the index never see them evaluated.  The index is thrown away by
+   clear_class_index() whenever a class is added to or removed from the
+   collection. */
+
+typedef struct hash_table class_match_hash_t;
+
+struct class_match {
+	struct class_match *next;	/* Same constant, another class. */
+	struct class_match *chain;	/* Every entry, for freeing. */
+	struct class *class;
+	struct expression *constant;
+	int position;			/* In the collection. */
+	int recheck;			/* Match if must still be evaluated. */
+};
+
+struct class_key {
+	struct class_key *next;
+	struct expression *expr;
+	class_match_hash_t *hash;
+};
+
+struct class_index {
+	struct class_key *keys;
+	struct class_match *entries;
+	struct class_match **unindexed;	/* In collection order. */
+	int unindexed_count;
+	int indexed_count;
+};
+
+HASH_FUNCTIONS (class_match, const unsigned char *, struct class_match,
+		class_match_hash_t, 0, 0, do_string_hash)
+
+/* Whether two expressions that can be used as keys are the same. */
+
+static int same_key (a, b)
+	struct expression *a, *b;
+{
+	if (a == b)
+		return 1;
+	if (a -> op != b -> op)
+		return 0;
+
+	switch (a -> op) {
+	      case expr_option:
+		return a -> data.option == b -> data.option;
+
+	      case expr_hardware:
+		return 1;
+
+	      case expr_const_int:
+		return a -> data.const_int == b -> data.const_int;
+
+	      case expr_const_data:
+		return (a -> data.const_data.len ==
+			b -> data.const_data.len &&
+			!memcmp (a -> data.const_data.data,
+				 b -> data.const_data.data,
+				 a -> data.const_data.len));
+
+	      case expr_substring:
+		return (same_key (a -> data.substring.expr,
+				  b -> data.substring.expr) &&
+			same_key (a -> data.substring.offset,
+				  b -> data.substring.offset) &&
+			same_key (a -> data.substring.len,
+				  b -> data.substring.len));
+
+	      case expr_suffix:
+		return (same_key (a -> data.suffix.expr,
+				  b -> data.suffix.expr) &&
+			same_key (a -> data.suffix.len, b -> data.suffix.len));
+
+	      case expr_packet:
+		return (same_key (a -> data.packet.offset,
+				  b -> data.packet.offset) &&
+			same_key (a -> data.packet.len, b -> data.packet.len));
+
+	      case expr_lcase:
+		return same_key (a -> data.lcase, b -> data.lcase);
+
+	      case expr_ucase:
+		return same_key (a -> data.ucase, b -> data.ucase);
+
+	      case expr_concat:
+		return (same_key (a -> data.concat [0],
+				  b -> data.concat [0]) &&
+			same_key (a -> data.concat [1], b -> data.concat [1]));
+
+	      default:
+		return 0;
+	}
+}
+
+/* Whether an expression may be used as a key.  This must agree with
+   same_key(). */
+
+static int usable_key (expr)
+	struct expression *expr;
+{
+	switch (expr -> op) {
+	      case expr_option:
+	      case expr_hardware:
+	      case expr_const_int:
+	      case expr_const_data:
+		return 1;
+
+	      case expr_substring:
+		return (usable_key (expr -> data.substring.expr) &&
+			expr -> data.substring.offset -> op == expr_const_int &&
+			expr -> data.substring.len -> op == expr_const_int);
+
+	      case expr_suffix:
+		return (usable_key (expr -> data.suffix.expr) &&
+			expr -> data.suffix.len -> op == expr_const_int);
+
+	      case expr_packet:
+		return (expr -> data.packet.offset -> op == expr_const_int &&
+			expr -> data.packet.len -> op == expr_const_int);
+
+	      case expr_lcase:
+		return usable_key (expr -> data.lcase);
+
+	      case expr_ucase:
+		return usable_key (expr -> data.ucase);
+
+	      case expr_concat:
+		return (usable_key (expr -> data.concat [0]) &&
+			usable_key (expr -> data.concat [1]));
+
+	      default:
+		return 0;
+	}
+}
+
+/* If a match expression can only be true when one of a set of key
+   expressions equals a constant, enter those comparisons for the class
+   in the index.  Returns 0 if it can't, having entered nothing. */
+
+static int index_comparisons (index, class, position, expr, recheck, add)
+	struct class_index *index;
+	struct class *class;
+	int position;
+	struct expression *expr;
+	int recheck;
+	int add;
+{
+	struct expression *key, *constant;
+	struct class_key *ck;
+	struct class_match *cm, *head;
+
+	switch (expr -> op) {
+	      case expr_or:
+		return (index_comparisons (index, class, position,
+					   expr -> data.or [0], recheck, add) &&
+			index_comparisons (index, class, position,
+					   expr -> data.or [1], recheck, add));
+
+	      case expr_and:
+		/* The right hand side is never evaluated unless the left
+		   hand side is true, so that's all that needs checking. */
+		return index_comparisons (index, class, position,
+					  expr -> data.and [0], 1, add);
+
+	      case expr_equal:
+		key = expr -> data.equal [0];
+		constant = expr -> data.equal [1];
+		if (key -> op == expr_const_data) {
+			key = expr -> data.equal [1];
+			constant = expr -> data.equal [0];
+		}
+		/* The hash can't have an empty key. */
+		if (constant -> op != expr_const_data ||
+		    constant -> data.const_data.len == 0 ||
+		    !usable_key (key))
+			return 0;
+		break;
+
+	      default:
+		return 0;
+	}
+
+	if (!add)
+		return 1;
+
+	for (ck = index -> keys; ck; ck = ck -> next)
+		if (same_key (ck -> expr, key))
+			break;
+	if (!ck) {
+		ck = dmalloc (sizeof *ck, MDL);
+		if (!ck || !class_match_new_hash (&ck -> hash, 0, MDL))
+			log_fatal ("no memory for class index.");
+		expression_reference (&ck -> expr, key, MDL);
+		ck -> next = index -> keys;
+		index -> keys = ck;
+	}
+
+	cm = dmalloc (sizeof *cm, MDL);
+	if (!cm)
+		log_fatal ("no memory for class index.");
+	class_reference (&cm -> class, class, MDL);
+	expression_reference (&cm -> constant, constant, MDL);
+	cm -> position = position;
+	cm -> recheck = recheck;
+	cm -> chain = index -> entries;
+	index -> entries = cm;
+	index -> indexed_count++;
+
+	head = (struct class_match *)0;
+	if (class_match_hash_lookup (&head, ck -> hash,
+				     constant -> data.const_data.data,
+				     constant -> data.const_data.len, MDL)) {
+		cm -> next = head -> next;
+		head -> next = cm;
+	} else
+		class_match_hash_add (ck -> hash,
+				      constant -> data.const_data.data,
+				      constant -> data.const_data.len,
+				      cm, MDL);
+	return 1;
+}
+
+static struct class_index *build_class_index (collection)
+	struct collection *collection;
+{
+	struct class_index *index;
+	struct class_match *cm;
+	struct class *class;
+	int position, count;
+
+	index = dmalloc (sizeof *index, MDL);
+	if (!index)
+		log_fatal ("no memory for class index.");
+
+	count = 0;
+	for (class = collection -> classes; class; class = class -> nic)
+		count++;
+	index -> unindexed = dmalloc ((count + 1) * sizeof *index -> unindexed,
+				     MDL);
+	if (!index -> unindexed)
+		log_fatal ("no memory for class index.");
+
+	position = 0;
+	for (class = collection -> classes; class; class = class -> nic) {
+		/* A first pass makes sure the whole expression can be
+		   indexed before any of it is. */
+		if (class -> expr &&
+		    index_comparisons (index, class, position,
+				       class -> expr, 0, 0)) {
+			index_comparisons (index, class, position,
+					   class -> expr, 0, 1);
+		} else {
+			cm = dmalloc (sizeof *cm, MDL);
+			if (!cm)
+				log_fatal ("no memory for class index.");
+			class_reference (&cm -> class, class, MDL);
+			cm -> position = position;
+			cm -> chain = index -> entries;
+			index -> entries = cm;
+			index -> unindexed [index -> unindexed_count++] = cm;
+		}
+		position++;
+	}
+
 #if defined (DEBUG_CLASS_MATCHING)
-				log_info ("spawning subclass %s.",
-				      print_hex_1 (data.len, data.data, 60));
+	log_info ("collection %s: %d classes, %d comparisons indexed, "
+		  "%d evaluated.", collection -> name, count,
+		  index -> indexed_count, index -> unindexed_count);
 #endif
-				status = class_allocate (&nc, MDL);
-				group_reference (&nc -> group,
-						 class -> group, MDL);
-				class_reference (&nc -> superclass,
-						 class, MDL);
-				nc -> lease_limit = class -> lease_limit;
-				nc -> dirty = 1;
-				if (nc -> lease_limit) {
-					nc -> billed_leases =
-						(dmalloc
-						 (nc -> lease_limit *
-						  sizeof (struct lease *),
-						  MDL));
-					if (!nc -> billed_leases) {
-						log_error ("no memory for%s",
-							   " billing");
-						data_string_forget
-							(&nc -> hash_string,
-							 MDL);
-						class_dereference (&nc, MDL);
-						data_string_forget (&data,
-								    MDL);
-						continue;
-					}
-					memset (nc -> billed_leases, 0,
-						(nc -> lease_limit *
-						 sizeof (struct lease *)));
+	return index;
+}
+
+void clear_class_index (collection)
+	struct collection *collection;
+{
+	struct class_index *index = collection -> index;
+	struct class_key *ck;
+	struct class_match *cm;
+
+	if (!index)
+		return;
+	collection -> index = (struct class_index *)0;
+
+	while ((ck = index -> keys)) {
+		index -> keys = ck -> next;
+		class_match_free_hash_table (&ck -> hash, MDL);
+		expression_dereference (&ck -> expr, MDL);
+		dfree (ck, MDL);
+	}
+	while ((cm = index -> entries)) {
+		index -> entries = cm -> chain;
+		class_dereference (&cm -> class, MDL);
+		if (cm -> constant)
+			expression_dereference (&cm -> constant, MDL);
+		dfree (cm, MDL);
+	}
+	dfree (index -> unindexed, MDL);
+	dfree (index, MDL);
+}
+
+static int class_match_cmp (const void *a, const void *b)
+{
+	const struct class_match *ma = *(const struct class_match **)a;
+	const struct class_match *mb = *(const struct class_match **)b;
+
+	return ma -> position - mb -> position;
+}
+
+int check_collection (packet, lease, collection)
+	struct packet *packet;
+	struct lease *lease;
+	struct collection *collection;
+{
+	struct class_index *index;
+	struct class_key *ck;
+	struct class_match *cm, *found;
+	struct class_match *local [64], **hits;
+	struct data_string data;
+	int hit_count, hit_max;
+	int matched = 0;
+	int i, j, recheck;
+
+	if (!collection -> index)
+		collection -> index = build_class_index (collection);
+	index = collection -> index;
+
+	/* Look up the value of each key expression. */
+	hits = local;
+	hit_max = sizeof local / sizeof local [0];
+	hit_count = 0;
+	for (ck = index -> keys; ck; ck = ck -> next) {
+		memset (&data, 0, sizeof data);
+		if (!evaluate_data_expression
+		    (&data, packet, lease, (struct client_state *)0,
+		     packet -> options, (struct option_state *)0,
+		     lease ? &lease -> scope : &global_scope, ck -> expr, MDL))
+			continue;
+		found = (struct class_match *)0;
+		if (data.len &&
+		    class_match_hash_lookup (&found, ck -> hash,
+					     data.data, data.len, MDL)) {
+			for (cm = found; cm; cm = cm -> next) {
+				if (hit_count == hit_max) {
+					struct class_match **nh;
+
+					nh = dmalloc (2 * hit_max * sizeof *nh,
+						      MDL);
+					if (!nh)
+						log_fatal ("no memory for "
+							   "class matches.");
+					memcpy (nh, hits,
+						hit_count * sizeof *nh);
+					if (hits != local)
+						dfree (hits, MDL);
+					hits = nh;
+					hit_max *= 2;
 				}
-				data_string_copy (&nc -> hash_string, &data,
-						  MDL);
-				if (!class -> hash)
-				    class_new_hash(&class->hash,
-						   SCLASS_HASH_SIZE, MDL);
-				class_hash_add (class -> hash,
-						(const char *)
-						nc -> hash_string.data,
-						nc -> hash_string.len,
-						nc, MDL);
-				classify (packet, nc);
-				class_dereference (&nc, MDL);
+				hits [hit_count++] = cm;
 			}
-
-			data_string_forget (&data, MDL);
 		}
+		data_string_forget (&data, MDL);
 	}
+	if (hit_count > 1)
+		qsort (hits, hit_count, sizeof *hits, class_match_cmp);
+
+	/* Merge the classes found with those that have to be evaluated,
+	   in collection order. */
+	i = j = 0;
+	while (i < hit_count || j < index -> unindexed_count) {
+		if (j == index -> unindexed_count ||
+		    (i < hit_count &&
+		     hits [i] -> position < index -> unindexed [j] -> position)) {
+			/* A class can be found more than once if its match
+			   expression has more than one comparison. */
+			cm = hits [i];
+			recheck = 0;
+			for (; i < hit_count &&
+			       hits [i] -> position == cm -> position; i++)
+				recheck |= hits [i] -> recheck;
+			if (check_class (packet, lease, cm -> class, !recheck))
+				matched = 1;
+		} else {
+			cm = index -> unindexed [j++];
+			if (check_class (packet, lease, cm -> class, 0))
+				matched = 1;
+		}
+	}
+
+	if (hits != local)
+		dfree (hits, MDL);
 	return matched;
 }
 
@@ -220,6 +631,7 @@ isc_result_t unlink_class(struct class **class) {
 					pp->nic = cp->nic;
 				}
 				cp->nic = 0;
+				clear_class_index(lp);
 				class_dereference(class, MDL);
 
 				return ISC_R_SUCCESS;
@@ -61,6 +61,13 @@ void parse_trace_setup ()
    parameters :== <nil> | parameter | parameters parameter
    declarations :== <nil> | declaration | declarations declaration */
 
+/* The configuration is parsed from source at every start.  A saved image
+   of the tokens was tried and dropped: for 400,000 hosts, replaying the
+   tokens took 0.32s plus 0.14s to check the file digests, against 0.44s
+   to scan the files.  Building the objects is the bulk of the cost, so
+   an image worth having would have to save the parsed groups, hosts,
+   classes and expressions themselves. */
+
 isc_result_t readconf ()
 {
 	isc_result_t res;
@@ -625,8 +632,7 @@ int parse_statement (cfile, group, type, host_decl, declaration)
 			skip_to_semi (cfile);
 			return declaration;
 		}
-		parse_address_range (cfile, group, type, (struct pool *)0,
-				     (struct lease **)0);
+		parse_address_range (cfile, group, type, (struct pool *)0);
 		return declaration;
 
 #ifdef DHCPv6
@@ -705,8 +711,8 @@ int parse_statement (cfile, group, type, host_decl, declaration)
 		   "option dhcp-server-identifier". */
 	      case SERVER_IDENTIFIER:
 		code = DHO_DHCP_SERVER_IDENTIFIER;
-		if (!option_code_hash_lookup(&option, dhcp_universe.code_hash,
-					     &code, 0, MDL))
+		if (!option_code_lookup(&option, &dhcp_universe,
+					code, MDL))
 			log_fatal("Server identifier not in hash (%s:%d).",
 				  MDL);
 		skip_token(&val, (unsigned *)0, cfile);
@@ -750,9 +756,8 @@ int parse_statement (cfile, group, type, host_decl, declaration)
 					option_name_hash_delete(
 						option->universe->name_hash,
 							option->name, 0, MDL);
-					option_code_hash_delete(
-						option->universe->code_hash,
-							&option->code, 0, MDL);
+					option_code_delete(option->universe,
+							   option);
 				}
 
 				parse_option_code_definition(cfile, option);
@@ -1284,7 +1289,18 @@ void parse_failover_state_declaration (struct parse *cfile,
 
 		      case PARTNER:
 			cp = &state -> partner;
-			goto do_state;
+			if (peek_token (&val, (unsigned *)0, cfile) != SEQUENCE)
+				goto do_state;
+			skip_token (&val, (unsigned *)0, cfile);
+			token = next_token (&val, (unsigned *)0, cfile);
+			if (token != NUMBER) {
+				parse_warn (cfile, "expecting a number.");
+				goto bogus;
+			}
+			state -> partner_sequence =
+				(isc_uint64_t)strtoull (val, NULL, 10);
+			parse_semi (cfile);
+			break;
 
 		      case MCLT:
 			if (state -> i_am == primary) {
@@ -1732,7 +1748,7 @@ void parse_pool_statement (cfile, group, type)
 	struct pool *pool, **p, *pp;
 	int declaration = 0;
 	isc_result_t status;
-	struct lease *lpchain = NULL, *lp;
+	int have_range;
 
 	pool = NULL;
 	status = pool_allocate(&pool, MDL);
@@ -1823,8 +1839,7 @@ void parse_pool_statement (cfile, group, type)
 
 		      case RANGE:
 			skip_token(&val, NULL, cfile);
-			parse_address_range (cfile, group, type,
-					     pool, &lpchain);
+			parse_address_range (cfile, group, type, pool);
 			break;
 		      case ALLOW:
 			skip_token(&val, NULL, cfile);
@@ -1860,6 +1875,8 @@ void parse_pool_statement (cfile, group, type)
 		}
 	} while (!done);
 
+	have_range = (pool->ranges != NULL);
+
 	/* See if there's already a pool into which we can merge this one. */
 	for (pp = pool->shared_network->pools; pp; pp = pp->next) {
 		if (pp->group->statements != pool->group->statements)
@@ -1879,11 +1896,8 @@ void parse_pool_statement (cfile, group, type)
 			continue;
 
 		/* Okay, we can merge these two pools.    All we have to
-		   do is fix up the leases, which all point to their pool. */
-		for (lp = lpchain; lp; lp = lp->next) {
-			pool_dereference(&lp->pool, MDL);
-			pool_reference(&lp->pool, pp, MDL);
-		}
+		   do is hand over the address ranges. */
+		pool_merge_ranges(pp, pool);
 
 #if defined (BINARY_LEASES)
 		/* If we are doing binary leases we also need to add the
@@ -1906,24 +1920,13 @@ void parse_pool_statement (cfile, group, type)
 
 	/* Don't allow a pool declaration with no addresses, since it is
 	   probably a configuration error. */
-	if (!lpchain) {
+	if (!have_range) {
 		parse_warn(cfile, "Pool declaration with no address range.");
 		log_error("Pool declarations must always contain at least");
 		log_error("one range statement.");
 	}
 
 cleanup:
-	/* Dereference the lease chain. */
-	lp = NULL;
-	while (lpchain) {
-		lease_reference(&lp, lpchain, MDL);
-		lease_dereference(&lpchain, MDL);
-		if (lp->next) {
-			lease_reference(&lpchain, lp->next, MDL);
-			lease_dereference(&lp->next, MDL);
-			lease_dereference(&lp, MDL);
-		}
-	}
 	pool_dereference(&pool, MDL);
 }
 
@@ -2382,10 +2385,10 @@ int parse_class_declaration (cp, cfile, group, type)
 				code = (type == CLASS_TYPE_VENDOR)
 					? DHO_VENDOR_CLASS_IDENTIFIER
 					: DHO_USER_CLASS;
-				option_code_hash_lookup(
-						&stmt->data.option->option,
-							dhcp_universe.code_hash,
-							&code, 0, MDL);
+				option_code_lookup(
+						   &stmt->data.option->option,
+						   &dhcp_universe,
+						   code, MDL);
 			}
 			class -> statements = stmt;
 		}
@@ -2584,6 +2587,9 @@ int parse_class_declaration (cp, cfile, group, type)
 		}
 	}
 
+	/* The class's match expression may have changed as well. */
+	clear_class_index (collections);
+
 	if (cp)				/* should always be 0??? */
 		status = class_reference (cp, class, MDL);
 	class_dereference (&class, MDL);
@@ -3128,7 +3134,8 @@ parse_fixed_addr_param(struct option_cache **oc,
 		     | HOSTNAME hostname SEMI
 		     | CLIENT_HOSTNAME hostname SEMI
 		     | CLASS identifier SEMI
-		     | DYNAMIC_BOOTP SEMI */
+		     | DYNAMIC_BOOTP SEMI
+		     | SEQUENCE NUMBER SEMI */
 
 int parse_lease_declaration (struct lease **lp, struct parse *cfile)
 {
@@ -3418,6 +3425,19 @@ int parse_lease_declaration (struct lease **lp, struct parse *cfile)
 			parse_semi (cfile);
 			break;
 
+		      case SEQUENCE:
+			seenbit = 1048576;
+			token = next_token (&val, (unsigned *)0, cfile);
+			if (token != NUMBER) {
+				parse_warn (cfile, "expecting a number.");
+				skip_to_semi (cfile);
+				seenbit = 0;
+				break;
+			}
+			lease->fo_seq = (isc_uint64_t)strtoull (val, NULL, 10);
+			parse_semi (cfile);
+			break;
+
 		      case CLIENT_HOSTNAME:
 			seenbit = 1024;
 			token = peek_token (&val, (unsigned *)0, cfile);
@@ -3651,6 +3671,20 @@ int parse_lease_declaration (struct lease **lp, struct parse *cfile)
 
 	} while (1);
 
+	finish_lease_declaration(lease, seenmask);
+
+	lease_reference (lp, lease, MDL);
+	lease_dereference (&lease, MDL);
+	return 1;
+}
+
+/* Fill in whatever a lease declaration left out: seenmask has the bits
+   parse_lease_declaration() sets for the parameters it has seen.  The
+   fast lease file reader in db.c uses this for the leases it parses
+   itself. */
+
+void finish_lease_declaration (struct lease *lease, int seenmask)
+{
 	/* If no binding state is specified, make one up. */
 	if (!(seenmask & 256)) {
 		if (lease->ends > cur_time ||
@@ -3678,10 +3712,6 @@ int parse_lease_declaration (struct lease **lp, struct parse *cfile)
 
 	if (!(seenmask & 65536))
 		lease->tstp = lease->ends;
-
-	lease_reference (lp, lease, MDL);
-	lease_dereference (&lease, MDL);
-	return 1;
 }
 
 /* Parse the right side of a 'binding value'.
@@ -3776,12 +3806,11 @@ parse_binding_value(struct parse *cfile, struct binding_value *value)
 /* address-range-declaration :== ip-address ip-address SEMI
 			       | DYNAMIC_BOOTP ip-address ip-address SEMI */
 
-void parse_address_range (cfile, group, type, inpool, lpchain)
+void parse_address_range (cfile, group, type, inpool)
 	struct parse *cfile;
 	struct group *group;
 	int type;
 	struct pool *inpool;
-	struct lease **lpchain;
 {
 	struct iaddr low, high, net;
 	unsigned char addr [4];
@@ -3934,7 +3963,7 @@ void parse_address_range (cfile, group, type, inpool, lpchain)
 #endif /* FAILOVER_PROTOCOL */
 
 	/* Create the new address range... */
-	new_address_range (cfile, low, high, subnet, pool, lpchain);
+	new_address_range (cfile, low, high, subnet, pool);
 	pool_dereference (&pool, MDL);
 }
 
@@ -4730,8 +4759,8 @@ int parse_allow_deny (oc, cfile, flag)
 		return 0;
 	}
 	/* Reference on option is passed to option cache. */
-	if (!option_code_hash_lookup(&option, server_universe.code_hash,
-				     &code, 0, MDL))
+	if (!option_code_lookup(&option, &server_universe,
+				code, MDL))
 		log_fatal("Unable to find server option %u (%s:%d).",
 			  code, MDL);
 	status = option_cache(oc, NULL, data, option, MDL);
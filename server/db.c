@@ -29,6 +29,14 @@
 #include "dhcpd.h"
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#if defined (ASYNC_LEASE_WRITER)
+#include <poll.h>
+#endif
+#if defined (ASYNC_LEASE_WRITER) || defined (FAST_LEASE_READER)
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 #define LEASE_REWRITE_PERIOD 3600
 
@@ -41,6 +49,7 @@ static int counting = 0;
 static int count = 0;
 TIME write_time;
 int lease_file_is_corrupt = 0;
+u_int32_t ia_write_count;
 
 /* Write a single binding scope value in parsable format.
  */
@@ -147,6 +156,11 @@ int write_lease (lease)
 	     fprintf(db_file, "\n  cltt %s", tval) < 0))
 		++errors;
 
+	if (lease->fo_seq &&
+	    fprintf(db_file, "\n  sequence %llu;",
+		    (unsigned long long)lease->fo_seq) < 0)
+		++errors;
+
 	if (fprintf (db_file, "\n  binding state %s;",
 		 ((lease -> binding_state > 0 &&
 		   lease -> binding_state <= FTS_LAST)
@@ -693,6 +707,7 @@ write_ia(const struct ia_xx *ia) {
                 goto error_exit;
 
 	fflush(db_file);
+	ia_write_count++;
 	return 1;
 
 error_exit:
@@ -793,6 +808,11 @@ int write_failover_state (dhcp_failover_state_t *state)
 		    tval) < 0)
 		++errors;
 
+	if (state->partner_sequence &&
+	    fprintf(db_file, "\n  partner sequence %llu;",
+		    (unsigned long long)state->partner_sequence) < 0)
+		++errors;
+
 	if (state -> i_am == secondary) {
 		errno = 0;
 		fprintf (db_file, "\n  mclt %ld;",
@@ -1020,6 +1040,525 @@ int write_billing_class (class)
 	return !errors;
 }
 
+#if defined (ASYNC_LEASE_WRITER)
+/*
+ * Asynchronous lease writer.
+ *
+ * Once the lease file has been rewritten, db_file no longer points at
+ * the file itself but at an in-memory stream.  Each commit closes that
+ * stream and hands the buffer to a writer thread through a single
+ * producer, single consumer ring; the thread writes everything that is
+ * queued, syncs the file once for the whole group and passes the
+ * buffers back through a second ring.  A byte on a pipe wakes the
+ * thread up and another byte on a second pipe tells the dispatcher a
+ * group is on disk, at which point the callback for each buffer (for
+ * the delayed-ack code, sending the held DHCPACKs) is run.
+ *
+ * Only the main thread allocates, logs or touches the lease database;
+ * the writer thread only sees the buffers and the file descriptor.
+ * The descriptor is only changed while nothing is queued, so the
+ * release/acquire pair on the ring heads is enough to publish it.
+ */
+
+#define LEASE_WRITER_QUEUE 64
+
+struct lease_write {
+	struct lease_write *next;
+	char *buf;
+	size_t len;
+	int error;
+	void (*done) (void *);
+	void *arg;
+};
+
+struct lease_write_ring {
+	struct lease_write *slot [LEASE_WRITER_QUEUE];
+	unsigned head;		/* Next slot to fill; producer only. */
+	unsigned tail;		/* Next slot to take; consumer only. */
+};
+
+struct lease_writer_state {
+	OMAPI_OBJECT_PREAMBLE;
+	int socket;
+};
+
+static omapi_object_type_t *dhcp_type_lease_writer;
+static struct lease_writer_state *lease_writer_state;
+OMAPI_OBJECT_ALLOC (lease_writer_state, struct lease_writer_state,
+		    dhcp_type_lease_writer)
+
+static struct lease_write_ring lease_write_queue;
+static struct lease_write_ring lease_write_done;
+static int lease_writer_wake [2] = { -1, -1 };
+static int lease_writer_signal [2] = { -1, -1 };
+static int lease_writer_fd = -1;
+static int lease_writer_exited;	/* Set by the thread as it gives up. */
+
+/* Main thread state. */
+static struct lease_write *lease_writer_next;
+static struct lease_write *ready_head, *ready_tail;
+static int lease_writes_pending;
+static int lease_writer_error;
+static int lease_writer_broken;
+
+static int
+ring_put(struct lease_write_ring *ring, struct lease_write *w)
+{
+	unsigned head, tail;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail == LEASE_WRITER_QUEUE)
+		return 0;
+	ring->slot[head % LEASE_WRITER_QUEUE] = w;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static struct lease_write *
+ring_get(struct lease_write_ring *ring)
+{
+	struct lease_write *w;
+	unsigned head, tail;
+
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (tail == head)
+		return NULL;
+	w = ring->slot[tail % LEASE_WRITER_QUEUE];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return w;
+}
+
+/* Write out and sync everything on the queue, a group at a time, and
+   pass it back.  Returns the number of buffers written. */
+static int
+lease_writer_run(void)
+{
+	struct lease_write *group [LEASE_WRITER_QUEUE];
+	int count, error, i, fd, total;
+	size_t done;
+	ssize_t n;
+
+	for (total = 0; ; total += count) {
+		count = 0;
+		while (count < LEASE_WRITER_QUEUE &&
+		       (group[count] = ring_get(&lease_write_queue)) != NULL)
+			count++;
+		if (count == 0)
+			return total;
+
+		fd = lease_writer_fd;
+		error = 0;
+		for (i = 0; i < count && error == 0; i++) {
+			for (done = 0; done < group[i]->len; done += n) {
+				n = write(fd, group[i]->buf + done,
+					  group[i]->len - done);
+				if (n < 0) {
+					if (errno == EINTR) {
+						n = 0;
+						continue;
+					}
+					error = errno;
+					break;
+				}
+			}
+		}
+
+		/* One sync covers every buffer in the group. */
+		if (error == 0 && dont_use_fsync == 0) {
+#if defined (_POSIX_SYNCHRONIZED_IO) && (_POSIX_SYNCHRONIZED_IO > 0)
+			if (fdatasync(fd) < 0)
+#else
+			if (fsync(fd) < 0)
+#endif
+				error = errno;
+		}
+
+		/* lease_writes_pending never lets more than a ring's worth
+		   be outstanding, so there is always room here. */
+		for (i = 0; i < count; i++) {
+			group[i]->error = error;
+			ring_put(&lease_write_done, group[i]);
+		}
+		IGNORE_RET(write(lease_writer_signal[1], "", 1));
+	}
+}
+
+/* The writer thread.  It must not call anything that logs or allocates
+   through the dhcpd memory routines, so errors are passed back in the
+   lease_write structure for the main thread to report.  If it can't
+   wait for work any more it says so and exits, and the main thread
+   takes over the queue. */
+static void *
+lease_writer_thread(void *arg)
+{
+	char buf [LEASE_WRITER_QUEUE];
+
+	for (;;) {
+		if (lease_writer_run() > 0)
+			continue;
+		if (read(lease_writer_wake[0], buf, sizeof buf) < 0 &&
+		    errno != EINTR) {
+			__atomic_store_n(&lease_writer_exited, 1,
+					 __ATOMIC_RELEASE);
+			IGNORE_RET(write(lease_writer_signal[1], "", 1));
+			return NULL;
+		}
+	}
+}
+
+/* Once the writer thread has gone, the main thread is the only consumer
+   of the queue and writes it out itself. */
+static int
+lease_writer_gone(void)
+{
+	if (!__atomic_load_n(&lease_writer_exited, __ATOMIC_ACQUIRE))
+		return 0;
+	if (!lease_writer_broken) {
+		log_error("lease writer thread has exited, "
+			  "writing leases from the main thread.");
+		lease_writer_broken = 1;
+	}
+	(void) lease_writer_run();
+	return 1;
+}
+
+/* Move finished writes from the writer thread onto the ready list. */
+static void
+lease_writer_reap(void)
+{
+	struct lease_write *w;
+
+	while ((w = ring_get(&lease_write_done)) != NULL) {
+		lease_writes_pending--;
+		if (w->error) {
+			errno = w->error;
+			log_error("commit_leases: unable to commit: %m");
+			lease_writer_error = 1;
+			/* What made it to the file is unknown, so
+			   rewrite it before anything else goes out. */
+			lease_file_is_corrupt = 1;
+		}
+		free(w->buf);
+		w->buf = NULL;
+		w->next = NULL;
+		if (ready_tail)
+			ready_tail->next = w;
+		else
+			ready_head = w;
+		ready_tail = w;
+	}
+}
+
+/* Wait for the writer thread to finish at least one group.  The thread
+   signals as it exits, so this can't wait on one that has gone; the
+   timeout is only there in case the signal is lost. */
+static void
+lease_writer_wait(void)
+{
+	struct pollfd pfd;
+	char buf [LEASE_WRITER_QUEUE];
+
+	if (!lease_writer_gone()) {
+		pfd.fd = lease_writer_signal[0];
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 1000) < 0 && errno != EINTR)
+			log_fatal("lease writer: poll: %m");
+		(void) lease_writer_gone();
+	}
+	while (read(lease_writer_signal[0], buf, sizeof buf) > 0)
+		;
+	lease_writer_reap();
+}
+
+/* Wait until everything handed to the writer thread is on disk.  The
+   callbacks are left for the dispatcher to run, since our caller may be
+   in the middle of changing the lease database. */
+static int
+lease_writer_drain(void)
+{
+	int ok;
+
+	while (lease_writes_pending > 0)
+		lease_writer_wait();
+	if (ready_head)
+		IGNORE_RET(write(lease_writer_signal[1], "", 1));
+
+	ok = !lease_writer_error;
+	lease_writer_error = 0;
+	return ok;
+}
+
+static int
+lease_writer_readsocket(omapi_object_t *h)
+{
+	return ((struct lease_writer_state *)h)->socket;
+}
+
+/* Called by the dispatcher when a group has been committed. */
+static isc_result_t
+lease_writer_done(omapi_object_t *h)
+{
+	struct lease_write *w;
+	char buf [LEASE_WRITER_QUEUE];
+
+	while (read(lease_writer_signal[0], buf, sizeof buf) > 0)
+		;
+	lease_writer_reap();
+
+	/* A callback may commit again and add to the list as we go. */
+	while ((w = ready_head) != NULL) {
+		ready_head = w->next;
+		if (ready_head == NULL)
+			ready_tail = NULL;
+		if (w->done)
+			(*w->done)(w->arg);
+		dfree(w, MDL);
+	}
+	return ISC_R_SUCCESS;
+}
+
+/* Start a fresh buffer for db_file to write into. */
+static struct lease_write *
+lease_write_new(FILE **stream)
+{
+	struct lease_write *w;
+
+	w = dmalloc(sizeof(*w), MDL);
+	if (w == NULL) {
+		log_error("lease writer: no memory for a new buffer");
+		return NULL;
+	}
+	*stream = open_memstream(&w->buf, &w->len);
+	if (*stream == NULL) {
+		log_error("lease writer: can't open a memory stream: %m");
+		dfree(w, MDL);
+		return NULL;
+	}
+	return w;
+}
+
+/* Queue the current buffer for the writer thread. */
+static void
+lease_writer_queue(struct lease_write *w, void (*done) (void *), void *arg)
+{
+	w->done = done;
+	w->arg = arg;
+	w->error = 0;
+
+	while (lease_writes_pending >= LEASE_WRITER_QUEUE)
+		lease_writer_wait();
+	lease_writes_pending++;
+	ring_put(&lease_write_queue, w);
+	if (!lease_writer_gone())
+		IGNORE_RET(write(lease_writer_wake[1], "", 1));
+}
+
+/* Hand what has been written to db_file since the last commit to the
+   writer thread and carry on with a new buffer. */
+static int
+lease_writer_submit(void (*done) (void *), void *arg)
+{
+	struct lease_write *w;
+	FILE *stream;
+
+	w = lease_write_new(&stream);
+	if (w == NULL)
+		return 0;
+
+	/* Closing the stream settles the buffer and its length. */
+	if (fclose(db_file) == EOF)
+		log_error("commit_leases: unable to close buffer: %m");
+	db_file = stream;
+
+	lease_writer_queue(lease_writer_next, done, arg);
+	lease_writer_next = w;
+	return 1;
+}
+
+static int
+lease_writer_start(void)
+{
+	isc_result_t result;
+	pthread_t tid;
+	pthread_attr_t attr;
+	sigset_t all, old;
+	int rv;
+#if defined (HAVE_SETFD)
+	int i;
+#endif
+
+	if (pipe(lease_writer_wake) < 0 || pipe(lease_writer_signal) < 0) {
+		log_error("lease writer: can't create pipe: %m");
+		return 0;
+	}
+#if defined (HAVE_SETFD)
+	for (i = 0; i < 2; i++) {
+		if (fcntl(lease_writer_wake[i], F_SETFD, 1) < 0 ||
+		    fcntl(lease_writer_signal[i], F_SETFD, 1) < 0)
+			log_error("Can't set close-on-exec on lease writer: %m");
+	}
+#endif
+	/* Neither side should ever block on a full pipe, and the
+	   dispatcher must not block reading one. */
+	(void) fcntl(lease_writer_wake[1], F_SETFL, O_NONBLOCK);
+	(void) fcntl(lease_writer_signal[0], F_SETFL, O_NONBLOCK);
+	(void) fcntl(lease_writer_signal[1], F_SETFL, O_NONBLOCK);
+
+	result = omapi_object_type_register(&dhcp_type_lease_writer,
+					    "lease-writer",
+					    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+					    sizeof(struct lease_writer_state),
+					    0, RC_MISC);
+	if (result != ISC_R_SUCCESS)
+		log_fatal("Can't register lease writer object type: %s",
+			  isc_result_totext(result));
+	lease_writer_state_allocate(&lease_writer_state, MDL);
+	lease_writer_state->socket = lease_writer_signal[0];
+	result = omapi_register_io_object((omapi_object_t *)lease_writer_state,
+					  lease_writer_readsocket, 0,
+					  lease_writer_done, 0, 0);
+	if (result != ISC_R_SUCCESS)
+		log_fatal("Can't register lease writer handle: %s",
+			  isc_result_totext(result));
+
+	/* Signals are for the main thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rv = pthread_create(&tid, &attr, lease_writer_thread, NULL);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rv != 0) {
+		errno = rv;
+		log_error("lease writer: can't create thread: %m");
+		omapi_unregister_io_object((omapi_object_t *)lease_writer_state);
+		return 0;
+	}
+	return 1;
+}
+
+/* The new lease file is complete and in place: give it to the writer
+   thread and point db_file at a buffer. */
+static void
+lease_writer_attach(void)
+{
+	struct lease_write *w;
+	FILE *stream;
+	int fd;
+
+	if (lease_writer_broken)
+		return;
+	if (lease_writer_wake[0] < 0 && !lease_writer_start()) {
+		log_error("Writing leases from the main thread.");
+		lease_writer_broken = 1;
+		return;
+	}
+
+	if (fflush(db_file) == EOF) {
+		log_error("lease writer: can't flush lease file: %m");
+		return;
+	}
+	w = lease_write_new(&stream);
+	if (w == NULL)
+		return;
+	fd = dup(fileno(db_file));
+	if (fd < 0) {
+		log_error("lease writer: can't dup lease file: %m");
+		fclose(stream);
+		free(w->buf);
+		dfree(w, MDL);
+		return;
+	}
+
+	fclose(db_file);
+	db_file = stream;
+	lease_writer_next = w;
+	lease_writer_fd = fd;
+}
+
+/* Flush the buffer, wait for the writer thread to catch up and let go
+   of the old lease file, ahead of it being rewritten.  Returns 0 if
+   anything failed to reach the file. */
+static int
+lease_writer_detach(void)
+{
+	int ok;
+
+	if (lease_writer_next == NULL)
+		return 1;
+
+	fclose(db_file);
+	db_file = NULL;
+	lease_writer_queue(lease_writer_next, NULL, NULL);
+	lease_writer_next = NULL;
+	ok = lease_writer_drain();
+
+	close(lease_writer_fd);
+	lease_writer_fd = -1;
+	return ok;
+}
+
+/* Stop handing commits to the writer thread: write out what has been
+   buffered and go back to writing the lease file directly.  If the
+   file can't be reopened it is rewritten. */
+static int
+lease_writer_stop(void)
+{
+	int fd, ok;
+
+	log_error("Writing leases from the main thread.");
+	lease_writer_broken = 1;
+	fd = dup(lease_writer_fd);
+	ok = lease_writer_detach();
+	if (fd >= 0 && (db_file = fdopen(fd, "a")) != NULL)
+		return ok;
+
+	log_error("lease writer: can't reopen lease file: %m");
+	if (fd >= 0)
+		close(fd);
+	lease_file_is_corrupt = 1;
+	return new_lease_file(0);
+}
+
+/* Commit what has been written so far and call done(arg) once it is on
+   disk.  Without a writer thread this is commit_leases() followed by
+   the callback. */
+int
+commit_leases_async(void (*done) (void *), void *arg)
+{
+	int rv;
+
+	if (lease_writer_next == NULL) {
+		rv = commit_leases();
+		if (done)
+			(*done)(arg);
+		return rv;
+	}
+
+	/* Without a new buffer to carry on with, commit from here and
+	   only then send the replies.  They are sent even if that fails,
+	   as they would be after a failed synchronous commit. */
+	if (!lease_writer_submit(done, arg)) {
+		rv = lease_writer_stop();
+		if (db_file != NULL && !commit_leases())
+			rv = 0;
+		if (done)
+			(*done)(arg);
+		return rv;
+	}
+
+	if (count && cur_time - write_time > LEASE_REWRITE_PERIOD) {
+		count = 0;
+		write_time = cur_time;
+		new_lease_file(0);
+	}
+	return 1;
+}
+#endif /* ASYNC_LEASE_WRITER */
+
 /* Commit leases after a timeout. */
 void commit_leases_timeout (void *foo)
 {
@@ -1030,6 +1569,13 @@ void commit_leases_timeout (void *foo)
 
 int commit_leases ()
 {
+#if defined (ASYNC_LEASE_WRITER)
+	/* Let the writer thread do it, and wait for it. */
+	if (lease_writer_next != NULL) {
+		if (!lease_writer_submit(NULL, NULL) || !lease_writer_drain())
+			return (0);
+	} else {
+#endif
 	/* Commit any outstanding writes to the lease database file.
 	   We need to do this even if we're rewriting the file below,
 	   just in case the rewrite fails. */
@@ -1042,6 +1588,9 @@ int commit_leases ()
 		log_info ("commit_leases: unable to commit, fsync(): %m");
 		return (0);
 	}
+#if defined (ASYNC_LEASE_WRITER)
+	}
+#endif
 
 	/* If we haven't rewritten the lease database in over an
 	   hour, rewrite it now.  (The length of time should probably
@@ -1058,8 +1607,8 @@ int commit_leases ()
  * rewrite the lease file about once an hour
  * This is meant as a quick patch for ticket 24887.  It allows
  * us to rotate the v6 lease file without adding too many fsync()
- * calls.  In the future wes should revisit this area and add
- * something similar to the delayed ack code for v4.
+ * calls.  When delayed acks are compiled in, dhcpv6() also holds
+ * any reply that follows a write_ia() until the file is committed.
  */
 int commit_leases_timed()
 {
@@ -1069,6 +1618,1030 @@ int commit_leases_timed()
 	return (1);
 }
 
+#if defined (FAST_LEASE_READER)
+/*
+ * Fast lease file reader.
+ *
+ * At startup the lease file is mapped and cut into chunks at record
+ * boundaries, which are lines starting with a letter that follow a
+ * line holding just "}".  That is where every braced record written
+ * by dhcpd ends.  A set of threads parses the chunks.  Each lease
+ * declaration of the kind write_lease() produces is turned into a
+ * lease_file_item without going through the config file lexer.
+ * Anything else is kept as a span of text: hosts, classes, failover
+ * state, IA records, and any lease that uses something this code does
+ * not handle (option, on, billing, mixed case keywords, and so on).
+ *
+ * The main thread then walks the chunks in file order.  It enters
+ * each lease as parse_lease_declaration() and lease_file_subparse()
+ * would have, and hands each span of text to lease_file_subparse(),
+ * so a later record for an address still replaces an earlier one.
+ * The threads only get a few chunks ahead of the main thread, so the
+ * parsed records for a large file are never all in memory at once.
+ *
+ * As with the lease writer, the threads must not log or allocate
+ * through the dhcpd memory routines.  They only read the mapped file
+ * and fill in their own chunk.
+ */
+
+#define LEASE_READER_CHUNK	(8 * 1024 * 1024)
+#define LEASE_READER_THREADS	16
+
+/* Longest string or name the lexer will return. */
+#define LF_TOKEN_MAX	(sizeof (((struct parse *)0)->tokbuf) - 1)
+
+/* A "set" statement in a lease declaration. */
+struct lease_file_binding {
+	size_t name;			/* Offsets into the chunk strings. */
+	size_t data;
+	unsigned data_len;
+	int type;			/* binding_data, _numeric or _boolean. */
+	unsigned long intval;
+};
+
+/* Either a lease declaration, or text for lease_file_subparse(). */
+struct lease_file_item {
+	const char *text;
+	size_t text_len;
+	int line;			/* Line the text starts on. */
+
+	unsigned char addr [4];
+	int seenmask;			/* As in parse_lease_declaration(). */
+	TIME starts, ends, tstp, tsfp, atsfp, cltt;
+	isc_uint64_t fo_seq;
+	binding_state_t binding_state;
+	binding_state_t next_binding_state;
+	binding_state_t rewind_binding_state;
+	u_int8_t flags;
+	int uid_string;
+	struct hardware hardware_addr;
+	size_t uid, client_hostname;
+	unsigned uid_len, client_hostname_len;
+	size_t binding;
+	unsigned nbindings;
+};
+
+struct lease_file_chunk {
+	const char *start, *end;
+	struct lease_file_item *items;
+	struct lease_file_binding *bindings;
+	char *strings;
+	size_t nitems, maxitems;
+	size_t nbindings, maxbindings;
+	size_t nstrings, maxstrings;
+	const char *counted;		/* Newlines are counted up to here. */
+	int lines;
+	int nomem;
+	int done;
+};
+
+struct lease_reader {
+	struct lease_file_chunk *chunks;
+	unsigned nchunks;
+	unsigned next;			/* Next chunk for a thread to take. */
+	unsigned entered;		/* Chunks the main thread has done. */
+	unsigned window;		/* How far ahead the threads may go. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Characters that continue a name or number token in conflex.c. */
+#define LF_IDCHAR(c) (isascii (c) && (isalnum (c) || (c) == '-' || \
+				      (c) == '_'))
+
+static int
+lf_grow(void **array, size_t *max, size_t need, size_t size)
+{
+	size_t n;
+	void *p;
+
+	if (need <= *max)
+		return 1;
+	n = *max ? *max : 64;
+	while (n < need)
+		n *= 2;
+	p = realloc(*array, n * size);
+	if (p == NULL)
+		return 0;
+	*array = p;
+	*max = n;
+	return 1;
+}
+
+/* Skip white space and comments. */
+static const char *
+lf_space(const char *p, const char *end)
+{
+	while (p < end) {
+		if (*p == '#') {
+			p = memchr(p, '\n', end - p);
+			if (p == NULL)
+				return end;
+		} else if (!isascii((unsigned char)*p) ||
+			   !isspace((unsigned char)*p))
+			break;
+		p++;
+	}
+	return p;
+}
+
+/* Find the first record boundary after p, or the end. */
+static const char *
+lf_next_record(const char *base, const char *p, const char *end)
+{
+	while (p < end && (p = memchr(p, '}', end - p)) != NULL) {
+		if ((p == base || p[-1] == '\n') && end - p > 2 &&
+		    p[1] == '\n' && isascii((unsigned char)p[2]) &&
+		    isalpha((unsigned char)p[2]))
+			return p + 2;
+		p++;
+	}
+	return end;
+}
+
+/* Find where the text starting at p ends: the next record boundary,
+   or the next line that starts a lease, whichever comes first. */
+static const char *
+lf_next_text(const char *base, const char *p, const char *end)
+{
+	const char *next = lf_next_record(base, p, end), *nl;
+
+	for (nl = p; nl < next &&
+		     (nl = memchr(nl, '\n', next - nl)) != NULL; nl++) {
+		if (next - nl > 6 && memcmp(nl + 1, "lease ", 6) == 0)
+			return nl + 1;
+	}
+	return next;
+}
+
+/* Match a keyword.  The lexer doesn't care about case, but dhcpd
+   only ever writes lower case; anything else goes the slow way. */
+static int
+lf_word(const char **pp, const char *end, const char *word)
+{
+	const char *p = lf_space(*pp, end);
+	size_t len = strlen(word);
+
+	if ((size_t)(end - p) <= len || memcmp(p, word, len) != 0 ||
+	    LF_IDCHAR((unsigned char)p[len]))
+		return 0;
+	*pp = p + len;
+	return 1;
+}
+
+/* Any name token; the caller compares it with LF_IS(). */
+static int
+lf_name(const char **pp, const char *end, const char **name, size_t *len)
+{
+	const char *p = lf_space(*pp, end);
+
+	if (p == end || !isascii((unsigned char)*p) ||
+	    !isalpha((unsigned char)*p))
+		return 0;
+	for (*name = p; p < end && LF_IDCHAR((unsigned char)*p); p++)
+		;
+	if (p == end)
+		return 0;
+	*len = p - *name;
+	*pp = p;
+	return 1;
+}
+
+#define LF_IS(name, len, word) \
+	((len) == sizeof (word) - 1 && memcmp((name), (word), (len)) == 0)
+
+static int
+lf_char(const char **pp, const char *end, int c)
+{
+	const char *p = lf_space(*pp, end);
+
+	if (p == end || *p != c)
+		return 0;
+	*pp = p + 1;
+	return 1;
+}
+
+/* A decimal NUMBER token that fits in an int. */
+static int
+lf_number(const char **pp, const char *end, int *val)
+{
+	const char *p = lf_space(*pp, end);
+	long long n = 0;
+	int neg = 0, digits = 0;
+
+	if (p < end && *p == '-') {
+		neg = 1;
+		p++;
+	}
+	while (p < end && isascii((unsigned char)*p) &&
+	       isdigit((unsigned char)*p)) {
+		if (++digits > 10)
+			return 0;
+		n = n * 10 + (*p++ - '0');
+	}
+	if (!digits || p == end || LF_IDCHAR((unsigned char)*p))
+		return 0;
+	if (neg)
+		n = -n;
+	if (n > INT_MAX || n < INT_MIN)
+		return 0;
+	*val = (int)n;
+	*pp = p;
+	return 1;
+}
+
+/* An unsigned 64-bit number, as parse_lease_declaration() takes a
+   sequence number. */
+static int
+lf_uint64(const char **pp, const char *end, isc_uint64_t *val)
+{
+	const char *p = lf_space(*pp, end);
+	isc_uint64_t n = 0;
+	int digits = 0;
+
+	while (p < end && isascii((unsigned char)*p) &&
+	       isdigit((unsigned char)*p)) {
+		if (n > (ISC_UINT64_MAX - 9) / 10)
+			return 0;
+		n = n * 10 + (*p++ - '0');
+		digits++;
+	}
+	if (!digits || p == end || LF_IDCHAR((unsigned char)*p))
+		return 0;
+	*val = n;
+	*pp = p;
+	return 1;
+}
+
+static int
+lf_hexdigit(int c)
+{
+	c = tolower(c);
+	return isdigit(c) ? c - '0' : c - 'a' + 10;
+}
+
+/* Colon separated hexadecimal octets, as parse_numeric_aggregate()
+   reads them in base 16. */
+static int
+lf_hex(const char **pp, const char *end, unsigned char *buf,
+       unsigned max, unsigned *len)
+{
+	const char *p = lf_space(*pp, end);
+	unsigned n = 0;
+	int digits, value;
+
+	for (;;) {
+		value = 0;
+		for (digits = 0; p < end && isascii((unsigned char)*p) &&
+			     isxdigit((unsigned char)*p); digits++)
+			value = value * 16 + lf_hexdigit((unsigned char)*p++);
+		if (digits == 0 || digits > 2 || n == max || p == end)
+			return 0;
+		buf[n++] = value;
+		if (*p != ':')
+			break;
+		p++;
+	}
+	if (LF_IDCHAR((unsigned char)*p))
+		return 0;
+	*len = n;
+	*pp = p;
+	return 1;
+}
+
+/* A quoted string, unescaped as read_string() does it and added to
+   the chunk strings with a NUL after it. */
+static int
+lf_string(struct lease_file_chunk *c, const char **pp, const char *end,
+	  size_t *off, unsigned *len)
+{
+	const char *p = lf_space(*pp, end);
+	unsigned n = 0;
+	int value, i;
+	char *s;
+
+	if (p == end || *p++ != '"')
+		return 0;
+	if (!lf_grow((void **)&c->strings, &c->maxstrings,
+		     c->nstrings + LF_TOKEN_MAX + 1, 1)) {
+		c->nomem = 1;
+		return 0;
+	}
+	s = c->strings + c->nstrings;
+	for (;;) {
+		if (p == end || n == LF_TOKEN_MAX)
+			return 0;
+		if (*p == '"')
+			break;
+		if (*p != '\\') {
+			s[n++] = *p++;
+			continue;
+		}
+		if (++p == end)
+			return 0;
+		switch (*p) {
+		      case 't':
+			s[n++] = '\t';
+			p++;
+			break;
+		      case 'r':
+			s[n++] = '\r';
+			p++;
+			break;
+		      case 'n':
+			s[n++] = '\n';
+			p++;
+			break;
+		      case 'b':
+			s[n++] = '\b';
+			p++;
+			break;
+		      case '0':
+		      case '1':
+		      case '2':
+		      case '3':
+			/* Three octal digits, as quotify_buf() writes
+			   them; leave anything else to the lexer. */
+			value = 0;
+			for (i = 0; i < 3; i++, p++) {
+				if (p == end || *p < '0' || *p > '7')
+					return 0;
+				value = value * 8 + (*p - '0');
+			}
+			s[n++] = value;
+			break;
+		      case 'x':
+			value = 0;
+			for (i = 0, p++; i < 2; i++, p++) {
+				if (p == end || !isascii((unsigned char)*p) ||
+				    !isxdigit((unsigned char)*p))
+					return 0;
+				value = value * 16 +
+					lf_hexdigit((unsigned char)*p);
+			}
+			s[n++] = value;
+			break;
+		      default:
+			s[n++] = *p++;
+			break;
+		}
+	}
+	s[n] = 0;
+	*off = c->nstrings;
+	*len = n;
+	c->nstrings += n + 1;
+	*pp = p + 1;
+	return 1;
+}
+
+/* date SEMI, as parse_date() reads it. */
+static int
+lf_date(const char **pp, const char *end, TIME *t)
+{
+	int dow, year, mon, mday, hour, min, sec, tzoff, secs;
+
+	if (lf_word(pp, end, "never")) {
+		*t = MAX_TIME;
+	} else if (lf_word(pp, end, "epoch")) {
+		if (!lf_number(pp, end, &secs))
+			return 0;
+		*t = (TIME)secs;
+	} else {
+		if (!lf_number(pp, end, &dow) ||
+		    !lf_number(pp, end, &year) || !lf_char(pp, end, '/') ||
+		    !lf_number(pp, end, &mon) || !lf_char(pp, end, '/') ||
+		    !lf_number(pp, end, &mday) ||
+		    !lf_number(pp, end, &hour) || !lf_char(pp, end, ':') ||
+		    !lf_number(pp, end, &min) || !lf_char(pp, end, ':') ||
+		    !lf_number(pp, end, &sec))
+			return 0;
+		if (!lf_number(pp, end, &tzoff))
+			tzoff = 0;
+		*t = date_to_time(year, mon - 1, mday, hour, min, sec, tzoff);
+	}
+	return lf_char(pp, end, ';');
+}
+
+/* state name SEMI, after [next|rewind] binding. */
+static int
+lf_binding_state(const char **pp, const char *end,
+		 binding_state_t *state, u_int8_t *flags)
+{
+	const char *name;
+	size_t len;
+
+	if (!lf_word(pp, end, "state") || !lf_name(pp, end, &name, &len))
+		return 0;
+	if (LF_IS(name, len, "free"))
+		*state = FTS_FREE;
+	else if (LF_IS(name, len, "active"))
+		*state = FTS_ACTIVE;
+	else if (LF_IS(name, len, "expired"))
+		*state = FTS_EXPIRED;
+	else if (LF_IS(name, len, "released"))
+		*state = FTS_RELEASED;
+	else if (LF_IS(name, len, "abandoned"))
+		*state = FTS_ABANDONED;
+	else if (LF_IS(name, len, "reset"))
+		*state = FTS_RESET;
+	else if (LF_IS(name, len, "backup"))
+		*state = FTS_BACKUP;
+	else if (LF_IS(name, len, "reserved")) {
+		/* RESERVED and BOOTP states preserved for
+		   compatibleness with older versions. */
+		*state = FTS_ACTIVE;
+		*flags |= RESERVED_LEASE;
+	} else if (LF_IS(name, len, "bootp")) {
+		*state = FTS_ACTIVE;
+		*flags |= BOOTP_LEASE;
+	} else
+		return 0;
+	return lf_char(pp, end, ';');
+}
+
+/* name EQUAL value SEMI, where the value is a string, %number, true
+   or false; that is everything write_binding_scope() writes. */
+static int
+lf_set(struct lease_file_chunk *c, struct lease_file_item *item,
+       const char **pp, const char *end)
+{
+	struct lease_file_binding *b;
+	const char *p = *pp, *name;
+	size_t len;
+	int n;
+
+	if (!lf_name(&p, end, &name, &len) || len > LF_TOKEN_MAX)
+		return 0;
+
+	if (!lf_grow((void **)&c->bindings, &c->maxbindings,
+		     c->nbindings + 1, sizeof *c->bindings) ||
+	    !lf_grow((void **)&c->strings, &c->maxstrings,
+		     c->nstrings + len + 1, 1)) {
+		c->nomem = 1;
+		return 0;
+	}
+	b = &c->bindings[c->nbindings];
+	memset(b, 0, sizeof *b);
+	b->name = c->nstrings;
+	memcpy(c->strings + c->nstrings, name, len);
+	c->strings[c->nstrings + len] = 0;
+	c->nstrings += len + 1;
+
+	if (!lf_char(&p, end, '='))
+		return 0;
+	if (lf_char(&p, end, '%')) {
+		if (!lf_number(&p, end, &n))
+			return 0;
+		b->type = binding_numeric;
+		b->intval = (long)n;
+	} else if (lf_word(&p, end, "true")) {
+		b->type = binding_boolean;
+		b->intval = 1;
+	} else if (lf_word(&p, end, "false")) {
+		b->type = binding_boolean;
+		b->intval = 0;
+	} else if (lf_string(c, &p, end, &b->data, &b->data_len)) {
+		b->type = binding_data;
+	} else
+		return 0;
+	if (!lf_char(&p, end, ';'))
+		return 0;
+
+	c->nbindings++;
+	item->nbindings++;
+	*pp = p;
+	return 1;
+}
+
+/* Parse a lease declaration into item, following
+   parse_lease_declaration().  Anything it doesn't expect makes it
+   give up, and the declaration is left to the real parser. */
+static int
+lf_lease(struct lease_file_chunk *c, struct lease_file_item *item,
+	 const char **pp, const char *end)
+{
+	const char *p = *pp, *name;
+	binding_state_t new_state;
+	size_t nlen;
+	unsigned len;
+	TIME *t;
+	int seenbit, value;
+
+	memset(item, 0, sizeof *item);
+	item->binding = c->nbindings;
+
+	if (!lf_word(&p, end, "lease"))
+		return 0;
+	for (len = 0; len < 4; len++) {
+		if ((len && !lf_char(&p, end, '.')) ||
+		    !lf_number(&p, end, &value) || value < 0 || value > 255)
+			return 0;
+		item->addr[len] = value;
+	}
+	if (!lf_char(&p, end, '{'))
+		return 0;
+
+	while (!lf_char(&p, end, '}')) {
+		if (!lf_name(&p, end, &name, &nlen))
+			return 0;
+		t = NULL;
+		if (LF_IS(name, nlen, "starts")) {
+			seenbit = 1;
+			t = &item->starts;
+		} else if (LF_IS(name, nlen, "ends")) {
+			seenbit = 2;
+			t = &item->ends;
+		} else if (LF_IS(name, nlen, "tstp")) {
+			seenbit = 65536;
+			t = &item->tstp;
+		} else if (LF_IS(name, nlen, "tsfp")) {
+			seenbit = 131072;
+			t = &item->tsfp;
+		} else if (LF_IS(name, nlen, "atsfp")) {
+			seenbit = 262144;
+			t = &item->atsfp;
+		} else if (LF_IS(name, nlen, "cltt")) {
+			seenbit = 524288;
+			t = &item->cltt;
+		} else if (LF_IS(name, nlen, "binding")) {
+			seenbit = 256;
+			if (!lf_binding_state(&p, end, &new_state,
+					      &item->flags))
+				return 0;
+			item->binding_state = new_state;
+			if (!(item->seenmask & 128))
+				item->next_binding_state = new_state;
+			if (!(item->seenmask & 512))
+				item->rewind_binding_state = new_state;
+		} else if (LF_IS(name, nlen, "next")) {
+			seenbit = 128;
+			if (!lf_word(&p, end, "binding") ||
+			    !lf_binding_state(&p, end,
+					      &item->next_binding_state,
+					      &item->flags))
+				return 0;
+		} else if (LF_IS(name, nlen, "rewind")) {
+			seenbit = 512;
+			if (!lf_word(&p, end, "binding") ||
+			    !lf_binding_state(&p, end,
+					      &item->rewind_binding_state,
+					      &item->flags))
+				return 0;
+		} else if (LF_IS(name, nlen, "abandoned")) {
+			seenbit = 256;
+			item->binding_state = FTS_ABANDONED;
+			item->next_binding_state = FTS_ABANDONED;
+			if (!lf_char(&p, end, ';'))
+				return 0;
+		} else if (LF_IS(name, nlen, "reserved")) {
+			seenbit = 0;
+			item->flags |= RESERVED_LEASE;
+			if (!lf_char(&p, end, ';'))
+				return 0;
+		} else if (LF_IS(name, nlen, "dynamic-bootp")) {
+			seenbit = 0;
+			item->flags |= BOOTP_LEASE;
+			if (!lf_char(&p, end, ';'))
+				return 0;
+		} else if (LF_IS(name, nlen, "hardware")) {
+			seenbit = 64;
+			if (lf_word(&p, end, "ethernet"))
+				item->hardware_addr.hbuf[0] = HTYPE_ETHER;
+			else if (lf_word(&p, end, "token-ring"))
+				item->hardware_addr.hbuf[0] = HTYPE_IEEE802;
+			else if (lf_word(&p, end, "fddi"))
+				item->hardware_addr.hbuf[0] = HTYPE_FDDI;
+			else if (lf_word(&p, end, "infiniband"))
+				item->hardware_addr.hbuf[0] =
+					HTYPE_INFINIBAND;
+			else
+				return 0;
+			if (!lf_hex(&p, end, &item->hardware_addr.hbuf[1],
+				    sizeof(item->hardware_addr.hbuf) - 1,
+				    &len) ||
+			    !lf_char(&p, end, ';'))
+				return 0;
+			item->hardware_addr.hlen = len + 1;
+		} else if (LF_IS(name, nlen, "uid")) {
+			seenbit = 8;
+			if (lf_string(c, &p, end, &item->uid,
+				      &item->uid_len)) {
+				item->uid_string = 1;
+			} else {
+				if (!lf_grow((void **)&c->strings,
+					     &c->maxstrings,
+					     c->nstrings + LF_TOKEN_MAX, 1)) {
+					c->nomem = 1;
+					return 0;
+				}
+				if (!lf_hex(&p, end,
+					    (unsigned char *)c->strings +
+					    c->nstrings, LF_TOKEN_MAX,
+					    &item->uid_len))
+					return 0;
+				item->uid = c->nstrings;
+				c->nstrings += item->uid_len;
+			}
+			if (!lf_char(&p, end, ';'))
+				return 0;
+		} else if (LF_IS(name, nlen, "client-hostname")) {
+			seenbit = 1024;
+			if (!lf_string(c, &p, end, &item->client_hostname,
+				       &item->client_hostname_len) ||
+			    !lf_char(&p, end, ';'))
+				return 0;
+		} else if (LF_IS(name, nlen, "sequence")) {
+			seenbit = 1048576;
+			if (!lf_uint64(&p, end, &item->fo_seq) ||
+			    !lf_char(&p, end, ';'))
+				return 0;
+		} else if (LF_IS(name, nlen, "set")) {
+			seenbit = 0;
+			if (!lf_set(c, item, &p, end))
+				return 0;
+		} else
+			return 0;
+
+		if (t != NULL && !lf_date(&p, end, t))
+			return 0;
+
+		/* The parser warns about these; let it. */
+		if (item->seenmask & seenbit)
+			return 0;
+		item->seenmask |= seenbit;
+	}
+
+	*pp = p;
+	return 1;
+}
+
+static int
+lf_count_lines(const char *p, const char *end)
+{
+	int lines = 0;
+
+	while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+		lines++;
+		p++;
+	}
+	return lines;
+}
+
+/* The number of lines in the chunk before p. */
+static int
+lf_line(struct lease_file_chunk *c, const char *p)
+{
+	c->lines += lf_count_lines(c->counted, p);
+	c->counted = p;
+	return c->lines;
+}
+
+static void
+lf_parse_chunk(const char *base, struct lease_file_chunk *c)
+{
+	struct lease_file_item *item;
+	const char *p = c->start, *next;
+	size_t nbindings, nstrings;
+
+	c->counted = c->start;
+	while ((p = lf_space(p, c->end)) < c->end) {
+		if (!lf_grow((void **)&c->items, &c->maxitems,
+			     c->nitems + 1, sizeof *c->items)) {
+			c->nomem = 1;
+			return;
+		}
+		item = &c->items[c->nitems];
+
+		/* A lease, if it's one we can read. */
+		nbindings = c->nbindings;
+		nstrings = c->nstrings;
+		if (lf_lease(c, item, &p, c->end)) {
+			c->nitems++;
+			continue;
+		}
+		if (c->nomem)
+			return;
+		c->nbindings = nbindings;
+		c->nstrings = nstrings;
+
+		/* Otherwise text up to the next record, which goes on the
+		   end of the text before it if there is some. */
+		next = lf_next_text(base, p, c->end);
+		if (c->nitems && c->items[c->nitems - 1].text != NULL) {
+			item = &c->items[c->nitems - 1];
+			item->text_len = next - item->text;
+		} else {
+			memset(item, 0, sizeof *item);
+			item->text = p;
+			item->text_len = next - p;
+			item->line = lf_line(c, p);
+			c->nitems++;
+		}
+		p = next;
+	}
+	lf_line(c, c->end);
+}
+
+static void *
+lease_reader_thread(void *arg)
+{
+	struct lease_reader *r = arg;
+	struct lease_file_chunk *c;
+
+	pthread_mutex_lock(&r->lock);
+	for (;;) {
+		while (r->next < r->nchunks &&
+		       r->next >= r->entered + r->window)
+			pthread_cond_wait(&r->cond, &r->lock);
+		if (r->next == r->nchunks)
+			break;
+		c = &r->chunks[r->next++];
+		pthread_mutex_unlock(&r->lock);
+
+		lf_parse_chunk(r->chunks[0].start, c);
+
+		pthread_mutex_lock(&r->lock);
+		c->done = 1;
+		pthread_cond_broadcast(&r->cond);
+	}
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+/* Hand len bytes of the lease file starting at line to the parser. */
+static isc_result_t
+lf_subparse(const char *filename, const char *text, size_t len, int line)
+{
+	struct parse *cfile = NULL;
+	isc_result_t status;
+
+	if (len > 0x7FFFFFFFUL)
+		log_fatal("%s: record at line %d is too long to buffer.",
+			  filename, line);
+	status = new_parse(&cfile, -1, (char *)text, len, filename, 0);
+	if (status != ISC_R_SUCCESS || cfile == NULL)
+		return status;
+	cfile->line = line;
+	status = lease_file_subparse(cfile);
+	end_parse(&cfile);
+	return status;
+}
+
+/* Enter a lease as lease_file_subparse() would. */
+static void
+lf_enter(struct lease_file_chunk *c, struct lease_file_item *item)
+{
+	struct lease *lease = NULL;
+	struct lease_file_binding *fb;
+	struct binding *binding;
+	struct binding_value *nv;
+	unsigned char *tuid;
+	unsigned i;
+
+	if (lease_allocate(&lease, MDL) != ISC_R_SUCCESS)
+		log_fatal("No memory for lease %d.%d.%d.%d.", item->addr[0],
+			  item->addr[1], item->addr[2], item->addr[3]);
+	memcpy(lease->ip_addr.iabuf, item->addr, 4);
+	lease->ip_addr.len = 4;
+	lease->starts = item->starts;
+	lease->ends = item->ends;
+	lease->tstp = item->tstp;
+	lease->tsfp = item->tsfp;
+	lease->atsfp = item->atsfp;
+	lease->cltt = item->cltt;
+	lease->fo_seq = item->fo_seq;
+	lease->binding_state = item->binding_state;
+	lease->next_binding_state = item->next_binding_state;
+	lease->rewind_binding_state = item->rewind_binding_state;
+	lease->flags = item->flags;
+	lease->hardware_addr = item->hardware_addr;
+
+	if (item->seenmask & 8) {
+		if (item->uid_string && item->uid_len < sizeof lease->uid_buf) {
+			tuid = lease->uid_buf;
+			lease->uid_max = sizeof lease->uid_buf;
+		} else {
+			tuid = dmalloc(item->uid_len, MDL);
+			if (!tuid)
+				log_fatal("No memory for lease uid");
+			lease->uid_max = item->uid_len;
+		}
+		memcpy(tuid, c->strings + item->uid, item->uid_len);
+		lease->uid = tuid;
+		lease->uid_len = item->uid_len;
+	}
+
+	if (item->seenmask & 1024) {
+		lease->client_hostname =
+			dmalloc(item->client_hostname_len + 1, MDL);
+		if (!lease->client_hostname)
+			log_fatal("no memory for string %s.",
+				  c->strings + item->client_hostname);
+		memcpy(lease->client_hostname,
+		       c->strings + item->client_hostname,
+		       item->client_hostname_len + 1);
+	}
+
+	for (i = 0; i < item->nbindings; i++) {
+		fb = &c->bindings[item->binding + i];
+		binding = NULL;
+		if (lease->scope)
+			binding = find_binding(lease->scope,
+					       c->strings + fb->name);
+		else if (!binding_scope_allocate(&lease->scope, MDL))
+			log_fatal("no memory for scope");
+
+		nv = NULL;
+		if (!binding_value_allocate(&nv, MDL))
+			log_fatal("no memory for binding value.");
+		nv->type = fb->type;
+		if (fb->type == binding_data) {
+			if (!buffer_allocate(&nv->value.data.buffer,
+					     fb->data_len + 1, MDL))
+				log_fatal("No memory for binding.");
+			memcpy(nv->value.data.buffer->data,
+			       c->strings + fb->data, fb->data_len + 1);
+			nv->value.data.data = nv->value.data.buffer->data;
+			nv->value.data.len = fb->data_len;
+			nv->value.data.terminated = 1;
+		} else if (fb->type == binding_numeric)
+			nv->value.intval = fb->intval;
+		else
+			nv->value.boolean = fb->intval;
+
+		if (!binding) {
+			binding = dmalloc(sizeof *binding, MDL);
+			if (!binding)
+				log_fatal("No memory for lease binding.");
+			binding->name =
+				dmalloc(strlen(c->strings + fb->name) + 1, MDL);
+			if (!binding->name)
+				log_fatal("No memory for binding name.");
+			strcpy(binding->name, c->strings + fb->name);
+			binding_value_reference(&binding->value, nv, MDL);
+			binding->next = lease->scope->bindings;
+			lease->scope->bindings = binding;
+		} else {
+			binding_value_dereference(&binding->value, MDL);
+			binding_value_reference(&binding->value, nv, MDL);
+		}
+		binding_value_dereference(&nv, MDL);
+	}
+
+	finish_lease_declaration(lease, item->seenmask);
+	enter_lease(lease);
+	lease_dereference(&lease, MDL);
+}
+
+/*
+ * Read the lease file named filename with up to threads threads (zero
+ * for one per CPU) in chunks of about chunk bytes (zero for the
+ * default).  The result is the same as read_conf_file() on the lease
+ * file.
+ */
+isc_result_t
+read_lease_file(const char *filename, int threads, size_t chunk)
+{
+	struct lease_reader r;
+	struct lease_file_chunk *c;
+	pthread_t tids [LEASE_READER_THREADS];
+	pthread_attr_t attr;
+	sigset_t all, old;
+	struct stat sb;
+	const char *map, *p, *end;
+	isc_result_t status, result = ISC_R_SUCCESS;
+	size_t i, j;
+	int fd, line, nthreads = 0, rv;
+
+#if defined (TRACING)
+	/* A trace has to carry the whole file. */
+	if (trace_record())
+		return read_conf_file(filename, NULL, 0, 1);
+#endif
+	/* Let read_conf_file() report the errors. */
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return read_conf_file(filename, NULL, 0, 1);
+	if (fstat(fd, &sb) < 0 || sb.st_size == 0 ||
+	    (map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED,
+			fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return read_conf_file(filename, NULL, 0, 1);
+	}
+	end = map + sb.st_size;
+
+	/* Cut the file into chunks. */
+	if (chunk == 0)
+		chunk = LEASE_READER_CHUNK;
+	memset(&r, 0, sizeof r);
+	r.nchunks = sb.st_size / chunk + 1;
+	r.chunks = dmalloc(r.nchunks * sizeof *r.chunks, MDL);
+	if (r.chunks == NULL)
+		log_fatal("No memory to read %s.", filename);
+	for (i = 0, p = map; p < end; i++) {
+		r.chunks[i].start = p;
+		if ((size_t)(end - p) > chunk)
+			p = lf_next_record(map, p + chunk, end);
+		else
+			p = end;
+		r.chunks[i].end = p;
+	}
+	r.nchunks = i;
+
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > LEASE_READER_THREADS)
+		threads = LEASE_READER_THREADS;
+	if (threads > (int)r.nchunks)
+		threads = r.nchunks;
+	r.window = 2 * threads;
+	if (threads > 1) {
+		pthread_mutex_init(&r.lock, NULL);
+		pthread_cond_init(&r.cond, NULL);
+
+		/* Signals are for the main thread. */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		pthread_attr_init(&attr);
+		for (; nthreads < threads; nthreads++) {
+			rv = pthread_create(&tids[nthreads], &attr,
+					    lease_reader_thread, &r);
+			if (rv != 0) {
+				errno = rv;
+				log_error("lease reader: can't create "
+					  "thread: %m");
+				break;
+			}
+		}
+		pthread_attr_destroy(&attr);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+
+	/* Enter everything in file order. */
+	line = 1;
+	for (i = 0; i < r.nchunks; i++) {
+		c = &r.chunks[i];
+		if (nthreads > 0) {
+			pthread_mutex_lock(&r.lock);
+			while (!c->done)
+				pthread_cond_wait(&r.cond, &r.lock);
+			pthread_mutex_unlock(&r.lock);
+		} else
+			lf_parse_chunk(map, c);
+
+		if (c->nomem) {
+			log_error("No memory to read %s quickly; "
+				  "parsing it slowly.", filename);
+			status = lf_subparse(filename, c->start,
+					     c->end - c->start, line);
+			if (status != ISC_R_SUCCESS)
+				result = status;
+			c->lines = lf_count_lines(c->start, c->end);
+		} else {
+			for (j = 0; j < c->nitems; j++) {
+				if (c->items[j].text == NULL) {
+					lf_enter(c, &c->items[j]);
+					continue;
+				}
+				status = lf_subparse(filename,
+						     c->items[j].text,
+						     c->items[j].text_len,
+						     line + c->items[j].line);
+				if (status != ISC_R_SUCCESS)
+					result = status;
+			}
+		}
+		line += c->lines;
+
+		free(c->items);
+		free(c->bindings);
+		free(c->strings);
+		c->items = NULL;
+		c->bindings = NULL;
+		c->strings = NULL;
+
+		if (nthreads > 0) {
+			pthread_mutex_lock(&r.lock);
+			r.entered = i + 1;
+			pthread_cond_broadcast(&r.cond);
+			pthread_mutex_unlock(&r.lock);
+		}
+	}
+
+	for (rv = 0; rv < nthreads; rv++)
+		pthread_join(tids[rv], NULL);
+	if (threads > 1) {
+		pthread_cond_destroy(&r.cond);
+		pthread_mutex_destroy(&r.lock);
+	}
+	dfree(r.chunks, MDL);
+	munmap((void *)map, sb.st_size);
+	close(fd);
+	return result;
+}
+#endif /* FAST_LEASE_READER */
+
 void db_startup (int test_mode)
 {
 	const char *current_db_path;
@@ -1082,8 +2655,12 @@ void db_startup (int test_mode)
 		authoring_byte_order = 0;
 
 		/* Read in the existing lease file... */
+#if defined (FAST_LEASE_READER)
+		status = read_lease_file (path_dhcpd_db, 0, 0);
+#else
 		status = read_conf_file (path_dhcpd_db,
 					 (struct group *)0, 0, 1);
+#endif
 		if (status != ISC_R_SUCCESS) {
 			/* XXX ignore status? */
 			;
@@ -1118,15 +2695,27 @@ void db_startup (int test_mode)
 #endif
 		time(&write_time);
 	new_lease_file (test_mode);
+}
 
-#if defined(REPORT_HASH_PERFORMANCE)
+/*
+ * Log how full the main lookup tables are and how long their chains
+ * have got.  This is done whenever the lease file is rewritten if
+ * log-hash-statistics is set.
+ */
+void log_hash_tables(void)
+{
 	log_info("Host HW hash:   %s", host_hash_report(host_hw_addr_hash));
 	log_info("Host UID hash:  %s", host_hash_report(host_uid_hash));
+	log_info("Host name hash: %s", host_hash_report(host_name_hash));
 	log_info("Lease IP hash:  %s",
 		 lease_ip_hash_report(lease_ip_addr_hash));
 	log_info("Lease UID hash: %s", lease_id_hash_report(lease_uid_hash));
 	log_info("Lease HW hash:  %s",
 		 lease_id_hash_report(lease_hw_addr_hash));
+#if defined (DHCPv6)
+	log_info("IA_NA hash:     %s", ia_hash_report(ia_na_active));
+	log_info("IA_TA hash:     %s", ia_hash_report(ia_ta_active));
+	log_info("IA_PD hash:     %s", ia_hash_report(ia_pd_active));
 #endif
 }
 
@@ -1181,6 +2770,10 @@ int new_lease_file (int test_mode)
 		goto fdfail;
 	}
 
+#if defined (ASYNC_LEASE_WRITER)
+	(void) lease_writer_detach();
+#endif
+
 	/* Close previous database, if any. */
 	if (db_file)
 		fclose(db_file);
@@ -1219,6 +2812,9 @@ int new_lease_file (int test_mode)
 	if (!write_leases ())
 		goto fail;
 
+	if (log_hash_statistics)
+		log_hash_tables();
+
 	if (test_mode) {
 		log_debug("Lease file test successful,"
 			  " removing temp lease file: %s",
@@ -1268,6 +2864,9 @@ int new_lease_file (int test_mode)
 	}
 
 	counting = 1;
+#if defined (ASYNC_LEASE_WRITER)
+	lease_writer_attach();
+#endif
 	return 1;
 
       fail:
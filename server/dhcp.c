@@ -51,6 +51,7 @@ int outstanding_pings;
 #if defined(DELAYED_ACK)
 static void delayed_ack_enqueue(struct lease *);
 static void delayed_acks_timer(void *);
+static void delayed_acks_send(void *);
 
 
 struct leasequeue *ackqueue_head, *ackqueue_tail;
@@ -1529,9 +1530,9 @@ void dhcpinform (packet, ms_nulltp)
 	if (option_cache_allocate (&oc, MDL)) {
 		if (make_const_data (&oc -> expression,
 				     &dhcpack, 1, 0, 0, MDL)) {
-			option_code_hash_lookup(&oc->option,
-						dhcp_universe.code_hash,
-						&i, 0, MDL);
+			option_code_lookup(&oc->option,
+					   &dhcp_universe,
+					   i, MDL);
 			save_option (&dhcp_universe, options, oc);
 		}
 		option_cache_dereference (&oc, MDL);
@@ -1549,9 +1550,9 @@ void dhcpinform (packet, ms_nulltp)
 					     subnet -> netmask.iabuf,
 					     subnet -> netmask.len,
 					     0, 0, MDL)) {
-				option_code_hash_lookup(&oc->option,
-							dhcp_universe.code_hash,
-							&i, 0, MDL);
+				option_code_lookup(&oc->option,
+						   &dhcp_universe,
+						   i, MDL);
 				save_option (&dhcp_universe, options, oc);
 			}
 			option_cache_dereference (&oc, MDL);
@@ -1812,8 +1813,8 @@ void nak_lease (packet, cip, network_group)
 		return;
 	}
 	i = DHO_DHCP_MESSAGE_TYPE;
-	option_code_hash_lookup(&oc->option, dhcp_universe.code_hash,
-				&i, 0, MDL);
+	option_code_lookup(&oc->option, &dhcp_universe,
+			   i, MDL);
 	save_option (&dhcp_universe, options, oc);
 	option_cache_dereference (&oc, MDL);
 
@@ -1836,8 +1837,8 @@ void nak_lease (packet, cip, network_group)
 		return;
 	}
 	i = DHO_DHCP_MESSAGE;
-	option_code_hash_lookup(&oc->option, dhcp_universe.code_hash,
-				&i, 0, MDL);
+	option_code_lookup(&oc->option, &dhcp_universe,
+			   i, MDL);
 	save_option (&dhcp_universe, options, oc);
 	option_cache_dereference (&oc, MDL);
 
@@ -2061,11 +2062,9 @@ void echo_client_id(packet, lease, in_options, out_options)
 						    client_id.data,
 						    client_id.len,
                                                     1, 0, MDL)) {
-					option_code_hash_lookup(&oc->option,
-							        dhcp_universe.
-                                                                code_hash,
-							        &opcode,
-                                                                0, MDL);
+					option_code_lookup(&oc->option,
+							   &dhcp_universe,
+							   opcode, MDL);
 					save_option(&dhcp_universe,
 						    out_options, oc);
 				}
@@ -3109,6 +3108,9 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 			 (struct option_chain_head *)
 			 packet -> options -> universes [agent_universe.index],
 			 MDL);
+		/* They're kept with the lease, so don't let them keep
+		   the packet's arena chunk too. */
+		option_chain_head_to_heap(lt -> agent_options, MDL);
 	    }
 	}
 
@@ -3328,9 +3330,9 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 		if (option_cache_allocate (&oc, MDL)) {
 			if (make_const_data (&oc -> expression,
 					     &state -> offer, 1, 0, 0, MDL)) {
-				option_code_hash_lookup(&oc->option,
-							dhcp_universe.code_hash,
-							&i, 0, MDL);
+				option_code_lookup(&oc->option,
+						   &dhcp_universe,
+						   i, MDL);
 				save_option (&dhcp_universe,
 					     state -> options, oc);
 			}
@@ -3351,9 +3353,9 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 		if (option_cache_allocate (&oc, MDL)) {
 			if (make_const_data(&oc->expression, state->expiry,
 					    4, 0, 0, MDL)) {
-				option_code_hash_lookup(&oc->option,
-							dhcp_universe.code_hash,
-							&i, 0, MDL);
+				option_code_lookup(&oc->option,
+						   &dhcp_universe,
+						   i, MDL);
 				save_option (&dhcp_universe,
 					     state -> options, oc);
 			}
@@ -3431,9 +3433,9 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 					     lease -> subnet -> netmask.iabuf,
 					     lease -> subnet -> netmask.len,
 					     0, 0, MDL)) {
-				option_code_hash_lookup(&oc->option,
-							dhcp_universe.code_hash,
-							&i, 0, MDL);
+				option_code_lookup(&oc->option,
+						   &dhcp_universe,
+						   i, MDL);
 				save_option (&dhcp_universe,
 					     state -> options, oc);
 			}
@@ -3474,9 +3476,9 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 						      h -> h_name),
 						     strlen (h -> h_name) + 1,
 						     1, 1, MDL)) {
-					option_code_hash_lookup(&oc->option,
-							dhcp_universe.code_hash,
-								&i, 0, MDL);
+					option_code_lookup(&oc->option,
+							   &dhcp_universe,
+							   i, MDL);
 					save_option (&dhcp_universe,
 						     state -> options, oc);
 				}
@@ -3503,9 +3505,9 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 						     lease -> ip_addr.iabuf,
 						     lease -> ip_addr.len,
 						     0, 0, MDL)) {
-					option_code_hash_lookup(&oc->option,
-							dhcp_universe.code_hash,
-								&i, 0, MDL);
+					option_code_lookup(&oc->option,
+							   &dhcp_universe,
+							   i, MDL);
 					save_option (&dhcp_universe,
 						     state -> options, oc);
 				}
@@ -3811,7 +3813,7 @@ delayed_ack_enqueue(struct lease *lease)
 static void
 delayed_acks_timer(void *foo)
 {
-	struct leasequeue *ack, *p;
+	struct leasequeue *ack;
 
 	/* Reset max fsync */
 	memset(&max_fsync, 0, sizeof(max_fsync));
@@ -3821,8 +3823,28 @@ delayed_acks_timer(void *foo)
 		return;
 	}
 
+	/* Take the queue as it stands; new acks start a new one. */
+	ack = ackqueue_tail;
+	ackqueue_head = NULL;
+	ackqueue_tail = NULL;
+	outstanding_acks = 0;
+
+#if defined (ASYNC_LEASE_WRITER)
+	/* The replies go out when the writer thread has synced the
+	   leases, and in the meantime we go back to reading packets. */
+	commit_leases_async(delayed_acks_send, ack);
+#else
 	/* Commit the leases first */
 	commit_leases();
+	delayed_acks_send(ack);
+#endif
+}
+
+/* Send the replies for a committed queue, given its tail. */
+static void
+delayed_acks_send(void *tail)
+{
+	struct leasequeue *ack, *p;
 
 	/* Now process the delayed ACKs
 	 - update failover peer
@@ -3830,8 +3852,14 @@ delayed_acks_timer(void *foo)
 	 - move the queue slots to the free list
 	*/
 
+#if defined (USE_SENDMMSG)
+	/* Hold the replies and send them per interface once they've all
+	   been built. */
+	send_batch_begin();
+#endif
+
 	/*  process from bottom to retain packet order */
-	for (ack = ackqueue_tail ; ack ; ack = p) {
+	for (ack = tail ; ack ; ack = p) {
 		p = ack->prev;
 
 #if defined(FAILOVER_PROTOCOL)
@@ -3860,9 +3888,9 @@ delayed_acks_timer(void *foo)
 		free_ackqueue = ack;
 	}
 
-	ackqueue_head = NULL;
-	ackqueue_tail = NULL;
-	outstanding_acks = 0;
+#if defined (USE_SENDMMSG)
+	send_batch_end();
+#endif
 }
 
 #if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
@@ -5053,6 +5081,7 @@ int allocate_lease (struct lease **lp, struct packet *packet,
 		} else
 #endif
 		{
+			pool_make_free_lease(pool);
 			if (LEASE_NOT_EMPTY(pool->free))
 				candl = LEASE_GET_FIRST(pool->free);
 			else
@@ -5483,9 +5512,9 @@ get_server_source_address(struct in_addr *from,
 		if (make_const_data(&oc->expression,
 				    (unsigned char *)a, sizeof(*a),
 				    0, allocate, MDL)) {
-			option_code_hash_lookup(&oc->option,
-						dhcp_universe.code_hash,
-						&option_num, 0, MDL);
+			option_code_lookup(&oc->option,
+					   &dhcp_universe,
+					   option_num, MDL);
 			save_option(&dhcp_universe, out_options, oc);
 		}
 		option_cache_dereference(&oc, MDL);
@@ -5694,9 +5723,9 @@ void use_host_decl_name(struct packet* packet,
                                             strlen(lease->host->name),
 					    1, 0, MDL)) {
 				ocode = DHO_HOST_NAME;
-                                option_code_hash_lookup(&oc->option,
-                                                        dhcp_universe.code_hash,
-                                                        &ocode, 0, MDL);
+                                option_code_lookup(&oc->option,
+						   &dhcp_universe,
+						   ocode, MDL);
                                 save_option(&dhcp_universe, options, oc);
                         }
                         option_cache_dereference(&oc, MDL);
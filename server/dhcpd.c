@@ -80,6 +80,11 @@ u_int16_t ddns_conflict_mask;
 int ddns_update_style;
 int dont_use_fsync = 0; /* 0 = default, use fsync, 1 = don't use fsync */
 int server_id_check = 0; /* 0 = default, don't check server id, 1 = do check */
+#if defined (REPORT_HASH_PERFORMANCE)
+int log_hash_statistics = 1;
+#else
+int log_hash_statistics = 0; /* 1 = log hash table use on lease file writes */
+#endif
 
 #ifdef DHCPv6
 int prefix_length_mode = PLM_PREFER;
@@ -761,7 +766,11 @@ main(int argc, char **argv) {
 
 	/* Set up various hooks. */
 	dhcp_interface_setup_hook = dhcpd_interface_setup_hook;
+#if defined (FAILOVER_PROTOCOL)
+	bootp_packet_handler = dhcp_failover_packet_handler;
+#else
 	bootp_packet_handler = do_packet;
+#endif
 #ifdef DHCPv6
 	add_enumeration (&prefix_length_modes);
 	dhcpv6_packet_handler = do_packet6;
@@ -1290,6 +1299,32 @@ void postconf_initialization (int quiet)
 		}
 	}
 
+	oc = lookup_option(&server_universe, options,
+			   SV_DDNS_ZONE_CONCURRENCY);
+	if ((oc != NULL) &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 2) {
+			ddns_zone_max_inflight = getUShort(db.data);
+		} else {
+			log_fatal("invalid ddns-zone-concurrency");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options,
+			   SV_DDNS_SERVER_CONCURRENCY);
+	if ((oc != NULL) &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 2) {
+			ddns_server_max_inflight = getUShort(db.data);
+		} else {
+			log_fatal("invalid ddns-server-concurrency");
+		}
+		data_string_forget(&db, MDL);
+	}
+
 	/* Don't init DNS client if update style is none. This avoids
 	 * listening ports that aren't needed.  We don't use ddns-udpates
 	 * as that has multiple levels of scope. */
@@ -1400,6 +1435,52 @@ void postconf_initialization (int quiet)
 		server_id_check = 1;
 	}
 
+	oc = lookup_option(&server_universe, options, SV_LOG_HASH_STATISTICS);
+	if (oc != NULL) {
+		log_hash_statistics =
+			evaluate_boolean_option_cache(NULL, NULL, NULL, NULL,
+						      options, NULL,
+						      &global_scope, oc, MDL);
+	}
+
+#if defined (ENABLE_EXECUTE)
+	oc = lookup_option(&server_universe, options, SV_EXECUTE_CONCURRENCY);
+	if ((oc != NULL) &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 2) {
+			execute_max_running = getUShort(db.data);
+		} else {
+			log_fatal("invalid execute-concurrency");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_EXECUTE_QUEUE_DEPTH);
+	if ((oc != NULL) &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			execute_max_queued = getULong(db.data);
+		} else {
+			log_fatal("invalid execute-queue-depth");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_EXECUTE_TIMEOUT);
+	if ((oc != NULL) &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			execute_timeout = getULong(db.data);
+		} else {
+			log_fatal("invalid execute-timeout");
+		}
+		data_string_forget(&db, MDL);
+	}
+#endif
+
 #ifdef DHCPv6
 	oc = lookup_option(&server_universe, options, SV_PREFIX_LEN_MODE);
 	if ((oc != NULL) &&
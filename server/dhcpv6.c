@@ -7725,11 +7725,170 @@ log_packet_in(const struct packet *packet) {
 	data_string_forget(&s, MDL);
 }
 
+static void
+send_reply6(struct interface_info *interface, const struct iaddr *client_addr,
+	    struct sockaddr_in6 *to_addr, const struct data_string *reply) {
+	int send_ret;
+
+	log_info("Sending %s to %s port %d",
+		 dhcpv6_type_names[reply->data[0]],
+		 piaddr(*client_addr),
+		 ntohs(to_addr->sin6_port));
+
+	send_ret = send_packet6(interface, reply->data, reply->len, to_addr);
+	if (send_ret != reply->len) {
+		log_error("dhcpv6: send_packet6() sent %d of %d bytes",
+			  send_ret, reply->len);
+	}
+}
+
+#if defined(DELAYED_ACK)
+/*
+ * Replies that follow a change to the lease file are held until the
+ * file has been committed, like delayed DHCPACKs in dhcp.c and under
+ * the same delayed-ack and max-ack-delay limits, so that a client is
+ * never told about a binding that isn't yet on stable storage.
+ */
+struct reply6_queue {
+	struct reply6_queue *next;
+	struct interface_info *interface;
+	struct iaddr client_addr;
+	struct sockaddr_in6 to_addr;
+	struct data_string reply;
+};
+
+static struct reply6_queue *reply6_head, *reply6_tail;
+static struct reply6_queue *free_reply6_queue;
+static int outstanding_replies6;
+static struct timeval max_fsync6;
+
+/* Send the replies for a committed queue, given its head. */
+static void
+delayed_replies6_send(void *head) {
+	struct reply6_queue *q, *n;
+
+	for (q = head; q != NULL; q = n) {
+		n = q->next;
+
+		send_reply6(q->interface, &q->client_addr, &q->to_addr,
+			    &q->reply);
+
+		data_string_forget(&q->reply, MDL);
+		interface_dereference(&q->interface, MDL);
+		q->next = free_reply6_queue;
+		free_reply6_queue = q;
+	}
+}
+
+static void
+delayed_replies6_timer(void *foo) {
+	struct reply6_queue *q;
+
+	memset(&max_fsync6, 0, sizeof(max_fsync6));
+
+	if (outstanding_replies6 == 0)
+		return;
+
+	q = reply6_head;
+	reply6_head = NULL;
+	reply6_tail = NULL;
+	outstanding_replies6 = 0;
+
+#if defined (ASYNC_LEASE_WRITER)
+	commit_leases_async(delayed_replies6_send, q);
+#else
+	commit_leases();
+	delayed_replies6_send(q);
+#endif
+}
+
+void
+delayed_reply6_enqueue(struct packet *packet, struct sockaddr_in6 *to_addr,
+		       struct data_string *reply) {
+	struct reply6_queue *q;
+	struct timeval next_fsync;
+
+	if (free_reply6_queue != NULL) {
+		q = free_reply6_queue;
+		free_reply6_queue = q->next;
+	} else {
+		q = dmalloc(sizeof(*q), MDL);
+		if (q == NULL)
+			log_fatal("delayed_reply6_enqueue: no memory!");
+	}
+	memset(q, 0, sizeof(*q));
+	interface_reference(&q->interface, packet->interface, MDL);
+	q->client_addr = packet->client_addr;
+	q->to_addr = *to_addr;
+	data_string_copy(&q->reply, reply, MDL);
+
+	/* Append, so replies go out in the order they were built. */
+	if (reply6_tail != NULL)
+		reply6_tail->next = q;
+	else
+		reply6_head = q;
+	reply6_tail = q;
+
+	outstanding_replies6++;
+	if (outstanding_replies6 > max_outstanding_acks) {
+		cancel_timeout(delayed_replies6_timer, NULL);
+		delayed_replies6_timer(NULL);
+		return;
+	}
+
+	if (max_fsync6.tv_sec == 0 && max_fsync6.tv_usec == 0) {
+		/* set the maximum time we'll wait */
+		max_fsync6.tv_sec = cur_tv.tv_sec + max_ack_delay_secs;
+		max_fsync6.tv_usec = cur_tv.tv_usec + max_ack_delay_usecs;
+		if (max_fsync6.tv_usec >= 1000000) {
+			max_fsync6.tv_sec++;
+			max_fsync6.tv_usec -= 1000000;
+		}
+	}
+
+	next_fsync.tv_sec = cur_tv.tv_sec;
+	next_fsync.tv_usec = cur_tv.tv_usec + min_ack_delay_usecs;
+	if (next_fsync.tv_usec >= 1000000) {
+		next_fsync.tv_sec++;
+		next_fsync.tv_usec -= 1000000;
+	}
+	/* but not more than the max */
+	if ((next_fsync.tv_sec > max_fsync6.tv_sec) ||
+	    ((next_fsync.tv_sec == max_fsync6.tv_sec) &&
+	     (next_fsync.tv_usec > max_fsync6.tv_usec))) {
+		next_fsync = max_fsync6;
+	}
+
+	add_timeout(&next_fsync, delayed_replies6_timer, NULL,
+		    (tvref_t) NULL, (tvunref_t) NULL);
+}
+
+#if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+void
+relinquish_reply6_queue(void) {
+	struct reply6_queue *q, *n;
+
+	for (q = reply6_head; q != NULL; q = n) {
+		n = q->next;
+		data_string_forget(&q->reply, MDL);
+		interface_dereference(&q->interface, MDL);
+		dfree(q, MDL);
+	}
+	for (q = free_reply6_queue; q != NULL; q = n) {
+		n = q->next;
+		dfree(q, MDL);
+	}
+}
+#endif
+#endif /* DELAYED_ACK */
+
 void
 dhcpv6(struct packet *packet) {
 	struct data_string reply;
 	struct sockaddr_in6 to_addr;
-	int send_ret;
+#if defined(DELAYED_ACK)
+	u_int32_t writes = ia_write_count;
+#endif
 
 	/*
 	 * Log a message that we received this packet.
@@ -7777,17 +7936,17 @@ dhcpv6(struct packet *packet) {
 		memcpy(&to_addr.sin6_addr, packet->client_addr.iabuf,
 		       sizeof(to_addr.sin6_addr));
 
-		log_info("Sending %s to %s port %d",
-			 dhcpv6_type_names[reply.data[0]],
-			 piaddr(packet->client_addr),
-			 ntohs(to_addr.sin6_port));
-
-		send_ret = send_packet6(packet->interface,
-					reply.data, reply.len, &to_addr);
-		if (send_ret != reply.len) {
-			log_error("dhcpv6: send_packet6() sent %d of %d bytes",
-				  send_ret, reply.len);
-		}
+#if defined(DELAYED_ACK)
+		/*
+		 * If building the reply wrote to the lease file, hold it
+		 * until the write has been committed.
+		 */
+		if (ia_write_count != writes)
+			delayed_reply6_enqueue(packet, &to_addr, &reply);
+		else
+#endif
+			send_reply6(packet->interface, &packet->client_addr,
+				    &to_addr, &reply);
 		data_string_forget(&reply, MDL);
 	}
 }
@@ -32,8 +32,10 @@
 
 #if defined (FAILOVER_PROTOCOL)
 dhcp_failover_state_t *failover_states;
-static isc_result_t do_a_failover_option (omapi_object_t *,
-					  dhcp_failover_link_t *);
+static isc_result_t do_a_failover_option (failover_message_t *,
+					  u_int8_t *, unsigned, unsigned *);
+static isc_result_t dhcp_failover_link_read (dhcp_failover_link_t *,
+					     omapi_object_t *);
 dhcp_failover_listener_t *failover_listeners;
 
 static isc_result_t failover_message_reference (failover_message_t **,
@@ -42,10 +44,19 @@ static isc_result_t failover_message_reference (failover_message_t **,
 static isc_result_t failover_message_dereference (failover_message_t **,
 						  const char *file, int line);
 
+static void dhcp_failover_reset_window (dhcp_failover_state_t *);
 static void dhcp_failover_pool_balance(dhcp_failover_state_t *state);
 static void dhcp_failover_pool_reqbalance(dhcp_failover_state_t *state);
+static void dhcp_failover_pool_balance_start(dhcp_failover_state_t *state,
+					     int flags);
+static void dhcp_failover_pool_balance_next(dhcp_failover_state_t *state);
+static int dhcp_failover_pool_lts(dhcp_failover_state_t *state,
+				  struct pool *p, LEASE_STRUCT_PTR *lq,
+				  binding_state_t *peer_lease_state,
+				  int *thresh, int *hold);
+static void dhcp_failover_pool_balance_done(dhcp_failover_state_t *state);
 static int dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
-					isc_boolean_t *sendreq);
+					int *budget, int *queued);
 static inline int secondary_not_hoarding(dhcp_failover_state_t *state,
 					 struct pool *p);
 static void scrub_lease(struct lease* lease, const char *file, int line);
@@ -310,10 +321,8 @@ isc_result_t dhcp_failover_link_signal (omapi_object_t *h,
 {
 	isc_result_t status;
 	dhcp_failover_link_t *link;
-	omapi_object_t *c;
-	dhcp_failover_state_t *s, *state = (dhcp_failover_state_t *)0;
-	char *sname;
-	int slen;
+	omapi_object_t *c = (omapi_object_t *)0;
+	dhcp_failover_state_t *state = (dhcp_failover_state_t *)0;
 	struct timeval tv;
 
 	if (h -> type != dhcp_type_failover_link) {
@@ -415,7 +424,27 @@ isc_result_t dhcp_failover_link_signal (omapi_object_t *h,
 
 	if (!h -> outer || h -> outer -> type != omapi_type_connection)
 		return DHCP_R_INVALIDARG;
-	c = h -> outer;
+	omapi_object_reference (&c, h -> outer, MDL);
+
+	/* Whatever we send in reply to the messages read here, such as
+	   acks and the updates they make room for, goes out in one
+	   write once they have all been processed. */
+	omapi_connection_cork (c);
+	status = dhcp_failover_link_read (link, c);
+	omapi_connection_uncork (c);
+	omapi_object_dereference (&c, MDL);
+	return status;
+}
+
+/* Read and process the messages in the input buffer of a link. */
+
+static isc_result_t dhcp_failover_link_read (dhcp_failover_link_t *link,
+					     omapi_object_t *c)
+{
+	isc_result_t status;
+	dhcp_failover_state_t *s, *state = (dhcp_failover_state_t *)0;
+	char *sname;
+	int slen;
 
 	/* We get here because we requested that we be woken up after
            some number of bytes were read, and that number of bytes
@@ -428,7 +457,22 @@ isc_result_t dhcp_failover_link_signal (omapi_object_t *h,
 	      case dhcp_flink_message_length_wait:
 	      next_message:
 		link -> state = dhcp_flink_message_wait;
-		link -> imsg = dmalloc (sizeof (failover_message_t), MDL);
+		/* Get the length: */
+		omapi_connection_get_uint16 (c, &link -> imsg_len);
+		link -> imsg_count = 0;	/* Bytes read. */
+
+		/* Ensure the message is of valid length. */
+		if (link->imsg_len < DHCP_FAILOVER_MIN_MESSAGE_SIZE ||
+		    link->imsg_len > DHCP_FAILOVER_MAX_MESSAGE_SIZE) {
+			status = ISC_R_UNEXPECTED;
+			goto dhcp_flink_fail;
+		}
+
+		/* The message is read into space at the end of the
+		   failover_message structure, and the options that
+		   aren't decoded into the structure are left there. */
+		link -> imsg = dmalloc (sizeof (failover_message_t) +
+					link -> imsg_len - 2U, MDL);
 		if (!link -> imsg) {
 			status = ISC_R_NOMEMORY;
 		      dhcp_flink_fail:
@@ -446,77 +490,22 @@ isc_result_t dhcp_failover_link_signal (omapi_object_t *h,
 		}
 		memset (link -> imsg, 0, sizeof (failover_message_t));
 		link -> imsg -> refcnt = 1;
-		/* Get the length: */
-		omapi_connection_get_uint16 (c, &link -> imsg_len);
-		link -> imsg_count = 0;	/* Bytes read. */
-
-		/* Ensure the message is of valid length. */
-		if (link->imsg_len < DHCP_FAILOVER_MIN_MESSAGE_SIZE ||
-		    link->imsg_len > DHCP_FAILOVER_MAX_MESSAGE_SIZE) {
-			status = ISC_R_UNEXPECTED;
-			goto dhcp_flink_fail;
-		}
 
 		if ((omapi_connection_require (c, link -> imsg_len - 2U)) !=
 		    ISC_R_SUCCESS)
 			break;
 	      case dhcp_flink_message_wait:
 		/* Read in the message.  At this point we have the
-		   entire message in the input buffer.  For each
-		   incoming value ID, set a bit in the bitmask
-		   indicating that we've gotten it.  Maybe flag an
-		   error message if the bit is already set.  Once
-		   we're done reading, we can check the bitmask to
-		   make sure that the required fields for each message
-		   have been included. */
-
-		link -> imsg_count += 2;	/* Count the length as read. */
-
-		/* Get message type. */
-		omapi_connection_copyout (&link -> imsg -> type, c, 1);
-		link -> imsg_count++;
-
-		/* Get message payload offset. */
-		omapi_connection_copyout (&link -> imsg_payoff, c, 1);
-		link -> imsg_count++;
-
-		/* Get message time. */
-		omapi_connection_get_uint32 (c, &link -> imsg -> time);
-		link -> imsg_count += 4;
-
-		/* Get transaction ID. */
-		omapi_connection_get_uint32 (c, &link -> imsg -> xid);
-		link -> imsg_count += 4;
-
-#if defined (DEBUG_FAILOVER_MESSAGES)
-# if !defined(DEBUG_FAILOVER_CONTACT_MESSAGES)
-		if (link->imsg->type == FTM_CONTACT)
-			goto skip_contact;
-# endif
-		log_info ("link: message %s  payoff %d  time %ld  xid %ld",
-			  dhcp_failover_message_name (link -> imsg -> type),
-			  link -> imsg_payoff,
-			  (unsigned long)link -> imsg -> time,
-			  (unsigned long)link -> imsg -> xid);
-# if !defined(DEBUG_FAILOVER_CONTACT_MESSAGES)
-	      skip_contact:
-# endif
-#endif
-		/* Skip over any portions of the message header that we
-		   don't understand. */
-		if (link -> imsg_payoff - link -> imsg_count) {
-			omapi_connection_copyout ((unsigned char *)0, c,
-						  (link -> imsg_payoff -
-						   link -> imsg_count));
-			link -> imsg_count = link -> imsg_payoff;
-		}
-
-		/* Now start sucking options off the wire. */
-		while (link -> imsg_count < link -> imsg_len) {
-			status = do_a_failover_option (c, link);
-			if (status != ISC_R_SUCCESS)
-				goto dhcp_flink_fail;
-		}
+		   entire message in the input buffer, so take it out
+		   in one go and decode it where it lies. */
+		omapi_connection_copyout ((unsigned char *)(link -> imsg + 1),
+					  c, link -> imsg_len - 2U);
+		status = dhcp_failover_parse_message
+			(link -> imsg, (u_int8_t *)(link -> imsg + 1),
+			 link -> imsg_len - 2U);
+		link -> imsg_count = link -> imsg_len;
+		if (status != ISC_R_SUCCESS)
+			goto dhcp_flink_fail;
 
 		/* If it's a connect message, try to associate it with
 		   a state object. */
@@ -642,46 +631,107 @@ isc_result_t dhcp_failover_link_signal (omapi_object_t *h,
 	return ISC_R_SUCCESS;
 }
 
-static isc_result_t do_a_failover_option (c, link)
-	omapi_object_t *c;
-	dhcp_failover_link_t *link;
+/* Decode a failover message, without its two-byte length, from buf.
+   For each incoming value ID, set a bit in the bitmask indicating that
+   we've gotten it.   Once we're done reading, we can check the bitmask
+   to make sure that the required fields for each message have been
+   included.   Fixed-size values are decoded into msg; variable-length
+   ones are left in buf, which must last as long as msg does. */
+
+isc_result_t dhcp_failover_parse_message (failover_message_t *msg,
+					  u_int8_t *buf, unsigned len)
+{
+	unsigned payoff, offset;
+	isc_result_t status;
+
+	if (len + 2 < DHCP_FAILOVER_MIN_MESSAGE_SIZE) {
+		log_error ("FAILOVER: message too short.");
+		return DHCP_R_PROTOCOLERROR;
+	}
+
+	/* Message type, payload offset, time and transaction ID.   The
+	   payload offset counts the length, which isn't in buf. */
+	msg -> type = buf [0];
+	payoff = buf [1];
+	msg -> time = getULong (&buf [2]);
+	msg -> xid = getULong (&buf [6]);
+
+#if defined (DEBUG_FAILOVER_MESSAGES)
+# if !defined(DEBUG_FAILOVER_CONTACT_MESSAGES)
+	if (msg->type == FTM_CONTACT)
+		goto skip_contact;
+# endif
+	log_info ("link: message %s  payoff %d  time %ld  xid %ld",
+		  dhcp_failover_message_name (msg -> type), payoff,
+		  (unsigned long)msg -> time, (unsigned long)msg -> xid);
+# if !defined(DEBUG_FAILOVER_CONTACT_MESSAGES)
+      skip_contact:
+# endif
+#endif
+	/* Skip over any portions of the message header that we
+	   don't understand. */
+	if (payoff < DHCP_FAILOVER_MIN_MESSAGE_SIZE || payoff > len + 2) {
+		log_error ("FAILOVER: bad payload offset %d.", payoff);
+		return DHCP_R_PROTOCOLERROR;
+	}
+
+	/* Now pick the options out of the payload. */
+	offset = payoff - 2;
+	while (offset < len) {
+		status = do_a_failover_option (msg, buf, len, &offset);
+		if (status != ISC_R_SUCCESS)
+			return status;
+	}
+	return ISC_R_SUCCESS;
+}
+
+static isc_result_t do_a_failover_option (msg, buf, len, offset)
+	failover_message_t *msg;
+	u_int8_t *buf;
+	unsigned len;
+	unsigned *offset;
 {
 	u_int16_t option_code;
 	u_int16_t option_len;
+	u_int8_t *data;
 	unsigned char *op;
 	unsigned op_size;
 	unsigned op_count;
 	int i;
 
-	if (link -> imsg_count + 2 > link -> imsg_len) {
+	if (*offset + 2 > len) {
 		log_error ("FAILOVER: message overflow at option code.");
 		return DHCP_R_PROTOCOLERROR;
 	}
 
-	if (link->imsg->type > FTM_MAX) {
+	if (msg->type > FTM_MAX) {
 		log_error ("FAILOVER: invalid message type: %d",
-			   link->imsg->type);
+			   msg->type);
 		return DHCP_R_PROTOCOLERROR;
 	}
 
 	/* Get option code. */
-	omapi_connection_get_uint16 (c, &option_code);
-	link -> imsg_count += 2;
+	option_code = getUShort (&buf [*offset]);
+	*offset += 2;
 
-	if (link -> imsg_count + 2 > link -> imsg_len) {
+	if (*offset + 2 > len) {
 		log_error ("FAILOVER: message overflow at length.");
 		return DHCP_R_PROTOCOLERROR;
 	}
 
 	/* Get option length. */
-	omapi_connection_get_uint16 (c, &option_len);
-	link -> imsg_count += 2;
+	option_len = getUShort (&buf [*offset]);
+	*offset += 2;
 
-	if (link -> imsg_count + option_len > link -> imsg_len) {
+	if (*offset + option_len > len) {
 		log_error ("FAILOVER: message overflow at data.");
 		return DHCP_R_PROTOCOLERROR;
 	}
 
+	/* Whatever happens, the option's data gets used up. */
+	data = &buf [*offset];
+	*offset += option_len;
+
 	/* If it's an unknown code, skip over it. */
 	if ((option_code > FTO_MAX) ||
 	    (ft_options[option_code].type == FT_UNDEF)) {
@@ -691,15 +741,12 @@ static isc_result_t do_a_failover_option (c, link)
 			   dhcp_failover_option_name (option_code),
 			   option_len);
 #endif
-		omapi_connection_copyout ((unsigned char *)0, c, option_len);
-		link -> imsg_count += option_len;
 		return ISC_R_SUCCESS;
 	}
 
 	/* If it's the digest, do it now. */
 	if (ft_options [option_code].type == FT_DIGEST) {
-		link -> imsg_count += option_len;
-		if (link -> imsg_count != link -> imsg_len) {
+		if (*offset != len) {
 			log_error ("FAILOVER: digest not at end of message");
 			return DHCP_R_PROTOCOLERROR;
 		}
@@ -708,12 +755,11 @@ static isc_result_t do_a_failover_option (c, link)
 			   ft_options [option_code].name, option_len);
 #endif
 		/* For now, just dump it. */
-		omapi_connection_copyout ((unsigned char *)0, c, option_len);
 		return ISC_R_SUCCESS;
 	}
 
 	/* Only accept an option once. */
-	if (link -> imsg -> options_present & ft_options [option_code].bit) {
+	if (msg -> options_present & ft_options [option_code].bit) {
 		log_error ("FAILOVER: duplicate option %s",
 			   ft_options [option_code].name);
 		return DHCP_R_PROTOCOLERROR;
@@ -726,10 +772,8 @@ static isc_result_t do_a_failover_option (c, link)
 	   value of an option we don't have any way to use, which allows
 	   us to make the failover_message structure smaller. */
 	if (ft_options [option_code].bit &&
-	    !(fto_allowed [link -> imsg -> type] &
+	    !(fto_allowed [msg -> type] &
 	      ft_options [option_code].bit)) {
-		omapi_connection_copyout ((unsigned char *)0, c, option_len);
-		link -> imsg_count += option_len;
 		return ISC_R_SUCCESS;
 	}
 
@@ -737,10 +781,10 @@ static isc_result_t do_a_failover_option (c, link)
 	   to store them. */
 	if (ft_options [option_code].num_present) {
 		/* If this option takes a fixed number of elements,
-		   we expect the space for them to be preallocated,
-		   and we can just read the data in. */
+		   there's space for them in the message structure, and
+		   we can just decode the data into it. */
 
-		op = ((unsigned char *)link -> imsg) +
+		op = ((unsigned char *)msg) +
 			ft_options [option_code].offset;
 		op_size = ft_sizes [ft_options [option_code].type];
 		op_count = ft_options [option_code].num_present;
@@ -765,31 +809,22 @@ static isc_result_t do_a_failover_option (c, link)
 		    ft_options [option_code].type == FT_DDNS1) {
 			ddns_fqdn_t *ddns =
 				((ddns_fqdn_t *)
-				 (((char *)link -> imsg) +
+				 (((char *)msg) +
 				  ft_options [option_code].offset));
 
 			op_count = (ft_options [option_code].type == FT_DDNS1
 				    ? 1 : 2);
+			if (option_len < op_count) {
+				log_error ("FAILOVER: option %s too short",
+					   ft_options [option_code].name);
+				return DHCP_R_PROTOCOLERROR;
+			}
 
-			omapi_connection_copyout (&ddns -> codes [0],
-						  c, op_count);
-			link -> imsg_count += op_count;
+			memcpy (&ddns -> codes [0], data, op_count);
 			if (op_count == 1)
 				ddns -> codes [1] = 0;
-			op_size = 1;
-			op_count = option_len - op_count;
-
-			ddns -> length = op_count;
-			ddns -> data = dmalloc (op_count, MDL);
-			if (!ddns -> data) {
-				log_error ("FAILOVER: no memory getting%s(%d)",
-					   " DNS data ", op_count);
-
-				/* Actually, NO_MEMORY, but if we lose here
-				   we have to drop the connection. */
-				return DHCP_R_PROTOCOLERROR;
-			}
-			omapi_connection_copyout (ddns -> data, c, op_count);
+			ddns -> length = option_len - op_count;
+			ddns -> data = data + op_count;
 			goto out;
 		}
 
@@ -811,25 +846,21 @@ static isc_result_t do_a_failover_option (c, link)
 		op_count = option_len / op_size;
 
 		fo = ((failover_option_t *)
-		      (((char *)link -> imsg) +
+		      (((char *)msg) +
 		       ft_options [option_code].offset));
 
+		/* The data stays where it is, in the message buffer,
+		   byte-swapped in place if need be. */
 		fo -> count = op_count;
-		fo -> data = dmalloc (option_len, MDL);
-		if (!fo -> data) {
-			log_error ("FAILOVER: no memory getting %s (%d)",
-				   "option data", op_count);
-
-			return DHCP_R_PROTOCOLERROR;
-		}
-		op = fo -> data;
+		fo -> data = data;
+		op = data;
 	}
 
 	/* For single-byte message values and multi-byte values that
-           don't need swapping, just read them in all at once. */
+           don't need swapping, just copy them. */
 	if (op_size == 1 || ft_options [option_code].type == FT_IPADDR) {
-		omapi_connection_copyout ((unsigned char *)op, c, option_len);
-		link -> imsg_count += option_len;
+		if (op != data)
+			memcpy (op, data, option_len);
 
 		/*
 		 * As of 3.1.0, many option codes were changed to conform to
@@ -853,7 +884,7 @@ static isc_result_t do_a_failover_option (c, link)
 		 * live with a weird warning.
 		 */
 		if ((option_code == 11) && (option_len > 9) &&
-		    (strncmp((const char *)op, "isc-V3.0.", 9) == 0)) {
+		    (strncmp((const char *)data, "isc-V3.0.", 9) == 0)) {
 		        log_error("WARNING: failover as of versions 3.1.0 and "
 				  "on are not reverse compatible with "
 				  "versions 3.0.x.");
@@ -862,21 +893,24 @@ static isc_result_t do_a_failover_option (c, link)
 		goto out;
 	}
 
-	/* For values that require swapping, read them in one at a time
-	   using routines that swap bytes. */
+	/* For values that require swapping, swap them one at a time. */
 	for (i = 0; i < op_count; i++) {
 		switch (ft_options [option_code].type) {
-		      case FT_UINT32:
-			omapi_connection_get_uint32 (c, (u_int32_t *)op);
+		      case FT_UINT32: {
+			u_int32_t v = getULong (data);
+			memcpy (op, &v, 4);
 			op += 4;
-			link -> imsg_count += 4;
+			data += 4;
 			break;
+		      }
 
-		      case FT_UINT16:
-			omapi_connection_get_uint16 (c, (u_int16_t *)op);
+		      case FT_UINT16: {
+			u_int16_t v = getUShort (data);
+			memcpy (op, &v, 2);
 			op += 2;
-			link -> imsg_count += 2;
+			data += 2;
 			break;
+		      }
 
 		      default:
 			/* Everything else should have been handled
@@ -889,7 +923,7 @@ static isc_result_t do_a_failover_option (c, link)
 	}
       out:
 	/* Remember that we got this option. */
-	link -> imsg -> options_present |= ft_options [option_code].bit;
+	msg -> options_present |= ft_options [option_code].bit;
 	return ISC_R_SUCCESS;
 }
 
@@ -1356,6 +1390,7 @@ isc_result_t dhcp_failover_state_signal (omapi_object_t *o,
 			if (link -> imsg -> options_present & FTB_MAX_UNACKED)
 				state -> partner.max_flying_updates =
 					link -> imsg -> max_unacked;
+			dhcp_failover_reset_window (state);
 			if (link -> imsg -> options_present & FTB_RECEIVE_TIMER)
 				state -> partner.max_response_delay =
 					link -> imsg -> receive_timer;
@@ -1439,6 +1474,7 @@ isc_result_t dhcp_failover_state_signal (omapi_object_t *o,
 		    if (link -> imsg -> options_present & FTB_MAX_UNACKED)
 			    state -> partner.max_flying_updates =
 				    link -> imsg -> max_unacked;
+		    dhcp_failover_reset_window (state);
 		    if (link -> imsg -> options_present & FTB_RECEIVE_TIMER)
 			    state -> partner.max_response_delay =
 				    link -> imsg -> receive_timer;
@@ -1907,7 +1943,7 @@ isc_result_t dhcp_failover_set_state (dhcp_failover_state_t *state,
 	     * which also schedules the next pool rebalance.
 	     */
 	    dhcp_failover_pool_balance(state);
-	    dhcp_failover_generate_update_queue(state, 0);
+	    dhcp_failover_generate_update_queue(state, 0, 0);
 
 	    if (state->update_queue_tail != NULL) {
 		dhcp_failover_send_updates(state);
@@ -1961,9 +1997,10 @@ isc_result_t dhcp_failover_set_state (dhcp_failover_state_t *state,
 	    break;
 
 	  case recover:
-	    /* XXX: We're supposed to calculate if updreq or updreqall is
-	     * needed.  In theory, we should only have to updreqall if we
-	     * are positive we lost our stable storage.
+	    /* We're supposed to calculate if updreq or updreqall is
+	     * needed.  The updreqall carries our checkpoint of the peer's
+	     * changes, so unless we lost our stable storage the peer only
+	     * sends what we haven't got.
 	     */
 	    if (state -> link_to_peer)
 		    dhcp_failover_send_update_request_all (state);
@@ -2440,6 +2477,18 @@ isc_result_t dhcp_failover_peer_state_changed (dhcp_failover_state_t *state,
 	return ISC_R_SUCCESS;
 }
 
+/*
+ * Pool rebalancing gives leases to the peer a slice at a time, so that a
+ * large pool doesn't hold up packet processing.  A slice looks at no more
+ * than DHCP_FAILOVER_BALANCE_SLICE leases and then, if there is more to
+ * do, schedules the next one to run after the dispatcher has had a turn.
+ * The pool being balanced and the next lease to look at in it are kept in
+ * the failover state.  How far out of balance a pool is comes from its
+ * free and backup lease counts, which supersede_lease() and
+ * lease_enqueue() keep current, so it is simply worked out again each
+ * time a slice resumes.
+ */
+
 /*
  * Balance operation manual entry; startup, entrance to normal state.  No
  * sense sending a POOLREQ at this stage; the peer is likely about to schedule
@@ -2452,7 +2501,7 @@ dhcp_failover_pool_balance(dhcp_failover_state_t *state)
 	cancel_timeout(dhcp_failover_pool_rebalance, state);
 	state->sched_balance = 0;
 
-	dhcp_failover_pool_dobalance(state, NULL);
+	dhcp_failover_pool_balance_start(state, 0);
 }
 
 /*
@@ -2464,236 +2513,416 @@ void
 dhcp_failover_pool_rebalance(void *failover_state)
 {
 	dhcp_failover_state_t *state;
-	isc_boolean_t sendreq = ISC_FALSE;
 
 	state = (dhcp_failover_state_t *)failover_state;
 
 	/* Clear scheduled event indicator. */
 	state->sched_balance = 0;
 
-	if (dhcp_failover_pool_dobalance(state, &sendreq))
-		dhcp_failover_send_updates(state);
-
-	if (sendreq)
-		dhcp_failover_send_poolreq(state);
+	dhcp_failover_pool_balance_start(state, DHCP_FAILOVER_BALANCE_POOLREQ);
 }
 
 /*
  * Balance operation entry from POOLREQ protocol message.  Do not permit a
- * POOLREQ to send back a POOLREQ.  Ping pong.
+ * POOLREQ to send back a POOLREQ.  Ping pong.  The POOLRESP is sent when
+ * the balance is done.
  */
 static void
 dhcp_failover_pool_reqbalance(dhcp_failover_state_t *state)
 {
-	int queued;
-
 	/* Cancel pending event. */
 	cancel_timeout(dhcp_failover_pool_rebalance, state);
 	state->sched_balance = 0;
 
-	queued = dhcp_failover_pool_dobalance(state, NULL);
+	dhcp_failover_pool_balance_start(state,
+					 DHCP_FAILOVER_BALANCE_POOLRESP);
+}
 
-	dhcp_failover_send_poolresp(state, queued);
+/*
+ * Start balancing the pools, or if a balance is already under way, have
+ * it also do what flags asks for when it is done: send a POOLREQ if one
+ * is needed (DHCP_FAILOVER_BALANCE_POOLREQ) or answer the peer's POOLREQ
+ * (DHCP_FAILOVER_BALANCE_POOLRESP).
+ */
+static void
+dhcp_failover_pool_balance_start(dhcp_failover_state_t *state, int flags)
+{
+	state->balance_flags |= flags;
+	if (state->balance_pool != NULL)
+		return;
 
-	if (queued)
-		dhcp_failover_send_updates(state);
-	else
-		log_info("peer %s: Got POOLREQ, answering negatively!  "
-			 "Peer may be out of leases or database inconsistent.",
-			 state->name);
+	state->balance_sendreq = ISC_FALSE;
+	state->balance_queued = 0;
+	state->balance_slices = 0;
+	state->balance_busy = 0;
+	state->balance_slice_max = 0;
+
+	if (state->me.state != normal) {
+		dhcp_failover_pool_balance_done(state);
+		return;
+	}
+
+	state->last_balance = cur_time;
+	dhcp_failover_pool_balance_next(state);
+	dhcp_failover_pool_balance_slice(state);
 }
 
 /*
- * Do the meat of the work common to all forms of pool rebalance.  If the
- * caller deems it appropriate to transmit POOLREQ messages, it can use the
- * sendreq pointer to pass in the address of a FALSE value which this function
- * will conditionally turn TRUE if a POOLREQ is determined to be necessary.
- * A NULL value may be passed, in which case no action is taken.
+ * Move on to the next pool that has state as its failover peer, if there
+ * is one, and log how out of balance it is.
  */
-static int
-dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
-			    isc_boolean_t *sendreq)
+static void
+dhcp_failover_pool_balance_next(dhcp_failover_state_t *state)
 {
-	int lts, total, thresh, hold, panic, pass;
-	int leases_queued = 0;
-	struct lease *lp = NULL;
-	struct lease *next = NULL;
-	struct lease *ltemp = NULL;
 	struct shared_network *s;
 	struct pool *p;
 	binding_state_t peer_lease_state;
-	/* binding_state_t my_lease_state; */
-        /* XXX Why is this my_lease_state never used? */
 	LEASE_STRUCT_PTR lq;
-	int (*log_func)(const char *, ...);
-	const char *result, *reqlog;
+	int lts, thresh, hold, panic;
+	const char *reqlog;
 
-	if (state -> me.state != normal)
-		return 0;
+	if (state->balance_pool != NULL) {
+		s = state->balance_pool->shared_network;
+		p = state->balance_pool->next;
+		pool_dereference(&state->balance_pool, MDL);
+	} else {
+		s = shared_networks;
+		p = s ? s->pools : NULL;
+	}
+	if (state->balance_next != NULL)
+		lease_dereference(&state->balance_next, MDL);
 
-	state->last_balance = cur_time;
+	for (;;) {
+		while (p != NULL && p->failover_peer != state)
+			p = p->next;
+		if (p != NULL || s == NULL || (s = s->next) == NULL)
+			break;
+		p = s->pools;
+	}
+	if (p == NULL)
+		return;
 
-	for (s = shared_networks ; s ; s = s->next) {
-	    for (p = s->pools ; p ; p = p->next) {
-		if (p->failover_peer != state)
-		    continue;
+	pool_reference(&state->balance_pool, p, MDL);
+	state->balance_pass = 0;
 
-		/* Right now we're giving the peer half of the free leases.
-		   If we have more leases than the peer (i.e., more than
-		   half), then the number of leases we have, less the number
-		   of leases the peer has, will be how many more leases we
-		   have than the peer has.   So if we send half that number
-		   to the peer, we should be even. */
-		if (p->failover_peer->i_am == primary) {
-			lts = (p->free_leases - p->backup_leases) / 2;
-			peer_lease_state = FTS_BACKUP;
-			/* my_lease_state = FTS_FREE; */
-			lq = &p->free;
-		} else {
-			lts = (p->backup_leases - p->free_leases) / 2;
-			peer_lease_state = FTS_FREE;
-			/* my_lease_state = FTS_BACKUP; */
-			lq = &p->backup;
+	lts = dhcp_failover_pool_lts(state, p, &lq, &peer_lease_state,
+				     &thresh, &hold);
+	if (LEASE_GET_FIRSTP(lq) != NULL)
+		lease_reference(&state->balance_next, LEASE_GET_FIRSTP(lq),
+				MDL);
+
+	/*
+	 * If we need leases (so lts is negative) more than negative
+	 * double the thresh%, panic and send poolreq to hopefully wake
+	 * up the peer (but more likely the db is inconsistent).  But,
+	 * if this comes out zero, switch to -1 so that the POOLREQ is
+	 * sent on lts == -2 rather than right away at -1.
+	 *
+	 * Note that we do not subtract -1 from panic all the time
+	 * because thresh% and hold% may come out to the same number,
+	 * and that is correct operation...where thresh% and hold% are
+	 * both -1, we want to send poolreq when lts reaches -3.  So,
+	 * "-3 < -2", lts < panic.
+	 */
+	panic = thresh * -2;
+
+	if (panic == 0)
+		panic = -1;
+
+	if ((state->balance_flags & DHCP_FAILOVER_BALANCE_POOLREQ) &&
+	    (lts < panic)) {
+		reqlog = "  (requesting peer rebalance!)";
+		state->balance_sendreq = ISC_TRUE;
+	} else
+		reqlog = "";
+
+	log_info("balancing pool %lx %s  total %d  free %d  "
+		 "backup %d  lts %d  max-own (+/-)%d%s",
+		 (unsigned long)p,
+		 (p->shared_network ?
+		  p->shared_network->name : ""), p->lease_count,
+		 p->free_leases, p->backup_leases, lts, hold,
+		 reqlog);
+}
+
+/*
+ * How many leases we should give the peer to even up pool p (negative if
+ * it should give us some), along with the queue to give them from, the
+ * state to give them in, and the misbalance and ownership thresholds.
+ */
+static int
+dhcp_failover_pool_lts(dhcp_failover_state_t *state, struct pool *p,
+		       LEASE_STRUCT_PTR *lq, binding_state_t *peer_lease_state,
+		       int *thresh, int *hold)
+{
+	int lts, total;
+
+	/* Right now we're giving the peer half of the free leases.
+	   If we have more leases than the peer (i.e., more than
+	   half), then the number of leases we have, less the number
+	   of leases the peer has, will be how many more leases we
+	   have than the peer has.   So if we send half that number
+	   to the peer, we should be even. */
+	if (state->i_am == primary) {
+		lts = (p->free_leases - p->backup_leases) / 2;
+		*peer_lease_state = FTS_BACKUP;
+		*lq = &p->free;
+	} else {
+		lts = (p->backup_leases - p->free_leases) / 2;
+		*peer_lease_state = FTS_FREE;
+		*lq = &p->backup;
+	}
+
+	total = p->backup_leases + p->free_leases;
+
+	*thresh = ((total * state->max_lease_misbalance) + 50) / 100;
+	*hold = ((total * state->max_lease_ownership) + 50) / 100;
+
+	return lts;
+}
+
+/*
+ * Run one slice of a pool balance, and schedule the next if there is
+ * more to do.
+ */
+void
+dhcp_failover_pool_balance_slice(void *vs)
+{
+	dhcp_failover_state_t *state = vs;
+	int budget = DHCP_FAILOVER_BALANCE_SLICE;
+	int queued = 0;
+	struct timeval start, end, tv;
+	u_int32_t usec;
+
+	gettimeofday(&start, NULL);
+
+	while (state->balance_pool != NULL) {
+		/* Only balance in the normal state; stop if we've left it. */
+		if (state->me.state != normal) {
+			pool_dereference(&state->balance_pool, MDL);
+			if (state->balance_next != NULL)
+				lease_dereference(&state->balance_next, MDL);
+			break;
 		}
+		if (!dhcp_failover_pool_dobalance(state, &budget, &queued))
+			break;
+		dhcp_failover_pool_balance_next(state);
+	}
 
-		total = p->backup_leases + p->free_leases;
+	if (queued) {
+		commit_leases();
+		dhcp_failover_send_updates(state);
+	}
 
-		thresh = ((total * state->max_lease_misbalance) + 50) / 100;
-		hold = ((total * state->max_lease_ownership) + 50) / 100;
+	gettimeofday(&end, NULL);
+	usec = (end.tv_sec - start.tv_sec) * 1000000 +
+		(end.tv_usec - start.tv_usec);
+	state->balance_slices++;
+	state->balance_busy += usec;
+	if (usec > state->balance_slice_max)
+		state->balance_slice_max = usec;
+
+	if (state->balance_pool != NULL) {
+		/* Run again once the dispatcher has had a turn; not at the
+		   time it is now, or this would run again straight away. */
+		tv = cur_tv;
+		if (++tv.tv_usec >= 1000000) {
+			tv.tv_sec++;
+			tv.tv_usec = 0;
+		}
+		add_timeout(&tv, dhcp_failover_pool_balance_slice, state,
+			    (tvref_t)dhcp_failover_state_reference,
+			    (tvunref_t)dhcp_failover_state_dereference);
+		return;
+	}
 
-		/*
-		 * If we need leases (so lts is negative) more than negative
-		 * double the thresh%, panic and send poolreq to hopefully wake
-		 * up the peer (but more likely the db is inconsistent).  But,
-		 * if this comes out zero, switch to -1 so that the POOLREQ is
-		 * sent on lts == -2 rather than right away at -1.
-		 *
-		 * Note that we do not subtract -1 from panic all the time
-		 * because thresh% and hold% may come out to the same number,
-		 * and that is correct operation...where thresh% and hold% are
-		 * both -1, we want to send poolreq when lts reaches -3.  So,
-		 * "-3 < -2", lts < panic.
-		 */
-		panic = thresh * -2;
+	/* Done; keep the figures for this pass until the next is done. */
+	state->balance_time = state->balance_busy;
+	state->balance_time_slices = state->balance_slices;
+	state->balance_time_slice_max = state->balance_slice_max;
+	state->balance_moved = state->balance_queued;
+	if (state->balance_slices > 1)
+		log_info("failover peer %s: balanced pools in %u slices, "
+			 "%u.%06u seconds, longest %u.%06u", state->name,
+			 state->balance_slices,
+			 state->balance_busy / 1000000,
+			 state->balance_busy % 1000000,
+			 state->balance_slice_max / 1000000,
+			 state->balance_slice_max % 1000000);
+
+	dhcp_failover_pool_balance_done(state);
+}
 
-		if (panic == 0)
-			panic = -1;
+/*
+ * A balance is over: do what was asked for at the end of it.
+ */
+static void
+dhcp_failover_pool_balance_done(dhcp_failover_state_t *state)
+{
+	int flags;
 
-		if ((sendreq != NULL) && (lts < panic)) {
-			reqlog = "  (requesting peer rebalance!)";
-			*sendreq = ISC_TRUE;
-		} else
-			reqlog = "";
-
-		log_info("balancing pool %lx %s  total %d  free %d  "
-			 "backup %d  lts %d  max-own (+/-)%d%s",
-			 (unsigned long)p,
-			 (p->shared_network ?
-			  p->shared_network->name : ""), p->lease_count,
-			 p->free_leases, p->backup_leases, lts, hold,
-			 reqlog);
-
-		/* In the first pass, try to allocate leases to the
-		 * peer which it would normally be responsible for (if
-		 * the lease has a hardware address or client-identifier,
-		 * and the load-balance-algorithm chooses the peer to
-		 * answer that address), up to a hold% excess in the peer's
-		 * favor.  In the second pass, just send the oldest (first
-		 * on the list) leases up to a hold% excess in our favor.
-		 *
-		 * This could make for additional pool rebalance
-		 * events, but preserving MAC possession should be
-		 * worth it.
-		 */
-		pass = 0;
-		lease_reference(&lp, LEASE_GET_FIRSTP(lq), MDL);
+	flags = state->balance_flags;
+	state->balance_flags = 0;
 
-		while (lp) {
-			if (next)
-			    lease_dereference(&next, MDL);
-			ltemp = LEASE_GET_NEXTP(lq, lp);
-			if (ltemp != NULL)
-			    lease_reference(&next, ltemp, MDL);
+	if (flags & DHCP_FAILOVER_BALANCE_POOLRESP) {
+		dhcp_failover_send_poolresp(state, state->balance_queued);
+		if (!state->balance_queued)
+			log_info("peer %s: Got POOLREQ, answering negatively!  "
+				 "Peer may be out of leases or database "
+				 "inconsistent.", state->name);
+	}
 
-			/*
-			 * Stop if the pool is 'balanced enough.'
-			 *
-			 * The pool is balanced enough if:
-			 *
-			 * 1) We're on the first run through and the peer has
-			 *    its fair share of leases already (lts reaches
-			 *    -hold).
-			 * 2) We're on the second run through, we are shifting
-			 *    never-used leases, and there is a perfectly even
-			 *    balance (lts reaches zero).
-			 * 3) Second run through, we are shifting previously
-			 *    used leases, and the local system has its fair
-			 *    share but no more (lts reaches hold).
-			 *
-			 * Note that this is implemented below in 3,2,1 order.
-			 */
-			if (pass) {
-				if (lp->ends) {
-					if (lts <= hold)
-						break;
-				} else {
-					if (lts <= 0)
-						break;
-				}
-			} else if (lts <= -hold)
-				break;
+	if ((flags & DHCP_FAILOVER_BALANCE_POOLREQ) && state->balance_sendreq)
+		dhcp_failover_send_poolreq(state);
+}
 
-			if (pass || peer_wants_lease(lp)) {
-			    --lts;
-			    ++leases_queued;
-			    lp->next_binding_state = peer_lease_state;
-			    lp->tstp = cur_time;
-			    lp->starts = cur_time;
-
-			    scrub_lease(lp, MDL);
-			    if (!supersede_lease(lp, NULL, 0, 1, 0, 0) ||
-			        !write_lease(lp))
-			    	    log_error("can't commit lease %s on "
-					      "giveaway", piaddr(lp->ip_addr));
-			}
+/*
+ * Do the meat of the work common to all forms of pool rebalance: give
+ * leases in the pool being balanced to the peer, starting from the next
+ * lease to look at, until the pool is balanced enough or *budget leases
+ * have been looked at.  Returns 1 if the pool is done, or 0 if it should
+ * be picked up again in the next slice.  *queued counts the leases given
+ * away.
+ */
+static int
+dhcp_failover_pool_dobalance(dhcp_failover_state_t *state,
+			    int *budget, int *queued)
+{
+	int lts, thresh, hold;
+	struct lease *lp = NULL;
+	struct lease *next = NULL;
+	struct lease *ltemp = NULL;
+	struct pool *p = state->balance_pool;
+	binding_state_t peer_lease_state, my_lease_state;
+	LEASE_STRUCT_PTR lq;
+	int (*log_func)(const char *, ...);
+	const char *result;
+
+	lts = dhcp_failover_pool_lts(state, p, &lq, &peer_lease_state,
+				     &thresh, &hold);
+	my_lease_state = (state->i_am == primary) ? FTS_FREE : FTS_BACKUP;
+
+	/* The lease to resume from may have left the queue since the last
+	 * slice; if so, go back to the start of it.
+	 */
+	if (state->balance_next != NULL) {
+		lease_reference(&lp, state->balance_next, MDL);
+		lease_dereference(&state->balance_next, MDL);
+		if (lp->pool != p || lp->binding_state != my_lease_state ||
+		    (lp->flags & RESERVED_LEASE)) {
+			lease_dereference(&lp, MDL);
+			if (LEASE_GET_FIRSTP(lq) != NULL)
+				lease_reference(&lp, LEASE_GET_FIRSTP(lq),
+						MDL);
+		}
+	}
 
+	/* In the first pass, try to allocate leases to the
+	 * peer which it would normally be responsible for (if
+	 * the lease has a hardware address or client-identifier,
+	 * and the load-balance-algorithm chooses the peer to
+	 * answer that address), up to a hold% excess in the peer's
+	 * favor.  In the second pass, just send the oldest (first
+	 * on the list) leases up to a hold% excess in our favor.
+	 *
+	 * This could make for additional pool rebalance
+	 * events, but preserving MAC possession should be
+	 * worth it.
+	 */
+	while (lp) {
+		/* Out of time for this slice; carry on from here. */
+		if (*budget <= 0) {
+			lease_reference(&state->balance_next, lp, MDL);
 			lease_dereference(&lp, MDL);
 			if (next)
-				lease_reference(&lp, next, MDL);
-			else if (!pass) {
-				pass = 1;
-				lease_reference(&lp, LEASE_GET_FIRSTP(lq), MDL);
-			}
+				lease_dereference(&next, MDL);
+			return 0;
 		}
+		--*budget;
 
 		if (next)
-			lease_dereference(&next, MDL);
-		if (lp)
-			lease_dereference(&lp, MDL);
+		    lease_dereference(&next, MDL);
+		ltemp = LEASE_GET_NEXTP(lq, lp);
+		if (ltemp != NULL)
+		    lease_reference(&next, ltemp, MDL);
 
-		if (lts > thresh) {
-			result = "IMBALANCED";
-			log_func = log_error;
-		} else {
-			result = "balanced";
-			log_func = log_info;
+		/*
+		 * Stop if the pool is 'balanced enough.'
+		 *
+		 * The pool is balanced enough if:
+		 *
+		 * 1) We're on the first run through and the peer has
+		 *    its fair share of leases already (lts reaches
+		 *    -hold).
+		 * 2) We're on the second run through, we are shifting
+		 *    never-used leases, and there is a perfectly even
+		 *    balance (lts reaches zero).
+		 * 3) Second run through, we are shifting previously
+		 *    used leases, and the local system has its fair
+		 *    share but no more (lts reaches hold).
+		 *
+		 * Note that this is implemented below in 3,2,1 order.
+		 */
+		if (state->balance_pass) {
+			if (lp->ends) {
+				if (lts <= hold)
+					break;
+			} else {
+				if (lts <= 0)
+					break;
+			}
+		} else if (lts <= -hold)
+			break;
+
+		if (state->balance_pass || peer_wants_lease(lp)) {
+		    --lts;
+		    ++*queued;
+		    ++state->balance_queued;
+		    lp->next_binding_state = peer_lease_state;
+		    lp->tstp = cur_time;
+		    lp->starts = cur_time;
+
+		    scrub_lease(lp, MDL);
+		    if (!supersede_lease(lp, NULL, 0, 1, 0, 0) ||
+		        !write_lease(lp))
+		    	    log_error("can't commit lease %s on "
+				      "giveaway", piaddr(lp->ip_addr));
 		}
 
-		log_func("%s pool %lx %s  total %d  free %d  backup %d  "
-			 "lts %d  max-misbal %d", result, (unsigned long)p,
-			 (p->shared_network ?
-			  p->shared_network->name : ""), p->lease_count,
-			 p->free_leases, p->backup_leases, lts, thresh);
+		lease_dereference(&lp, MDL);
+		if (next)
+			lease_reference(&lp, next, MDL);
+		else if (!state->balance_pass) {
+			state->balance_pass = 1;
+			if (LEASE_GET_FIRSTP(lq) != NULL)
+				lease_reference(&lp, LEASE_GET_FIRSTP(lq),
+						MDL);
+		}
+	}
 
-		/* Recalculate next rebalance event timer. */
-		dhcp_failover_pool_check(p);
-	    }
+	if (next)
+		lease_dereference(&next, MDL);
+	if (lp)
+		lease_dereference(&lp, MDL);
+
+	if (lts > thresh) {
+		result = "IMBALANCED";
+		log_func = log_error;
+	} else {
+		result = "balanced";
+		log_func = log_info;
 	}
 
-	if (leases_queued)
-		commit_leases();
+	log_func("%s pool %lx %s  total %d  free %d  backup %d  "
+		 "lts %d  max-misbal %d", result, (unsigned long)p,
+		 (p->shared_network ?
+		  p->shared_network->name : ""), p->lease_count,
+		 p->free_leases, p->backup_leases, lts, thresh);
+
+	/* Recalculate next rebalance event timer. */
+	dhcp_failover_pool_check(p);
 
-	return leases_queued;
+	return 1;
 }
 
 /* dhcp_failover_pool_check: Called whenever FREE or BACKUP leases change
@@ -2809,23 +3038,140 @@ int dhcp_failover_state_pool_check (dhcp_failover_state_t *state)
 	return 0;
 }
 
+/* The number of updates we may have unacked.  The peer tells us the
+   most it will take; within that the window is cut back when updates
+   take much longer to be acked than the fastest ones have, which means
+   they are queueing up at the peer, and opened up again an update at a
+   time while acks come back promptly.  It is never cut below half of
+   what we told the peer we might send, as that is how many acks the
+   peer collects before sending them without waiting for a timer. */
+
+u_int32_t dhcp_failover_update_window (dhcp_failover_state_t *state)
+{
+	u_int32_t floor, ceiling = state -> partner.max_flying_updates;
+
+	floor = (state -> me.max_flying_updates + 1) / 2;
+	if (floor > ceiling)
+		floor = ceiling;
+
+	if (state -> update_window == 0 || state -> update_window > ceiling)
+		return ceiling;
+	if (state -> update_window < floor)
+		return floor;
+	return state -> update_window;
+}
+
+/* Forget what we measured about the last peer, when a new connection
+   to it comes up. */
+
+static void dhcp_failover_reset_window (dhcp_failover_state_t *state)
+{
+	state -> update_window = 0;
+	state -> rtt_xid = 0;
+	state -> rtt = state -> rtt_min = 0;
+}
+
+/* The update being timed has been acked: fold its round trip time into
+   the estimate and adjust the window. */
+
+void dhcp_failover_update_rtt (dhcp_failover_state_t *state)
+{
+	u_int32_t window;
+	long usec;
+
+	state -> rtt_xid = 0;
+	usec = ((cur_tv.tv_sec - state -> rtt_sent.tv_sec) * 1000000L +
+		(cur_tv.tv_usec - state -> rtt_sent.tv_usec));
+	/* The clock was stepped. */
+	if (usec < 0 || usec > 100000000L)
+		return;
+	if (usec == 0)
+		usec = 1;
+
+	if (state -> rtt_min == 0 || usec < state -> rtt_min)
+		state -> rtt_min = usec;
+	if (state -> rtt == 0)
+		state -> rtt = usec;
+	else
+		state -> rtt = state -> rtt - state -> rtt / 8 + usec / 8;
+
+	window = dhcp_failover_update_window (state);
+	if (state -> rtt > 2 * state -> rtt_min &&
+	    state -> rtt - state -> rtt_min > 10000)
+		window -= window / 4;
+	else
+		window++;
+	state -> update_window = window;
+}
+
+/* Count an acked update towards the rate reported in the failover-state
+   object. */
+
+static void dhcp_failover_count_ack (dhcp_failover_state_t *state)
+{
+	state -> updates_acked++;
+	if (state -> rate_time != cur_time) {
+		if (state -> rate_time + 1 == cur_time)
+			state -> rate_last = state -> rate_count;
+		else
+			state -> rate_last = 0;
+		state -> rate_time = cur_time;
+		state -> rate_count = 0;
+	}
+	state -> rate_count++;
+}
+
+/* The number of leases waiting to be sent to the peer. */
+
+static u_int32_t dhcp_failover_queue_depth (dhcp_failover_state_t *state)
+{
+	struct lease *lp;
+	u_int32_t depth = 0;
+
+	for (lp = state -> update_queue_head; lp; lp = lp -> next_pending)
+		depth++;
+	return depth;
+}
+
+/* Updates acked in the last full second. */
+
+static u_int32_t dhcp_failover_update_rate (dhcp_failover_state_t *state)
+{
+	if (state -> rate_time == cur_time)
+		return state -> rate_last;
+	if (state -> rate_time + 1 == cur_time)
+		return state -> rate_count;
+	return 0;
+}
+
 isc_result_t dhcp_failover_send_updates (dhcp_failover_state_t *state)
 {
 	struct lease *lp = (struct lease *)0;
-	isc_result_t status;
+	omapi_object_t *c = (omapi_object_t *)0;
+	isc_result_t status = ISC_R_SUCCESS;
+	u_int32_t window;
 
 	/* Can't update peer if we're not talking to it! */
 	if (!state -> link_to_peer)
 		return ISC_R_SUCCESS;
 
+	/* Send the acks and all the updates we can in one write. */
+	if (state -> link_to_peer -> outer &&
+	    state -> link_to_peer -> outer -> type == omapi_type_connection) {
+		omapi_object_reference (&c, state -> link_to_peer -> outer,
+					MDL);
+		omapi_connection_cork (c);
+	}
+
 	/* If there are acks pending, transmit them prior to potentially
 	 * sending new updates for the same lease.
 	 */
 	if (state->toack_queue_head != NULL)
 		dhcp_failover_send_acks(state);
 
-	while ((state -> partner.max_flying_updates >
-		state -> cur_unacked_updates) && state -> update_queue_head) {
+	window = dhcp_failover_update_window (state);
+	while ((window > state -> cur_unacked_updates) &&
+	       state -> update_queue_head) {
 		/* Grab the head of the update queue. */
 		lease_reference (&lp, state -> update_queue_head, MDL);
 
@@ -2833,9 +3179,16 @@ isc_result_t dhcp_failover_send_updates (dhcp_failover_state_t *state)
 		status = dhcp_failover_send_bind_update (state, lp);
 		if (status != ISC_R_SUCCESS) {
 			lease_dereference (&lp, MDL);
-			return status;
+			break;
 		}
 		lp -> flags &= ~ON_UPDATE_QUEUE;
+		state -> updates_sent++;
+
+		/* Time one update at a time. */
+		if (state -> rtt_xid == 0) {
+			state -> rtt_xid = lp -> last_xid;
+			state -> rtt_sent = cur_tv;
+		}
 
 		/* Take it off the head of the update queue and put the next
 		   item in the update queue at the head. */
@@ -2869,7 +3222,83 @@ isc_result_t dhcp_failover_send_updates (dhcp_failover_state_t *state)
 		/* Count the object as an unacked update. */
 		state -> cur_unacked_updates++;
 	}
-	return ISC_R_SUCCESS;
+
+	if (c) {
+		omapi_connection_uncork (c);
+		omapi_object_dereference (&c, MDL);
+	}
+	return status;
+}
+
+/* Number a change to a lease in one of state's pools.  Each lease
+   carries the number of its last change, and a peer that has stored and
+   acked our numbers up to some checkpoint only needs the leases changed
+   after it (and any it hasn't acked) to catch up.  The numbers never go
+   back, even across a restart that lost the lease file, because they are
+   seeded from the clock.  Should they ever run out, numbering starts
+   again from the clock, and checkpoints from before that are of no use. */
+
+isc_uint64_t dhcp_failover_next_sequence (dhcp_failover_state_t *state)
+{
+	isc_uint64_t floor = (isc_uint64_t)cur_time << 24;
+
+	if (floor == 0)
+		floor = 1;
+	if (state -> sequence == ~(isc_uint64_t)0) {
+		state -> sequence = floor;
+		state -> sequence_start = floor;
+	} else if (state -> sequence < floor)
+		state -> sequence = floor;
+	else
+		state -> sequence++;
+	if (state -> sequence_start == 0)
+		state -> sequence_start = state -> sequence;
+	return state -> sequence;
+}
+
+/* Make the vendor-specific-options option carrying a sequence number,
+   or skip it if there isn't one to send.  Peers that don't know it
+   discard it. */
+
+static failover_option_t *
+dhcp_failover_sequence_option (isc_uint64_t seq,
+			       char *obuf, unsigned *obufix, unsigned obufmax)
+{
+	u_int8_t buf [14];
+
+	if (!seq)
+		return &skip_failover_option;
+
+	putULong (buf, FTV_ISC_ENTERPRISE);
+	buf [4] = FTV_SEQUENCE;
+	buf [5] = 8;
+	putULong (&buf [6], (u_int32_t)(seq >> 32));
+	putULong (&buf [10], (u_int32_t)seq);
+	return dhcp_failover_make_option (FTO_VENDOR_OPTIONS,
+					  obuf, obufix, obufmax,
+					  sizeof buf, buf);
+}
+
+/* The sequence number in a message, or zero if it hasn't got one. */
+
+static isc_uint64_t
+dhcp_failover_message_sequence (failover_message_t *msg)
+{
+	const u_int8_t *p, *end;
+
+	if (!(msg -> options_present & FTB_VENDOR_OPTIONS))
+		return 0;
+
+	p = msg -> vendor_options.data;
+	end = p + msg -> vendor_options.count;
+	while (end - p >= 6 && end - p >= 6 + p [5]) {
+		if (getULong (p) == FTV_ISC_ENTERPRISE &&
+		    p [4] == FTV_SEQUENCE && p [5] == 8)
+			return (((isc_uint64_t)getULong (&p [6]) << 32) |
+				getULong (&p [10]));
+		p += 6 + p [5];
+	}
+	return 0;
 }
 
 /* Queue an update for a lease.   Always returns 1 at this point - it's
@@ -2921,11 +3350,36 @@ int dhcp_failover_queue_update (struct lease *lease, int immediate)
 int dhcp_failover_send_acks (dhcp_failover_state_t *state)
 {
 	failover_message_t *msg = (failover_message_t *)0;
+	omapi_object_t *c = (omapi_object_t *)0;
+	isc_uint64_t seq, checkpoint = state -> partner_sequence;
+
+	/* Once these are acked we have the partner's changes up to the
+	   highest sequence number among them, apart from any it still has
+	   unacked; record that with the leases. */
+	for (msg = state -> toack_queue_head; msg; msg = msg -> next) {
+		seq = dhcp_failover_message_sequence (msg);
+		if (seq > checkpoint)
+			checkpoint = seq;
+	}
+	msg = (failover_message_t *)0;
+	if (checkpoint != state -> partner_sequence) {
+		state -> partner_sequence = checkpoint;
+		if (!write_failover_state (state))
+			return 0;
+	}
 
 	/* Must commit all leases prior to acking them. */
 	if (!commit_leases ())
 		return 0;
 
+	/* Send the acks in one write. */
+	if (state -> link_to_peer && state -> link_to_peer -> outer &&
+	    state -> link_to_peer -> outer -> type == omapi_type_connection) {
+		omapi_object_reference (&c, state -> link_to_peer -> outer,
+					MDL);
+		omapi_connection_cork (c);
+	}
+
 	while (state -> toack_queue_head) {
 		failover_message_reference
 			(&msg, state -> toack_queue_head, MDL);
@@ -2936,7 +3390,10 @@ int dhcp_failover_send_acks (dhcp_failover_state_t *state)
 				(&state -> toack_queue_head, msg -> next, MDL);
 		}
 
-		dhcp_failover_send_bind_ack (state, msg, 0, (const char *)0);
+		if (dhcp_failover_send_bind_ack (state, msg, 0,
+						 (const char *)0) ==
+		    ISC_R_SUCCESS)
+			state -> acks_sent++;
 
 		failover_message_dereference (&msg, MDL);
 	}
@@ -2945,6 +3402,11 @@ int dhcp_failover_send_acks (dhcp_failover_state_t *state)
 		failover_message_dereference (&state -> toack_queue_tail, MDL);
 	state -> pending_acks = 0;
 
+	if (c) {
+		omapi_connection_uncork (c);
+		omapi_object_dereference (&c, MDL);
+	}
+
 	return 1;
 }
 
@@ -3044,6 +3506,9 @@ void dhcp_failover_ack_queue_remove (dhcp_failover_state_t *state,
 	}
 
 	lease -> flags &= ~ON_ACK_QUEUE;
+	/* An update that won't be acked can't be timed. */
+	if (lease->last_xid == state->rtt_xid)
+		state->rtt_xid = 0;
 	/* Multiple acks on one XID is an error and may cause badness. */
 	lease->last_xid = 0;
 	/* XXX: this violates draft-failover.  We can't send another
@@ -3118,6 +3583,32 @@ isc_result_t dhcp_failover_state_set_value (omapi_object_t *h,
 		return ISC_R_SUCCESS;
 	} else if (!omapi_ds_strcmp (name, "cur-unacked-updates")) {
 		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "update-queue-depth")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "update-window")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "update-rtt")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "update-rtt-min")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "updates-sent")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "updates-acked")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "updates-per-second")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "acks-sent")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "balance-time")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "balance-slices")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "balance-slice-max")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "balance-leases")) {
+		return ISC_R_SUCCESS;
+	} else if (!omapi_ds_strcmp (name, "load-balance-prefiltered")) {
+		return ISC_R_SUCCESS;
 	}
 
 	if (h -> inner && h -> inner -> type -> set_value)
@@ -3316,6 +3807,47 @@ isc_result_t dhcp_failover_state_get_value (omapi_object_t *h,
 	} else if (!omapi_ds_strcmp (name, "cur-unacked-updates")) {
 		return omapi_make_int_value (value, name,
 					     s -> cur_unacked_updates, MDL);
+	} else if (!omapi_ds_strcmp (name, "update-queue-depth")) {
+		return omapi_make_uint_value (value, name,
+					      dhcp_failover_queue_depth (s),
+					      MDL);
+	} else if (!omapi_ds_strcmp (name, "update-window")) {
+		return omapi_make_uint_value (value, name,
+					      dhcp_failover_update_window (s),
+					      MDL);
+	} else if (!omapi_ds_strcmp (name, "update-rtt")) {
+		return omapi_make_uint_value (value, name, s -> rtt, MDL);
+	} else if (!omapi_ds_strcmp (name, "update-rtt-min")) {
+		return omapi_make_uint_value (value, name, s -> rtt_min, MDL);
+	} else if (!omapi_ds_strcmp (name, "updates-sent")) {
+		return omapi_make_uint_value (value, name,
+					      s -> updates_sent, MDL);
+	} else if (!omapi_ds_strcmp (name, "updates-acked")) {
+		return omapi_make_uint_value (value, name,
+					      s -> updates_acked, MDL);
+	} else if (!omapi_ds_strcmp (name, "updates-per-second")) {
+		return omapi_make_uint_value (value, name,
+					      dhcp_failover_update_rate (s),
+					      MDL);
+	} else if (!omapi_ds_strcmp (name, "acks-sent")) {
+		return omapi_make_uint_value (value, name,
+					      s -> acks_sent, MDL);
+	} else if (!omapi_ds_strcmp (name, "balance-time")) {
+		return omapi_make_uint_value (value, name,
+					      s -> balance_time, MDL);
+	} else if (!omapi_ds_strcmp (name, "balance-slices")) {
+		return omapi_make_uint_value (value, name,
+					      s -> balance_time_slices, MDL);
+	} else if (!omapi_ds_strcmp (name, "balance-slice-max")) {
+		return omapi_make_uint_value (value, name,
+					      s -> balance_time_slice_max,
+					      MDL);
+	} else if (!omapi_ds_strcmp (name, "balance-leases")) {
+		return omapi_make_int_value (value, name,
+					     s -> balance_moved, MDL);
+	} else if (!omapi_ds_strcmp (name, "load-balance-prefiltered")) {
+		return omapi_make_uint_value (value, name,
+					      s -> lb_prefiltered, MDL);
 	}
 
 	if (h -> inner && h -> inner -> type -> get_value)
@@ -3363,6 +3895,10 @@ isc_result_t dhcp_failover_state_destroy (omapi_object_t *h,
 	if (s -> toack_queue_tail)
 		failover_message_dereference (&s -> toack_queue_tail,
 					      file, line);
+	if (s -> balance_pool)
+		pool_dereference (&s -> balance_pool, file, line);
+	if (s -> balance_next)
+		lease_dereference (&s -> balance_next, file, line);
 	return ISC_R_SUCCESS;
 }
 
@@ -3584,6 +4120,68 @@ isc_result_t dhcp_failover_state_stuff (omapi_object_t *c,
 	if (status != ISC_R_SUCCESS)
 		return status;
 
+	/* Update traffic on the link. */
+	status = omapi_connection_put_named_uint32 (c, "update-queue-depth",
+						    dhcp_failover_queue_depth
+						    (s));
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "update-window",
+						    dhcp_failover_update_window
+						    (s));
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "update-rtt", s -> rtt);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "update-rtt-min",
+						    s -> rtt_min);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "updates-sent",
+						    s -> updates_sent);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "updates-acked",
+						    s -> updates_acked);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "updates-per-second",
+						    dhcp_failover_update_rate
+						    (s));
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "acks-sent",
+						    s -> acks_sent);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	/* The last pool balance. */
+	status = omapi_connection_put_named_uint32 (c, "balance-time",
+						    s -> balance_time);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "balance-slices",
+						    s -> balance_time_slices);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "balance-slice-max",
+						    s ->
+						    balance_time_slice_max);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_connection_put_named_uint32 (c, "balance-leases",
+						    (u_int32_t)
+						    s -> balance_moved);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	status = omapi_connection_put_named_uint32 (c,
+						    "load-balance-prefiltered",
+						    s -> lb_prefiltered);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
 	if (h -> inner && h -> inner -> type -> stuff_values)
 		return (*(h -> inner -> type -> stuff_values)) (c, id,
 								h -> inner);
@@ -4242,24 +4840,24 @@ failover_option_t *dhcp_failover_make_option (unsigned code,
 	return op;
 }
 
-/* Send a failover message header. */
+/* Send a failover message.  The header and options are assembled
+   in one buffer and handed to the connection in one piece. */
 
 isc_result_t dhcp_failover_put_message (dhcp_failover_link_t *link,
 					omapi_object_t *connection,
 					int msg_type, u_int32_t xid, ...)
 {
-	unsigned size = 0;
+	unsigned size = 12;
 	int bad_option = 0;
-	int opix = 0;
+	int opix = 12;
 	va_list list;
 	failover_option_t *option;
-	unsigned char *opbuf;
+	unsigned char msgbuf [DHCP_FAILOVER_MAX_MESSAGE_SIZE];
 	isc_result_t status = ISC_R_SUCCESS;
-	unsigned char cbuf;
 	struct timeval tv;
 
 	/* Run through the argument list once to compute the length of
-	   the option portion of the message. */
+	   the message. */
 	va_start (list, xid);
 	while ((option = va_arg (list, failover_option_t *))) {
 		if (option != &skip_failover_option)
@@ -4269,20 +4867,18 @@ isc_result_t dhcp_failover_put_message (dhcp_failover_link_t *link,
 	}
 	va_end (list);
 
-	/* Allocate an option buffer, unless we got an error. */
-	if (!bad_option && size) {
-		opbuf = dmalloc (size, MDL);
-		if (!opbuf)
-			status = ISC_R_NOMEMORY;
-	} else
-		opbuf = (unsigned char *)0;
+	if (size > sizeof msgbuf) {
+		log_error ("failover message type %d is %u bytes long.",
+			   msg_type, size);
+		bad_option = 1;
+	}
 
 	va_start (list, xid);
 	while ((option = va_arg (list, failover_option_t *))) {
 		if (option == &skip_failover_option)
 		    continue;
-		if (!bad_option && opbuf)
-			memcpy (&opbuf [opix],
+		if (!bad_option)
+			memcpy (&msgbuf [opix],
 				option -> data, option -> count);
 		if (option != &null_failover_option &&
 		    option != &skip_failover_option) {
@@ -4296,42 +4892,18 @@ isc_result_t dhcp_failover_put_message (dhcp_failover_link_t *link,
 	if (bad_option)
 		return DHCP_R_INVALIDARG;
 
-	/* Now send the message header. */
-
-	/* Message length. */
-	status = omapi_connection_put_uint16 (connection, size + 12);
-	if (status != ISC_R_SUCCESS)
-		goto err;
-
-	/* Message type. */
-	cbuf = msg_type;
-	status = omapi_connection_copyin (connection, &cbuf, 1);
-	if (status != ISC_R_SUCCESS)
-		goto err;
-
-	/* Payload offset. */
-	cbuf = 12;
-	status = omapi_connection_copyin (connection, &cbuf, 1);
-	if (status != ISC_R_SUCCESS)
-		goto err;
+	/* Now fill in the message header: the message length, type and
+	   payload offset, the current time and the transaction ID. */
+	putUShort (&msgbuf [0], size);
+	msgbuf [2] = msg_type;
+	msgbuf [3] = 12;
+	putULong (&msgbuf [4], (u_int32_t)cur_time);
+	putULong (&msgbuf [8], xid);
 
-	/* Current time. */
-	status = omapi_connection_put_uint32 (connection, (u_int32_t)cur_time);
+	status = omapi_connection_copyin (connection, msgbuf, size);
 	if (status != ISC_R_SUCCESS)
 		goto err;
 
-	/* Transaction ID. */
-	status = omapi_connection_put_uint32(connection, xid);
-	if (status != ISC_R_SUCCESS)
-		goto err;
-
-	/* Payload. */
-	if (opbuf) {
-		status = omapi_connection_copyin (connection, opbuf, size);
-		if (status != ISC_R_SUCCESS)
-			goto err;
-		dfree (opbuf, MDL);
-	}
 	if (link -> state_object &&
 	    link -> state_object -> link_to_peer == link) {
 #if defined (DEBUG_FAILOVER_CONTACT_TIMING)
@@ -4352,8 +4924,6 @@ isc_result_t dhcp_failover_put_message (dhcp_failover_link_t *link,
 	return status;
 
       err:
-	if (opbuf)
-		dfree (opbuf, MDL);
 	log_info ("dhcp_failover_put_message: something went wrong.");
 	omapi_disconnect (connection, 1);
 	return status;
@@ -4769,6 +5339,7 @@ isc_result_t dhcp_failover_send_bind_update (dhcp_failover_state_t *state,
 		   &skip_failover_option,	/* XXX DDNS */
 		   &skip_failover_option,	/* XXX request options */
 		   &skip_failover_option,	/* XXX reply options */
+		   dhcp_failover_sequence_option (lease -> fo_seq, FMA),
 		   (failover_option_t *)0));
 
 #if defined (DEBUG_FAILOVER_MESSAGES)
@@ -5028,8 +5599,15 @@ isc_result_t dhcp_failover_send_update_request_all (dhcp_failover_state_t
 	 * and were interrupted by something.
 	 */
 
+	/* Tell the peer how far we have its changes, so it need only send
+	 * the leases changed since.  Without a checkpoint, or to a peer that
+	 * doesn't know about them, this asks for everything.
+	 */
 	status = (dhcp_failover_put_message(link, link->outer, FTM_UPDREQALL,
-					    link->xid++, NULL));
+					    link->xid++,
+					    dhcp_failover_sequence_option
+					    (state->partner_sequence, FMA),
+					    NULL));
 
 	state->curUPD = FTM_UPDREQALL;
 
@@ -5284,31 +5862,37 @@ isc_result_t dhcp_failover_process_bind_update (dhcp_failover_state_t *state,
 			    lt->uid_len) != 0))
 			ident_changed = ISC_TRUE;
 
-		lt->uid_len = msg->client_identifier.count;
-
-		/* Allocate the lt->uid buffer if we haven't already, or
-		 * re-allocate the lt-uid buffer if we have one that is not
-		 * large enough.  Otherwise, just use the extant buffer.
+		/* The copy of the lease already has the identifier unless
+		 * it has changed.
 		 */
-		if (!lt->uid || lt->uid == lt->uid_buf ||
-		    lt->uid_len > lt->uid_max) {
-			if (lt->uid && lt->uid != lt->uid_buf)
-				dfree(lt->uid, MDL);
-
-			if (lt->uid_len > sizeof(lt->uid_buf)) {
-				lt->uid_max = lt->uid_len;
-				lt->uid = dmalloc(lt->uid_len, MDL);
-				if (!lt->uid) {
-					message = "no memory";
-					goto bad;
+		if (ident_changed) {
+			lt->uid_len = msg->client_identifier.count;
+
+			/* Allocate the lt->uid buffer if we haven't
+			 * already, or re-allocate the lt-uid buffer if we
+			 * have one that is not large enough.  Otherwise,
+			 * just use the extant buffer.
+			 */
+			if (!lt->uid || lt->uid == lt->uid_buf ||
+			    lt->uid_len > lt->uid_max) {
+				if (lt->uid && lt->uid != lt->uid_buf)
+					dfree(lt->uid, MDL);
+
+				if (lt->uid_len > sizeof(lt->uid_buf)) {
+					lt->uid_max = lt->uid_len;
+					lt->uid = dmalloc(lt->uid_len, MDL);
+					if (!lt->uid) {
+						message = "no memory";
+						goto bad;
+					}
+				} else {
+					lt->uid_max = sizeof(lt->uid_buf);
+					lt->uid = lt->uid_buf;
 				}
-			} else {
-				lt->uid_max = sizeof(lt->uid_buf);
-				lt->uid = lt->uid_buf;
 			}
+			memcpy (lt -> uid,
+				msg -> client_identifier.data, lt -> uid_len);
 		}
-		memcpy (lt -> uid,
-			msg -> client_identifier.data, lt -> uid_len);
 	} else if (lt->uid && msg->binding_status != FTS_RESET &&
 		   msg->binding_status != FTS_FREE &&
 		   msg->binding_status != FTS_BACKUP) {
@@ -5557,6 +6141,7 @@ isc_result_t dhcp_failover_process_bind_ack (dhcp_failover_state_t *state,
 			   ? (const char *)(msg -> message.data)
 			   : (dhcp_failover_reject_reason_print
 			      (msg -> reject_reason)));
+		dhcp_failover_count_ack (state);
 		goto unqueue;
 	}
 
@@ -5571,6 +6156,10 @@ isc_result_t dhcp_failover_process_bind_ack (dhcp_failover_state_t *state,
 		goto bad;
 	}
 
+	dhcp_failover_count_ack (state);
+	if (msg->xid == state->rtt_xid)
+		dhcp_failover_update_rtt (state);
+
 	/* XXX Times may need to be adjusted based on clock skew! */
 	if (msg->options_present & FTO_POTENTIAL_EXPIRY)
 		pot_expire = msg->potential_expiry;
@@ -5686,8 +6275,13 @@ isc_result_t dhcp_failover_process_bind_ack (dhcp_failover_state_t *state,
 	goto out;
 }
 
+/* Queue the leases the peer needs: everything if everythingp is set;
+   otherwise the ones it hasn't acked and the expired ones, and if since
+   is nonzero the ones changed after that sequence number. */
+
 isc_result_t dhcp_failover_generate_update_queue (dhcp_failover_state_t *state,
-						  int everythingp)
+						  int everythingp,
+						  isc_uint64_t since)
 {
 	struct shared_network *s;
 	struct pool *p;
@@ -5721,6 +6315,7 @@ isc_result_t dhcp_failover_generate_update_queue (dhcp_failover_state_t *state,
 			 l = LEASE_GET_NEXTP(lptr[i], l)) {
 			if ((l->flags & ON_QUEUE) == 0 &&
 			    (everythingp ||
+			     (since && l->fo_seq > since) ||
 			     (l->tstp > l->atsfp) ||
 			     (i == EXPIRED_LEASES))) {
 				l -> desired_binding_state = l -> binding_state;
@@ -5744,7 +6339,7 @@ dhcp_failover_process_update_request (dhcp_failover_state_t *state,
 	}
 
 	/* Generate a fresh update queue. */
-	dhcp_failover_generate_update_queue (state, 0);
+	dhcp_failover_generate_update_queue (state, 0, 0);
 
 	state->updxid = msg->xid;
 
@@ -5772,14 +6367,35 @@ isc_result_t
 dhcp_failover_process_update_request_all (dhcp_failover_state_t *state,
 					  failover_message_t *msg)
 {
+	isc_uint64_t since;
+
 	if (state->send_update_done) {
 		log_info("Received update request while old update still "
 			 "flying!  Silently discarding old request.");
 		lease_dereference(&state->send_update_done, MDL);
 	}
 
-	/* Generate a fresh update queue that includes every lease. */
-	dhcp_failover_generate_update_queue (state, 1);
+	/* If the peer has a checkpoint, it only needs what changed since.
+	   One we can't have given it means our numbering started again,
+	   and one from before the oldest change we know of may cover
+	   changes we have lost, such as with the lease file; then it gets
+	   everything. */
+	since = dhcp_failover_message_sequence (msg);
+	if (since > state -> sequence) {
+		log_info ("Update request all from %s: checkpoint %llu is "
+			  "ahead of us", state -> name,
+			  (unsigned long long)since);
+		since = 0;
+	} else if (since != 0 && since < state -> sequence_start) {
+		log_info ("Update request all from %s: checkpoint %llu is "
+			  "older than our lease data", state -> name,
+			  (unsigned long long)since);
+		since = 0;
+	}
+
+	/* Generate a fresh update queue that includes every lease, or
+	   every lease changed since the checkpoint. */
+	dhcp_failover_generate_update_queue (state, !since, since);
 
 	state->updxid = msg->xid;
 
@@ -5787,8 +6403,13 @@ dhcp_failover_process_update_request_all (dhcp_failover_state_t *state,
 		lease_reference (&state -> send_update_done,
 				 state -> update_queue_tail, MDL);
 		dhcp_failover_send_updates (state);
-		log_info ("Update request all from %s: sending update",
-			   state -> name);
+		if (since)
+			log_info ("Update request all from %s: sending "
+				  "changes since %llu", state -> name,
+				  (unsigned long long)since);
+		else
+			log_info ("Update request all from %s: sending update",
+				  state -> name);
 	} else {
 		/* This should really never happen, but it could happen
 		   on a server that currently has no leases configured. */
@@ -5955,15 +6576,15 @@ static unsigned char loadb_p_hash (const unsigned char *key, unsigned len)
         return hash;
 }
 
-int load_balance_mine (struct packet *packet, dhcp_failover_state_t *state)
+/* Returns true if the client has been trying for longer than the
+   load-balance-max-seconds configured for this peer, in which case we
+   answer it whichever of us the hash says it belongs to. */
+static int load_balance_expired (dhcp_failover_state_t *state,
+				 u_int16_t secs)
 {
-	struct option_cache *oc;
-	struct data_string ds;
-	unsigned char hbaix;
-	int hm;
 	u_int16_t ec;
 
-	ec = ntohs(packet->raw->secs);
+	ec = ntohs(secs);
 
 	/*
 	 * If desired check to see if the secs field may have been byte
@@ -5976,16 +6597,43 @@ int load_balance_mine (struct packet *packet, dhcp_failover_state_t *state)
 		ec = (ec >> 8) | (ec << 8);
 	}
 
-	if ((state->load_balance_max_secs == 0) ||
-	    (state->load_balance_max_secs < ec)) {
-		return (1);
-	}
+	return ((state->load_balance_max_secs == 0) ||
+		(state->load_balance_max_secs < ec));
+}
+
+/* Look the client's hash up in the hash bucket array. */
+static int load_balance_bucket_mine (dhcp_failover_state_t *state,
+				     const unsigned char *key, unsigned len)
+{
+	unsigned char hbaix;
+	int hm;
 
 	/* If we don't have a hash bucket array, we can't tell if this
 	   one's ours, so we assume it's not. */
 	if (!state->hba)
 		return (0);
 
+	hbaix = loadb_p_hash(key, len);
+	hm = state->hba[(hbaix >> 3) & 0x1F] & (1 << (hbaix & 0x07));
+
+	if (state->i_am == primary)
+		return (hm);
+	else
+		return (!hm);
+}
+
+int load_balance_mine (struct packet *packet, dhcp_failover_state_t *state)
+{
+	struct option_cache *oc;
+	struct data_string ds;
+	int mine;
+
+	if (load_balance_expired(state, packet->raw->secs))
+		return (1);
+
+	if (!state->hba)
+		return (0);
+
 	oc = lookup_option(&dhcp_universe, packet->options,
 			   DHO_DHCP_CLIENT_IDENTIFIER);
 	memset(&ds, 0, sizeof ds);
@@ -5993,20 +6641,133 @@ int load_balance_mine (struct packet *packet, dhcp_failover_state_t *state)
 	    evaluate_option_cache(&ds, packet, NULL, NULL,
 				  packet->options, NULL,
 				  &global_scope, oc, MDL)) {
-		hbaix = loadb_p_hash(ds.data, ds.len);
+		mine = load_balance_bucket_mine(state, ds.data, ds.len);
 
 		data_string_forget(&ds, MDL);
 	} else {
-		hbaix = loadb_p_hash(packet->raw->chaddr,
-				     packet->raw->hlen);
+		mine = load_balance_bucket_mine(state, packet->raw->chaddr,
+						packet->raw->hlen);
 	}
 
-	hm = state->hba[(hbaix >> 3) & 0x1F] & (1 << (hbaix & 0x07));
+	return (mine);
+}
 
-	if (state->i_am == primary)
-		return (hm);
-	else
-		return (!hm);
+/* Decide, from the packet as it came off the wire, whether it is a
+ * DHCPDISCOVER that dhcpdiscover() would leave to our failover peer.
+ * That is only certain for a broadcast received on a network whose
+ * pools all belong to the one peer, with no host declaration for the
+ * client and nothing in the options that could send it elsewhere; in
+ * every other case, and for anything we don't understand, we return
+ * zero and let the packet be handled normally.
+ */
+int load_balance_theirs_raw (struct interface_info *ip,
+			     const struct dhcp_packet *raw, unsigned len,
+			     dhcp_failover_state_t **statep)
+{
+	dhcp_failover_state_t *state = NULL;
+	struct pool *pool;
+	struct host_decl *hp = NULL;
+	const unsigned char *op, *end, *uid = NULL;
+	unsigned uid_len = 0;
+	int msgtype = 0;
+	int peer_has_leases = 0;
+
+	if (raw->op != BOOTREQUEST || raw->giaddr.s_addr ||
+	    raw->hlen > sizeof raw->chaddr ||
+	    len < DHCP_FIXED_NON_UDP + 4 ||
+	    memcmp(raw->options, DHCP_OPTIONS_COOKIE, 4))
+		return 0;
+
+	/* The same test find_lease() makes for peer_has_leases. */
+	if (!ip->shared_network || !ip->shared_network->pools)
+		return 0;
+	for (pool = ip->shared_network->pools; pool; pool = pool->next) {
+		if (!pool->failover_peer ||
+		    (state && pool->failover_peer != state))
+			return 0;
+		state = pool->failover_peer;
+		if ((state->i_am == primary && pool->backup_leases) ||
+		    (state->i_am == secondary && pool->free_leases))
+			peer_has_leases = 1;
+	}
+	if (state->service_state != cooperating || !peer_has_leases ||
+	    load_balance_expired(state, raw->secs))
+		return 0;
+
+	/* Find the message type and client identifier.  Anything that
+	   parse_options() would have to put back together, or that could
+	   select another network, is left to it. */
+	op = raw->options + 4;
+	end = (const unsigned char *)raw + len;
+	while (op < end && *op != DHO_END) {
+		if (*op == DHO_PAD) {
+			op++;
+			continue;
+		}
+		if (op + 2 > end || op + 2 + op[1] > end)
+			return 0;
+		switch (*op) {
+		      case DHO_DHCP_MESSAGE_TYPE:
+			if (msgtype || op[1] != 1)
+				return 0;
+			msgtype = op[2];
+			break;
+
+		      case DHO_DHCP_CLIENT_IDENTIFIER:
+			if (uid || op[1] == 0)
+				return 0;
+			uid = op + 2;
+			uid_len = op[1];
+			break;
+
+		      case DHO_DHCP_OPTION_OVERLOAD:
+		      case DHO_DHCP_AGENT_OPTIONS:
+		      case DHO_SUBNET_SELECTION:
+			return 0;
+		}
+		op += 2 + op[1];
+	}
+	if (msgtype != DHCPDISCOVER)
+		return 0;
+
+	/* A client with a host declaration may get a fixed address, which
+	   isn't load balanced. */
+	if (host_id_options_configured())
+		return 0;
+	if (uid && find_hosts_by_uid(&hp, uid, uid_len, MDL)) {
+		host_dereference(&hp, MDL);
+		return 0;
+	}
+	if (find_hosts_by_haddr(&hp, raw->htype, raw->chaddr, raw->hlen,
+				MDL)) {
+		host_dereference(&hp, MDL);
+		return 0;
+	}
+
+	*statep = state;
+	if (uid)
+		return !load_balance_bucket_mine(state, uid, uid_len);
+	return !load_balance_bucket_mine(state, raw->chaddr, raw->hlen);
+}
+
+/* The DHCPv4 packet handler when failover is compiled in.  In a load
+ * balanced pair, each server gets every broadcast DHCPDISCOVER and
+ * ignores half of them; we drop those here rather than after the
+ * packet has been parsed and classified and a lease looked up for it.
+ */
+void dhcp_failover_packet_handler (struct interface_info *interface,
+				   struct dhcp_packet *packet, unsigned len,
+				   unsigned int from_port, struct iaddr from,
+				   struct hardware *hfrom)
+{
+	dhcp_failover_state_t *state = NULL;
+
+	if (load_balance_theirs_raw(interface, packet, len, &state)) {
+		state->lb_prefiltered++;
+		return;
+	}
+
+	do_packet(interface, packet, len, from_port, from, hfrom);
 }
 
 /* The inverse of load_balance_mine ("load balance theirs").  We can't
@@ -6465,26 +7226,7 @@ static isc_result_t failover_message_dereference (failover_message_t **mp,
 		if (m -> next)
 			failover_message_dereference (&m -> next,
 						      file, line);
-		if (m -> chaddr.data)
-			dfree (m -> chaddr.data, file, line);
-		if (m -> client_identifier.data)
-			dfree (m -> client_identifier.data, file, line);
-		if (m -> hba.data)
-			dfree (m -> hba.data, file, line);
-		if (m -> message.data)
-			dfree (m -> message.data, file, line);
-		if (m -> relationship_name.data)
-			dfree (m -> relationship_name.data, file, line);
-		if (m -> reply_options.data)
-			dfree (m -> reply_options.data, file, line);
-		if (m -> request_options.data)
-			dfree (m -> request_options.data, file, line);
-		if (m -> vendor_class.data)
-			dfree (m -> vendor_class.data, file, line);
-		if (m -> vendor_options.data)
-			dfree (m -> vendor_options.data, file, line);
-		if (m -> ddns.data)
-			dfree (m -> ddns.data, file, line);
+		/* The option data is in the same allocation. */
 		dfree (*mp, file, line);
 	}
 	*mp = 0;
@@ -38,42 +38,64 @@
  * The original code use a simply linear list for each of those pools but
  * this can present performance issues if the pool is large and the lists are
  * long.
- * This code adds an array on top of the list allowing us to search the list
- * in a binary fashion instead of a linear walk.
+ * This code adds a B+tree on top of the list allowing us to find the place
+ * for a lease in logarithmic time instead of a linear walk.
  *
  * \verbatim
  * leasechain
- * +------------+    +-------+-------+-------+-------+
- * | lease list |--> | lease | lease | lease | lease |....
- * | start      |    |  ptr  |  ptr  |  ptr  |  ptr  |
- * | end        |    +-------+-------+-------+-------+
- * | max        |                |       |
- * +------------+                V       V
- *                          +-------+  +-------+
- *                          | lease |  | lease |
- *                          |       |  |       |
- *                          |  next |->|  next |->NULL
- *                   NULL<- | prev  |<-| prev  |
- *                          +-------+  +-------+
- * 
- * The linked list is maintained in an ordered state.  Inserting an entry is
- * accomplished by doing a binary search on the array to find the proper place
- * in the list and then updating the pointers in the linked list to include the
- * new entry.  The entry is added into the array by copying the remainder of 
- * the array to provide space for the new entry.
- * Removing an entry is the reverse.
- * The arrays for the queues will be pre-allocated but not all of them will be
- * large enough to hold all of the leases.  If additional space is required the
- * array will be grown.
+ * +------------+    +-----+-----+-----+
+ * | root       |--> | key | key | key |            interior nodes
+ * | nelem      |    | ptr | ptr | ptr |
+ * +------------+    +-----+-----+-----+
+ *                      |     |     |
+ *                      V     V     V
+ *                   +-----+-----+-----+-----+
+ *                   | key | key | key | key |....   leaf nodes
+ *                   +-----+-----+-----+-----+
+ *                      |     |
+ *                      V     V
+ *                  +-------+  +-------+
+ *                  | lease |  | lease |
+ *                  |       |  |       |
+ *                  |  next |->|  next |->NULL
+ *           NULL<- | prev  |<-| prev  |
+ *                  +-------+  +-------+
+ *
+ * The linked list is maintained in an ordered state.  Each key holds a
+ * copy of a lease's sort_time and sort_tiebreaker, so searching a node
+ * doesn't touch the leases themselves, along with the lease pointer, which
+ * breaks any remaining ties so that every key is unique.  Interior nodes
+ * hold the smallest key of each of their children.  Inserting an entry is
+ * accomplished by searching the tree for the lease that will precede it,
+ * linking the new entry into the list after that lease and adding its key
+ * to a leaf, splitting full nodes on the way back up.  Removing an entry
+ * is the reverse: nodes that fall below a quarter full are merged with
+ * or refilled from a neighbour.  A node is wide enough that a tree for a
+ * few million leases is only four levels deep, and no change moves more
+ * than a node's worth of keys.
  */
 
 #include "dhcpd.h"
 
 #if defined (BINARY_LEASES)
-/* Default number number of lease pointers to add to the leasechain array
- * everytime it grows beyond the current size
+/* The number of keys in a node, and the fewest a node other than the
+ * root may be left with before it is merged or refilled.
  */
-#define LC_GROWTH_DELTA 256
+#define LC_NODE_SIZE 64
+#define LC_NODE_MIN (LC_NODE_SIZE / 4)
+
+struct lc_key {
+	TIME sort_time;
+	long int sort_tiebreaker;
+	struct lease *lease;
+};
+
+struct lc_node {
+	int leaf;
+	int count;
+	struct lc_key key[LC_NODE_SIZE];
+	struct lc_node **child;	/* LC_NODE_SIZE entries, NULL in leaves */
+};
 
 /*!
  *
@@ -103,16 +125,20 @@ lc_not_empty( struct leasechain *lc ) {
  */
 struct lease *
 lc_get_first_lease(struct leasechain *lc) {
+	struct lc_node *node;
+
 #if defined (DEBUG_BINARY_LEASES)
 	log_debug("LC Get first %s:%d", MDL);
 	INSIST(lc != NULL);
-	INSIST(lc->total >= lc->nelem);
 #endif
 
-	if (lc->nelem > 0) {
-		return (lc->list)[0];
+	if ((node = lc->root) == NULL) {
+		return (NULL);
 	}
-	return (NULL);
+	while (!node->leaf) {
+		node = node->child[0];
+	}
+	return (node->key[0].lease);
 }
 
 /*!
@@ -137,301 +163,332 @@ lc_get_next(struct leasechain *lc, struct lease *lp) {
 
 /*!
  *
- * \brief Find the best position for inserting a lease
+ * \brief Get the last lease from a leasechain
  *
- * Given a potential range of the array to insert the lease into this routine
- * will recursively examine the range to find the proper place in which to
- * insert the lease.
- * 
- * \param lc The leasechain to add the lease to
- * \param lp The lease to insert
- * \param min The minium index of the potential range for insertion
- * \param max The maximum index of the potential range for insertion
+ * \param lc The leasechain to check
  *
- * \return The index of the array entry to insert the lease
+ * \return A pointer to the last lease in the chain, or NULL if it is empty
  */
-size_t 
-lc_binary_search_insert_point(struct leasechain *lc,
-			      struct lease *lp,
-			      size_t min, size_t max)
-{
-	size_t mid_index = ((max - min)/2) + min;
-
-	if ((lc->list[mid_index]->sort_time > lp->sort_time) ||
-	    ((lc->list[mid_index]->sort_time == lp->sort_time) &&
-	     (lc->list[mid_index]->sort_tiebreaker > lp->sort_tiebreaker))) {
-		if (mid_index == min) {
-			/* insert in the min position, as sort_time is larger */
-			return (min);
-		}
-		/* try again with lower half of list */
-		return (lc_binary_search_insert_point(lc, lp,
-						      min, mid_index - 1));
-	} else  if ((lc->list[mid_index]->sort_time < lp->sort_time) ||
-		    ((lc->list[mid_index]->sort_time == lp->sort_time) && 
-		     (lc->list[mid_index]->sort_tiebreaker < lp->sort_tiebreaker))) {
-		if (mid_index == max) {
-			/* insert in mid_index + 1 as sort_time is smaller */
-			return (mid_index+1);
-		}
-		/* try again with upper half of list */
-		return (lc_binary_search_insert_point(lc, lp,
-						      mid_index + 1, max));
+static struct lease *
+lc_get_last_lease(struct leasechain *lc) {
+	struct lc_node *node;
+
+	if ((node = lc->root) == NULL) {
+		return (NULL);
+	}
+	while (!node->leaf) {
+		node = node->child[node->count - 1];
 	}
+	return (node->key[node->count - 1].lease);
+}
 
-	/* sort_time and sort_tiebreaker match, so insert in this position */
-	return (mid_index);
+/*!
+ *
+ * \brief Compare two keys
+ *
+ * \return less than, equal to or greater than zero as a sorts before, with
+ * or after b
+ */
+static int
+lc_key_cmp(const struct lc_key *a, const struct lc_key *b) {
+	if (a->sort_time != b->sort_time) {
+		return (a->sort_time < b->sort_time ? -1 : 1);
+	}
+	if (a->sort_tiebreaker != b->sort_tiebreaker) {
+		return (a->sort_tiebreaker < b->sort_tiebreaker ? -1 : 1);
+	}
+	if (a->lease != b->lease) {
+		return ((uintptr_t)a->lease < (uintptr_t)b->lease ? -1 : 1);
+	}
+	return (0);
 }
 
 /*!
  *
- * \brief Find an exact match for a lease
+ * \brief Find the first key in a node that sorts after the one given
  *
- * Given a potential range of the array to search this routine
- * will recursively examine the range to find the proper lease
- * 
- * \param lc The leasechain to check
- * \param lp The lease to find
- * \param min The minium index of the search range
- * \param max The maximum index of the search range
+ * \param node The node to search
+ * \param k The key to look for
  *
- * \return The index of the array entry for the lease, SIZE_MAX if the lease
- * wasn't found
+ * \return The index of the first larger key, or the count of keys if
+ * there is none
  */
-
-size_t
-lc_binary_search_lease(struct leasechain *lc,
-		       struct lease *lp,
-		       size_t min, size_t max)
-{
-	size_t mid_index;
-	size_t i;
-
-	if (max < min) {
-		/* lease not found */
-		return (SIZE_MAX);
-	}
-
-	mid_index = ((max - min)/2) + min;
-
-	if ((lc->list[mid_index]->sort_time > lp->sort_time) ||
-	    ((lc->list[mid_index]->sort_time == lp->sort_time) &&
-	     (lc->list[mid_index]->sort_tiebreaker > lp->sort_tiebreaker))) {
-		if (mid_index == min) {
-			/* lease not found */
-			return (SIZE_MAX);
-		} 
-		/* try the lower half of the list */
-		return (lc_binary_search_lease(lc, lp, min, mid_index - 1));
-	} else if ((lc->list[mid_index]->sort_time < lp->sort_time) ||
-		   ((lc->list[mid_index]->sort_time == lp->sort_time) &&
-		    (lc->list[mid_index]->sort_tiebreaker < lp->sort_tiebreaker))) {
-		/* try the upper half of the list */	  
-		return (lc_binary_search_lease(lc, lp, mid_index + 1, max));
-	}
-
-	/*
-	 * As sort_time/sort_tiebreaker may not be unique in the list, once we
-	 * find a match, we need to look before and after from this position
-	 * for all matching sort_time/sort_tiebreaker until we find the exact
-	 * lease or until no matching lease is found
-	 */
-	if (lp == lc->list[mid_index]) {
-		return (mid_index);
-	}
-
-	/* Check out entries below the mid_index */
-	if (mid_index > min) {
-		/* We will break out of the loop if we either go past the
-	         * canddiates or hit the end of the range when i == min.  As
-		 * i is unsigned we can't check it in the for loop itself.
-		 */
-		for (i = mid_index - 1; ; i--) {
-			if (lp == lc->list[i]) {
-				return (i);
-			}
-
-			/* Are we done with this range? */
-			if ((i == min) ||
-			    ((lc->list[i]->sort_time != lp->sort_time) || 
-			     ((lc->list[i]->sort_time == lp->sort_time) &&
-			      (lc->list[i]->sort_tiebreaker != lp->sort_tiebreaker)))) {
-				break;
-			}
+static int
+lc_upper_bound(const struct lc_node *node, const struct lc_key *k) {
+	int min = 0, max = node->count, mid;
+
+	while (min < max) {
+		mid = (min + max) / 2;
+		if (lc_key_cmp(&node->key[mid], k) > 0) {
+			max = mid;
+		} else {
+			min = mid + 1;
 		}
 	}
+	return (min);
+}
 
-	/* Check out entries above the mid_index */
-	if (mid_index < max) {
-		/* We will break out of the loop if we either go past the 
-	         * canddiates or hit the end of the range when i == max.
-		 */
-		for (i = mid_index + 1; i <= max; i++) {
-			if (lp == lc->list[i]) {
-				return (i);
-			}
+/*!
+ *
+ * \brief Choose the child of an interior node that may hold a key
+ *
+ * \return The index of the last child whose smallest key is no larger than
+ * k, or 0 if k sorts before all of them
+ */
+static int
+lc_route(const struct lc_node *node, const struct lc_key *k) {
+	int i = lc_upper_bound(node, k);
 
-			if ((lc->list[i]->sort_time != lp->sort_time) ||
-			    ((lc->list[i]->sort_time == lp->sort_time) &&
-			     (lc->list[i]->sort_tiebreaker != lp->sort_tiebreaker))) {
-				break;
-			}
+	return (i > 0 ? i - 1 : 0);
+}
+
+static struct lc_node *
+lc_node_new(int leaf) {
+	struct lc_node *node;
+
+	node = dmalloc(sizeof(struct lc_node), MDL);
+	if ((node != NULL) && !leaf) {
+		node->child = dmalloc(LC_NODE_SIZE * sizeof(node->child[0]),
+				      MDL);
+		if (node->child == NULL) {
+			dfree(node, MDL);
+			node = NULL;
 		}
 	}
+	if (node == NULL) {
+		log_fatal("LC unable to allocate a node %s:%d", MDL);
+	}
+	node->leaf = leaf;
+	return (node);
+}
 
-	/* Lease not found */
-	return (SIZE_MAX);
+static void
+lc_node_free(struct lc_node *node) {
+	if (node->child != NULL) {
+		dfree(node->child, MDL);
+	}
+	dfree(node, MDL);
 }
 
 /*!
  *
- * \brief Increase the size of the array for the lease chain
- *
- * \param lc The leasechain to expand
- *
- * If we are unable to allocate memory we log a fatal error.  There's
- * not much else to do as we can't figure out where to put the lease.
+ * \brief Put a key, and for interior nodes a child, into a node
  *
- * If we can allocate memory we copy the old lease chain to the new
- * lease chain and free the old.
+ * \param node The node to update, which must not be full
+ * \param i The position for the new key
+ * \param k The key
+ * \param child The child node the key belongs to, or NULL for a leaf
  */
-void
-lc_grow_chain(struct leasechain *lc) {
-#if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC grow lease chain max was %zu, %s:%d", lc->total, MDL);
-#endif
-
-	void *p;
-	size_t temp_size;
-
-	if (lc->growth == 0) 
-		temp_size = lc->total + LC_GROWTH_DELTA;
-	else
-		temp_size = lc->total + lc->growth;
-
-	/* try to allocate the memory */
-	p = dmalloc(sizeof(struct lease *) * temp_size, MDL);
-	if (p == NULL) {
-		log_fatal("LC grow, unable to allocated memory %s:%d", MDL);
+static void
+lc_node_put(struct lc_node *node, int i, const struct lc_key *k,
+	    struct lc_node *child) {
+	memmove(&node->key[i + 1], &node->key[i],
+		(node->count - i) * sizeof(node->key[0]));
+	node->key[i] = *k;
+	if (!node->leaf) {
+		memmove(&node->child[i + 1], &node->child[i],
+			(node->count - i) * sizeof(node->child[0]));
+		node->child[i] = child;
 	}
+	node->count++;
+}
 
-	/* Success, copy the lease chain and install the new one */
-	if (lc->list != NULL) {
-		memcpy(p, lc->list, sizeof(struct lease *) * lc->nelem);
-		dfree(lc->list, MDL);
+/*!
+ *
+ * \brief Drop the key, and any child, at a position in a node
+ */
+static void
+lc_node_drop(struct lc_node *node, int i) {
+	memmove(&node->key[i], &node->key[i + 1],
+		(node->count - i - 1) * sizeof(node->key[0]));
+	if (!node->leaf) {
+		memmove(&node->child[i], &node->child[i + 1],
+			(node->count - i - 1) * sizeof(node->child[0]));
 	}
-	lc->list = (struct lease **) p;
-	lc->total = temp_size;
-
-	return;
+	node->count--;
 }
 
-
 /*!
  *
- * \brief Link a lease to a lease chain position
+ * \brief Move n keys, and any children, from one node to another
  *
- * This function may increase the size of the lease chain if necessary and will
- * probably need to move entries in the lease chain around.
- *
- * \param lc The leasechain to update
- * \param lp The lease to insert
- * \param n  The position in which to insert the lease
+ * \param to The node to add to
+ * \param ti The position in to at which to put them
+ * \param from The node to take them from
+ * \param fi The position of the first one in from
+ * \param n The number to move
  *
+ * Room must already have been made in to; the hole left in from is
+ * closed up.
  */
-void
-lc_link_lcp(struct leasechain *lc, struct lease *lp, size_t n) {
-#if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC link lcp %s:%d", MDL);
-	INSIST (lc != NULL);
-	INSIST (lp != NULL);
-#endif
-
-	if (lc->nelem == lc->total) {
-		lc_grow_chain(lc);
+static void
+lc_node_move(struct lc_node *to, int ti, struct lc_node *from, int fi, int n) {
+	memcpy(&to->key[ti], &from->key[fi], n * sizeof(to->key[0]));
+	memmove(&from->key[fi], &from->key[fi + n],
+		(from->count - fi - n) * sizeof(from->key[0]));
+	if (!to->leaf) {
+		memcpy(&to->child[ti], &from->child[fi],
+		       n * sizeof(to->child[0]));
+		memmove(&from->child[fi], &from->child[fi + n],
+			(from->count - fi - n) * sizeof(from->child[0]));
 	}
+	to->count += n;
+	from->count -= n;
+}
 
-#if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC Link lcp position %zu, elem %zu, %s:%d",
-		  n, lc->nelem, MDL);
-#endif
-
-	/* create room for the new pointer */
-	if (n < lc->nelem) {
-#if defined (DEBUG_BINARY_LEASES)
-		log_debug("LC link lcp moving position %zu, moving %zu. %s:%d",
-			  n, (lc->nelem-n), MDL);
-#endif
-		memmove(lc->list + n + 1,  lc->list + n,
-			sizeof(struct lease *) * (lc->nelem-n));
-	}
+/*!
+ *
+ * \brief Split a full node, moving its upper half into a new node
+ *
+ * \return The new node
+ */
+static struct lc_node *
+lc_node_split(struct lc_node *node) {
+	struct lc_node *right = lc_node_new(node->leaf);
+	int half = node->count / 2;
 
-	/* clean any stale pointer info from this position before calling 
-	 * lease_reference as it won't work if pointer is not NULL
-	 */
-	lc->list[n] = NULL;
-	lease_reference(&(lc->list[n]), lp, MDL);
+	lc_node_move(right, 0, node, half, node->count - half);
+	return (right);
+}
 
-	lc->nelem++;
+/*!
+ *
+ * \brief Add a key to the subtree under a node
+ *
+ * \param node The top of the subtree
+ * \param k The key to add
+ *
+ * \return A new node to be added to the right of this one if it had to be
+ * split, otherwise NULL
+ */
+static struct lc_node *
+lc_node_insert(struct lc_node *node, const struct lc_key *k) {
+	struct lc_node *target = node, *right, *split = NULL;
+	int i;
+
+	if (node->leaf) {
+		if (node->count == LC_NODE_SIZE) {
+			split = lc_node_split(node);
+			if (lc_key_cmp(k, &split->key[0]) >= 0) {
+				target = split;
+			}
+		}
+		lc_node_put(target, lc_upper_bound(target, k), k, NULL);
+		return (split);
+	}
 
-	lp->lc = lc;
+	i = lc_route(node, k);
+	right = lc_node_insert(node->child[i], k);
+	node->key[i] = node->child[i]->key[0];
+	if (right == NULL) {
+		return (NULL);
+	}
 
-	return;
+	/* The child was split, add the new half after it */
+	i++;
+	if (node->count == LC_NODE_SIZE) {
+		split = lc_node_split(node);
+		if (i > node->count) {
+			i -= node->count;
+			target = split;
+		}
+	}
+	lc_node_put(target, i, &right->key[0], right);
+	return (split);
 }
 
 /*!
- * 
- * \brief Insert the lease at the specified position in both the lease chain
- * and the linked list
  *
- * This function may increase the size of the lease chain if necessary and will
- * probably need to move entries in the lease chain around.
- * \param lc The leasechain to update
- * \param lp The lease to insert
- * \param n  The position in which to insert the lease
+ * \brief Refill or merge a child that has fallen below LC_NODE_MIN keys
  *
+ * \param node The parent of the child
+ * \param i The index of the child
  */
-void
-lc_add_lease_pos(struct leasechain *lc, struct lease *lp, size_t pos) {
-#if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC Add lease position %zu, %s:%d", pos, MDL);
-	INSIST (lc != NULL);
-	INSIST (lp != NULL);
-#endif
-	lc_link_lcp(lc, lp, pos);
+static void
+lc_node_rebalance(struct lc_node *node, int i) {
+	struct lc_node *a, *b;
+	int l, half;
 
-#if 0
-	/* this shoudln't be necessary, if we still have pointers on
-	 *  the lease being inserted things are broken
-	 */
-	if (lp->prev) {
-		lease_dereference(&lp->prev, MDL);
-	}
-	if (lp->next) {
-		lease_dereference(&lp->next, MDL);
+	if (node->count < 2) {
+		/* No neighbour, our own parent will deal with us */
+		return;
 	}
-#endif
 
-	/* not the first element? */
-	if (pos > 0) {
-		if (lc->list[pos-1]->next) {
-			lease_dereference(&(lc->list[pos-1]->next), MDL);
+	/* Work on the child and the neighbour to its right, or to its
+	 * left if it is the last one */
+	l = (i + 1 < node->count) ? i : i - 1;
+	a = node->child[l];
+	b = node->child[l + 1];
+
+	if (a->count + b->count <= LC_NODE_SIZE) {
+		lc_node_move(a, a->count, b, 0, b->count);
+		lc_node_free(b);
+		lc_node_drop(node, l + 1);
+		if (a->count == 0) {
+			lc_node_free(a);
+			lc_node_drop(node, l);
+			return;
 		}
-		lease_reference(&(lc->list[pos-1]->next), lp, MDL);
-		lease_reference(&lp->prev, lc->list[pos-1], MDL );
+	} else {
+		half = (a->count + b->count) / 2;
+		if (a->count < half) {
+			lc_node_move(a, a->count, b, 0, half - a->count);
+		} else {
+			/* make room at the front of b */
+			memmove(&b->key[a->count - half], &b->key[0],
+				b->count * sizeof(b->key[0]));
+			if (!b->leaf) {
+				memmove(&b->child[a->count - half],
+					&b->child[0],
+					b->count * sizeof(b->child[0]));
+			}
+			lc_node_move(b, 0, a, half, a->count - half);
+		}
+		node->key[l + 1] = b->key[0];
 	}
+	node->key[l] = a->key[0];
+}
 
-	/* not the last element? we've already bumped nelem when linking
-	 * into the lease chain so nelem should never be zero here */
-	if (pos < (lc->nelem-1)) {
-		if (lc->list[pos+1]->prev) {
-			lease_dereference(&(lc->list[pos+1]->prev), MDL);
+/*!
+ *
+ * \brief Remove a key from the subtree under a node
+ *
+ * \param node The top of the subtree
+ * \param k The key to remove
+ *
+ * \return 1 if the key was found and removed, 0 if it wasn't there
+ */
+static int
+lc_node_remove(struct lc_node *node, const struct lc_key *k) {
+	int i;
+
+	if (node->leaf) {
+		i = lc_upper_bound(node, k) - 1;
+		if ((i < 0) || (lc_key_cmp(&node->key[i], k) != 0)) {
+			return (0);
 		}
-		lease_reference(&(lc->list[pos+1]->prev), lp,  MDL);
-		lease_reference(&lp->next, lc->list[pos+1], MDL);
+		lc_node_drop(node, i);
+		return (1);
 	}
 
-	return;
+	i = lc_route(node, k);
+	if (!lc_node_remove(node->child[i], k)) {
+		return (0);
+	}
+	if (node->child[i]->count > 0) {
+		node->key[i] = node->child[i]->key[0];
+	}
+	if (node->child[i]->count < LC_NODE_MIN) {
+		lc_node_rebalance(node, i);
+	}
+	return (1);
+}
+
+static void
+lc_make_key(struct lc_key *k, struct lease *lp) {
+	k->sort_time = lp->sort_time;
+	k->sort_tiebreaker = lp->sort_tiebreaker;
+	k->lease = lp;
 }
 
 #ifdef POINTER_DEBUG
@@ -445,27 +502,25 @@ lc_add_lease_pos(struct leasechain *lc, struct lease *lp, size_t pos) {
  */
 void
 lc_check_lc_sort_order(struct leasechain *lc) {
-	size_t i;
-	TIME t = 0;
-	long int tiebreak = 0;
+	struct lease *lp, *prev = NULL;
+	size_t n = 0;
 
 	log_debug("LC check sort %s:%d", MDL);
-	for (i = 0; i < lc->nelem; i++ ) {
-		if ((lc->list[i]->sort_time < t)  ||
-		    ((lc->list[i]->sort_time == t) && 
-		     (lc->list[i]->tiebreaker < tiebreaker))) {
-			if (i > 0) {
-				print_lease(lc->list[i-1]);
-			}
-			print_lease(lc->list[i]);
-			if (i < lc->nelem - 1) {
-				print_lease(lc->list[i+1]);
-			}
+	for (lp = lc_get_first_lease(lc); lp != NULL; lp = lp->next) {
+		if ((prev != NULL) &&
+		    ((lp->sort_time < prev->sort_time) ||
+		     ((lp->sort_time == prev->sort_time) &&
+		      (lp->sort_tiebreaker < prev->sort_tiebreaker)))) {
+			print_lease(prev);
+			print_lease(lp);
 			log_fatal("lc[%p] not sorted properly", lc);
 		}
-
-		t = lc->list[i]->sort_time;
-		tiebreak = lc->list[i]->sort_tiebreaker;
+		prev = lp;
+		n++;
+	}
+	if (n != lc->nelem) {
+		log_fatal("lc[%p] has %zu leases on its list, expected %zu",
+			  lc, n, lc->nelem);
 	}
 }
 #endif
@@ -495,48 +550,91 @@ lc_check_lc_sort_order(struct leasechain *lc) {
  */
 void
 lc_add_sorted_lease(struct leasechain *lc, struct lease *lp) {
-	size_t pos;
+	struct lease *last, *prev, *next;
+	struct lc_key k;
+	struct lc_node *right, *root;
+	int i;
 
 #if defined (DEBUG_BINARY_LEASES)
 	log_debug("LC add sorted %s:%d", MDL);
 	INSIST (lc != NULL);
 	INSIST (lp != NULL);
 #endif
-	if (lc->nelem == 0) {
-		/* The first lease start with a tiebreak of 0 and add it at
-		 * the first position */
+	last = lc_get_last_lease(lc);
+	if (last == NULL) {
+		/* The first lease start with a tiebreak of 0 */
 		lp->sort_tiebreaker = 0;
-
-		lc_add_lease_pos(lc, lp, 0);
-		/* log_debug("LC add sorted done, %s:%d", MDL); */
-
-		return;
-	}
-
-	if (lp->sort_time > lc->list[lc->nelem-1]->sort_time) {
+		prev = NULL;
+	} else if (lp->sort_time > last->sort_time) {
 		/* Adding to end of queue, with a different sort time */
 		lp->sort_tiebreaker = 0;
-		pos = lc->nelem;
-	} else if (lp->sort_time == lc->list[lc->nelem-1]->sort_time) {
+		prev = last;
+	} else if (lp->sort_time == last->sort_time) {
 		/* Adding to end of queue, with the same sort time */
-		if (lc->list[lc->nelem-1]->sort_tiebreaker < LONG_MAX)
-			lp->sort_tiebreaker =
-			  lc->list[lc->nelem-1]->sort_tiebreaker+1;
+		if (last->sort_tiebreaker < LONG_MAX)
+			lp->sort_tiebreaker = last->sort_tiebreaker + 1;
 		else
 			lp->sort_tiebreaker = LONG_MAX;
-		pos = lc->nelem;
+		prev = last;
 	} else {
 		/* Adding somewhere in the queue, just pick a random value */
 		lp->sort_tiebreaker = random();
-		pos = lc_binary_search_insert_point(lc, lp, 0, lc->nelem - 1);
+		prev = NULL;
 	}
+	lc_make_key(&k, lp);
 
-	/* Finally add it to the queue */
-	lc_add_lease_pos(lc, lp, pos);
+	/* Find the lease it goes after, unless we already know */
+	if (prev == NULL && last != NULL) {
+		root = lc->root;
+		while (!root->leaf) {
+			root = root->child[lc_route(root, &k)];
+		}
+		i = lc_upper_bound(root, &k);
+		if (i > 0) {
+			prev = root->key[i - 1].lease;
+		}
+	}
+	next = (prev != NULL) ? prev->next : lc_get_first_lease(lc);
+
+	/* Add the key to the tree, holding a reference for it */
+	k.lease = NULL;
+	lease_reference(&k.lease, lp, MDL);
+	if (lc->root == NULL) {
+		lc->root = lc_node_new(1);
+	}
+	right = lc_node_insert(lc->root, &k);
+	if (right != NULL) {
+		/* The root was split, grow the tree by a level */
+		root = lc_node_new(0);
+		root->key[0] = lc->root->key[0];
+		root->child[0] = lc->root;
+		root->key[1] = right->key[0];
+		root->child[1] = right;
+		root->count = 2;
+		lc->root = root;
+	}
+	lc->nelem++;
+	lp->lc = lc;
+
+	/* And link it into the list between prev and next */
+	if (prev != NULL) {
+		if (prev->next) {
+			lease_dereference(&prev->next, MDL);
+		}
+		lease_reference(&prev->next, lp, MDL);
+		lease_reference(&lp->prev, prev, MDL);
+	}
+	if (next != NULL) {
+		if (next->prev) {
+			lease_dereference(&next->prev, MDL);
+		}
+		lease_reference(&next->prev, lp, MDL);
+		lease_reference(&lp->next, next, MDL);
+	}
 
 #if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC add sorted complete position %zu, elements %zu, %s:%d",
-		  pos, lc->nelem, MDL);
+	log_debug("LC add sorted complete, elements %zu, %s:%d",
+		  lc->nelem, MDL);
 #endif
 
 #ifdef POINTER_DEBUG
@@ -546,55 +644,51 @@ lc_add_sorted_lease(struct leasechain *lc, struct lease *lp) {
 
 /*!
  *
- * \brief Remove the Nth pointer from a leasechain structure and update counters.
- * The pointers in the array will be moved to fill in the hole if necessary.
+ * \brief Find a lease in the lease chain and then remove it
+ * If we can't find the lease on the given lease chain it's a fatal error.
  *
  * \param lc The lease chain to update
- * \param n the entry to remove from the lease chain
+ * \param lp The lease to remove
  */
 void
-lc_unlink_lcp(struct leasechain *lc, size_t n) {
+lc_unlink_lease(struct leasechain *lc, struct lease *lp) {
+	struct lc_node *root;
+	struct lc_key k;
+
 #if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC unlink lcp %s:%d", MDL);
+	log_debug("LC unlink lease %s:%d", MDL);
 
-	/* element index to remove must be less than the number of elements present */
-	INSIST(n < lc->nelem);
+	INSIST(lc != NULL);
+	INSIST(lp != NULL );
+	INSIST(lp->lc != NULL );
+	INSIST(lp->lc == lc );
 #endif
 
-	/* Clear the pointer from the lease back to the LC */
-	lc->list[n]->lc = NULL;
-
-	/* Clear the pointer from the LC to the lease */
-	lease_dereference(&(lc->list[n]), MDL);
-
-	/*  memove unless we are removing the last element */
-	if ((lc->nelem-1) > n) {
-		memmove(lc->list + n, lc->list + n + 1,
-			sizeof(struct lease *) * (lc->nelem-1-n));
+	lc_make_key(&k, lp);
+	if ((lc->root == NULL) || !lc_node_remove(lc->root, &k)) {
+		/* fatal, lease not found in leasechain */
+		log_fatal("Lease with binding state %s not on its queue.",
+			  (lp->binding_state < 1 ||
+			   lp->binding_state > FTS_LAST)
+			  ? "unknown"
+			  : binding_state_names[lp->binding_state - 1]);
 	}
 	lc->nelem--;
-}
 
-/*!
- *
- * \brief Remove a lease from a specific position. This will first unlink
- * the lease from the lease chain and then update the linked list.
- *
- * \param lc The lease chain to update
- * \param pos the entry to remove from the lease chain
- */
-void
-lc_unlink_lease_pos(struct leasechain *lc, size_t pos)
-{
-#if defined (DEBUG_BINARY_LEASES)
-	INSIST(lc != NULL);
-#endif
-
-	struct lease *lp = NULL;
-	lease_reference(&lp, lc->list[pos], MDL);
+	/* Shrink the tree if the root is empty or has a single child */
+	while ((root = lc->root) != NULL) {
+		if (root->leaf && root->count == 0) {
+			lc->root = NULL;
+		} else if (!root->leaf && root->count == 1) {
+			lc->root = root->child[0];
+		} else {
+			break;
+		}
+		lc_node_free(root);
+	}
 
-	/* unlink from lease chain list */
-	lc_unlink_lcp(lc, pos);
+	/* Clear the pointer from the lease back to the LC */
+	lp->lc = NULL;
 
 	/* unlink from the linked list */
 	if (lp->next) {
@@ -611,40 +705,9 @@ lc_unlink_lease_pos(struct leasechain *lc, size_t pos)
 	if (lp->next) {
 		lease_dereference(&lp->next, MDL);
 	}
-	lease_dereference(&lp, MDL);
-}
 
-/*!
- *
- * \brief Find a lease in the lease chain and then remove it
- * If we can't find the lease on the given lease chain it's a fatal error.
- *
- * \param lc The lease chain to update
- * \param lp The lease to remove
- */
-void
-lc_unlink_lease(struct leasechain *lc, struct lease *lp) {
-#if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC unlink lease %s:%d", MDL);
-
-	INSIST(lc != NULL);
-	INSIST(lc->list != NULL);
-	INSIST(lp != NULL );
-	INSIST(lp->lc != NULL );
-	INSIST(lp->lc == lc );
-#endif
-
-	size_t pos = lc_binary_search_lease(lc, lp, 0, lc->nelem-1);
-	if (pos == SIZE_MAX) {
-		/* fatal, lease not found in leasechain */
-		log_fatal("Lease with binding state %s not on its queue.",
-			  (lp->binding_state < 1 ||
-			   lp->binding_state > FTS_LAST)
-			  ? "unknown"
-			  : binding_state_names[lp->binding_state - 1]);
-	}
-
-	lc_unlink_lease_pos(lc, pos);
+	/* Drop the reference the tree held */
+	lease_dereference(&k.lease, MDL);
 }
 
 /*!
@@ -657,39 +720,27 @@ lc_unlink_lease(struct leasechain *lc, struct lease *lp) {
  */
 void
 lc_delete_all(struct leasechain *lc) {
-	size_t i;
-
-	if (lc->nelem > 0) {
-		/* better to delete from the last one, to avoid the memmove */
-		for (i = lc->nelem - 1; ; i--) {
-			lc_unlink_lease_pos(lc, i);
-			if (i == 0) {
-				break;
-			}
-		}
-	}
+	struct lease *lp;
 
-	/* and then get rid of the list itself */
-	if (lc->list != NULL) {
-		dfree(lc->list, MDL);
-		lc->list = NULL;
+	/* better to delete from the last one, to keep the list short */
+	while ((lp = lc_get_last_lease(lc)) != NULL) {
+		lc_unlink_lease(lc, lp);
 	}
 
-	lc->total = 0;
 	lc->nelem = 0;
 }
 
 /*!
  *
- * \brief Set the growth value.  This is the number of elements to
- * add to the array whenever it needs to grow.
+ * \brief Set the growth value.  This used to be the number of elements
+ * to add to the lease chain array whenever it needed to grow.  The tree
+ * grows a node at a time so it is no longer needed and is ignored.
  *
  * \param lc the lease chain to set up
  * \param growth the growth value to use
  */
 void
 lc_init_growth(struct leasechain *lc, size_t growth) {
-	lc->growth = growth;
 }
 
 #endif /* #if defined (BINARY_LEASES) */
@@ -94,6 +94,7 @@ isc_result_t enter_class(cd, dynamicp, commit)
 			/* nothing */ ;
 		class_reference (&c -> nic, cd, MDL);
 	}
+	clear_class_index (collections);
 
 	if (dynamicp && commit) {
 		const char *name = cd->name;
@@ -159,6 +160,14 @@ find_host_id_info(unsigned int option_code, int relays) {
 	return p;
 }
 
+/* Returns true if any host declaration is matched on an option through
+ * host-identifier, in which case the host for a packet can't be known
+ * without parsing its options. */
+int
+host_id_options_configured(void) {
+	return (host_id_info != NULL);
+}
+
 /* Debugging code */
 #if 0
 isc_result_t
@@ -778,24 +787,281 @@ int find_host_for_network (struct subnet **sp, struct host_decl **host,
 	return 0;
 }
 
-void new_address_range (cfile, low, high, subnet, pool, lpchain)
+/*
+ * Every range is kept in an array sorted by its first address, so that
+ * find_lease_by_ip_addr() can find the range an address belongs to
+ * with a binary search.  Ranges never overlap.
+ */
+static struct lease_range **lease_ranges;
+static unsigned lease_range_count;
+static unsigned lease_range_max;
+
+/* Set once expire_all_pools() has queued the leases read at startup;
+   leases made after that go straight onto their pool's free queue. */
+static int lease_ranges_queued;
+
+#define RANGE_UNUSED(range, i) \
+	((range)->unused[(i) >> 3] & (1 << ((i) & 7)))
+
+static u_int32_t
+range_addr(struct iaddr addr) {
+	u_int32_t value;
+
+	memcpy(&value, addr.iabuf, 4);
+	return ntohl(value);
+}
+
+/* Index of the first range that starts above the address. */
+static unsigned
+lease_range_slot(u_int32_t addr) {
+	unsigned lo = 0, hi = lease_range_count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (lease_ranges[mid]->low <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static struct lease_range *
+lease_range_find(u_int32_t addr) {
+	struct lease_range *range;
+	unsigned slot = lease_range_slot(addr);
+
+	if (slot == 0)
+		return NULL;
+	range = lease_ranges[slot - 1];
+	if (addr - range->low >= range->count)
+		return NULL;
+	return range;
+}
+
+/* Complain about every address in [low, low + count) that is already
+   in a range, as we used to when there was a lease for each of them. */
+static int
+lease_range_overlap(struct parse *cfile, u_int32_t low, unsigned count) {
+	struct lease_range *range;
+	u_int32_t addr, first, last, high = low + (count - 1);
+	unsigned slot = lease_range_slot(low);
+	int overlaps = 0;
+
+	if (slot > 0)
+		slot--;
+	for (; slot < lease_range_count; slot++) {
+		range = lease_ranges[slot];
+		if (range->low > high)
+			break;
+		if (range->low + (range->count - 1) < low)
+			continue;
+
+		first = range->low > low ? range->low : low;
+		last = range->low + (range->count - 1);
+		if (last > high)
+			last = high;
+		for (addr = first; ; addr++) {
+			struct iaddr ia;
+			u_int32_t net = htonl(addr);
+
+			ia.len = 4;
+			memcpy(ia.iabuf, &net, 4);
+			parse_warn(cfile, "lease %s is declared twice!",
+				   piaddr(ia));
+			if (addr == last)
+				break;
+		}
+		overlaps = 1;
+	}
+	return overlaps;
+}
+
+static void
+lease_range_add(u_int32_t low, unsigned count,
+		struct subnet *subnet, struct pool *pool) {
+	struct lease_range *range, **nr;
+	unsigned slot, nmax;
+
+	if (lease_range_count == lease_range_max) {
+		nmax = lease_range_max ? lease_range_max * 2 : 64;
+		nr = dmalloc(nmax * sizeof(*nr), MDL);
+		if (nr == NULL)
+			log_fatal("No memory for address ranges.");
+		if (lease_ranges != NULL) {
+			memcpy(nr, lease_ranges,
+			       lease_range_count * sizeof(*nr));
+			dfree(lease_ranges, MDL);
+		}
+		lease_ranges = nr;
+		lease_range_max = nmax;
+	}
+
+	range = dmalloc(sizeof(*range), MDL);
+	if (range != NULL)
+		range->unused = dmalloc((count + 7) / 8, MDL);
+	if (range == NULL || range->unused == NULL)
+		log_fatal("No memory for address range of %u addresses.",
+			  count);
+	memset(range->unused, 0xff, (count + 7) / 8);
+	range->low = low;
+	range->count = count;
+	range->remaining = count;
+	subnet_reference(&range->subnet, subnet, MDL);
+	pool_reference(&range->pool, pool, MDL);
+	range->next = pool->ranges;
+	pool->ranges = range;
+
+	slot = lease_range_slot(low);
+	memmove(&lease_ranges[slot + 1], &lease_ranges[slot],
+		(lease_range_count - slot) * sizeof(*lease_ranges));
+	lease_ranges[slot] = range;
+	lease_range_count++;
+}
+
+/* Make the lease for address "i" of a range, as new_address_range()
+   used to do for every address up front. */
+static void
+lease_range_make(struct lease **lp, struct lease_range *range, unsigned i) {
+	struct lease *lease = NULL;
+	isc_result_t status;
+	u_int32_t net = htonl(range->low + i);
+
+	range->unused[i >> 3] &= ~(1 << (i & 7));
+	if (--range->remaining == 0) {
+		dfree(range->unused, MDL);
+		range->unused = NULL;
+	}
+
+	status = lease_allocate(&lease, MDL);
+	if (status != ISC_R_SUCCESS)
+		log_fatal("No memory for lease: %s",
+			  isc_result_totext(status));
+	lease->ip_addr.len = 4;
+	memcpy(lease->ip_addr.iabuf, &net, 4);
+	lease->starts = MIN_TIME;
+	lease->ends = MIN_TIME;
+	subnet_reference(&lease->subnet, range->subnet, MDL);
+	pool_reference(&lease->pool, range->pool, MDL);
+	lease->binding_state = FTS_FREE;
+	lease->next_binding_state = FTS_FREE;
+	lease->rewind_binding_state = FTS_FREE;
+	lease->flags = 0;
+
+	lease_ip_hash_add(lease_ip_addr_hash, lease->ip_addr.iabuf,
+			  lease->ip_addr.len, lease, MDL);
+
+	/* It was already counted as free, so don't use lease_enqueue(). */
+	if (lease_ranges_queued) {
+		lease->sort_time = lease->ends;
+		LEASE_INSERTP(&range->pool->free, lease);
+	}
+
+	if (lp != NULL)
+		lease_reference(lp, lease, MDL);
+	lease_dereference(&lease, MDL);
+}
+
+static unsigned
+pool_unmade_leases(struct pool *pool) {
+	struct lease_range *range;
+	unsigned count = 0;
+
+	for (range = pool->ranges; range != NULL; range = range->next)
+		count += range->remaining;
+	return count;
+}
+
+#if defined (FAILOVER_PROTOCOL)
+/* Make leases for all the addresses left in a pool's ranges. */
+static void
+pool_make_all_leases(struct pool *pool) {
+	struct lease_range *range;
+	unsigned i;
+
+	for (range = pool->ranges; range != NULL; range = range->next) {
+		for (i = 0; range->remaining > 0 && i < range->count; i++) {
+			if (RANGE_UNUSED(range, i))
+				lease_range_make(NULL, range, i);
+		}
+	}
+}
+#endif
+
+/* Hand the ranges of a pool that is being merged away to the pool it is
+   merged into. */
+void pool_merge_ranges(struct pool *to, struct pool *from)
+{
+	struct lease_range *range;
+
+	while ((range = from->ranges) != NULL) {
+		from->ranges = range->next;
+		pool_dereference(&range->pool, MDL);
+		pool_reference(&range->pool, to, MDL);
+		range->next = to->ranges;
+		to->ranges = range;
+	}
+}
+
+/*
+ * Called before picking a lease from the pool's free queue.  Leases
+ * that have never been used sort to the front of that queue, so if the
+ * front isn't one of them, make one from the next unused address.
+ */
+void pool_make_free_lease(struct pool *pool)
+{
+	struct lease_range *range;
+	struct lease *first;
+
+	first = LEASE_GET_FIRST(pool->free);
+	if (first != NULL && first->ends == MIN_TIME)
+		return;
+
+	for (range = pool->ranges; range != NULL; range = range->next) {
+		if (range->remaining == 0)
+			continue;
+		while (range->unused[range->cursor >> 3] == 0)
+			range->cursor = (range->cursor | 7) + 1;
+		while (!RANGE_UNUSED(range, range->cursor))
+			range->cursor++;
+		lease_range_make(NULL, range, range->cursor);
+		return;
+	}
+}
+
+#if defined (DEBUG_MEMORY_LEAKAGE) && \
+		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+static void
+lease_ranges_free(void) {
+	struct lease_range *range;
+	unsigned i;
+
+	for (i = 0; i < lease_range_count; i++) {
+		range = lease_ranges[i];
+		range->pool->ranges = NULL;
+		pool_dereference(&range->pool, MDL);
+		subnet_dereference(&range->subnet, MDL);
+		if (range->unused != NULL)
+			dfree(range->unused, MDL);
+		dfree(range, MDL);
+	}
+	if (lease_ranges != NULL)
+		dfree(lease_ranges, MDL);
+	lease_ranges = NULL;
+	lease_range_count = lease_range_max = 0;
+}
+#endif
+
+void new_address_range (cfile, low, high, subnet, pool)
 	struct parse *cfile;
 	struct iaddr low, high;
 	struct subnet *subnet;
 	struct pool *pool;
-	struct lease **lpchain;
 {
-#if defined(COMPACT_LEASES)
-	struct lease *address_range;
-	unsigned s;
-#endif
-	unsigned min, max, i, num_addrs;
+	unsigned min, max, num_addrs;
+	u_int32_t low_addr;
 	char lowbuf [16], highbuf [16], netbuf [16];
 	struct shared_network *share = subnet -> shared_network;
-	struct lease *lt = (struct lease *)0;
-#if !defined(COMPACT_LEASES)
-	isc_result_t status;
-#endif
 
 	/* All subnets should have attached shared network structures. */
 	if (!share) {
@@ -854,99 +1120,254 @@ void new_address_range (cfile, low, high, subnet, pool, lpchain)
 	pool->lease_count += num_addrs;
 #endif
 
-	/* Get a lease structure for each address in the range. */
-#if defined (COMPACT_LEASES)
-	s = (num_addrs + 1) * sizeof (struct lease);
-	/* Check unsigned overflow in new_leases().
-	   With 304 byte lease structure (x64_86), this happens at
-	   range 10.0.0.0 10.215.148.52; */
-	if (((s % sizeof (struct lease)) != 0) ||
-	    ((s / sizeof (struct lease)) != (num_addrs + 1))) {
-		strcpy (lowbuf, piaddr (low));
-		strcpy (highbuf, piaddr (high));
-		parse_warn (cfile, "%s-%s is an overly large address range.",
-			   lowbuf, highbuf);
-		log_fatal ("Memory overflow.");
-	}
-	address_range = new_leases (num_addrs, MDL);
-	if (!address_range) {
-		strcpy (lowbuf, piaddr (low));
-		strcpy (highbuf, piaddr (high));
-		log_fatal ("No memory for address range %s-%s.",
-			   lowbuf, highbuf);
+	/* Leases for the range are only made as they are needed, see
+	   lease_range_make().  Addresses can only be in one range. */
+	low_addr = range_addr(ip_addr(subnet->net, subnet->netmask, min));
+	if (!lease_range_overlap(cfile, low_addr, num_addrs))
+		lease_range_add(low_addr, num_addrs, subnet, pool);
+}
+
+/*
+ * Subnets are also kept in a path-compressed binary trie per address
+ * family so that find_subnet() can do a longest prefix match instead
+ * of walking every subnet.  Each node covers the first "bits" bits of
+ * "key"; nodes without a subnet are only there to join two branches.
+ * A netmask that isn't contiguous can't be put in a trie, so if we
+ * ever see one we fall back to searching the subnet list.
+ */
+struct subnet_trie_node {
+	struct subnet_trie_node *child[2];
+	struct subnet *subnet;
+	unsigned char key[16];
+	int bits;
+};
+
+static struct subnet_trie_node *subnet_trie4;
+static struct subnet_trie_node *subnet_trie6;
+static int subnet_trie_unusable;
+
+#define TRIE_BIT(key, n) (((key)[(n) >> 3] >> (7 - ((n) & 7))) & 1)
+
+/* Return the prefix length of a netmask or -1 if it isn't contiguous. */
+static int
+netmask_prefix_len(const struct iaddr *mask) {
+	int i, bits = 0;
+
+	for (i = 0; i < mask->len * 8; i++) {
+		if (!TRIE_BIT(mask->iabuf, i))
+			break;
+		bits++;
 	}
-#endif
+	for (; i < mask->len * 8; i++) {
+		if (TRIE_BIT(mask->iabuf, i))
+			return -1;
+	}
+	return bits;
+}
 
-	/* Fill out the lease structures with some minimal information. */
-	for (i = 0; i < num_addrs; i++) {
-		struct lease *lp = (struct lease *)0;
-#if defined (COMPACT_LEASES)
-		omapi_object_initialize ((omapi_object_t *)&address_range [i],
-					 dhcp_type_lease,
-					 0, sizeof (struct lease), MDL);
-		lease_reference (&lp, &address_range [i], MDL);
-#else
-		status = lease_allocate (&lp, MDL);
-		if (status != ISC_R_SUCCESS)
-			log_fatal ("No memory for lease %s: %s",
-				   piaddr (ip_addr (subnet -> net,
-						    subnet -> netmask,
-						    i + min)),
-				   isc_result_totext (status));
-#endif
-		lp->ip_addr = ip_addr(subnet->net, subnet->netmask, i + min);
-		lp->starts = MIN_TIME;
-		lp->ends = MIN_TIME;
-		subnet_reference(&lp->subnet, subnet, MDL);
-		pool_reference(&lp->pool, pool, MDL);
-		lp->binding_state = FTS_FREE;
-		lp->next_binding_state = FTS_FREE;
-		lp->rewind_binding_state = FTS_FREE;
-		lp->flags = 0;
-
-		/* Remember the lease in the IP address hash. */
-		if (find_lease_by_ip_addr (&lt, lp -> ip_addr, MDL)) {
-			if (lt -> pool) {
-				parse_warn (cfile,
-					    "lease %s is declared twice!",
-					    piaddr (lp -> ip_addr));
-			} else
-				pool_reference (&lt -> pool, pool, MDL);
-			lease_dereference (&lt, MDL);
-		} else
-			lease_ip_hash_add(lease_ip_addr_hash,
-					  lp->ip_addr.iabuf, lp->ip_addr.len,
-					  lp, MDL);
-		/* Put the lease on the chain for the caller. */
-		if (lpchain) {
-			if (*lpchain) {
-				lease_reference (&lp -> next, *lpchain, MDL);
-				lease_dereference (lpchain, MDL);
+/* Number of leading bits, up to max, that a and b have in common. */
+static int
+trie_common_bits(const unsigned char *a, const unsigned char *b, int max) {
+	int i = 0;
+
+	while (i + 8 <= max && a[i >> 3] == b[i >> 3])
+		i += 8;
+	while (i < max && TRIE_BIT(a, i) == TRIE_BIT(b, i))
+		i++;
+	return i;
+}
+
+static struct subnet_trie_node *
+subnet_trie_node_new(const unsigned char *key, int bits) {
+	struct subnet_trie_node *node;
+
+	node = dmalloc(sizeof(*node), MDL);
+	if (node == NULL)
+		log_fatal("No memory for subnet trie node.");
+	memcpy(node->key, key, (bits + 7) / 8);
+	node->bits = bits;
+	return node;
+}
+
+static void
+subnet_overlap_warning(const struct subnet *subnet, int bits,
+		       const struct subnet *scan, int scan_bits) {
+	char n1buf[sizeof("ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255")];
+
+	strcpy(n1buf, piaddr(subnet->net));
+	log_error("Warning: subnet %s/%d overlaps subnet %s/%d",
+		  n1buf, bits, piaddr(scan->net), scan_bits);
+}
+
+/* Warn about every subnet at or below node, all of which lie inside
+   the new subnet. */
+static void
+subnet_trie_warn_inner(const struct subnet *subnet, int bits,
+		       const struct subnet_trie_node *node) {
+	if (node == NULL)
+		return;
+	if (node->subnet != NULL)
+		subnet_overlap_warning(subnet, bits, node->subnet, node->bits);
+	subnet_trie_warn_inner(subnet, bits, node->child[0]);
+	subnet_trie_warn_inner(subnet, bits, node->child[1]);
+}
+
+/*
+ * Put a subnet into the trie, warning about any subnets it overlaps.
+ * Returns 0 if the subnet can't be represented, in which case the
+ * trie is no longer used for lookups.
+ */
+static int
+subnet_trie_insert(struct subnet *subnet) {
+	struct subnet_trie_node **slot, *node, *glue;
+	const unsigned char *key = subnet->net.iabuf;
+	int bits, common;
+
+	bits = netmask_prefix_len(&subnet->netmask);
+	if (bits < 0 ||
+	    (subnet->net.len != 4 && subnet->net.len != 16) ||
+	    subnet->net.len != subnet->netmask.len) {
+		subnet_trie_unusable = 1;
+		return 0;
+	}
+	slot = (subnet->net.len == 4) ? &subnet_trie4 : &subnet_trie6;
+
+	while ((node = *slot) != NULL) {
+		common = trie_common_bits(key, node->key,
+					  bits < node->bits ? bits : node->bits);
+		if (common == node->bits && common == bits) {
+			/* Same prefix: the later declaration wins, as it
+			   did when it was put at the head of the list.  If
+			   the two are in different shared networks a node
+			   can't answer find_grouped_subnet() for both. */
+			subnet_trie_warn_inner(subnet, bits, node);
+			if (node->subnet != NULL) {
+				if (node->subnet->shared_network !=
+				    subnet->shared_network) {
+					subnet_trie_unusable = 1;
+					return 0;
+				}
+				subnet_dereference(&node->subnet, MDL);
 			}
-			lease_reference (lpchain, lp, MDL);
+			subnet_reference(&node->subnet, subnet, MDL);
+			return 1;
 		}
-		lease_dereference (&lp, MDL);
+		if (common == node->bits) {
+			/* Node is a prefix of the new subnet, go down. */
+			if (node->subnet != NULL)
+				subnet_overlap_warning(subnet, bits,
+						       node->subnet,
+						       node->bits);
+			slot = &node->child[TRIE_BIT(key, node->bits)];
+			continue;
+		}
+
+		if (common == bits) {
+			/* The new subnet is a prefix of this node. */
+			subnet_trie_warn_inner(subnet, bits, node);
+			glue = subnet_trie_node_new(key, bits);
+			subnet_reference(&glue->subnet, subnet, MDL);
+		} else {
+			/* They diverge: join them under a new branch. */
+			glue = subnet_trie_node_new(key, common);
+			glue->child[TRIE_BIT(key, common)] =
+				subnet_trie_node_new(key, bits);
+			subnet_reference(&glue->child[TRIE_BIT(key, common)]
+					 ->subnet, subnet, MDL);
+		}
+		glue->child[TRIE_BIT(node->key, common)] = node;
+		*slot = glue;
+		return 1;
 	}
+
+	*slot = subnet_trie_node_new(key, bits);
+	subnet_reference(&(*slot)->subnet, subnet, MDL);
+	return 1;
 }
 
+/*
+ * Walk the trie for addr and return the most specific subnet containing
+ * it.  If share is not NULL only subnets in that shared network count.
+ */
+static struct subnet *
+subnet_trie_lookup(struct iaddr addr, struct shared_network *share) {
+	struct subnet_trie_node *node;
+	struct subnet *best = NULL;
+	int max = addr.len * 8;
+
+	if (addr.len == 4)
+		node = subnet_trie4;
+	else if (addr.len == 16)
+		node = subnet_trie6;
+	else
+		return NULL;
+
+	while (node != NULL && node->bits <= max) {
+		if (trie_common_bits(addr.iabuf, node->key,
+				     node->bits) != node->bits)
+			break;
+		if (node->subnet != NULL &&
+		    (share == NULL || node->subnet->shared_network == share))
+			best = node->subnet;
+		if (node->bits == max)
+			break;
+		node = node->child[TRIE_BIT(addr.iabuf, node->bits)];
+	}
+	return best;
+}
+
+#if defined (DEBUG_MEMORY_LEAKAGE) && \
+		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
+static void
+subnet_trie_free(struct subnet_trie_node **slot) {
+	struct subnet_trie_node *node = *slot;
+
+	if (node == NULL)
+		return;
+	subnet_trie_free(&node->child[0]);
+	subnet_trie_free(&node->child[1]);
+	if (node->subnet != NULL)
+		subnet_dereference(&node->subnet, MDL);
+	dfree(node, MDL);
+	*slot = NULL;
+}
+#endif
+
 int find_subnet (struct subnet **sp,
 		 struct iaddr addr, const char *file, int line)
 {
-	struct subnet *rv;
+	struct subnet *rv, *best = NULL;
+	int i, bits, best_bits = -1;
 
-	for (rv = subnets; rv; rv = rv -> next_subnet) {
+	if (!subnet_trie_unusable)
+		best = subnet_trie_lookup(addr, NULL);
+	else {
+		/* The list isn't kept in any useful order once the trie
+		   has been given up, so look for the narrowest mask. */
+		for (rv = subnets; rv; rv = rv -> next_subnet) {
 #if defined(DHCP4o6)
-		if (addr.len != rv->netmask.len)
-			continue;
+			if (addr.len != rv->netmask.len)
+				continue;
 #endif
-		if (addr_eq (subnet_number (addr, rv -> netmask), rv -> net)) {
-			if (subnet_reference (sp, rv,
-					      file, line) != ISC_R_SUCCESS)
-				return 0;
-			return 1;
+			if (!addr_eq (subnet_number (addr, rv -> netmask),
+				      rv -> net))
+				continue;
+			bits = 0;
+			for (i = 0; i < rv -> netmask.len * 8; i++)
+				if (TRIE_BIT (rv -> netmask.iabuf, i))
+					bits++;
+			if (bits > best_bits) {
+				best = rv;
+				best_bits = bits;
+			}
 		}
 	}
-	return 0;
+
+	if (best == NULL)
+		return 0;
+	if (subnet_reference (sp, best, file, line) != ISC_R_SUCCESS)
+		return 0;
+	return 1;
 }
 
 int find_grouped_subnet (struct subnet **sp,
@@ -955,6 +1376,15 @@ int find_grouped_subnet (struct subnet **sp,
 {
 	struct subnet *rv;
 
+	if (!subnet_trie_unusable) {
+		rv = subnet_trie_lookup(addr, share);
+		if (rv == NULL)
+			return 0;
+		if (subnet_reference (sp, rv, file, line) != ISC_R_SUCCESS)
+			return 0;
+		return 1;
+	}
+
 	for (rv = share -> subnets; rv; rv = rv -> next_sibling) {
 #if defined(DHCP4o6)
 		if (addr.len != rv->netmask.len)
@@ -1011,6 +1441,18 @@ void enter_subnet (subnet)
 	struct subnet *next = (struct subnet *)0;
 	struct subnet *prev = (struct subnet *)0;
 
+	/* The trie finds the right subnet whatever the list order is, and
+	   warns about overlaps itself, so just put it at the front. */
+	if (!subnet_trie_unusable && subnet_trie_insert (subnet)) {
+		if (subnets) {
+			subnet_reference (&subnet -> next_subnet,
+					  subnets, MDL);
+			subnet_dereference (&subnets, MDL);
+		}
+		subnet_reference (&subnets, subnet, MDL);
+		return;
+	}
+
 	/* Check for duplicates... */
 	if (subnets)
 	    subnet_reference (&next, subnets, MDL);
@@ -1041,7 +1483,6 @@ void enter_subnet (subnet)
 	if (prev)
 		subnet_dereference (&prev, MDL);
 
-	/* XXX use the BSD radix tree code instead of a linked list. */
 	if (subnets) {
 		subnet_reference (&subnet -> next_subnet, subnets, MDL);
 		subnet_dereference (&subnets, MDL);
@@ -1350,6 +1791,14 @@ int supersede_lease (comp, lease, commit, propogate, pimmediate, from_pool)
 		return 0;
 	}
 
+#if defined (FAILOVER_PROTOCOL)
+	/* Stamp the change, so that a peer catching up from a checkpoint
+	   is sent this lease (see dhcp_failover_generate_update_queue()). */
+	if (comp->pool->failover_peer)
+		comp->fo_seq =
+			dhcp_failover_next_sequence(comp->pool->failover_peer);
+#endif
+
 	/* Figure out which queue it's on. */
 	switch (comp -> binding_state) {
 	      case FTS_FREE:
@@ -1742,6 +2191,7 @@ int lease_copy (struct lease **lp,
 	lt->tsfp = lease->tsfp;
 	lt->atsfp = lease->atsfp;
 	lt->cltt = lease -> cltt;
+	lt->fo_seq = lease->fo_seq;
 	lt->binding_state = lease->binding_state;
 	lt->next_binding_state = lease->next_binding_state;
 	lt->rewind_binding_state = lease->rewind_binding_state;
@@ -2051,8 +2501,24 @@ void pool_timer (vpool)
 int find_lease_by_ip_addr (struct lease **lp, struct iaddr addr,
 			   const char *file, int line)
 {
-	return lease_ip_hash_lookup(lp, lease_ip_addr_hash, addr.iabuf,
-				    addr.len, file, line);
+	struct lease_range *range;
+	u_int32_t value;
+
+	if (lease_ip_hash_lookup(lp, lease_ip_addr_hash, addr.iabuf,
+				 addr.len, file, line))
+		return 1;
+
+	/* An address in a range that has never been used has no lease
+	   yet, so make it now. */
+	if (addr.len != 4)
+		return 0;
+	value = range_addr(addr);
+	range = lease_range_find(value);
+	if (range == NULL || range->remaining == 0 ||
+	    !RANGE_UNUSED(range, value - range->low))
+		return 0;
+	lease_range_make(lp, range, value - range->low);
+	return 1;
 }
 
 int find_lease_by_uid (struct lease **lp, const unsigned char *uid,
@@ -2430,15 +2896,63 @@ int write_leases4(void) {
 
 /* Write all interesting leases to permanent storage. */
 
+/*
+ * hash_foreach() callbacks for write_leases().  The hash tables can be
+ * part way through a resize, so they are walked with hash_foreach()
+ * rather than by looking at their buckets directly.
+ */
+static int write_decls_failed;
+static int decls_written;
+
+static isc_result_t
+write_dynamic_group(const void *name, unsigned len, void *value)
+{
+	struct group_object *gp = (struct group_object *)value;
+
+	if ((gp -> flags & GROUP_OBJECT_DYNAMIC) ||
+	    ((gp -> flags & GROUP_OBJECT_STATIC) &&
+	     (gp -> flags & GROUP_OBJECT_DELETED))) {
+		if (!write_group (gp)) {
+			write_decls_failed = 1;
+			return ISC_R_IOERROR;
+		}
+		++decls_written;
+	}
+	return ISC_R_SUCCESS;
+}
+
+static isc_result_t
+write_deleted_host(const void *name, unsigned len, void *value)
+{
+	struct host_decl *hp = (struct host_decl *)value;
+
+	if (((hp -> flags & HOST_DECL_STATIC) &&
+	     (hp -> flags & HOST_DECL_DELETED))) {
+		if (!write_host (hp)) {
+			write_decls_failed = 1;
+			return ISC_R_IOERROR;
+		}
+		++decls_written;
+	}
+	return ISC_R_SUCCESS;
+}
+
+static isc_result_t
+write_dynamic_host(const void *name, unsigned len, void *value)
+{
+	struct host_decl *hp = (struct host_decl *)value;
+
+	if ((hp -> flags & HOST_DECL_DYNAMIC)) {
+		if (!write_host (hp))
+			++decls_written;
+	}
+	return ISC_R_SUCCESS;
+}
+
 int write_leases ()
 {
-	struct host_decl *hp;
-	struct group_object *gp;
-	struct hash_bucket *hb;
 	struct class *cp;
 	struct collection *colp;
-	int i;
-	int num_written;
 
 	/* write all the dynamically-created class declarations. */
 	if (collections->classes) {
@@ -2459,57 +2973,31 @@ int write_leases ()
 
 	/* Write all the dynamically-created group declarations. */
 	if (group_name_hash) {
-	    num_written = 0;
-	    for (i = 0; i < group_name_hash -> hash_count; i++) {
-		for (hb = group_name_hash -> buckets [i];
-		     hb; hb = hb -> next) {
-			gp = (struct group_object *)hb -> value;
-			if ((gp -> flags & GROUP_OBJECT_DYNAMIC) ||
-			    ((gp -> flags & GROUP_OBJECT_STATIC) &&
-			     (gp -> flags & GROUP_OBJECT_DELETED))) {
-				if (!write_group (gp))
-					return 0;
-				++num_written;
-			}
-		}
-	    }
-	    log_info ("Wrote %d group decls to leases file.", num_written);
+	    write_decls_failed = 0;
+	    decls_written = 0;
+	    group_hash_foreach (group_name_hash, write_dynamic_group);
+	    if (write_decls_failed)
+		return 0;
+	    log_info ("Wrote %d group decls to leases file.", decls_written);
 	}
 
 	/* Write all the deleted host declarations. */
 	if (host_name_hash) {
-	    num_written = 0;
-	    for (i = 0; i < host_name_hash -> hash_count; i++) {
-		for (hb = host_name_hash -> buckets [i];
-		     hb; hb = hb -> next) {
-			hp = (struct host_decl *)hb -> value;
-			if (((hp -> flags & HOST_DECL_STATIC) &&
-			     (hp -> flags & HOST_DECL_DELETED))) {
-				if (!write_host (hp))
-					return 0;
-				++num_written;
-			}
-		}
-	    }
+	    write_decls_failed = 0;
+	    decls_written = 0;
+	    host_hash_foreach (host_name_hash, write_deleted_host);
+	    if (write_decls_failed)
+		return 0;
 	    log_info ("Wrote %d deleted host decls to leases file.",
-		      num_written);
+		      decls_written);
 	}
 
 	/* Write all the new, dynamic host declarations. */
 	if (host_name_hash) {
-	    num_written = 0;
-	    for (i = 0; i < host_name_hash -> hash_count; i++) {
-		for (hb = host_name_hash -> buckets [i];
-		     hb; hb = hb -> next) {
-			hp = (struct host_decl *)hb -> value;
-			if ((hp -> flags & HOST_DECL_DYNAMIC)) {
-				if (!write_host (hp))
-					++num_written;
-			}
-		}
-	    }
+	    decls_written = 0;
+	    host_hash_foreach (host_name_hash, write_dynamic_host);
 	    log_info ("Wrote %d new dynamic host decls to leases file.",
-		      num_written);
+		      decls_written);
 	}
 
 #if defined (FAILOVER_PROTOCOL)
@@ -2790,6 +3278,20 @@ lease_instantiate(const void *key, unsigned len, void *object)
 		lease->rewind_binding_state = FTS_FREE;
 	}
 
+#if defined (FAILOVER_PROTOCOL)
+	/* Carry on numbering changes from where the lease file left off,
+	   and note how far back it goes. */
+	if (lease->pool->failover_peer && lease->fo_seq != 0) {
+		dhcp_failover_state_t *peer = lease->pool->failover_peer;
+
+		if (lease->fo_seq > peer->sequence)
+			peer->sequence = lease->fo_seq;
+		if (peer->sequence_start == 0 ||
+		    lease->fo_seq < peer->sequence_start)
+			peer->sequence_start = lease->fo_seq;
+	}
+#endif
+
 	/* Put the lease on the right queue.  Failure to queue is probably
 	 * due to a bogus binding state.  In such a case, we claim success,
 	 * so that later leases in a hash_foreach are processed, but we
@@ -2842,26 +3344,13 @@ void expire_all_pools ()
 	/* Indicate that we are in the startup phase */
 	server_starting = SS_NOSYNC | SS_QFOLLOW;
 
-#if defined (BINARY_LEASES)
-	/* set up the growth factors for the binary leases.
-	 * We use 100% for free, 50% for active and backup
-	 * 20% for expired, abandoned and reserved
-	 * but no less than 100, 50, and 20.
-	 */
+#if defined (FAILOVER_PROTOCOL)
+	/* Failover balances free leases between the peers one lease at a
+	   time, so pools with a peer get all of their leases up front. */
 	for (s = shared_networks; s; s = s -> next) {
 	    for (p = s -> pools; p != NULL; p = p -> next) {
-		size_t num_f = 100, num_a = 50, num_e = 20;
-		if (p->lease_count > 100) {
-		    num_f = p->lease_count;
-		    num_a = num_f / 2;
-		    num_e = num_f / 5;
-		}
-		lc_init_growth(&p->free, num_f);
-		lc_init_growth(&p->active, num_a);
-		lc_init_growth(&p->expired, num_a);
-		lc_init_growth(&p->abandoned, num_e);
-		lc_init_growth(&p->backup, num_e);
-		lc_init_growth(&p->reserved, num_e);
+		if (p -> failover_peer)
+		    pool_make_all_leases (p);
 	    }
 	}
 #endif
@@ -2869,6 +3358,7 @@ void expire_all_pools ()
 	/* First, go over the hash list and actually put all the leases
 	   on the appropriate lists. */
 	lease_ip_hash_foreach(lease_ip_addr_hash, lease_instantiate);
+	lease_ranges_queued = 1;
 
 	/* Loop through each pool in each shared network and call the
 	 * expiry routine on the pool.  It is no longer safe to follow
@@ -2922,6 +3412,10 @@ void expire_all_pools ()
 #endif
 		    }
 		}
+
+		/* Addresses that have never been used are free too. */
+		p -> lease_count += pool_unmade_leases (p);
+		p -> free_leases += pool_unmade_leases (p);
 	    }
 	}
 
@@ -3047,6 +3541,7 @@ void free_everything(void)
 				  MDL);
 
 	for (lp = collections; lp; lp = lp -> next) {
+	    clear_class_index (lp);
 	    if (lp -> classes) {
 		class_reference (&cn, lp -> classes, MDL);
 		do {
@@ -3101,7 +3596,11 @@ void free_everything(void)
 	    interface_dereference (&interfaces, MDL);
 	}
 
+	lease_ranges_free ();
+
 	/* Subnets are complicated because of the extra links. */
+	subnet_trie_free (&subnet_trie4);
+	subnet_trie_free (&subnet_trie6);
 	if (subnets) {
 	    subnet_reference (&sn, subnets, MDL);
 	    do {
@@ -3221,6 +3720,9 @@ void free_everything(void)
 	relinquish_timeouts ();
 #if defined(DELAYED_ACK)
 	relinquish_ackqueue();
+#if defined(DHCPv6)
+	relinquish_reply6_queue();
+#endif
 #endif
 	trace_free_all ();
 	group_dereference (&root_group, MDL);
@@ -3252,6 +3754,7 @@ void free_everything(void)
 			    option_code_free_hash_table(
 						&universes[i]->code_hash,
 						MDL);
+			option_code_table_free(universes[i]);
 #if 0
 			if (universes [i] -> name > (char *)&end) {
 				foo.c = universes [i] -> name;
@@ -3266,10 +3769,13 @@ void free_everything(void)
 
 	relinquish_free_lease_states ();
 	relinquish_free_pairs ();
+	relinquish_free_option_indexes ();
 	relinquish_free_expressions ();
 	relinquish_free_binding_values ();
+	relinquish_encoded_options ();
 	relinquish_free_option_caches ();
 	relinquish_free_packets ();
+	relinquish_free_arena_chunks ();
 #if defined(COMPACT_LEASES)
 	relinquish_lease_hunks ();
 #endif
@@ -751,6 +751,7 @@ isc_result_t dhcp_lease_lookup (omapi_object_t **lp,
 	omapi_value_t *tv = (omapi_value_t *)0;
 	isc_result_t status;
 	struct lease *lease;
+	struct iaddr addr;
 
 	if (!ref)
 		return DHCP_R_NOKEYS;
@@ -775,9 +776,12 @@ isc_result_t dhcp_lease_lookup (omapi_object_t **lp,
 	status = omapi_get_value_str (ref, id, "ip-address", &tv);
 	if (status == ISC_R_SUCCESS) {
 		lease = (struct lease *)0;
-		lease_ip_hash_lookup(&lease, lease_ip_addr_hash,
-				     tv->value->u.buffer.value,
-				     tv->value->u.buffer.len, MDL);
+		if (tv->value->u.buffer.len <= sizeof(addr.iabuf)) {
+			addr.len = tv->value->u.buffer.len;
+			memcpy(addr.iabuf, tv->value->u.buffer.value,
+			       addr.len);
+			find_lease_by_ip_addr(&lease, addr, MDL);
+		}
 
 		omapi_value_dereference (&tv, MDL);
 
@@ -1499,12 +1503,16 @@ isc_result_t dhcp_host_lookup (omapi_object_t **lp,
 	status = omapi_get_value_str (ref, id, "ip-address", &tv);
 	if (status == ISC_R_SUCCESS) {
 		struct lease *l;
+		struct iaddr addr;
 
 		/* first find the lease for this ip address */
 		l = (struct lease *)0;
-		lease_ip_hash_lookup(&l, lease_ip_addr_hash,
-				     tv->value->u.buffer.value,
-				     tv->value->u.buffer.len, MDL);
+		if (tv->value->u.buffer.len <= sizeof(addr.iabuf)) {
+			addr.len = tv->value->u.buffer.len;
+			memcpy(addr.iabuf, tv->value->u.buffer.value,
+			       addr.len);
+			find_lease_by_ip_addr(&l, addr, MDL);
+		}
 		omapi_value_dereference (&tv, MDL);
 
 		if (!l && !*lp)
@@ -112,7 +112,7 @@ u_int32_t fto_allowed [] = {
 	(FTB_ASSIGNED_IP_ADDRESS | FTB_BINDING_STATUS | FTB_CLIENT_IDENTIFIER |
 	 FTB_CHADDR | FTB_DDNS | FTB_IP_FLAGS | FTB_LEASE_EXPIRY |
 	 FTB_POTENTIAL_EXPIRY | FTB_STOS | FTB_CLTT | FTB_REQUEST_OPTIONS |
-	 FTB_REPLY_OPTIONS), /* 3 BNDUPD */
+	 FTB_REPLY_OPTIONS | FTB_VENDOR_OPTIONS), /* 3 BNDUPD */
 	(FTB_ASSIGNED_IP_ADDRESS | FTB_BINDING_STATUS | FTB_CLIENT_IDENTIFIER |
 	 FTB_CHADDR | FTB_DDNS | FTB_IP_FLAGS | FTB_LEASE_EXPIRY |
 	 FTB_POTENTIAL_EXPIRY | FTB_STOS | FTB_CLTT | FTB_REQUEST_OPTIONS |
@@ -123,7 +123,7 @@ u_int32_t fto_allowed [] = {
 	(FTB_RELATIONSHIP_NAME | FTB_MAX_UNACKED | FTB_RECEIVE_TIMER |
 	 FTB_VENDOR_CLASS | FTB_PROTOCOL_VERSION | FTB_TLS_REPLY |
 	 FTB_REJECT_REASON | FTB_MESSAGE), /* CONNECTACK */
-	0, /* 7 UPDREQALL */
+	FTB_VENDOR_OPTIONS, /* 7 UPDREQALL */
 	0, /* 8 UPDDONE */
 	0, /* 9 UPDREQ */
 	(FTB_SERVER_STATE | FTB_SERVER_FLAGS | FTB_STOS), /* 10 STATE */
@@ -293,6 +293,14 @@ static struct option server_options[] = {
 	{ "bind-local-address6", "f",	&server_universe,  SV_BIND_LOCAL_ADDRESS6, 1 },
 	{ "ping-cltt-secs", "T",	&server_universe,  SV_PING_CLTT_SECS, 1 },
 	{ "ping-timeout-ms", "T",       &server_universe,  SV_PING_TIMEOUT_MS, 1 },
+	{ "log-hash-statistics", "f",	&server_universe,  SV_LOG_HASH_STATISTICS, 1 },
+	{ "ddns-zone-concurrency", "S",	&server_universe,  SV_DDNS_ZONE_CONCURRENCY, 1 },
+	{ "ddns-server-concurrency", "S",	&server_universe,  SV_DDNS_SERVER_CONCURRENCY, 1 },
+#if defined(ENABLE_EXECUTE)
+	{ "execute-concurrency", "S",	&server_universe,  SV_EXECUTE_CONCURRENCY, 1 },
+	{ "execute-queue-depth", "L",	&server_universe,  SV_EXECUTE_QUEUE_DEPTH, 1 },
+	{ "execute-timeout", "T",	&server_universe,  SV_EXECUTE_TIMEOUT, 1 },
+#endif
 	{ NULL, NULL, NULL, 0, 0 }
 };
 
@@ -497,8 +505,8 @@ void initialize_server_option_spaces()
 		 option_code_hash_report(agent_universe.code_hash));
 #endif
 	code = DHO_DHCP_AGENT_OPTIONS;
-	option_code_hash_lookup(&agent_universe.enc_opt,
-				dhcp_universe.code_hash, &code, 0, MDL);
+	option_code_lookup(&agent_universe.enc_opt,
+			   &dhcp_universe, code, MDL);
 
 	/* Set up the server option universe... */
 	server_universe.name = "server";
@@ -548,6 +556,6 @@ void initialize_server_option_spaces()
 	config_universe = &server_universe;
 
 	code = SV_VENDOR_OPTION_SPACE;
-	option_code_hash_lookup(&vendor_cfg_option, server_universe.code_hash,
-				&code, 0, MDL);
+	option_code_lookup(&vendor_cfg_option, &server_universe,
+			   code, MDL);
 }
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+#include "t_bench.h"
+
+/*
+ * Test classification.  check_collection() indexes the match expressions
+ * it can and evaluates the rest, so for each packet the classes it picks
+ * are compared with what evaluating every match expression in turn gives.
+ */
+
+#define BENCH_CLASSES	3000
+#define BENCH_PACKETS	100000
+
+static struct dhcp_packet raw;
+static struct packet packet;
+
+static void
+setup(void) {
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	if (!group_allocate(&root_group, MDL))
+		atf_tc_fail("can't allocate root group");
+}
+
+static void
+parse_config(const char *text) {
+	struct parse *cfile = NULL;
+
+	if (new_parse(&cfile, -1, (char *)text, strlen(text),
+		      "test config", 0) != ISC_R_SUCCESS)
+		atf_tc_fail("can't set up parse");
+	if (conf_file_subparse(cfile, root_group, ROOT_GROUP) !=
+	    ISC_R_SUCCESS)
+		atf_tc_fail("can't parse config");
+	end_parse(&cfile);
+}
+
+static void
+new_packet(const char *vendor, const char *circuit, const char *host) {
+	int i;
+
+	for (i = 0; i < packet.class_count; i++)
+		class_dereference(&packet.classes[i], MDL);
+	if (packet.options != NULL)
+		option_state_dereference(&packet.options, MDL);
+
+	memset(&packet, 0, sizeof(packet));
+	memset(&raw, 0, sizeof(raw));
+	raw.htype = HTYPE_ETHER;
+	raw.hlen = 6;
+	raw.chaddr[0] = 1;
+	packet.raw = &raw;
+	packet.packet_type = DHCPDISCOVER;
+	if (!option_state_allocate(&packet.options, MDL))
+		atf_tc_fail("can't allocate options");
+
+	if (vendor != NULL &&
+	    !save_option_buffer(&dhcp_universe, packet.options, NULL,
+				(unsigned char *)vendor, strlen(vendor),
+				DHO_VENDOR_CLASS_IDENTIFIER, 0))
+		atf_tc_fail("can't save vendor class");
+	if (circuit != NULL &&
+	    !save_option_buffer(&agent_universe, packet.options, NULL,
+				(unsigned char *)circuit, strlen(circuit),
+				RAI_CIRCUIT_ID, 0))
+		atf_tc_fail("can't save circuit id");
+	if (host != NULL &&
+	    !save_option_buffer(&dhcp_universe, packet.options, NULL,
+				(unsigned char *)host, strlen(host),
+				DHO_HOST_NAME, 0))
+		atf_tc_fail("can't save host name");
+}
+
+/* The classes without a submatch that evaluating each match expression
+   in turn puts the packet in. */
+static int
+interpret(struct class **found) {
+	struct class *class;
+	int count = 0, ignorep;
+
+	for (class = default_collection.classes; class; class = class->nic) {
+		if (class->expr == NULL || class->submatch != NULL)
+			continue;
+		if (evaluate_boolean_expression_result(&ignorep, &packet,
+						       NULL, NULL,
+						       packet.options, NULL,
+						       &global_scope,
+						       class->expr) &&
+		    count < PACKET_MAX_CLASSES)
+			found[count++] = class;
+	}
+	return count;
+}
+
+static void
+check_classes(const char *expect) {
+	char names[256];
+	int i;
+
+	check_collection(&packet, NULL, &default_collection);
+
+	names[0] = '\0';
+	for (i = 0; i < packet.class_count; i++) {
+		if (i > 0)
+			strcat(names, " ");
+		strcat(names, packet.classes[i]->name != NULL ?
+		       packet.classes[i]->name :
+		       packet.classes[i]->superclass->name);
+	}
+	ATF_CHECK_MSG(strcmp(names, expect) == 0,
+		      "got \"%s\", expected \"%s\"", names, expect);
+}
+
+ATF_TC(class_index_match);
+ATF_TC_HEAD(class_index_match, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify indexed and evaluated "
+			  "classes match in collection order");
+}
+
+ATF_TC_BODY(class_index_match, tc)
+{
+	setup();
+	parse_config(
+	    "class \"msft\" {\n"
+	    "  match if substring(option vendor-class-identifier, 0, 4)"
+	    " = \"MSFT\";\n"
+	    "}\n"
+	    "class \"named\" {\n"
+	    "  match if exists host-name;\n"
+	    "}\n"
+	    "class \"pxe\" {\n"
+	    "  match if \"PXEClient\" = option vendor-class-identifier;\n"
+	    "}\n"
+	    "class \"ports\" {\n"
+	    "  match if option agent.circuit-id = \"port1\" or\n"
+	    "           option agent.circuit-id = \"port2\" or\n"
+	    "           option vendor-class-identifier = \"PXEClient\";\n"
+	    "}\n"
+	    "class \"named-msft\" {\n"
+	    "  match if substring(option vendor-class-identifier, 0, 4)"
+	    " = \"MSFT\" and exists host-name;\n"
+	    "}\n"
+	    "class \"by-circuit\" {\n"
+	    "  match option agent.circuit-id;\n"
+	    "}\n"
+	    "subclass \"by-circuit\" \"port2\";\n");
+
+	new_packet("MSFT 5.0", NULL, NULL);
+	check_classes("msft");
+
+	new_packet("MSFT 5.0", "port3", "pc");
+	check_classes("msft named named-msft");
+
+	new_packet("PXEClient", NULL, "pc");
+	check_classes("named pxe ports");
+
+	new_packet("PXEClient:Arch:00000", "port2", NULL);
+	check_classes("ports by-circuit");
+
+	new_packet("MSF", "port", NULL);
+	check_classes("");
+
+	/* Adding a class must be seen by the next packet. */
+	parse_config(
+	    "class \"late\" {\n"
+	    "  match if option vendor-class-identifier = \"MSF\";\n"
+	    "}\n");
+	check_classes("late");
+}
+
+ATF_TC(class_index_bench);
+ATF_TC_HEAD(class_index_bench, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Time classifying packets against "
+			  "3000 classes");
+}
+
+ATF_TC_BODY(class_index_bench, tc)
+{
+	struct class *found[PACKET_MAX_CLASSES];
+	struct timeval start;
+	char *config, *cp, vendor[32], circuit[32];
+	int i, j, count, matched = 0;
+
+	BENCH_REQUIRE();
+	setup();
+
+	/* Half the classes look at a prefix of the vendor class, half at
+	   the circuit id, as a site classifying by both would have. */
+	config = dmalloc(BENCH_CLASSES * 128, MDL);
+	ATF_REQUIRE(config != NULL);
+	cp = config;
+	for (i = 0; i < BENCH_CLASSES; i += 2) {
+		cp += sprintf(cp, "class \"v%d\" { match if substring("
+			      "option vendor-class-identifier, 0, %d) = "
+			      "\"vendor%04d\"; }\n", i, 10, i);
+		cp += sprintf(cp, "class \"c%d\" { match if "
+			      "option agent.circuit-id = \"port%d\"; }\n",
+			      i + 1, i + 1);
+	}
+	parse_config(config);
+	dfree(config, MDL);
+
+	/* Check the index against the interpreter first. */
+	for (i = 0; i < 2000; i++) {
+		sprintf(vendor, "vendor%04d:x", (i * 7) % (BENCH_CLASSES + 10));
+		sprintf(circuit, "port%d", (i * 13) % (BENCH_CLASSES + 10));
+		new_packet(vendor, circuit, NULL);
+		count = interpret(found);
+		check_collection(&packet, NULL, &default_collection);
+		ATF_REQUIRE_EQ(packet.class_count, count);
+		for (j = 0; j < count; j++)
+			ATF_REQUIRE(packet.classes[j] == found[j]);
+	}
+
+	new_packet("vendor1234:x", "port1235", NULL);
+	bench_start(&start);
+	for (i = 0; i < BENCH_PACKETS / 100; i++)
+		matched += interpret(found);
+	bench_report(&start, "evaluate %d classes for %d packets",
+		     BENCH_CLASSES, BENCH_PACKETS / 100);
+
+	bench_start(&start);
+	for (i = 0; i < BENCH_PACKETS; i++) {
+		check_collection(&packet, NULL, &default_collection);
+		for (j = 0; j < packet.class_count; j++)
+			class_dereference(&packet.classes[j], MDL);
+		packet.class_count = 0;
+	}
+	bench_report(&start, "classify %d packets", BENCH_PACKETS);
+	ATF_CHECK_EQ(matched, 2 * (BENCH_PACKETS / 100));
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, class_index_match);
+	ATF_TP_ADD_TC(tp, class_index_bench);
+
+	return (atf_no_error());
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+/*
+ * Test that DHCPv6 replies which follow a lease file write are held
+ * until the file is committed.
+ *
+ * The replies are sent over the loopback interface to a socket of our
+ * own.  The lease file is a temporary file with a buffer larger than
+ * anything written to it, so nothing reaches the file until
+ * commit_leases() flushes it.
+ */
+
+#if defined (DHCPv6) && defined (DELAYED_ACK)
+extern FILE *db_file;
+
+static struct interface_info *ifp;
+static struct sockaddr_in6 client;
+static int client_fd = -1;
+
+/* Set up the interface, the client socket and the lease file, or skip
+   the test if there's no IPv6 loopback to send over. */
+static void
+reply6_setup(void) {
+	socklen_t len;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+	omapi_init();
+	dhcp_common_objects_setup();
+	gettimeofday(&cur_tv, NULL);
+	cur_time = cur_tv.tv_sec;
+
+	client_fd = socket(AF_INET6, SOCK_DGRAM, 0);
+	if (client_fd < 0)
+		atf_tc_skip("no IPv6 sockets");
+	memset(&client, 0, sizeof(client));
+	client.sin6_family = AF_INET6;
+	client.sin6_addr = in6addr_loopback;
+	if (bind(client_fd, (struct sockaddr *)&client, sizeof(client)) < 0)
+		atf_tc_skip("no IPv6 loopback");
+	len = sizeof(client);
+	ATF_REQUIRE(getsockname(client_fd, (struct sockaddr *)&client,
+				&len) == 0);
+
+	ifp = NULL;
+	ATF_REQUIRE(interface_allocate(&ifp, MDL) == ISC_R_SUCCESS);
+	strcpy(ifp->name, "lo");
+	ifp->wfdesc = socket(AF_INET6, SOCK_DGRAM, 0);
+	ATF_REQUIRE(ifp->wfdesc >= 0);
+
+	db_file = tmpfile();
+	ATF_REQUIRE(db_file != NULL);
+	ATF_REQUIRE(setvbuf(db_file, NULL, _IOFBF, 8192) == 0);
+}
+
+/* Write to the lease file and queue a reply marked with the given byte,
+   as dhcpv6() does after building a reply that called write_ia(). */
+static void
+reply6_queue(u_int8_t mark) {
+	struct packet packet;
+	struct data_string reply;
+
+	fprintf(db_file, "ia-na \"%c\" { }\n", mark);
+
+	memset(&packet, 0, sizeof(packet));
+	packet.interface = ifp;
+	packet.client_addr.len = 16;
+	memcpy(packet.client_addr.iabuf, &in6addr_loopback, 16);
+
+	memset(&reply, 0, sizeof(reply));
+	ATF_REQUIRE(buffer_allocate(&reply.buffer, 4, MDL));
+	reply.data = reply.buffer->data;
+	reply.len = 4;
+	reply.buffer->data[0] = DHCPV6_REPLY;
+	reply.buffer->data[1] = mark;
+
+	delayed_reply6_enqueue(&packet, &client, &reply);
+	data_string_forget(&reply, MDL);
+}
+
+/* Return the mark of the next reply the client has, or 0 if none. */
+static u_int8_t
+reply6_received(void) {
+	unsigned char buf[16];
+
+	if (recv(client_fd, buf, sizeof(buf), MSG_DONTWAIT) != 4)
+		return (0);
+	ATF_CHECK_EQ(buf[0], DHCPV6_REPLY);
+	return (buf[1]);
+}
+
+/* How much of the lease file has been committed to it. */
+static off_t
+committed(void) {
+	struct stat st;
+
+	ATF_REQUIRE(fstat(fileno(db_file), &st) == 0);
+	return (st.st_size);
+}
+
+/* Wait for the loopback to deliver what was sent. */
+static void
+reply6_wait(void) {
+	struct pollfd pfd;
+
+	pfd.fd = client_fd;
+	pfd.events = POLLIN;
+	(void) poll(&pfd, 1, 1000);
+}
+#endif
+
+ATF_TC(reply6_held_until_commit);
+
+ATF_TC_HEAD(reply6_held_until_commit, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that replies "
+			  "are held until the lease file is committed, and then "
+			  "sent in order.");
+}
+
+ATF_TC_BODY(reply6_held_until_commit, tc)
+{
+#if defined (DHCPv6) && defined (DELAYED_ACK)
+	struct timeval when;
+
+	reply6_setup();
+	max_outstanding_acks = 2;
+
+	/* Two replies are within the limit and both are held. */
+	reply6_queue('a');
+	reply6_queue('b');
+	reply6_wait();
+	ATF_CHECK_EQ(reply6_received(), 0);
+	ATF_CHECK_EQ(committed(), 0);
+
+	/* When the timer goes off the file is committed and they are sent. */
+	when = cur_tv;
+	ATF_REQUIRE(process_outstanding_timeouts(&when) == &when);
+	cur_tv = when;
+	cur_time = cur_tv.tv_sec;
+	process_outstanding_timeouts(NULL);
+	ATF_CHECK(committed() > 0);
+	reply6_wait();
+	ATF_CHECK_EQ(reply6_received(), 'a');
+	ATF_CHECK_EQ(reply6_received(), 'b');
+	ATF_CHECK_EQ(reply6_received(), 0);
+
+	/* One past the limit flushes the lot without waiting. */
+	reply6_queue('c');
+	reply6_queue('d');
+	reply6_wait();
+	ATF_CHECK_EQ(reply6_received(), 0);
+	reply6_queue('e');
+	reply6_wait();
+	ATF_CHECK_EQ(reply6_received(), 'c');
+	ATF_CHECK_EQ(reply6_received(), 'd');
+	ATF_CHECK_EQ(reply6_received(), 'e');
+
+	/* Nothing is left queued, or waiting to be. */
+	ATF_CHECK(process_outstanding_timeouts(&when) == NULL);
+#else
+	atf_tc_skip("DHCPv6 or delayed ack is disabled");
+#endif
+}
+
+ATF_TC(reply6_no_delayed_ack);
+
+ATF_TC_HEAD(reply6_no_delayed_ack, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that with "
+			  "delayed-ack 0 each reply is committed and sent at "
+			  "once.");
+}
+
+ATF_TC_BODY(reply6_no_delayed_ack, tc)
+{
+#if defined (DHCPv6) && defined (DELAYED_ACK)
+	struct timeval when;
+	off_t size;
+
+	reply6_setup();
+	max_outstanding_acks = 0;
+
+	reply6_queue('a');
+	size = committed();
+	ATF_CHECK(size > 0);
+	reply6_wait();
+	ATF_CHECK_EQ(reply6_received(), 'a');
+	ATF_CHECK_EQ(reply6_received(), 0);
+
+	reply6_queue('b');
+	ATF_CHECK(committed() > size);
+	reply6_wait();
+	ATF_CHECK_EQ(reply6_received(), 'b');
+
+	/* No timer was needed. */
+	ATF_CHECK(process_outstanding_timeouts(&when) == NULL);
+#else
+	atf_tc_skip("DHCPv6 or delayed ack is disabled");
+#endif
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, reply6_held_until_commit);
+	ATF_TP_ADD_TC(tp, reply6_no_delayed_ack);
+
+	return (atf_no_error());
+}
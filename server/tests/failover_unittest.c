@@ -0,0 +1,1241 @@
+/*
+ * Copyright (C) 2017 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+#include "t_bench.h"
+
+/*
+ * Test decoding of failover messages as they come off the wire.
+ *
+ * Each message is given as it appears on the connection, less the
+ * two-byte length, which the link reads first.  Variable length options
+ * are expected to be left where they are in the buffer.
+ */
+
+#if defined(FAILOVER_PROTOCOL)
+/* A BNDUPD for 10.0.0.5, with an option we don't know about. */
+static const u_int8_t bndupd[] = {
+	FTM_BNDUPD, 12,			/* type, payload offset */
+	0x5f, 0x00, 0x00, 0x00,		/* time */
+	0x00, 0x00, 0x00, 0x07,		/* xid */
+	0, FTO_ASSIGNED_IP_ADDRESS, 0, 4, 10, 0, 0, 5,
+	0, FTO_BINDING_STATUS, 0, 1, FTS_ACTIVE,
+	0, FTO_CHADDR, 0, 7, 1, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+	0, FTO_CLIENT_IDENTIFIER, 0, 3, 1, 2, 3,
+	0, 99, 0, 2, 0xab, 0xcd,
+	0, FTO_LEASE_EXPIRY, 0, 4, 0x00, 0x00, 0x0e, 0x10,
+	0, FTO_IP_FLAGS, 0, 2, 0x00, 0x02,
+};
+
+/* A CONNECT with a relationship name, and an option that the
+   message type doesn't use and so shouldn't be stored. */
+static const u_int8_t connect_msg[] = {
+	FTM_CONNECT, 12,
+	0x5f, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x01,
+	0, FTO_RELATIONSHIP_NAME, 0, 4, 'p', 'e', 'e', 'r',
+	0, FTO_MAX_UNACKED, 0, 4, 0x00, 0x00, 0x00, 0x0a,
+	0, FTO_CLIENT_IDENTIFIER, 0, 2, 9, 9,
+};
+#endif
+
+ATF_TC(parse_bndupd);
+
+ATF_TC_HEAD(parse_bndupd, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "a BNDUPD is decoded in place.");
+}
+
+ATF_TC_BODY(parse_bndupd, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	failover_message_t msg;
+	u_int8_t buf[sizeof bndupd];
+	static const u_int8_t addr[] = { 10, 0, 0, 5 };
+
+	memcpy(buf, bndupd, sizeof buf);
+	memset(&msg, 0, sizeof msg);
+
+	if (dhcp_failover_parse_message(&msg, buf, sizeof buf) !=
+	    ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: BNDUPD not decoded %s:%d", MDL);
+	}
+
+	if (msg.type != FTM_BNDUPD || msg.xid != 7 ||
+	    msg.time != 0x5f000000) {
+		atf_tc_fail("ERROR: bad header %s:%d", MDL);
+	}
+
+	if (msg.options_present !=
+	    (FTB_ASSIGNED_IP_ADDRESS | FTB_BINDING_STATUS | FTB_CHADDR |
+	     FTB_CLIENT_IDENTIFIER | FTB_LEASE_EXPIRY | FTB_IP_FLAGS)) {
+		atf_tc_fail("ERROR: options present %x %s:%d",
+			    msg.options_present, MDL);
+	}
+
+	if (memcmp(&msg.assigned_addr, addr, sizeof addr) != 0 ||
+	    msg.binding_status != FTS_ACTIVE ||
+	    msg.expiry != 3600 || msg.ip_flags != 2) {
+		atf_tc_fail("ERROR: bad fixed option value %s:%d", MDL);
+	}
+
+	/* The variable length options should point into the buffer. */
+	if (msg.chaddr.count != 7 || msg.chaddr.data != &buf[27] ||
+	    memcmp(msg.chaddr.data, &bndupd[27], 7) != 0) {
+		atf_tc_fail("ERROR: bad chaddr %s:%d", MDL);
+	}
+
+	if (msg.client_identifier.count != 3 ||
+	    msg.client_identifier.data != &buf[38]) {
+		atf_tc_fail("ERROR: bad client identifier %s:%d", MDL);
+	}
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(parse_connect);
+
+ATF_TC_HEAD(parse_connect, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "options a message type doesn't use are skipped.");
+}
+
+ATF_TC_BODY(parse_connect, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	failover_message_t msg;
+	u_int8_t buf[sizeof connect_msg];
+
+	memcpy(buf, connect_msg, sizeof buf);
+	memset(&msg, 0, sizeof msg);
+
+	if (dhcp_failover_parse_message(&msg, buf, sizeof buf) !=
+	    ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: CONNECT not decoded %s:%d", MDL);
+	}
+
+	if (msg.options_present !=
+	    (FTB_RELATIONSHIP_NAME | FTB_MAX_UNACKED)) {
+		atf_tc_fail("ERROR: options present %x %s:%d",
+			    msg.options_present, MDL);
+	}
+
+	if (msg.relationship_name.count != 4 ||
+	    memcmp(msg.relationship_name.data, "peer", 4) != 0 ||
+	    msg.max_unacked != 10 || msg.client_identifier.data != NULL) {
+		atf_tc_fail("ERROR: bad option value %s:%d", MDL);
+	}
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(parse_bad);
+
+ATF_TC_HEAD(parse_bad, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "malformed messages are refused.");
+}
+
+ATF_TC_BODY(parse_bad, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	failover_message_t msg;
+	u_int8_t buf[sizeof bndupd + 5];
+
+	/* Option data running off the end. */
+	memcpy(buf, bndupd, sizeof bndupd);
+	memset(&msg, 0, sizeof msg);
+	if (dhcp_failover_parse_message(&msg, buf, sizeof bndupd - 1) ==
+	    ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: truncated message accepted %s:%d", MDL);
+	}
+
+	/* The binding status a second time. */
+	memcpy(buf, bndupd, sizeof bndupd);
+	memcpy(buf + sizeof bndupd, &bndupd[18], 5);
+	memset(&msg, 0, sizeof msg);
+	if (dhcp_failover_parse_message(&msg, buf, sizeof buf) ==
+	    ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: duplicate option accepted %s:%d", MDL);
+	}
+
+	/* A payload offset past the end of the message. */
+	memcpy(buf, bndupd, sizeof bndupd);
+	buf[1] = 200;
+	memset(&msg, 0, sizeof msg);
+	if (dhcp_failover_parse_message(&msg, buf, sizeof bndupd) ==
+	    ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: bad payload offset accepted %s:%d", MDL);
+	}
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+#define BENCH_MESSAGES 1000000
+
+ATF_TC(parse_bench);
+
+ATF_TC_HEAD(parse_bench, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Time decoding BNDUPDs in place, "
+			  "and with each variable length option copied out "
+			  "as the link used to.");
+}
+
+#if defined(FAILOVER_PROTOCOL)
+/* Copy an option out into a buffer of its own, and free it again. */
+static void
+copy_option(failover_option_t *option)
+{
+	u_int8_t *copy;
+
+	if (option->count == 0)
+		return;
+	copy = dmalloc(option->count, MDL);
+	if (copy == NULL) {
+		atf_tc_fail("ERROR: no memory %s:%d", MDL);
+	}
+	memcpy(copy, option->data, option->count);
+	dfree(copy, MDL);
+}
+#endif
+
+ATF_TC_BODY(parse_bench, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	failover_message_t msg;
+	u_int8_t buf[sizeof bndupd];
+	struct timeval start;
+	int i;
+
+	BENCH_REQUIRE();
+
+	bench_start(&start);
+	for (i = 0; i < BENCH_MESSAGES; i++) {
+		memcpy(buf, bndupd, sizeof buf);
+		memset(&msg, 0, sizeof msg);
+		if (dhcp_failover_parse_message(&msg, buf, sizeof buf) !=
+		    ISC_R_SUCCESS) {
+			atf_tc_fail("ERROR: BNDUPD not decoded %s:%d", MDL);
+		}
+	}
+	bench_report(&start, "decode %d BNDUPDs in place", BENCH_MESSAGES);
+
+	bench_start(&start);
+	for (i = 0; i < BENCH_MESSAGES; i++) {
+		memcpy(buf, bndupd, sizeof buf);
+		memset(&msg, 0, sizeof msg);
+		if (dhcp_failover_parse_message(&msg, buf, sizeof buf) !=
+		    ISC_R_SUCCESS) {
+			atf_tc_fail("ERROR: BNDUPD not decoded %s:%d", MDL);
+		}
+		copy_option(&msg.chaddr);
+		copy_option(&msg.client_identifier);
+	}
+	bench_report(&start, "decode %d BNDUPDs and copy options",
+		     BENCH_MESSAGES);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(update_window);
+
+ATF_TC_HEAD(update_window, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "the update window shrinks while acks are slow "
+			  "and grows again while they are prompt.");
+}
+
+#if defined(FAILOVER_PROTOCOL)
+/* Time an update that was acked usec microseconds after it was sent. */
+static void
+rtt_sample(dhcp_failover_state_t *state, long usec)
+{
+	state->rtt_xid = 1;
+	state->rtt_sent.tv_sec = cur_tv.tv_sec - 1;
+	state->rtt_sent.tv_usec = cur_tv.tv_usec + 1000000 - usec;
+	dhcp_failover_update_rtt(state);
+	if (state->rtt_xid != 0) {
+		atf_tc_fail("ERROR: update still timed %s:%d", MDL);
+	}
+}
+#endif
+
+ATF_TC_BODY(update_window, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t state;
+	u_int32_t window, last;
+	int i;
+
+	memset(&state, 0, sizeof state);
+	state.partner.max_flying_updates = 100;
+	state.me.max_flying_updates = 20;
+	cur_tv.tv_sec = 1000;
+	cur_tv.tv_usec = 0;
+
+	/* Until something is measured the peer's limit applies. */
+	if (dhcp_failover_update_window(&state) != 100) {
+		atf_tc_fail("ERROR: window %u before any sample %s:%d",
+			    dhcp_failover_update_window(&state), MDL);
+	}
+
+	/* Prompt acks can't open it beyond the peer's limit. */
+	for (i = 0; i < 10; i++)
+		rtt_sample(&state, 1000);
+	if (state.rtt_min != 1000 || state.rtt != 1000 ||
+	    dhcp_failover_update_window(&state) != 100) {
+		atf_tc_fail("ERROR: window %u rtt %u/%u when prompt %s:%d",
+			    dhcp_failover_update_window(&state),
+			    state.rtt, state.rtt_min, MDL);
+	}
+
+	/* Slow acks cut it by a quarter a sample, down to half of our
+	   own max-unacked-updates. */
+	rtt_sample(&state, 200000);
+	if (dhcp_failover_update_window(&state) != 75) {
+		atf_tc_fail("ERROR: window %u after a slow ack %s:%d",
+			    dhcp_failover_update_window(&state), MDL);
+	}
+	last = 75;
+	for (i = 0; i < 20; i++) {
+		rtt_sample(&state, 200000);
+		window = dhcp_failover_update_window(&state);
+		if (window > last) {
+			atf_tc_fail("ERROR: window grew to %u while slow %s:%d",
+				    window, MDL);
+		}
+		last = window;
+	}
+	if (last != 10) {
+		atf_tc_fail("ERROR: window %u after slow acks %s:%d",
+			    last, MDL);
+	}
+
+	/* Once the smoothed time comes back down it opens an update at
+	   a time. */
+	for (i = 0; i < 100 && last == 10; i++) {
+		rtt_sample(&state, 1000);
+		last = dhcp_failover_update_window(&state);
+	}
+	if (last != 11) {
+		atf_tc_fail("ERROR: window %u as acks speed up %s:%d",
+			    last, MDL);
+	}
+	for (i = 0; i < 5; i++) {
+		rtt_sample(&state, 1000);
+		window = dhcp_failover_update_window(&state);
+		if (window != last + 1) {
+			atf_tc_fail("ERROR: window went from %u to %u %s:%d",
+				    last, window, MDL);
+		}
+		last = window;
+	}
+
+	/* A sample from a clock that was stepped back is ignored. */
+	window = state.update_window;
+	state.rtt_xid = 1;
+	state.rtt_sent.tv_sec = cur_tv.tv_sec + 10;
+	state.rtt_sent.tv_usec = 0;
+	dhcp_failover_update_rtt(&state);
+	if (state.rtt_xid != 0 || state.update_window != window) {
+		atf_tc_fail("ERROR: stepped clock changed window %s:%d", MDL);
+	}
+
+	/* The floor never lifts the window over the peer's limit. */
+	state.partner.max_flying_updates = 4;
+	for (i = 0; i < 10; i++)
+		rtt_sample(&state, 200000);
+	if (dhcp_failover_update_window(&state) != 4) {
+		atf_tc_fail("ERROR: window %u over a limit of 4 %s:%d",
+			    dhcp_failover_update_window(&state), MDL);
+	}
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(connection_cork);
+
+ATF_TC_HEAD(connection_cork, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "a corked connection writes what it was given "
+			  "in one piece when the last cork is removed.");
+}
+
+#if defined(FAILOVER_PROTOCOL)
+/* The lease file, which db.c doesn't export; acks wait for it to be
+   committed. */
+extern FILE *db_file;
+
+/* A connection to one end of a socket pair, and the other end. */
+static omapi_connection_object_t *
+socket_connection(int *peer)
+{
+	omapi_connection_object_t *c = NULL;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ||
+	    fcntl(sv[1], F_SETFL, O_NONBLOCK) < 0) {
+		atf_tc_fail("ERROR: no socket pair %s:%d", MDL);
+	}
+	if (omapi_connection_allocate(&c, MDL) != ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: no connection %s:%d", MDL);
+	}
+	c->socket = sv[0];
+	c->state = omapi_connection_connected;
+	*peer = sv[1];
+	return c;
+}
+
+static void
+socket_connection_close(omapi_connection_object_t **c, int peer)
+{
+	close((*c)->socket);
+	close(peer);
+	(*c)->state = omapi_connection_closed;
+	omapi_connection_dereference(c, MDL);
+}
+#endif
+
+ATF_TC_BODY(connection_cork, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	omapi_connection_object_t *c;
+	omapi_object_t *h;
+	unsigned char out[20], in[sizeof out + 1];
+	int peer, i;
+
+	for (i = 0; i < sizeof out; i++)
+		out[i] = i;
+
+	omapi_init();
+	c = socket_connection(&peer);
+	h = (omapi_object_t *)c;
+
+	omapi_connection_cork(h);
+	omapi_connection_cork(h);
+	omapi_connection_copyin(h, out, 10);
+	if (omapi_connection_uncork(h) != ISC_R_SUCCESS ||
+	    recv(peer, in, sizeof in, 0) != -1) {
+		atf_tc_fail("ERROR: inner uncork wrote %s:%d", MDL);
+	}
+	omapi_connection_copyin(h, &out[10], 10);
+	if (omapi_connection_uncork(h) != ISC_R_SUCCESS ||
+	    c->out_bytes != 0) {
+		atf_tc_fail("ERROR: last uncork left %u bytes %s:%d",
+			    c->out_bytes, MDL);
+	}
+	if (recv(peer, in, sizeof in, 0) != sizeof out ||
+	    memcmp(in, out, sizeof out) != 0) {
+		atf_tc_fail("ERROR: bad data written %s:%d", MDL);
+	}
+
+	if (omapi_connection_uncork(h) != ISC_R_UNEXPECTED) {
+		atf_tc_fail("ERROR: unmatched uncork accepted %s:%d", MDL);
+	}
+
+	socket_connection_close(&c, peer);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(send_acks_write);
+
+ATF_TC_HEAD(send_acks_write, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "the acks sent together go out in one write.");
+}
+
+ATF_TC_BODY(send_acks_write, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	omapi_connection_object_t *c;
+	dhcp_failover_link_t *link = NULL;
+	dhcp_failover_state_t *state = NULL;
+	failover_message_t *msg[2];
+	unsigned char in[64];
+	int peer, i;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	omapi_init();
+	dhcp_db_objects_setup();
+	db_file = tmpfile();
+	dont_use_fsync = 1;
+
+	c = socket_connection(&peer);
+	if (dhcp_failover_link_allocate(&link, MDL) != ISC_R_SUCCESS ||
+	    dhcp_failover_state_allocate(&state, MDL) != ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: can't allocate failover objects %s:%d",
+			    MDL);
+	}
+	omapi_object_reference(&link->outer, (omapi_object_t *)c, MDL);
+	omapi_object_reference(&c->inner, (omapi_object_t *)link, MDL);
+	dhcp_failover_link_reference(&state->link_to_peer, link, MDL);
+
+	/* Acks are sent when half of the peer's window is waiting. */
+	state->partner.max_flying_updates = 4;
+	for (i = 0; i < 2; i++) {
+		msg[i] = dmalloc(sizeof *msg[i], MDL);
+		msg[i]->refcnt = 1;
+		msg[i]->xid = 21 + i;
+		dhcp_failover_queue_ack(state, msg[i]);
+	}
+	if (state->pending_acks != 0 || state->acks_sent != 2) {
+		atf_tc_fail("ERROR: %d acks pending, %u sent %s:%d",
+			    state->pending_acks, state->acks_sent, MDL);
+	}
+
+	/* Two BNDACKs, each a header and the assigned address. */
+	if (recv(peer, in, sizeof in, 0) != 40 ||
+	    getUShort(&in[0]) != 20 || in[2] != FTM_BNDACK ||
+	    getULong(&in[8]) != 21 ||
+	    getUShort(&in[20]) != 20 || in[22] != FTM_BNDACK ||
+	    getULong(&in[28]) != 22) {
+		atf_tc_fail("ERROR: acks not written together %s:%d", MDL);
+	}
+
+	for (i = 0; i < 2; i++)
+		dfree(msg[i], MDL);
+	dhcp_failover_state_dereference(&state, MDL);
+	dhcp_failover_link_dereference(&link, MDL);
+	socket_connection_close(&c, peer);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(update_queue_checkpoint);
+
+ATF_TC_HEAD(update_queue_checkpoint, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "an update request all with a checkpoint queues "
+			  "only the leases changed since, unless the "
+			  "checkpoint can't be trusted.");
+}
+
+#if defined(FAILOVER_PROTOCOL)
+/* Give a message the sequence number seq, in the 14 bytes at buf. */
+static void
+put_sequence(failover_message_t *msg, u_int8_t *buf, isc_uint64_t seq)
+{
+	putULong(buf, FTV_ISC_ENTERPRISE);
+	buf[4] = FTV_SEQUENCE;
+	buf[5] = 8;
+	putULong(&buf[6], (u_int32_t)(seq >> 32));
+	putULong(&buf[10], (u_int32_t)seq);
+	msg->options_present |= FTB_VENDOR_OPTIONS;
+	msg->vendor_options.count = 14;
+	msg->vendor_options.data = buf;
+}
+
+/* An UPDREQALL, carrying the checkpoint since unless it's zero. */
+static void
+updreqall(failover_message_t *msg, u_int8_t *buf, isc_uint64_t since)
+{
+	memset(msg, 0, sizeof *msg);
+	msg->type = FTM_UPDREQALL;
+	if (since != 0)
+		put_sequence(msg, buf, since);
+}
+
+/* Empty the update queue, returning a bit for each of the leases that
+   was on it. */
+static unsigned
+update_queue_take(dhcp_failover_state_t *state, struct lease **leases)
+{
+	struct lease *lp = NULL, *next = NULL;
+	unsigned queued = 0;
+	int i;
+
+	if (state->send_update_done != NULL)
+		lease_dereference(&state->send_update_done, MDL);
+	if (state->update_queue_head != NULL) {
+		lease_reference(&lp, state->update_queue_head, MDL);
+		lease_dereference(&state->update_queue_head, MDL);
+		lease_dereference(&state->update_queue_tail, MDL);
+	}
+	while (lp != NULL) {
+		for (i = 0; leases[i] != NULL; i++) {
+			if (leases[i] == lp)
+				queued |= 1 << i;
+		}
+		lp->flags &= ~ON_UPDATE_QUEUE;
+		if (lp->next_pending != NULL) {
+			lease_reference(&next, lp->next_pending, MDL);
+			lease_dereference(&lp->next_pending, MDL);
+		}
+		lease_dereference(&lp, MDL);
+		if (next != NULL) {
+			lease_reference(&lp, next, MDL);
+			lease_dereference(&next, MDL);
+		}
+	}
+	return queued;
+}
+#endif
+
+ATF_TC_BODY(update_queue_checkpoint, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t *state = NULL;
+	struct shared_network *share = NULL;
+	struct pool *pool = NULL;
+	struct lease *leases[7];
+	failover_message_t msg;
+	u_int8_t buf[14];
+	unsigned queued;
+	int i;
+
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	cur_time = 1000;
+
+	if (dhcp_failover_state_allocate(&state, MDL) != ISC_R_SUCCESS ||
+	    shared_network_allocate(&share, MDL) != ISC_R_SUCCESS ||
+	    pool_allocate(&pool, MDL) != ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: can't allocate %s:%d", MDL);
+	}
+	dhcp_failover_state_reference(&pool->failover_peer, state, MDL);
+	pool_reference(&share->pools, pool, MDL);
+	shared_network_reference(&shared_networks, share, MDL);
+
+	/* Five leases changed in turn, the peer having acked all but the
+	   first change, and one that hasn't changed since it was loaded. */
+	memset(leases, 0, sizeof leases);
+	for (i = 0; i < 6; i++) {
+		if (lease_allocate(&leases[i], MDL) != ISC_R_SUCCESS) {
+			atf_tc_fail("ERROR: can't allocate lease %s:%d", MDL);
+		}
+		pool_reference(&leases[i]->pool, pool, MDL);
+		leases[i]->binding_state = FTS_ACTIVE;
+		leases[i]->sort_time = i;
+		if (i < 5)
+			leases[i]->fo_seq = dhcp_failover_next_sequence(state);
+		LEASE_INSERTP(&pool->active, leases[i]);
+	}
+	leases[0]->tstp = 10;
+	if (state->sequence_start != leases[0]->fo_seq ||
+	    state->sequence != leases[4]->fo_seq) {
+		atf_tc_fail("ERROR: numbering not started %s:%d", MDL);
+	}
+
+	/* A checkpoint we can use: the later changes and the unacked. */
+	updreqall(&msg, buf, leases[2]->fo_seq);
+	dhcp_failover_process_update_request_all(state, &msg);
+	queued = update_queue_take(state, leases);
+	if (queued != 0x19) {
+		atf_tc_fail("ERROR: queued %x from a checkpoint %s:%d",
+			    queued, MDL);
+	}
+
+	/* Up to date, apart from the unacked. */
+	updreqall(&msg, buf, leases[4]->fo_seq);
+	dhcp_failover_process_update_request_all(state, &msg);
+	queued = update_queue_take(state, leases);
+	if (queued != 0x01) {
+		atf_tc_fail("ERROR: queued %x when up to date %s:%d",
+			    queued, MDL);
+	}
+
+	/* No checkpoint, one older than anything we have, and one we
+	   haven't got to: everything. */
+	updreqall(&msg, buf, 0);
+	dhcp_failover_process_update_request_all(state, &msg);
+	queued = update_queue_take(state, leases);
+	if (queued != 0x3f) {
+		atf_tc_fail("ERROR: queued %x without a checkpoint %s:%d",
+			    queued, MDL);
+	}
+
+	updreqall(&msg, buf, leases[0]->fo_seq - 1);
+	dhcp_failover_process_update_request_all(state, &msg);
+	queued = update_queue_take(state, leases);
+	if (queued != 0x3f) {
+		atf_tc_fail("ERROR: queued %x from an old checkpoint %s:%d",
+			    queued, MDL);
+	}
+
+	updreqall(&msg, buf, leases[4]->fo_seq + 1);
+	dhcp_failover_process_update_request_all(state, &msg);
+	queued = update_queue_take(state, leases);
+	if (queued != 0x3f) {
+		atf_tc_fail("ERROR: queued %x from a checkpoint ahead %s:%d",
+			    queued, MDL);
+	}
+
+	for (i = 0; i < 6; i++) {
+		LEASE_REMOVEP(&pool->active, leases[i]);
+		lease_dereference(&leases[i], MDL);
+	}
+	shared_network_dereference(&shared_networks, MDL);
+	shared_network_dereference(&share, MDL);
+	pool_dereference(&pool, MDL);
+	dhcp_failover_state_dereference(&state, MDL);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(update_request_all_reconnect);
+
+ATF_TC_HEAD(update_request_all_reconnect, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "a server that acked some of its peer's updates "
+			  "before losing the connection asks for, and is "
+			  "sent, only the leases changed after them.");
+}
+
+ATF_TC_BODY(update_request_all_reconnect, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	omapi_connection_object_t *c;
+	dhcp_failover_link_t *link = NULL;
+	dhcp_failover_state_t *sender = NULL, *receiver = NULL;
+	struct shared_network *share = NULL;
+	struct pool *pool = NULL;
+	struct lease *leases[7];
+	failover_message_t *bndupd[3], msg;
+	u_int8_t seqbuf[3][14], in[128];
+	unsigned queued;
+	int peer, i, len;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	omapi_init();
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	db_file = tmpfile();
+	dont_use_fsync = 1;
+	cur_time = 1000;
+
+	/* The sender's pool, with six leases: five changed in turn and
+	   stamped as supersede_lease() stamps them, and one loaded from
+	   the lease file with no stamp. */
+	if (dhcp_failover_state_allocate(&sender, MDL) != ISC_R_SUCCESS ||
+	    dhcp_failover_state_allocate(&receiver, MDL) != ISC_R_SUCCESS ||
+	    shared_network_allocate(&share, MDL) != ISC_R_SUCCESS ||
+	    pool_allocate(&pool, MDL) != ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: can't allocate %s:%d", MDL);
+	}
+	receiver->name = dmalloc(sizeof "receiver", MDL);
+	strcpy(receiver->name, "receiver");
+	dhcp_failover_state_reference(&pool->failover_peer, sender, MDL);
+	pool_reference(&share->pools, pool, MDL);
+	shared_network_reference(&shared_networks, share, MDL);
+
+	memset(leases, 0, sizeof leases);
+	for (i = 0; i < 6; i++) {
+		if (lease_allocate(&leases[i], MDL) != ISC_R_SUCCESS) {
+			atf_tc_fail("ERROR: can't allocate lease %s:%d", MDL);
+		}
+		pool_reference(&leases[i]->pool, pool, MDL);
+		leases[i]->binding_state = FTS_ACTIVE;
+		leases[i]->sort_time = i;
+		if (i < 5)
+			leases[i]->fo_seq = dhcp_failover_next_sequence(sender);
+		LEASE_INSERTP(&pool->active, leases[i]);
+	}
+
+	/* The receiver gets the BNDUPDs for the first three and acks
+	   them, which checkpoints the last of them. */
+	c = socket_connection(&peer);
+	if (dhcp_failover_link_allocate(&link, MDL) != ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: can't allocate link %s:%d", MDL);
+	}
+	omapi_object_reference(&link->outer, (omapi_object_t *)c, MDL);
+	omapi_object_reference(&c->inner, (omapi_object_t *)link, MDL);
+	dhcp_failover_link_reference(&receiver->link_to_peer, link, MDL);
+	receiver->partner.max_flying_updates = 6;
+	for (i = 0; i < 3; i++) {
+		bndupd[i] = dmalloc(sizeof *bndupd[i], MDL);
+		bndupd[i]->refcnt = 1;
+		bndupd[i]->type = FTM_BNDUPD;
+		bndupd[i]->xid = 30 + i;
+		put_sequence(bndupd[i], seqbuf[i], leases[i]->fo_seq);
+		dhcp_failover_queue_ack(receiver, bndupd[i]);
+	}
+	if (receiver->acks_sent != 3 ||
+	    receiver->partner_sequence != leases[2]->fo_seq) {
+		atf_tc_fail("ERROR: %u acks sent, checkpoint %llu %s:%d",
+			    receiver->acks_sent,
+			    (unsigned long long)receiver->partner_sequence,
+			    MDL);
+	}
+
+	/* The connection drops and a new one comes up, on which the
+	   receiver asks for everything since its checkpoint. */
+	dhcp_failover_link_dereference(&receiver->link_to_peer, MDL);
+	omapi_object_dereference(&link->outer, MDL);
+	omapi_object_dereference(&c->inner, MDL);
+	socket_connection_close(&c, peer);
+
+	c = socket_connection(&peer);
+	omapi_object_reference(&link->outer, (omapi_object_t *)c, MDL);
+	omapi_object_reference(&c->inner, (omapi_object_t *)link, MDL);
+	dhcp_failover_link_reference(&receiver->link_to_peer, link, MDL);
+	if (dhcp_failover_send_update_request_all(receiver) !=
+	    ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: update request all not sent %s:%d", MDL);
+	}
+	omapi_connection_writer((omapi_object_t *)c);
+	len = recv(peer, in, sizeof in, 0);
+	memset(&msg, 0, sizeof msg);
+	if (len < 2 || getUShort(in) != len ||
+	    dhcp_failover_parse_message(&msg, &in[2], len - 2) !=
+	    ISC_R_SUCCESS || msg.type != FTM_UPDREQALL) {
+		atf_tc_fail("ERROR: bad update request all %s:%d", MDL);
+	}
+
+	/* The sender queues the two leases changed since. */
+	dhcp_failover_process_update_request_all(sender, &msg);
+	queued = update_queue_take(sender, leases);
+	if (queued != 0x18) {
+		atf_tc_fail("ERROR: queued %x after reconnecting %s:%d",
+			    queued, MDL);
+	}
+
+	/* A sender whose numbering is behind the checkpoint, as after
+	   going back to an older lease file, sends everything. */
+	sender->sequence = leases[1]->fo_seq;
+	dhcp_failover_process_update_request_all(sender, &msg);
+	queued = update_queue_take(sender, leases);
+	if (queued != 0x3f) {
+		atf_tc_fail("ERROR: queued %x from a checkpoint ahead %s:%d",
+			    queued, MDL);
+	}
+
+	for (i = 0; i < 3; i++)
+		dfree(bndupd[i], MDL);
+	for (i = 0; i < 6; i++) {
+		LEASE_REMOVEP(&pool->active, leases[i]);
+		lease_dereference(&leases[i], MDL);
+	}
+	shared_network_dereference(&shared_networks, MDL);
+	shared_network_dereference(&share, MDL);
+	pool_dereference(&pool, MDL);
+	dhcp_failover_state_dereference(&receiver, MDL);
+	dhcp_failover_state_dereference(&sender, MDL);
+	dhcp_failover_link_dereference(&link, MDL);
+	socket_connection_close(&c, peer);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(sequence_wrap);
+
+ATF_TC_HEAD(sequence_wrap, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "sequence numbers start again from the clock when "
+			  "they run out, and never come out as zero.");
+}
+
+ATF_TC_BODY(sequence_wrap, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t state;
+	isc_uint64_t last = ~(isc_uint64_t)0, floor;
+
+	memset(&state, 0, sizeof state);
+	cur_time = 2000;
+	floor = (isc_uint64_t)cur_time << 24;
+
+	/* Numbers go on from the last one, or the clock if it's ahead. */
+	if (dhcp_failover_next_sequence(&state) != floor ||
+	    dhcp_failover_next_sequence(&state) != floor + 1 ||
+	    state.sequence_start != floor) {
+		atf_tc_fail("ERROR: numbering not from the clock %s:%d", MDL);
+	}
+
+	/* The last number there is, then the clock again. */
+	state.sequence = last - 1;
+	if (dhcp_failover_next_sequence(&state) != last) {
+		atf_tc_fail("ERROR: wrapped early %s:%d", MDL);
+	}
+	if (dhcp_failover_next_sequence(&state) != floor ||
+	    state.sequence_start != floor) {
+		atf_tc_fail("ERROR: bad number after wrapping %s:%d", MDL);
+	}
+
+	/* A clock at zero still doesn't make a zero, which would mean
+	   no number. */
+	memset(&state, 0, sizeof state);
+	cur_time = 0;
+	if (dhcp_failover_next_sequence(&state) == 0) {
+		atf_tc_fail("ERROR: zero sequence number %s:%d", MDL);
+	}
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(pool_balance_slices);
+
+ATF_TC_HEAD(pool_balance_slices, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "a pool balance done a slice at a time gives the "
+			  "peer the same leases as doing it in one go.");
+}
+
+#if defined(FAILOVER_PROTOCOL)
+/* More than three slices' worth of leases. */
+#define BALANCE_LEASES	(DHCP_FAILOVER_BALANCE_SLICE * 3 + 100)
+
+/* A primary with a pool of free leases, every third of them used before,
+   and a peer that would answer for about a quarter of them. */
+static dhcp_failover_state_t *
+balance_setup(struct pool **pool, struct lease **leases)
+{
+	dhcp_failover_state_t *state = NULL;
+	struct shared_network *share = NULL;
+	int i;
+
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	cur_tv.tv_sec = 1000;
+	cur_tv.tv_usec = 0;
+	db_file = tmpfile();
+	dont_use_fsync = 1;
+
+	if (dhcp_failover_state_allocate(&state, MDL) != ISC_R_SUCCESS ||
+	    shared_network_allocate(&share, MDL) != ISC_R_SUCCESS ||
+	    pool_allocate(pool, MDL) != ISC_R_SUCCESS) {
+		atf_tc_fail("ERROR: can't allocate %s:%d", MDL);
+	}
+	state->name = dmalloc(5, MDL);
+	strcpy(state->name, "peer");
+	state->i_am = primary;
+	state->me.state = normal;
+	state->max_lease_misbalance = 15;
+	state->max_lease_ownership = 10;
+	state->hba = dmalloc(32, MDL);
+	memset(state->hba, 0xee, 32);
+	dhcp_failover_state_reference(&(*pool)->failover_peer, state, MDL);
+	pool_reference(&share->pools, *pool, MDL);
+	shared_network_reference(&shared_networks, share, MDL);
+	shared_network_dereference(&share, MDL);
+
+	memset(leases, 0, BALANCE_LEASES * sizeof *leases);
+	for (i = 0; i < BALANCE_LEASES; i++) {
+		if (lease_allocate(&leases[i], MDL) != ISC_R_SUCCESS) {
+			atf_tc_fail("ERROR: can't allocate lease %s:%d", MDL);
+		}
+		pool_reference(&leases[i]->pool, *pool, MDL);
+		leases[i]->ip_addr.len = 4;
+		leases[i]->ip_addr.iabuf[0] = 10;
+		leases[i]->ip_addr.iabuf[2] = i >> 8;
+		leases[i]->ip_addr.iabuf[3] = i;
+		leases[i]->hardware_addr.hlen = 7;
+		leases[i]->hardware_addr.hbuf[0] = HTYPE_ETHER;
+		leases[i]->hardware_addr.hbuf[5] = i >> 8;
+		leases[i]->hardware_addr.hbuf[6] = i;
+		leases[i]->binding_state = FTS_FREE;
+		leases[i]->next_binding_state = FTS_FREE;
+		if (i % 3 == 0)
+			leases[i]->ends = 500;
+		lease_enqueue(leases[i]);
+	}
+	return state;
+}
+
+static int
+balance_index(struct lease *lp)
+{
+	return (lp->ip_addr.iabuf[2] << 8) | lp->ip_addr.iabuf[3];
+}
+
+/* Work out which of the free leases the balance should give the peer,
+   the way it was done in a single pass over the pool: first those the
+   peer would answer for, then the oldest, until the pool is even
+   enough. */
+static void
+balance_expect(dhcp_failover_state_t *state, struct pool *pool,
+	       binding_state_t *expect)
+{
+	struct lease *lp;
+	int lts, hold, total;
+
+	total = pool->free_leases + pool->backup_leases;
+	lts = (pool->free_leases - pool->backup_leases) / 2;
+	hold = ((total * state->max_lease_ownership) + 50) / 100;
+
+	for (lp = LEASE_GET_FIRST(pool->free); lp != NULL;
+	     lp = LEASE_GET_NEXT(pool->free, lp)) {
+		if (lts <= -hold)
+			return;
+		if (peer_wants_lease(lp)) {
+			expect[balance_index(lp)] = FTS_BACKUP;
+			lts--;
+		}
+	}
+	for (lp = LEASE_GET_FIRST(pool->free); lp != NULL;
+	     lp = LEASE_GET_NEXT(pool->free, lp)) {
+		if (peer_wants_lease(lp))
+			continue;
+		if (lts <= (lp->ends ? hold : 0))
+			return;
+		expect[balance_index(lp)] = FTS_BACKUP;
+		lts--;
+	}
+}
+
+/* Run the rest of the balance under way, as the dispatcher would, and
+   return the number of slices it took. */
+static int
+balance_finish(dhcp_failover_state_t *state)
+{
+	int slices = 0;
+
+	while (state->balance_pool != NULL) {
+		cancel_timeout(dhcp_failover_pool_balance_slice, state);
+		dhcp_failover_pool_balance_slice(state);
+		slices++;
+	}
+	return slices;
+}
+
+static void
+balance_check(struct pool *pool, struct lease **leases,
+	      binding_state_t *expect)
+{
+	int i, free_leases = 0, backup = 0;
+
+	for (i = 0; i < BALANCE_LEASES; i++) {
+		if (leases[i]->binding_state != expect[i]) {
+			atf_tc_fail("ERROR: lease %d is %s, not %s %s:%d", i,
+				    binding_state_print(
+					    leases[i]->binding_state),
+				    binding_state_print(expect[i]), MDL);
+		}
+		if (expect[i] == FTS_FREE)
+			free_leases++;
+		else if (expect[i] == FTS_BACKUP)
+			backup++;
+	}
+	if (pool->free_leases != free_leases ||
+	    pool->backup_leases != backup) {
+		atf_tc_fail("ERROR: %d free and %d backup, not %d and %d "
+			    "%s:%d", pool->free_leases, pool->backup_leases,
+			    free_leases, backup, MDL);
+	}
+}
+
+static void
+balance_cleanup(dhcp_failover_state_t **state, struct pool **pool,
+		struct lease **leases)
+{
+	struct lease *none = NULL;
+	int i;
+
+	update_queue_take(*state, &none);
+	cancel_timeout(dhcp_failover_pool_rebalance, *state);
+	cancel_timeout(dhcp_failover_pool_balance_slice, *state);
+	cancel_timeout(pool_timer, *pool);
+	for (i = 0; i < BALANCE_LEASES; i++) {
+		switch (leases[i]->binding_state) {
+		      case FTS_FREE:
+			LEASE_REMOVEP(&(*pool)->free, leases[i]);
+			break;
+		      case FTS_BACKUP:
+			LEASE_REMOVEP(&(*pool)->backup, leases[i]);
+			break;
+		      default:
+			LEASE_REMOVEP(&(*pool)->active, leases[i]);
+			break;
+		}
+		lease_dereference(&leases[i], MDL);
+	}
+	shared_network_dereference(&shared_networks, MDL);
+	pool_dereference(pool, MDL);
+	dhcp_failover_state_dereference(state, MDL);
+}
+#endif
+
+ATF_TC_BODY(pool_balance_slices, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t *state;
+	struct pool *pool = NULL;
+	struct lease *leases[BALANCE_LEASES];
+	binding_state_t expect[BALANCE_LEASES];
+	int i, slices;
+
+	state = balance_setup(&pool, leases);
+	for (i = 0; i < BALANCE_LEASES; i++)
+		expect[i] = FTS_FREE;
+	balance_expect(state, pool, expect);
+
+	dhcp_failover_pool_rebalance(state);
+	if (state->balance_pool != pool || state->balance_slices != 1) {
+		atf_tc_fail("ERROR: first slice didn't stop %s:%d", MDL);
+	}
+	slices = 1 + balance_finish(state);
+	if (slices <= BALANCE_LEASES / DHCP_FAILOVER_BALANCE_SLICE ||
+	    state->balance_time_slices != slices) {
+		atf_tc_fail("ERROR: balanced in %d slices, reported %u %s:%d",
+			    slices, state->balance_time_slices, MDL);
+	}
+	balance_check(pool, leases, expect);
+	if (state->balance_moved != pool->backup_leases) {
+		atf_tc_fail("ERROR: reported %d leases moved %s:%d",
+			    state->balance_moved, MDL);
+	}
+
+	balance_cleanup(&state, &pool, leases);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(pool_balance_restart);
+
+ATF_TC_HEAD(pool_balance_restart, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "a pool balance goes back to the start of the "
+			  "queue when the lease it was to resume from has "
+			  "left it.");
+}
+
+ATF_TC_BODY(pool_balance_restart, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t *state;
+	struct pool *pool = NULL;
+	struct lease *leases[BALANCE_LEASES], *lp = NULL;
+	binding_state_t expect[BALANCE_LEASES];
+	int i;
+
+	state = balance_setup(&pool, leases);
+	dhcp_failover_pool_rebalance(state);
+	if (state->balance_next == NULL) {
+		atf_tc_fail("ERROR: nowhere to resume from %s:%d", MDL);
+	}
+
+	/* Between slices, the lease to resume from goes to a client. */
+	lease_reference(&lp, state->balance_next, MDL);
+	lp->next_binding_state = FTS_ACTIVE;
+	lp->ends = cur_time + 3600;
+	if (!supersede_lease(lp, NULL, 0, 0, 0, 0)) {
+		atf_tc_fail("ERROR: can't activate lease %s:%d", MDL);
+	}
+
+	/* What's been given away stays given, and the rest is balanced
+	   as if starting again. */
+	for (i = 0; i < BALANCE_LEASES; i++)
+		expect[i] = leases[i]->binding_state;
+	balance_expect(state, pool, expect);
+
+	balance_finish(state);
+	balance_check(pool, leases, expect);
+
+	lease_dereference(&lp, MDL);
+	balance_cleanup(&state, &pool, leases);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(pool_balance_merge_stop);
+
+ATF_TC_HEAD(pool_balance_merge_stop, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "a balance asked for while one is under way joins "
+			  "it, and that a balance stops when the failover "
+			  "state leaves normal.");
+}
+
+ATF_TC_BODY(pool_balance_merge_stop, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t *state;
+	struct pool *pool = NULL;
+	struct lease *leases[BALANCE_LEASES], *lp = NULL;
+	int free_leases;
+
+	state = balance_setup(&pool, leases);
+	dhcp_failover_pool_rebalance(state);
+	lease_reference(&lp, state->balance_next, MDL);
+	free_leases = pool->free_leases;
+
+	/* Asking again carries on with the balance under way. */
+	dhcp_failover_pool_rebalance(state);
+	if (state->balance_pool != pool || state->balance_next != lp ||
+	    state->balance_slices != 1 ||
+	    state->balance_flags != DHCP_FAILOVER_BALANCE_POOLREQ ||
+	    pool->free_leases != free_leases) {
+		atf_tc_fail("ERROR: second request not merged %s:%d", MDL);
+	}
+
+	/* Leaving normal ends it at the next slice, with nothing more
+	   given away. */
+	state->me.state = communications_interrupted;
+	if (balance_finish(state) != 1 ||
+	    state->balance_next != NULL || state->balance_flags != 0) {
+		atf_tc_fail("ERROR: balance not stopped %s:%d", MDL);
+	}
+	if (pool->free_leases != free_leases) {
+		atf_tc_fail("ERROR: %d leases given away after stopping %s:%d",
+			    free_leases - pool->free_leases, MDL);
+	}
+
+	lease_dereference(&lp, MDL);
+	balance_cleanup(&state, &pool, leases);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, parse_bndupd);
+	ATF_TP_ADD_TC(tp, parse_connect);
+	ATF_TP_ADD_TC(tp, parse_bad);
+	ATF_TP_ADD_TC(tp, parse_bench);
+	ATF_TP_ADD_TC(tp, update_window);
+	ATF_TP_ADD_TC(tp, connection_cork);
+	ATF_TP_ADD_TC(tp, send_acks_write);
+	ATF_TP_ADD_TC(tp, update_queue_checkpoint);
+	ATF_TP_ADD_TC(tp, update_request_all_reconnect);
+	ATF_TP_ADD_TC(tp, sequence_wrap);
+	ATF_TP_ADD_TC(tp, pool_balance_slices);
+	ATF_TP_ADD_TC(tp, pool_balance_restart);
+	ATF_TP_ADD_TC(tp, pool_balance_merge_stop);
+
+	return (atf_no_error());
+}
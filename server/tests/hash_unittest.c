@@ -537,6 +537,288 @@ ATF_TC_BODY(lease_hash_basic_3hosts, tc) {
    the hash code to its previous state.  As we may choose to
    redo the hash code again this test hasn't been deleted.
 */   
+static int hash_grow_seen;
+
+static isc_result_t
+hash_grow_count(const void *name, unsigned len, void *value) {
+    hash_grow_seen++;
+    return ISC_R_SUCCESS;
+}
+
+static int
+hash_grow_find(struct hash_table *table, unsigned char *key, int expect) {
+    hashed_object_t *value = NULL;
+    int found;
+
+    found = hash_lookup(&value, table, key, 6, MDL);
+    if (found != expect)
+        return 0;
+    return (!found || value == (hashed_object_t *)key);
+}
+
+ATF_TC(hash_grow);
+ATF_TC_HEAD(hash_grow, tc) {
+    atf_tc_set_md_var(tc, "descr", "Verify a hash table resizes itself "
+                      "while entries are added, looked up and deleted");
+}
+ATF_TC_BODY(hash_grow, tc) {
+    struct hash_table *table = NULL;
+    unsigned char *keys, *key;
+    int i, j, count = 50000;
+
+    keys = dmalloc(count * 6, MDL);
+    ATF_REQUIRE(keys != NULL);
+
+    /* Vendor-sequential hardware addresses. */
+    for (i = 0; i < count; i++) {
+        key = keys + i * 6;
+        key[0] = 0x00; key[1] = 0x1b; key[2] = 0x21;
+        key[3] = (i >> 16) & 0xff; key[4] = (i >> 8) & 0xff; key[5] = i & 0xff;
+    }
+
+    ATF_REQUIRE(new_hash(&table, NULL, NULL, 7, do_id_hash, MDL));
+
+    for (i = 0; i < count; i++) {
+        add_hash(table, keys + i * 6, 6, (hashed_object_t *)(keys + i * 6),
+                 MDL);
+
+        /* Everything added so far must be found, mid-resize or not. */
+        if ((i % 997) == 0) {
+            for (j = 0; j <= i; j += 101) {
+                ATF_CHECK_MSG(hash_grow_find(table, keys + j * 6, 1),
+                              "entry %d missing after %d adds", j, i + 1);
+            }
+        }
+    }
+
+    ATF_CHECK(table->hash_count > 7);
+    ATF_CHECK_EQ(table->entries, count);
+
+    hash_grow_seen = 0;
+    ATF_CHECK_EQ(hash_foreach(table, hash_grow_count), count);
+    ATF_CHECK_EQ(hash_grow_seen, count);
+
+    for (i = 0; i < count; i += 2) {
+        delete_hash_entry(table, keys + i * 6, 6, MDL);
+    }
+    ATF_CHECK_EQ(table->entries, count / 2);
+
+    for (i = 0; i < count; i++) {
+        ATF_CHECK_MSG(hash_grow_find(table, keys + i * 6, i & 1),
+                      "entry %d wrong after deletes", i);
+    }
+
+    /* Reporting finishes any resize, leaving one bucket array. */
+    hash_report(table);
+    ATF_CHECK(table->old_buckets == NULL);
+    ATF_CHECK(table->entries <= table->hash_count * HASH_MAX_LOAD);
+
+    free_hash_table(&table, MDL);
+    dfree(keys, MDL);
+}
+
+static struct hash_table *hash_walk_table;
+static unsigned char *hash_walk_keys;
+static unsigned char *hash_walk_seen;
+static unsigned hash_walk_index;
+
+/* Mark each entry visited, and check a lookup made from inside the
+   walk finds it without moving anything between the bucket arrays. */
+static isc_result_t
+hash_walk_mark(const void *name, unsigned len, void *value) {
+    hashed_object_t *found = NULL;
+    int i = ((unsigned char *)value - hash_walk_keys) / 6;
+
+    /* A key added twice finds the newer entry both times. */
+    hash_walk_seen[i]++;
+    if (!hash_lookup(&found, hash_walk_table, name, len, MDL) ||
+        memcmp(found, value, 6) != 0 ||
+        hash_walk_table->rehash_index != hash_walk_index)
+        return ISC_R_FAILURE;
+    return ISC_R_SUCCESS;
+}
+
+/* Find a key that is still waiting in the old bucket array and won't
+   be moved by the next step of the resize. */
+static int
+hash_old_key(struct hash_table *table, unsigned char *keys, int count) {
+    unsigned hashno;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        hashno = (*table->do_hash)(keys + i * 6, 6, table->old_count);
+        if (hashno >= table->rehash_index + HASH_REHASH_STEP &&
+            hash_grow_find(table, keys + i * 6, 1))
+            return i;
+    }
+    return -1;
+}
+
+ATF_TC(hash_rehash_midway);
+ATF_TC_HEAD(hash_rehash_midway, tc) {
+    atf_tc_set_md_var(tc, "descr", "Verify lookups, deletes and walks "
+                      "while a hash table is part way through a resize");
+}
+ATF_TC_BODY(hash_rehash_midway, tc) {
+    struct hash_table *table = NULL;
+    unsigned char *keys, *key, *dup;
+    hashed_object_t *value;
+    unsigned size = 1024, start;
+    int i, old, moved, count, live, steps;
+
+    /* One more than the table holds before it grows, and a spare
+       slot for a duplicate key. */
+    count = size * HASH_MAX_LOAD + 1;
+    keys = dmalloc((count + 1) * 6, MDL);
+    ATF_REQUIRE(keys != NULL);
+    for (i = 0; i < count; i++) {
+        key = keys + i * 6;
+        key[0] = 0x00; key[1] = 0x1b; key[2] = 0x21;
+        key[3] = (i >> 16) & 0xff; key[4] = (i >> 8) & 0xff; key[5] = i & 0xff;
+    }
+
+    ATF_REQUIRE(new_hash(&table, NULL, NULL, size, do_id_hash, MDL));
+    for (i = 0; i < count - 1; i++) {
+        add_hash(table, keys + i * 6, 6, (hashed_object_t *)(keys + i * 6),
+                 MDL);
+    }
+    ATF_REQUIRE(table->old_buckets == NULL);
+
+    /* The last add starts the resize, but moves nothing yet. */
+    add_hash(table, keys + i * 6, 6, (hashed_object_t *)(keys + i * 6), MDL);
+    ATF_REQUIRE(table->old_buckets != NULL);
+    ATF_CHECK_EQ(table->old_count, size);
+    ATF_CHECK_EQ(table->hash_count, size * 2);
+    ATF_CHECK_EQ(table->rehash_index, 0);
+    live = count;
+
+    /* A lookup of an entry still in the old array finds it, and moves
+       only one step's worth of buckets. */
+    old = hash_old_key(table, keys, count);
+    ATF_REQUIRE(old >= 0);
+    start = table->rehash_index;
+    ATF_CHECK(hash_grow_find(table, keys + old * 6, 1));
+    ATF_CHECK_EQ(table->rehash_index, start + HASH_REHASH_STEP);
+    ATF_CHECK(table->old_buckets != NULL);
+
+    /* Delete an entry still in the old array, and one already moved. */
+    old = hash_old_key(table, keys, count);
+    ATF_REQUIRE(old >= 0);
+    delete_hash_entry(table, keys + old * 6, 6, MDL);
+    live--;
+    ATF_CHECK_EQ(table->entries, live);
+    ATF_CHECK(hash_grow_find(table, keys + old * 6, 0));
+
+    for (moved = 0; moved < count; moved++) {
+        if ((*table->do_hash)(keys + moved * 6, 6, table->old_count) <
+            table->rehash_index)
+            break;
+    }
+    ATF_REQUIRE(moved < count);
+    delete_hash_entry(table, keys + moved * 6, 6, MDL);
+    live--;
+    ATF_CHECK_EQ(table->entries, live);
+    ATF_CHECK(hash_grow_find(table, keys + moved * 6, 0));
+    ATF_CHECK(hash_grow_find(table, keys + old * 6, 0));
+    ATF_CHECK(table->old_buckets != NULL);
+    hash_walk_seen = dmalloc(count + 1, MDL);
+    ATF_REQUIRE(hash_walk_seen != NULL);
+    hash_walk_seen[old] = hash_walk_seen[moved] = 0xff;
+
+    /* Add a second entry for a key still in the old array.  The newer
+       one is found first, before and after the old one is moved. */
+    old = hash_old_key(table, keys, count);
+    ATF_REQUIRE(old >= 0);
+    dup = keys + count * 6;
+    memcpy(dup, keys + old * 6, 6);
+    add_hash(table, dup, 6, (hashed_object_t *)dup, MDL);
+    live++;
+    value = NULL;
+    ATF_CHECK(hash_lookup(&value, table, keys + old * 6, 6, MDL));
+    ATF_CHECK(value == (hashed_object_t *)dup);
+
+    /* Walk the table mid-resize: every entry once, nothing moved. */
+    ATF_REQUIRE(table->old_buckets != NULL);
+    hash_walk_table = table;
+    hash_walk_keys = keys;
+    hash_walk_index = table->rehash_index;
+    ATF_CHECK_EQ(hash_foreach(table, hash_walk_mark), live);
+    ATF_CHECK_EQ(table->rehash_index, hash_walk_index);
+    ATF_CHECK(table->old_buckets != NULL);
+    for (i = 0; i <= count; i++) {
+        /* The two deleted entries are marked and must not be seen. */
+        ATF_CHECK_MSG(hash_walk_seen[i] == 1 || hash_walk_seen[i] == 0xff,
+                      "entry %d walked %d times", i, hash_walk_seen[i]);
+    }
+    dfree(hash_walk_seen, MDL);
+
+    /* Finish the resize with lookups, checking everything on the way. */
+    steps = 0;
+    while (table->old_buckets != NULL) {
+        value = NULL;
+        ATF_CHECK(hash_lookup(&value, table, keys + old * 6, 6, MDL));
+        ATF_CHECK(value == (hashed_object_t *)dup);
+        steps++;
+    }
+    ATF_CHECK(steps > 1);
+    ATF_CHECK_EQ(table->entries, live);
+
+    /* Deleting the key now removes the newer entry, then the older. */
+    delete_hash_entry(table, dup, 6, MDL);
+    value = NULL;
+    ATF_CHECK(hash_lookup(&value, table, keys + old * 6, 6, MDL));
+    ATF_CHECK(value == (hashed_object_t *)(keys + old * 6));
+    delete_hash_entry(table, dup, 6, MDL);
+    ATF_CHECK(hash_grow_find(table, keys + old * 6, 0));
+    live -= 2;
+    ATF_CHECK_EQ(table->entries, live);
+
+    free_hash_table(&table, MDL);
+    dfree(keys, MDL);
+}
+
+ATF_TC(hash_spread);
+ATF_TC_HEAD(hash_spread, tc) {
+    atf_tc_set_md_var(tc, "descr", "Verify keys sharing a long prefix are "
+                      "spread evenly and case is ignored by do_case_hash");
+}
+ATF_TC_BODY(hash_spread, tc) {
+    struct hash_table *table = NULL;
+    unsigned *chains, size = 4096, max = 0;
+    unsigned char key[14];
+    int i;
+
+    /* Sizes are rounded up to a power of two. */
+    ATF_REQUIRE(new_hash(&table, NULL, NULL, 1000, do_id_hash, MDL));
+    ATF_CHECK_EQ(table->hash_count, 1024);
+    free_hash_table(&table, MDL);
+
+    chains = dmalloc(size * sizeof(*chains), MDL);
+    ATF_REQUIRE(chains != NULL);
+
+    /* DUID-LLT style identifiers from one vendor, 16 per bucket. */
+    memset(key, 0, sizeof(key));
+    key[1] = 0x01; key[3] = 0x01; key[4] = 0x25; key[5] = 0x3c;
+    key[8] = 0x00; key[9] = 0x1b; key[10] = 0x21;
+    for (i = 0; i < 16 * size; i++) {
+        key[11] = (i >> 16) & 0xff;
+        key[12] = (i >> 8) & 0xff;
+        key[13] = i & 0xff;
+        chains[do_id_hash(key, sizeof(key), size)]++;
+    }
+    for (i = 0; i < size; i++) {
+        if (chains[i] > max)
+            max = chains[i];
+    }
+    ATF_CHECK_MSG(max < 64, "longest chain %u", max);
+    dfree(chains, MDL);
+
+    ATF_CHECK_EQ(do_case_hash("Host-42.Example.COM", 19, 1 << 20),
+                 do_case_hash("host-42.example.com", 19, 1 << 20));
+    ATF_CHECK_EQ(do_case_hash("[Node_7]", 8, 1 << 20),
+                 do_case_hash("[node_7]", 8, 1 << 20));
+}
+
 /* this test is a direct reproduction of 29851 issue */
 ATF_TC(uid_hash_rt29851);
 
@@ -600,6 +882,9 @@ ATF_TP_ADD_TCS(tp) {
     ATF_TP_ADD_TC(tp, lease_hash_string_2hosts);
     ATF_TP_ADD_TC(tp, lease_hash_string_3hosts);
     ATF_TP_ADD_TC(tp, lease_hash_negative1);
+    ATF_TP_ADD_TC(tp, hash_grow);
+    ATF_TP_ADD_TC(tp, hash_rehash_midway);
+    ATF_TP_ADD_TC(tp, hash_spread);
 #if 0 /* see comment in function */
     ATF_TP_ADD_TC(tp, uid_hash_rt29851);
 #endif
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2017 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+#include "t_bench.h"
+
+/*
+ * Test the parallel lease file reader.  read_lease_file() should leave
+ * the same leases behind as read_conf_file() does, whichever of its
+ * chunks a lease was in and whether it parsed the lease itself or
+ * handed it to the generic parser.
+ */
+
+#if defined (FAST_LEASE_READER)
+static struct iaddr
+make_addr(const char *text) {
+	struct iaddr addr;
+
+	memset(&addr, 0, sizeof(addr));
+	if (inet_pton(AF_INET, text, addr.iabuf) != 1)
+		atf_tc_fail("bad address %s", text);
+	addr.len = 4;
+	return addr;
+}
+
+/* One subnet with a range covering 10.0.0.1 - 10.255.255.254. */
+static void
+setup_range(void) {
+	static int done = 0;
+	struct shared_network *share = NULL;
+	struct subnet *subnet = NULL;
+	struct pool *pool = NULL;
+
+	if (done)
+		return;
+	done = 1;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	cur_time = 1000;
+
+	if (shared_network_allocate(&share, MDL) != ISC_R_SUCCESS ||
+	    subnet_allocate(&subnet, MDL) != ISC_R_SUCCESS ||
+	    pool_allocate(&pool, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("allocation failed");
+	share->name = "leasefile";
+	subnet->net = make_addr("10.0.0.0");
+	subnet->netmask = make_addr("255.0.0.0");
+	shared_network_reference(&subnet->shared_network, share, MDL);
+	shared_network_reference(&pool->shared_network, share, MDL);
+	pool_reference(&share->pools, pool, MDL);
+	enter_shared_network(share);
+	enter_subnet(subnet);
+
+	new_address_range(NULL, make_addr("10.0.0.1"),
+			  make_addr("10.255.255.254"), subnet, pool);
+}
+
+static struct lease *
+lookup(const char *text) {
+	struct lease *lease = NULL;
+
+	if (!find_lease_by_ip_addr(&lease, make_addr(text), MDL))
+		atf_tc_fail("no lease for %s", text);
+	lease_dereference(&lease, MDL);
+	return lease;
+}
+
+static const char *test_leases =
+	"# The format of this file is documented in the dhcpd.leases(5) manual page.\n"
+	"# This lease file was written by isc-dhcp-4.4.1\n"
+	"\n"
+	"# authoring-byte-order entry is generated, DO NOT DELETE\n"
+	"authoring-byte-order little-endian;\n"
+	"\n"
+	"lease 10.0.0.1 {\n"
+	"  starts 3 2025/01/01 00:00:00;\n"
+	"  ends 3 2025/01/01 01:00:00;\n"
+	"  cltt 3 2025/01/01 00:00:00;\n"
+	"  sequence 7;\n"
+	"  binding state active;\n"
+	"  next binding state free;\n"
+	"  rewind binding state free;\n"
+	"  hardware ethernet 00:11:22:33:44:55;\n"
+	"  uid \"\\001\\000\\021\\\"3DU\";\n"
+	"  set vendor-class-identifier = \"MSFT 5.0\";\n"
+	"  set counter = %42;\n"
+	"  client-hostname \"alpha\";\n"
+	"}\n"
+	/* Keywords in capitals are left to the generic parser. */
+	"lease 10.0.0.2 {\n"
+	"  Starts 3 2025/01/01 00:00:00;\n"
+	"  ends epoch 1735693200; # Wed Jan 01 01:00:00 2025\n"
+	"  sequence 29115089203806208;\n"
+	"  binding state active;\n"
+	"  hardware ethernet 00:11:22:33:44:66;\n"
+	"  ddns-fwd-name \"beta.example.org\";\n"
+	"}\n"
+	/* A later record for the same address wins. */
+	"lease 10.0.0.1 {\n"
+	"  starts 3 2025/01/01 00:30:00;\n"
+	"  ends 3 2025/01/01 01:30:00;\n"
+	"  tstp 3 2025/01/01 01:30:00;\n"
+	"  sequence 29115089203806209;\n"
+	"  binding state active;\n"
+	"  next binding state free;\n"
+	"  hardware ethernet 00:11:22:33:44:55;\n"
+	"  uid 01:00:11:22:33:44:55;\n"
+	"  set counter = %43;\n"
+	"  client-hostname \"alpha-2\";\n"
+	"}\n"
+	"lease 10.0.0.3 {\n"
+	"  starts 3 2025/01/01 00:00:00;\n"
+	"  ends never;\n"
+	"  binding state abandoned;\n"
+	"}\n";
+
+ATF_TC(leasefile_read);
+ATF_TC_HEAD(leasefile_read, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the parallel lease file reader "
+			  "matches the generic parser");
+}
+
+ATF_TC_BODY(leasefile_read, tc)
+{
+	char filename[] = "leasefile.XXXXXX";
+	struct lease *lease;
+	struct binding *binding;
+	TIME base;
+	FILE *f;
+	int fd, i;
+
+	setup_range();
+
+	fd = mkstemp(filename);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL)
+		atf_tc_fail("can't create %s", filename);
+	/* Enough copies that the smallest chunks end up in several. */
+	for (i = 0; i < 64; i++)
+		fputs(test_leases, f);
+	fclose(f);
+
+	if (read_lease_file(filename, 4, 256) != ISC_R_SUCCESS)
+		atf_tc_fail("read_lease_file failed");
+	unlink(filename);
+
+	base = 1735689600;	/* 2025/01/01 00:00:00 UTC */
+
+	lease = lookup("10.0.0.1");
+	ATF_CHECK_EQ(lease->starts, base + 1800);
+	ATF_CHECK_EQ(lease->ends, base + 5400);
+	ATF_CHECK_EQ(lease->tstp, base + 5400);
+	ATF_CHECK(lease->fo_seq == 29115089203806209ULL);
+	ATF_CHECK_EQ(lease->binding_state, FTS_ACTIVE);
+	ATF_CHECK_EQ(lease->next_binding_state, FTS_FREE);
+	ATF_CHECK_EQ(lease->hardware_addr.hlen, 7);
+	ATF_CHECK_EQ(lease->hardware_addr.hbuf[0], HTYPE_ETHER);
+	ATF_CHECK_EQ(lease->uid_len, 7);
+	ATF_CHECK(memcmp(lease->uid, "\001\000\021\"3DU", 7) == 0);
+	ATF_REQUIRE(lease->client_hostname != NULL);
+	ATF_CHECK_STREQ(lease->client_hostname, "alpha-2");
+	ATF_REQUIRE(lease->scope != NULL);
+	binding = find_binding(lease->scope, "counter");
+	ATF_REQUIRE(binding != NULL && binding->value != NULL);
+	ATF_CHECK_EQ(binding->value->type, binding_numeric);
+	ATF_CHECK_EQ(binding->value->value.intval, 43);
+	/* Nothing is carried over from the earlier record. */
+	ATF_CHECK(find_binding(lease->scope,
+			       "vendor-class-identifier") == NULL);
+
+	lease = lookup("10.0.0.2");
+	ATF_CHECK_EQ(lease->starts, base);
+	ATF_CHECK_EQ(lease->ends, base + 3600);
+	ATF_CHECK_EQ(lease->binding_state, FTS_ACTIVE);
+	ATF_CHECK(lease->fo_seq == 29115089203806208ULL);
+	ATF_REQUIRE(lease->scope != NULL);
+	ATF_CHECK(find_binding(lease->scope, "ddns-fwd-name") != NULL);
+
+	lease = lookup("10.0.0.3");
+	ATF_CHECK_EQ(lease->ends, MAX_TIME);
+	ATF_CHECK_EQ(lease->binding_state, FTS_ABANDONED);
+	ATF_CHECK_EQ(lease->hardware_addr.hlen, 0);
+	ATF_CHECK(lease->fo_seq == 0);
+}
+
+#define BENCH_LEASES 200000
+
+ATF_TC(leasefile_startup_bench);
+ATF_TC_HEAD(leasefile_startup_bench, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Time reading a large lease file "
+			  "with both parsers");
+}
+
+ATF_TC_BODY(leasefile_startup_bench, tc)
+{
+	char filename[] = "leasefile.XXXXXX";
+	struct timeval start;
+	struct stat sb;
+	FILE *f;
+	int fd, i;
+
+	BENCH_REQUIRE();
+	setup_range();
+
+	fd = mkstemp(filename);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL)
+		atf_tc_fail("can't create %s", filename);
+	fprintf(f, "authoring-byte-order little-endian;\n\n");
+	for (i = 0; i < BENCH_LEASES; i++) {
+		fprintf(f, "lease 10.%d.%d.%d {\n"
+			"  starts 3 2025/01/01 00:%02d:%02d;\n"
+			"  ends 3 2025/01/01 12:%02d:%02d;\n"
+			"  tstp 3 2025/01/01 12:%02d:%02d;\n"
+			"  cltt 3 2025/01/01 00:%02d:%02d;\n"
+			"  binding state active;\n"
+			"  next binding state free;\n"
+			"  rewind binding state free;\n"
+			"  hardware ethernet 02:00:00:%02x:%02x:%02x;\n"
+			"  uid \"\\001\\002\\000\\000%c%c%c\";\n"
+			"  set vendor-class-identifier = \"bench\";\n"
+			"  client-hostname \"host-%d\";\n"
+			"}\n",
+			((i + 1) >> 16) & 0xff, ((i + 1) >> 8) & 0xff,
+			(i + 1) & 0xff,
+			(i / 60) % 60, i % 60, (i / 60) % 60, i % 60,
+			(i / 60) % 60, i % 60, (i / 60) % 60, i % 60,
+			(i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff,
+			'A' + (i >> 16) % 26, 'A' + (i >> 8) % 26,
+			'A' + i % 26, i);
+	}
+	fclose(f);
+	if (stat(filename, &sb) == 0)
+		printf("lease file: %d leases, %lu bytes\n", BENCH_LEASES,
+		       (unsigned long)sb.st_size);
+
+	bench_start(&start);
+	if (read_conf_file(filename, NULL, 0, 1) != ISC_R_SUCCESS)
+		atf_tc_fail("read_conf_file failed");
+	bench_report(&start, "read_conf_file");
+
+	bench_start(&start);
+	if (read_lease_file(filename, 0, 0) != ISC_R_SUCCESS)
+		atf_tc_fail("read_lease_file failed");
+	bench_report(&start, "read_lease_file");
+
+	unlink(filename);
+	ATF_CHECK_STREQ(lookup("10.3.13.64")->client_hostname, "host-199999");
+}
+#endif /* FAST_LEASE_READER */
+
+ATF_TP_ADD_TCS(tp)
+{
+#if defined (FAST_LEASE_READER)
+	ATF_TP_ADD_TC(tp, leasefile_read);
+	ATF_TP_ADD_TC(tp, leasefile_startup_bench);
+#endif
+	return (atf_no_error());
+}
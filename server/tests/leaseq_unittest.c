@@ -19,6 +19,7 @@
 #include "dhcpd.h"
 
 #include <atf-c.h>
+#include "t_bench.h"
 
 /*
  * Test the lease queue code.  These tests will verify that we can
@@ -490,6 +491,79 @@ ATF_TC_BODY(leaseq_same_time, tc)
 
 }
 
+/* Time a renew heavy load: fill a queue with leases and then repeatedly
+ * take a lease out, move its time forward and put it back, the way the
+ * active queue is used as clients renew.  The linear list can't cope
+ * with a large queue so it gets a smaller one.
+ */
+#if defined (BINARY_LEASES)
+#define BENCH_LEASES 200000
+#else
+#define BENCH_LEASES 5000
+#endif
+#define BENCH_RENEWS (BENCH_LEASES * 5)
+
+ATF_TC(leaseq_renew_bench);
+ATF_TC_HEAD(leaseq_renew_bench, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Time renewing leases in a long queue");
+}
+
+ATF_TC_BODY(leaseq_renew_bench, tc)
+{
+	LEASE_STRUCT lq;
+	struct lease *test_lease, *check_lease;
+	struct timeval start;
+	TIME last;
+	int i, n;
+
+	BENCH_REQUIRE();
+	INIT_LQ(lq);
+	test_lease = calloc(BENCH_LEASES, sizeof(struct lease));
+	ATF_REQUIRE(test_lease != NULL);
+	srandom(42);
+
+	bench_start(&start);
+	for (i = 0; i < BENCH_LEASES; i++) {
+		test_lease[i].sort_time = 1000 + random() % 3600;
+		check_lease = NULL;
+		lease_reference(&check_lease, &test_lease[i], MDL);
+		LEASE_INSERTP(&lq, &test_lease[i]);
+	}
+	bench_report(&start, "add %d leases", BENCH_LEASES);
+
+	bench_start(&start);
+	for (n = 0; n < BENCH_RENEWS; n++) {
+		i = random() % BENCH_LEASES;
+		LEASE_REMOVEP(&lq, &test_lease[i]);
+		test_lease[i].sort_time += 1800 + random() % 1800;
+		LEASE_INSERTP(&lq, &test_lease[i]);
+	}
+	bench_report(&start, "renew %d leases", BENCH_RENEWS);
+
+	/* check that they are all there and in order */
+	last = 0;
+	n = 0;
+	for (check_lease = LEASE_GET_FIRST(lq); check_lease != NULL;
+	     check_lease = LEASE_GET_NEXT(lq, check_lease)) {
+		if (check_lease->sort_time < last)
+			atf_tc_fail("leases out of order at %d", n);
+		last = check_lease->sort_time;
+		n++;
+	}
+	ATF_CHECK_EQ(n, BENCH_LEASES);
+
+	bench_start(&start);
+	for (i = 0; i < BENCH_LEASES; i++) {
+		LEASE_REMOVEP(&lq, &test_lease[i]);
+	}
+	bench_report(&start, "remove %d leases", BENCH_LEASES);
+
+	if (LEASE_NOT_EMPTY(lq))
+		atf_tc_fail("queue not empty");
+	free(test_lease);
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, leaseq_basic);
@@ -499,5 +573,6 @@ ATF_TP_ADD_TCS(tp)
 	ATF_TP_ADD_TC(tp, leaseq_cycle);
 	ATF_TP_ADD_TC(tp, leaseq_long);
 	ATF_TP_ADD_TC(tp, leaseq_same_time);
+	ATF_TP_ADD_TC(tp, leaseq_renew_bench);
 	return (atf_no_error());
 }
@@ -19,6 +19,7 @@
 #include "dhcpd.h"
 
 #include <atf-c.h>
+#include "t_bench.h"
 
 /*
  * Test the load balancing code.  
@@ -185,11 +186,389 @@ ATF_TC_BODY(load_balance_swap, tc)
 #endif
 }
 
+ATF_TC(load_balance_raw);
+
+ATF_TC_HEAD(load_balance_raw, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "the raw packet filter drops a DHCPDISCOVER just "
+			  "when load_balance_mine() leaves it to the peer, "
+			  "by client identifier or by chaddr.");
+}
+
+#if defined(FAILOVER_PROTOCOL)
+/*
+ * The raw filter only drops packets received on a network whose pools
+ * all belong to one cooperating peer holding free leases; lb_setup()
+ * makes such a network with a single pool, and a hash bucket array that
+ * gives half the buckets to each server.  The option spaces have to
+ * be set up, once, before any packet is parsed.
+ */
+static struct interface_info lb_ip;
+static struct shared_network lb_share;
+static struct pool lb_pool;
+static u_int8_t lb_hba[32];
+
+static void
+lb_setup(dhcp_failover_state_t *state, int role)
+{
+	memset(lb_hba, 0x55, sizeof lb_hba);
+	memset(state, 0, sizeof *state);
+	state->i_am = role;
+	state->load_balance_max_secs = 5;
+	state->service_state = cooperating;
+	state->hba = lb_hba;
+
+	memset(&lb_pool, 0, sizeof lb_pool);
+	lb_pool.failover_peer = state;
+	lb_pool.free_leases = 1;
+	lb_pool.backup_leases = 1;
+	memset(&lb_share, 0, sizeof lb_share);
+	lb_share.pools = &lb_pool;
+	memset(&lb_ip, 0, sizeof lb_ip);
+	lb_ip.shared_network = &lb_share;
+}
+
+/* A broadcast DHCPDISCOVER from 00:00:5e:00:53:mac with opts after the
+   message type; returns its length. */
+static unsigned
+lb_discover(struct dhcp_packet *raw, u_int8_t mac,
+	    const u_int8_t *opts, unsigned optlen)
+{
+	static const u_int8_t chaddr[] = { 0x00, 0x00, 0x5e, 0x00, 0x53 };
+	u_int8_t *op;
+
+	memset(raw, 0, sizeof *raw);
+	raw->op = BOOTREQUEST;
+	raw->htype = HTYPE_ETHER;
+	raw->hlen = 6;
+	memcpy(raw->chaddr, chaddr, sizeof chaddr);
+	raw->chaddr[5] = mac;
+	memcpy(raw->options, DHCP_OPTIONS_COOKIE, 4);
+	op = &raw->options[4];
+	*op++ = DHO_DHCP_MESSAGE_TYPE;
+	*op++ = 1;
+	*op++ = DHCPDISCOVER;
+	memcpy(op, opts, optlen);
+	op += optlen;
+	*op++ = DHO_END;
+	return op - (u_int8_t *)raw;
+}
+
+/* A client identifier made from mac, which hashes differently from
+   the chaddr lb_discover() makes from it. */
+static unsigned
+lb_client_id(u_int8_t *opt, u_int8_t mac)
+{
+	opt[0] = DHO_DHCP_CLIENT_IDENTIFIER;
+	opt[1] = 3;
+	opt[2] = 0;
+	opt[3] = mac;
+	opt[4] = ~mac;
+	return 5;
+}
+
+/* Whether the raw filter leaves the packet to state's peer. */
+static int
+lb_raw_theirs(struct dhcp_packet *raw, unsigned len,
+	      dhcp_failover_state_t *state)
+{
+	dhcp_failover_state_t *sp = NULL;
+	int theirs;
+
+	theirs = load_balance_theirs_raw(&lb_ip, raw, len, &sp);
+	if (theirs && sp != state) {
+		atf_tc_fail("ERROR: dropped for the wrong peer %s:%d", MDL);
+	}
+	return theirs;
+}
+
+/* What load_balance_mine() says once the packet has been parsed as
+   do_packet() would, or -1 if do_packet() would throw it away. */
+static int
+lb_parsed_mine(struct dhcp_packet *raw, unsigned len,
+	       dhcp_failover_state_t *state)
+{
+	struct packet *packet = NULL;
+	int mine = -1;
+
+	if (!packet_allocate(&packet, MDL) ||
+	    !option_state_allocate(&packet->options, MDL)) {
+		atf_tc_fail("ERROR: can't allocate packet %s:%d", MDL);
+	}
+	packet->raw = raw;
+	packet->packet_length = len;
+	if (parse_options(packet))
+		mine = load_balance_mine(packet, state);
+	packet->raw = NULL;
+	packet_dereference(&packet, MDL);
+	return mine;
+}
+#endif
+
+ATF_TC_BODY(load_balance_raw, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t state;
+	struct dhcp_packet raw;
+	u_int8_t opt[8];
+	unsigned len, optlen;
+	int role, mac, by_chaddr, by_uid, dropped, differ;
+
+	initialize_common_option_spaces();
+	for (role = 0; role < 2; role++) {
+		lb_setup(&state, role ? secondary : primary);
+		dropped = differ = 0;
+		for (mac = 0; mac < 64; mac++) {
+			len = lb_discover(&raw, mac, NULL, 0);
+			by_chaddr = lb_raw_theirs(&raw, len, &state);
+			if (by_chaddr == lb_parsed_mine(&raw, len, &state)) {
+				atf_tc_fail("ERROR: %s disagrees on chaddr %d "
+					    "%s:%d", role ? "secondary" :
+					    "primary", mac, MDL);
+			}
+
+			/* The client identifier takes precedence. */
+			optlen = lb_client_id(opt, mac);
+			len = lb_discover(&raw, mac, opt, optlen);
+			by_uid = lb_raw_theirs(&raw, len, &state);
+			if (by_uid == lb_parsed_mine(&raw, len, &state)) {
+				atf_tc_fail("ERROR: %s disagrees on client "
+					    "id %d %s:%d", role ? "secondary" :
+					    "primary", mac, MDL);
+			}
+
+			dropped += by_chaddr + by_uid;
+			differ += by_chaddr != by_uid;
+		}
+
+		/* Both servers drop some, keep some, and the client
+		   identifier changes the answer for some. */
+		if (dropped == 0 || dropped == 128 || differ == 0) {
+			atf_tc_fail("ERROR: %d dropped, %d by client id %s:%d",
+				    dropped, differ, MDL);
+		}
+	}
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(load_balance_raw_options);
+
+ATF_TC_HEAD(load_balance_raw_options, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "the raw packet filter passes on a DHCPDISCOVER "
+			  "with options it can't be sure of.");
+}
+
+ATF_TC_BODY(load_balance_raw_options, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t state;
+	struct dhcp_packet raw;
+	u_int8_t opt[16];
+	unsigned len, optlen;
+	int mac, hidden = 0;
+
+	initialize_common_option_spaces();
+	lb_setup(&state, primary);
+	for (mac = 0; mac < 64; mac++) {
+		len = lb_discover(&raw, mac, NULL, 0);
+		if (!lb_raw_theirs(&raw, len, &state))
+			continue;
+
+		/* A client identifier that runs past the end. */
+		optlen = lb_client_id(opt, mac);
+		len = lb_discover(&raw, mac, opt, optlen);
+		if (lb_raw_theirs(&raw, len - 2, &state) ||
+		    lb_parsed_mine(&raw, len - 2, &state) != -1) {
+			atf_tc_fail("ERROR: truncated option %s:%d", MDL);
+		}
+
+		/* An empty client identifier. */
+		opt[1] = 0;
+		len = lb_discover(&raw, mac, opt, 2);
+		if (lb_raw_theirs(&raw, len, &state)) {
+			atf_tc_fail("ERROR: empty client id %s:%d", MDL);
+		}
+
+		/* A client identifier split in two, which parse_options()
+		   puts back together. */
+		optlen = lb_client_id(opt, mac);
+		opt[1] = 1;
+		opt[3] = DHO_DHCP_CLIENT_IDENTIFIER;
+		opt[4] = 2;
+		opt[5] = mac;
+		opt[6] = ~mac;
+		len = lb_discover(&raw, mac, opt, 7);
+		if (lb_raw_theirs(&raw, len, &state)) {
+			atf_tc_fail("ERROR: split client id %s:%d", MDL);
+		}
+
+		/* A second message type. */
+		opt[0] = DHO_DHCP_MESSAGE_TYPE;
+		opt[1] = 1;
+		opt[2] = DHCPDISCOVER;
+		len = lb_discover(&raw, mac, opt, 3);
+		if (lb_raw_theirs(&raw, len, &state)) {
+			atf_tc_fail("ERROR: two message types %s:%d", MDL);
+		}
+
+		/* Option overload, with a client identifier in the file
+		   field.  The parsed packet is sometimes ours by it. */
+		opt[0] = DHO_DHCP_OPTION_OVERLOAD;
+		opt[1] = 1;
+		opt[2] = 1;
+		len = lb_discover(&raw, mac, opt, 3);
+		optlen = lb_client_id((u_int8_t *)raw.file, mac);
+		raw.file[optlen] = DHO_END;
+		if (lb_raw_theirs(&raw, len, &state)) {
+			atf_tc_fail("ERROR: option overload %s:%d", MDL);
+		}
+		hidden += lb_parsed_mine(&raw, len, &state) == 1;
+	}
+	if (hidden == 0) {
+		atf_tc_fail("ERROR: overload never changed the answer %s:%d",
+			    MDL);
+	}
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+ATF_TC(load_balance_raw_secs);
+
+ATF_TC_HEAD(load_balance_raw_secs, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "This test case checks that "
+			  "the raw packet filter passes on a DHCPDISCOVER "
+			  "from a client past load-balance-max-seconds.");
+}
+
+ATF_TC_BODY(load_balance_raw_secs, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t state;
+	struct dhcp_packet raw;
+	unsigned len;
+	int mac;
+
+	initialize_common_option_spaces();
+	lb_setup(&state, primary);
+	check_secs_byte_order = 1;
+	for (mac = 0; mac < 64; mac++) {
+		len = lb_discover(&raw, mac, NULL, 0);
+		if (!lb_raw_theirs(&raw, len, &state))
+			continue;
+
+		/* Still within the limit, in either byte order. */
+		raw.secs = htons(5);
+		if (!lb_raw_theirs(&raw, len, &state) ||
+		    lb_parsed_mine(&raw, len, &state) != 0) {
+			atf_tc_fail("ERROR: secs within limit %s:%d", MDL);
+		}
+		raw.secs = htons(5 << 8);
+		if (!lb_raw_theirs(&raw, len, &state) ||
+		    lb_parsed_mine(&raw, len, &state) != 0) {
+			atf_tc_fail("ERROR: swapped secs within limit %s:%d",
+				    MDL);
+		}
+
+		/* Past it, in either byte order. */
+		raw.secs = htons(6);
+		if (lb_raw_theirs(&raw, len, &state) ||
+		    lb_parsed_mine(&raw, len, &state) != 1) {
+			atf_tc_fail("ERROR: secs past limit %s:%d", MDL);
+		}
+		raw.secs = htons(6 << 8);
+		if (lb_raw_theirs(&raw, len, &state) ||
+		    lb_parsed_mine(&raw, len, &state) != 1) {
+			atf_tc_fail("ERROR: swapped secs past limit %s:%d",
+				    MDL);
+		}
+
+		/* No limit, so we answer every client. */
+		raw.secs = 0;
+		state.load_balance_max_secs = 0;
+		if (lb_raw_theirs(&raw, len, &state) ||
+		    lb_parsed_mine(&raw, len, &state) != 1) {
+			atf_tc_fail("ERROR: no limit %s:%d", MDL);
+		}
+		state.load_balance_max_secs = 5;
+	}
+	check_secs_byte_order = 0;
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
+
+#define BENCH_DISCOVERS 1000000
+
+ATF_TC(load_balance_raw_bench);
+
+ATF_TC_HEAD(load_balance_raw_bench, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Time deciding whose a DHCPDISCOVER "
+			  "is from the raw packet and after parsing it.");
+}
+
+/*
+ * This only times parse_options() and load_balance_mine(), so the time
+ * saved per dropped packet is at least the difference; do_packet() goes
+ * on to classify the packet and look up a lease before it gets there.
+ */
+ATF_TC_BODY(load_balance_raw_bench, tc)
+{
+#if defined(FAILOVER_PROTOCOL)
+	dhcp_failover_state_t state;
+	struct dhcp_packet raw;
+	struct timeval start;
+	u_int8_t opt[8], *uid;
+	unsigned len, optlen;
+	int i, n;
+
+	BENCH_REQUIRE();
+
+	initialize_common_option_spaces();
+	lb_setup(&state, primary);
+	optlen = lb_client_id(opt, 0);
+	len = lb_discover(&raw, 0, opt, optlen);
+	/* The byte of the client identifier that varies with mac, after
+	   the cookie, the message type and the identifier's own type. */
+	uid = &raw.options[4 + 3 + 3];
+
+	n = 0;
+	bench_start(&start);
+	for (i = 0; i < BENCH_DISCOVERS; i++) {
+		raw.chaddr[5] = *uid = i;
+		n += lb_raw_theirs(&raw, len, &state);
+	}
+	bench_report(&start, "%d raw filter decisions, %d dropped",
+		     BENCH_DISCOVERS, n);
+
+	n = 0;
+	bench_start(&start);
+	for (i = 0; i < BENCH_DISCOVERS; i++) {
+		raw.chaddr[5] = *uid = i;
+		n += lb_parsed_mine(&raw, len, &state) == 0;
+	}
+	bench_report(&start, "%d parsed decisions, %d theirs",
+		     BENCH_DISCOVERS, n);
+#else
+	atf_tc_skip("failover is disabled");
+#endif
+}
 
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, load_balance);
 	ATF_TP_ADD_TC(tp, load_balance_swap);
+	ATF_TP_ADD_TC(tp, load_balance_raw);
+	ATF_TP_ADD_TC(tp, load_balance_raw_options);
+	ATF_TP_ADD_TC(tp, load_balance_raw_secs);
+	ATF_TP_ADD_TC(tp, load_balance_raw_bench);
 
 	return (atf_no_error());
 }
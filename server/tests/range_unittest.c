@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+
+/*
+ * Test address ranges.  new_address_range() doesn't make a lease for
+ * each address any more; leases should appear when they are looked up
+ * by address or allocated, and the pool counts should include the
+ * addresses that have no lease yet.
+ */
+
+static struct iaddr
+make_addr(const char *text) {
+	struct iaddr addr;
+
+	memset(&addr, 0, sizeof(addr));
+	if (inet_pton(AF_INET, text, addr.iabuf) != 1)
+		atf_tc_fail("bad address %s", text);
+	addr.len = 4;
+	return addr;
+}
+
+ATF_TC(range_lazy_leases);
+ATF_TC_HEAD(range_lazy_leases, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify leases in a /10 range are "
+			  "only made when they are needed");
+}
+
+ATF_TC_BODY(range_lazy_leases, tc)
+{
+	struct shared_network *share = NULL;
+	struct subnet *subnet = NULL;
+	struct pool *pool = NULL;
+	struct lease *lease = NULL, *again = NULL;
+	unsigned count = (1 << 22) - 2;
+	int peer_has_leases = 0;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+	cur_time = 1000;
+
+	if (shared_network_allocate(&share, MDL) != ISC_R_SUCCESS ||
+	    subnet_allocate(&subnet, MDL) != ISC_R_SUCCESS ||
+	    pool_allocate(&pool, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("allocation failed");
+	share->name = "cgnat";
+	subnet->net = make_addr("100.64.0.0");
+	subnet->netmask = make_addr("255.192.0.0");
+	shared_network_reference(&subnet->shared_network, share, MDL);
+	shared_network_reference(&pool->shared_network, share, MDL);
+	pool_reference(&share->pools, pool, MDL);
+	enter_shared_network(share);
+	enter_subnet(subnet);
+
+	new_address_range(NULL, make_addr("100.64.0.1"),
+			  make_addr("100.127.255.254"), subnet, pool);
+	ATF_CHECK(lease_ip_addr_hash->entries == 0);
+
+	/* Looking an address up makes its lease, once. */
+	ATF_REQUIRE(find_lease_by_ip_addr(&lease, make_addr("100.100.1.2"),
+					  MDL));
+	ATF_CHECK(lease->pool == pool && lease->subnet == subnet);
+	ATF_CHECK_EQ(lease->binding_state, FTS_FREE);
+	ATF_REQUIRE(find_lease_by_ip_addr(&again, make_addr("100.100.1.2"),
+					  MDL));
+	ATF_CHECK(again == lease);
+	ATF_CHECK(lease_ip_addr_hash->entries == 1);
+	lease_dereference(&again, MDL);
+	lease_dereference(&lease, MDL);
+
+	ATF_CHECK(!find_lease_by_ip_addr(&lease, make_addr("100.64.0.0"),
+					 MDL));
+	ATF_CHECK(!find_lease_by_ip_addr(&lease, make_addr("100.128.0.1"),
+					 MDL));
+
+	expire_all_pools();
+	ATF_CHECK_EQ(pool->lease_count, count);
+	ATF_CHECK_EQ(pool->free_leases, count);
+
+	/* Allocation starts with the lowest address nobody has used. */
+	ATF_REQUIRE(allocate_lease(&lease, NULL, pool, &peer_has_leases));
+	ATF_CHECK(addr_eq(lease->ip_addr, make_addr("100.64.0.1")));
+	ATF_CHECK(lease_ip_addr_hash->entries == 2);
+	ATF_REQUIRE(find_lease_by_ip_addr(&again, make_addr("100.64.0.1"),
+					  MDL));
+	ATF_CHECK(again == lease);
+	lease_dereference(&again, MDL);
+
+	/* Once it has been offered, the next one is made. */
+	lease->ends = cur_time + 120;
+	ATF_CHECK(supersede_lease(lease, NULL, 0, 0, 0, 0));
+	lease_dereference(&lease, MDL);
+	ATF_REQUIRE(allocate_lease(&lease, NULL, pool, &peer_has_leases));
+	ATF_CHECK(addr_eq(lease->ip_addr, make_addr("100.64.0.2")));
+	ATF_CHECK_EQ(pool->free_leases, count);
+	lease_dereference(&lease, MDL);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, range_lazy_leases);
+
+	return (atf_no_error());
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2019 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+
+/*
+ * Test the subnet lookup code.  Subnets are entered with enter_subnet()
+ * and found with find_subnet() and find_grouped_subnet(), which should
+ * return the most specific subnet containing the address.
+ */
+
+static struct iaddr
+make_addr(const char *text) {
+	struct iaddr addr;
+
+	memset(&addr, 0, sizeof(addr));
+	if (inet_pton(AF_INET, text, addr.iabuf) == 1) {
+		addr.len = 4;
+	} else if (inet_pton(AF_INET6, text, addr.iabuf) == 1) {
+		addr.len = 16;
+	} else {
+		atf_tc_fail("bad address %s", text);
+	}
+	return addr;
+}
+
+static struct subnet *
+make_subnet(struct shared_network *share, const char *net, int bits) {
+	struct subnet *subnet = NULL;
+	int i;
+
+	if (subnet_allocate(&subnet, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("subnet_allocate failed");
+	subnet->net = make_addr(net);
+	subnet->netmask.len = subnet->net.len;
+	for (i = 0; i < bits; i++)
+		subnet->netmask.iabuf[i / 8] |= 0x80 >> (i % 8);
+	shared_network_reference(&subnet->shared_network, share, MDL);
+	enter_subnet(subnet);
+	return subnet;
+}
+
+/* A subnet with a netmask given as an address, which needn't be a
+   prefix. */
+static struct subnet *
+make_masked_subnet(struct shared_network *share, const char *net,
+		   const char *mask) {
+	struct subnet *subnet = NULL;
+
+	if (subnet_allocate(&subnet, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("subnet_allocate failed");
+	subnet->net = make_addr(net);
+	subnet->netmask = make_addr(mask);
+	shared_network_reference(&subnet->shared_network, share, MDL);
+	enter_subnet(subnet);
+	return subnet;
+}
+
+/* Put a subnet at the head of its shared network's list, as the
+   config parser does with the most specific of a set of subnets. */
+static void
+add_sibling(struct subnet *subnet) {
+	struct shared_network *share = subnet->shared_network;
+
+	if (share->subnets != NULL) {
+		subnet_reference(&subnet->next_sibling, share->subnets, MDL);
+		subnet_dereference(&share->subnets, MDL);
+	}
+	subnet_reference(&share->subnets, subnet, MDL);
+}
+
+static struct shared_network *
+make_share(const char *name) {
+	struct shared_network *share = NULL;
+
+	if (shared_network_allocate(&share, MDL) != ISC_R_SUCCESS)
+		atf_tc_fail("shared_network_allocate failed");
+	share->name = (char *)name;
+	return share;
+}
+
+static void
+check_find(const char *addr, struct subnet *expect) {
+	struct subnet *found = NULL;
+	int rv;
+
+	rv = find_subnet(&found, make_addr(addr), MDL);
+	if (expect == NULL) {
+		ATF_CHECK_MSG(rv == 0, "found a subnet for %s", addr);
+	} else {
+		ATF_CHECK_MSG(rv == 1 && found == expect,
+			      "wrong subnet for %s", addr);
+	}
+	if (found != NULL)
+		subnet_dereference(&found, MDL);
+}
+
+static void
+check_grouped(struct shared_network *share, const char *addr,
+	      struct subnet *expect) {
+	struct subnet *found = NULL;
+	int rv;
+
+	rv = find_grouped_subnet(&found, share, make_addr(addr), MDL);
+	if (expect == NULL) {
+		ATF_CHECK_MSG(rv == 0, "found a %s subnet for %s",
+			      share->name, addr);
+	} else {
+		ATF_CHECK_MSG(rv == 1 && found == expect,
+			      "wrong %s subnet for %s", share->name, addr);
+	}
+	if (found != NULL)
+		subnet_dereference(&found, MDL);
+}
+
+ATF_TC(subnet_longest_match);
+ATF_TC_HEAD(subnet_longest_match, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the most specific IPv4 "
+			  "subnet is found");
+}
+
+ATF_TC_BODY(subnet_longest_match, tc)
+{
+	struct shared_network *a, *b;
+	struct subnet *s8, *s16, *s24, *s32, *other;
+
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+
+	a = make_share("a");
+	b = make_share("b");
+
+	/* Enter them in an order that doesn't match their nesting. */
+	s24 = make_subnet(a, "10.1.2.0", 24);
+	s8 = make_subnet(a, "10.0.0.0", 8);
+	other = make_subnet(b, "192.168.0.0", 24);
+	s16 = make_subnet(b, "10.1.0.0", 16);
+	s32 = make_subnet(b, "10.1.2.77", 32);
+
+	check_find("10.1.2.3", s24);
+	check_find("10.1.2.0", s24);
+	check_find("10.1.2.255", s24);
+	check_find("10.1.2.77", s32);
+	check_find("10.1.3.3", s16);
+	check_find("10.2.0.1", s8);
+	check_find("192.168.0.200", other);
+	check_find("192.168.1.1", NULL);
+	check_find("11.0.0.1", NULL);
+
+	/* Only subnets in the given shared network count. */
+	check_grouped(a, "10.1.3.3", s8);
+	check_grouped(a, "10.1.2.77", s24);
+	check_grouped(b, "10.1.2.3", s16);
+	check_grouped(b, "10.2.0.1", NULL);
+	check_grouped(a, "192.168.0.1", NULL);
+}
+
+ATF_TC(subnet_longest_match6);
+ATF_TC_HEAD(subnet_longest_match6, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the most specific IPv6 "
+			  "subnet is found");
+}
+
+ATF_TC_BODY(subnet_longest_match6, tc)
+{
+	struct shared_network *a;
+	struct subnet *s32, *s48, *s64, *v4;
+
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+
+	a = make_share("a");
+	s64 = make_subnet(a, "2001:db8:1:2::", 64);
+	s32 = make_subnet(a, "2001:db8::", 32);
+	s48 = make_subnet(a, "2001:db8:1::", 48);
+	v4 = make_subnet(a, "0.0.0.0", 0);
+
+	check_find("2001:db8:1:2::1", s64);
+	check_find("2001:db8:1:3::1", s48);
+	check_find("2001:db8:ffff::1", s32);
+	check_find("2001:db9::1", NULL);
+
+	/* A zero length IPv4 prefix only matches IPv4 addresses. */
+	check_find("10.0.0.1", v4);
+	check_grouped(a, "2001:db8:1:2::1", s64);
+}
+
+ATF_TC(subnet_noncontiguous);
+ATF_TC_HEAD(subnet_noncontiguous, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify subnets are still found "
+			  "by searching the list once a subnet with a "
+			  "non-contiguous netmask is entered");
+}
+
+ATF_TC_BODY(subnet_noncontiguous, tc)
+{
+	struct shared_network *a, *b;
+	struct subnet *s8, *s16, *s24, *odd;
+
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+
+	a = make_share("a");
+	b = make_share("b");
+
+	/* Subnets entered before and after the trie is given up. */
+	s8 = make_subnet(a, "10.0.0.0", 8);
+	s16 = make_subnet(a, "10.1.0.0", 16);
+	odd = make_masked_subnet(b, "10.3.0.5", "255.255.0.255");
+	s24 = make_subnet(a, "10.1.2.0", 24);
+	add_sibling(s8);
+	add_sibling(s16);
+	add_sibling(s24);
+	add_sibling(odd);
+
+	check_find("10.1.2.3", s24);
+	check_find("10.1.7.5", s16);
+	check_find("10.3.7.5", odd);
+	check_find("10.3.7.6", s8);
+	check_find("11.3.0.5", NULL);
+
+	check_grouped(b, "10.3.9.5", odd);
+	check_grouped(b, "10.3.9.6", NULL);
+	check_grouped(a, "10.3.9.5", s8);
+	check_grouped(a, "10.1.2.5", s24);
+}
+
+ATF_TC(subnet_same_prefix);
+ATF_TC_HEAD(subnet_same_prefix, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the same subnet in two "
+			  "shared networks is found in each of them");
+}
+
+ATF_TC_BODY(subnet_same_prefix, tc)
+{
+	struct shared_network *a, *b;
+	struct subnet *s24, *sa, *sb, *later;
+
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+
+	a = make_share("a");
+	b = make_share("b");
+
+	/* A trie node holds one subnet, so the second of these makes
+	   the lookups go back to the lists. */
+	s24 = make_subnet(a, "10.5.2.0", 24);
+	sa = make_subnet(a, "10.5.0.0", 16);
+	sb = make_subnet(b, "10.5.0.0", 16);
+	later = make_subnet(b, "10.6.0.0", 16);
+	add_sibling(sa);
+	add_sibling(s24);
+	add_sibling(sb);
+	add_sibling(later);
+
+	/* The later declaration wins where a shared network isn't
+	   given. */
+	check_find("10.5.1.1", sb);
+	check_find("10.5.2.1", s24);
+	check_find("10.6.0.1", later);
+	check_find("10.7.0.1", NULL);
+
+	check_grouped(a, "10.5.1.1", sa);
+	check_grouped(a, "10.5.2.1", s24);
+	check_grouped(b, "10.5.1.1", sb);
+	check_grouped(b, "10.5.2.1", sb);
+	check_grouped(a, "10.6.0.1", NULL);
+}
+
+ATF_TC(subnet_many);
+ATF_TC_HEAD(subnet_many, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify lookups with 40000 subnets");
+}
+
+ATF_TC_BODY(subnet_many, tc)
+{
+	struct shared_network *share;
+	struct subnet **list;
+	char buf[32];
+	int i, count = 40000;
+
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+
+	list = dmalloc(count * sizeof(*list), MDL);
+	ATF_REQUIRE(list != NULL);
+
+	share = make_share("relays");
+	for (i = 0; i < count; i++) {
+		snprintf(buf, sizeof(buf), "10.%d.%d.0", i / 256, i % 256);
+		list[i] = make_subnet(share, buf, 24);
+	}
+
+	for (i = 0; i < count; i++) {
+		snprintf(buf, sizeof(buf), "10.%d.%d.%d",
+			 i / 256, i % 256, 1 + i % 254);
+		check_find(buf, list[i]);
+		check_grouped(share, buf, list[i]);
+	}
+	check_find("10.200.0.1", NULL);
+
+	dfree(list, MDL);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, subnet_longest_match);
+	ATF_TP_ADD_TC(tp, subnet_longest_match6);
+	ATF_TP_ADD_TC(tp, subnet_noncontiguous);
+	ATF_TP_ADD_TC(tp, subnet_same_prefix);
+	ATF_TP_ADD_TC(tp, subnet_many);
+
+	return (atf_no_error());
+}